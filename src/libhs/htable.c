@@ -11,14 +11,90 @@
 #include "common_priv.h"
 #include "htable.h"
 
+// Buckets moved to the new table by each add, while it is being rehashed
+#define REHASH_STEP 4
+
+static void init_heads(_hs_htable_head *heads, unsigned int size)
+{
+    for (unsigned int i = 0; i < size; i++) {
+        heads[i].next = &heads[i];
+        heads[i].prev = &heads[i];
+    }
+}
+
+static void link_head(_hs_htable_head *prev, _hs_htable_head *n)
+{
+    n->prev = prev;
+    n->next = prev->next;
+    prev->next->prev = n;
+    prev->next = n;
+}
+
+static void unlink_head(_hs_htable_head *n)
+{
+    n->prev->next = n->next;
+    n->next->prev = n->prev;
+    n->next = NULL;
+    n->prev = NULL;
+}
+
+static void move_bucket(_hs_htable *table, unsigned int idx)
+{
+    _hs_htable_head *old_head = &table->old_heads[idx];
+
+    while (old_head->next != old_head) {
+        _hs_htable_head *n = old_head->next;
+
+        unlink_head(n);
+        link_head(&table->heads[n->key % table->size], n);
+    }
+}
+
+static void finish_rehash(_hs_htable *table)
+{
+    free(table->old_heads);
+    table->old_heads = NULL;
+    table->old_size = 0;
+    table->rehash_idx = 0;
+}
+
+static void rehash_step(_hs_htable *table, unsigned int steps)
+{
+    while (steps-- && table->rehash_idx < table->old_size)
+        move_bucket(table, table->rehash_idx++);
+    if (table->rehash_idx == table->old_size)
+        finish_rehash(table);
+}
+
+// Failing to grow is not a problem, the chains just get longer
+static void grow(_hs_htable *table)
+{
+    _hs_htable_head *heads;
+
+    if (table->old_heads || table->size > UINT_MAX / 2)
+        return;
+
+    heads = (_hs_htable_head *)malloc(table->size * 2 * sizeof(*heads));
+    if (!heads)
+        return;
+    init_heads(heads, table->size * 2);
+
+    table->old_heads = table->heads;
+    table->old_size = table->size;
+    table->rehash_idx = 0;
+    table->heads = heads;
+    table->size *= 2;
+}
+
 int _hs_htable_init(_hs_htable *table, unsigned int size)
 {
-    table->heads = (void **)malloc(size * sizeof(*table->heads));
+    memset(table, 0, sizeof(*table));
+
+    table->heads = (_hs_htable_head *)malloc(size * sizeof(*table->heads));
     if (!table->heads)
         return hs_error(HS_ERROR_MEMORY, NULL);
     table->size = size;
-
-    _hs_htable_clear(table);
+    init_heads(table->heads, size);
 
     return 0;
 }
@@ -26,45 +102,46 @@ int _hs_htable_init(_hs_htable *table, unsigned int size)
 void _hs_htable_release(_hs_htable *table)
 {
     free(table->heads);
+    free(table->old_heads);
 }
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key)
+// Nodes with this key may also be in the old table, see _hs_htable_get_next_head()
+_hs_htable_head *_hs_htable_get_head(const _hs_htable *table, uint32_t key)
 {
-    return (_hs_htable_head *)&table->heads[key % table->size];
+    return &table->heads[key % table->size];
 }
 
-void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *n)
+_hs_htable_head *_hs_htable_get_heads(_hs_htable *table)
 {
-    _hs_htable_head *head = _hs_htable_get_head(table, key);
-
-    n->key = key;
+    if (table->old_heads)
+        rehash_step(table, table->old_size);
 
-    n->next = head->next;
-    head->next = n;
+    return table->heads;
 }
 
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *n)
+void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *n)
 {
-    n->key = prev->key;
+    if (table->count >= table->size)
+        grow(table);
 
-    n->next = prev->next;
-    prev->next = n;
+    if (table->old_heads)
+        rehash_step(table, REHASH_STEP);
+
+    n->key = key;
+    link_head(&table->heads[key % table->size], n);
+    table->count++;
 }
 
-void _hs_htable_remove(_hs_htable_head *head)
+void _hs_htable_remove(_hs_htable *table, _hs_htable_head *n)
 {
-    for (_hs_htable_head *prev = head->next; prev != head; prev = prev->next) {
-        if (prev->next == head) {
-            prev->next = head->next;
-            head->next = NULL;
-
-            break;
-        }
-    }
+    unlink_head(n);
+    table->count--;
 }
 
 void _hs_htable_clear(_hs_htable *table)
 {
-    for (unsigned int i = 0; i < table->size; i++)
-        table->heads[i] = (_hs_htable_head *)&table->heads[i];
+    if (table->old_heads)
+        finish_rehash(table);
+    init_heads(table->heads, table->size);
+    table->count = 0;
 }
@@ -15,28 +15,57 @@
 
 HS_BEGIN_C
 
+/* Intrusive hash table: embed a _hs_htable_head in your structure and use
+   _hs_container_of() to get back to it. Each bucket is a circular doubly-linked list, so
+   nodes can be unlinked in O(1).
+
+   The table doubles its size when it holds more nodes than buckets. Nodes are moved to the
+   new buckets a few at a time by _hs_htable_add(), so no single operation has to rehash the
+   whole table. Until then, lookups check the old bucket too.
+
+   Lookups (_hs_htable_get_head() and _hs_htable_foreach_hash()) never modify the table, so
+   several threads can do them at the same time. Adding, removing, clearing and iterating
+   over the whole table (_hs_htable_foreach(), which finishes the rehash first) need
+   exclusive access. Don't add nodes while you iterate over the table, removing the current
+   node is fine. */
+
 typedef struct _hs_htable_head {
-    // Keep first!
     struct _hs_htable_head *next;
+    struct _hs_htable_head *prev;
     uint32_t key;
 } _hs_htable_head;
 
 typedef struct _hs_htable {
     unsigned int size;
-    void **heads;
+    _hs_htable_head *heads;
+    unsigned int count;
+
+    // Buckets of the table before it grew, while it is being rehashed
+    _hs_htable_head *old_heads;
+    unsigned int old_size;
+    unsigned int rehash_idx;
 } _hs_htable;
 
 int _hs_htable_init(_hs_htable *table, unsigned int size);
 void _hs_htable_release(_hs_htable *table);
 
-_hs_htable_head *_hs_htable_get_head(_hs_htable *table, uint32_t key);
+_hs_htable_head *_hs_htable_get_head(const _hs_htable *table, uint32_t key);
+_hs_htable_head *_hs_htable_get_heads(_hs_htable *table);
 
 void _hs_htable_add(_hs_htable *table, uint32_t key, _hs_htable_head *head);
-void _hs_htable_insert(_hs_htable_head *prev, _hs_htable_head *head);
-void _hs_htable_remove(_hs_htable_head *head);
+void _hs_htable_remove(_hs_htable *table, _hs_htable_head *head);
 
 void _hs_htable_clear(_hs_htable *table);
 
+// Bucket of the old table that may still hold nodes with this key, after the new one
+static inline _hs_htable_head *_hs_htable_get_next_head(const _hs_htable *table, uint32_t key,
+                                                        const _hs_htable_head *head)
+{
+    if (!table->old_heads || head != &table->heads[key % table->size])
+        return NULL;
+    return &table->old_heads[key % table->old_size];
+}
+
 static inline uint32_t _hs_htable_hash_str(const char *s)
 {
     uint32_t hash = 0;
@@ -52,18 +81,25 @@ static inline uint32_t _hs_htable_hash_ptr(const void *p)
 }
 
 /* While a break will only end the inner loop, the outer loop will subsequently fail
-   the cur == HS_UNIQUE_ID(head) test and thus break out of the outer loop too. */
+   the cur == HS_UNIQUE_ID(head) test and thus break out of the outer loop too. The
+   table is fully rehashed first, this is O(n) anyway. */
 #define _hs_htable_foreach(cur, table) \
-    for (_hs_htable_head *_HS_UNIQUE_ID(head) = (_hs_htable_head *)(table)->heads, *cur = _HS_UNIQUE_ID(head), *_HS_UNIQUE_ID(next); \
-            cur == _HS_UNIQUE_ID(head) && _HS_UNIQUE_ID(head) < (_hs_htable_head *)((table)->heads + (table)->size); \
-            _HS_UNIQUE_ID(head) = (_hs_htable_head *)((_hs_htable_head **)_HS_UNIQUE_ID(head) + 1), cur = (_hs_htable_head *)((_hs_htable_head **)cur + 1)) \
+    for (_hs_htable_head *_HS_UNIQUE_ID(head) = _hs_htable_get_heads(table), *cur = _HS_UNIQUE_ID(head), *_HS_UNIQUE_ID(next); \
+            cur == _HS_UNIQUE_ID(head) && _HS_UNIQUE_ID(head) < (table)->heads + (table)->size; \
+            _HS_UNIQUE_ID(head)++, cur = _HS_UNIQUE_ID(head)) \
         for (cur = cur->next, _HS_UNIQUE_ID(next) = cur->next; cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
 
+/* The outer loop goes over the new bucket and then over the old one (if the table is being
+   rehashed). It only moves on when the inner loop ran to the end (cur is back to head), so
+   a break ends both loops. */
 #define _hs_htable_foreach_hash(cur, table, k) \
     if ((table)->size) \
-        for (_hs_htable_head *_HS_UNIQUE_ID(head) = _hs_htable_get_head((table), (k)), *cur = _HS_UNIQUE_ID(head)->next, *_HS_UNIQUE_ID(next) = cur->next; \
-             cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
-            if (cur->key == (k))
+        for (_hs_htable_head *_HS_UNIQUE_ID(head) = _hs_htable_get_head((table), (k)), *cur = _HS_UNIQUE_ID(head), *_HS_UNIQUE_ID(next); \
+                _HS_UNIQUE_ID(head); \
+                _HS_UNIQUE_ID(head) = (cur == _HS_UNIQUE_ID(head)) ? _hs_htable_get_next_head((table), (k), _HS_UNIQUE_ID(head)) : NULL, \
+                cur = _HS_UNIQUE_ID(head)) \
+            for (cur = cur->next, _HS_UNIQUE_ID(next) = cur->next; cur != _HS_UNIQUE_ID(head); cur = _HS_UNIQUE_ID(next), _HS_UNIQUE_ID(next) = cur->next) \
+                if (cur->key == (k))
 
 HS_END_C
 
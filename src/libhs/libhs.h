@@ -24,7 +24,7 @@
    Windows (MSVC)      | Nothing to do, libhs uses `#pragma comment(lib)`
    Windows (MinGW-w64) | Link _user32, advapi32, setupapi and hid_ `-luser32 -ladvapi32 -lsetupapi -lhid`
    OSX (Clang)         | Link _CoreFoundation and IOKit_ `-framework CoreFoundation -framework IOKit`
-   Linux (GCC)         | Link _libudev_ `-ludev`
+   Linux (GCC)         | Link _libudev_ `-ludev`, or define HS_NO_LIBUDEV to read sysfs directly
 
    Other systems are not supported at the moment. */
 
@@ -36,6 +36,7 @@
 #include "match.h"
 #include "monitor.h"
 #include "platform.h"
+#include "replay.h"
 #include "serial.h"
 
 #endif
@@ -52,6 +53,11 @@
     #include "common_priv.h"
     #include "device_priv.h"
     #include "match_priv.h"
+    #include "monitor_priv.h"
+    #include "replay_priv.h"
+    #ifdef __linux__
+        #include "sysfs_priv.h"
+    #endif
 
     #include "common.c"
     #include "compat.c"
@@ -61,6 +67,7 @@
     #include "htable.c"
     #include "monitor_common.c"
     #include "platform.c"
+    #include "replay.c"
 
     #if defined(_WIN32)
         #include "device_win32.c"
@@ -80,6 +87,7 @@
         #include "monitor_linux.c"
         #include "platform_posix.c"
         #include "serial_posix.c"
+        #include "sysfs_linux.c"
     #else
         #error "Platform not supported"
     #endif
@@ -85,6 +85,37 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
  */
 int hs_find(const hs_match_spec *matches, unsigned int count, struct hs_device **rdev);
 
+/**
+ * @ingroup monitor
+ * @brief Keep expensive device information in a cache file between runs.
+ *
+ * Some device properties, such as the usage of HID devices, take several system calls to
+ * get. With a cache file, they are only computed again when the device changes. Several
+ * processes can share the same file. The cache is only used on Linux for now.
+ *
+ * @param path Path of the cache file, or NULL to disable the cache (default). The parent
+ *     directory is created if needed.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+int hs_monitor_set_cache_path(const char *path);
+
+/**
+ * @ingroup monitor
+ * @brief Record device events to a file.
+ *
+ * Each device added or removed by a monitor is written to the file, with a timestamp and the
+ * device information. Use @ref hs_replay to replay them later.
+ *
+ * This function is not thread-safe, call it before you start any monitor.
+ *
+ * @param path Path of the event file, or NULL to stop recording (default). An existing file
+ *     is overwritten.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ *
+ * @sa hs_replay_open()
+ */
+int hs_monitor_set_record_path(const char *path);
+
 /**
  * @{
  * @name Monitoring Functions
@@ -57,6 +57,7 @@ int _hs_monitor_add(_hs_htable *devices, hs_device *dev, hs_enumerate_func *f, v
     _hs_htable_add(devices, _hs_htable_hash_str(dev->key), &dev->hnode);
 
     _hs_device_log(dev, "Add");
+    _hs_monitor_record_event(dev);
 
     if (f) {
         return (*f)(dev, udata);
@@ -75,11 +76,12 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
             dev->status = HS_DEVICE_STATUS_DISCONNECTED;
 
             hs_log(HS_LOG_DEBUG, "Remove device '%s'", dev->key);
+            _hs_monitor_record_event(dev);
 
             if (f)
                 (*f)(dev, udata);
 
-            _hs_htable_remove(&dev->hnode);
+            _hs_htable_remove(devices, &dev->hnode);
             hs_device_unref(dev);
         }
     }
@@ -11,21 +11,41 @@
 #include "common_priv.h"
 #include <fcntl.h>
 #include <linux/hidraw.h>
-#include <libudev.h>
+#include <linux/netlink.h>
+#ifndef HS_NO_LIBUDEV
+    #include <libudev.h>
+#endif
 #include <pthread.h>
 #include <sys/eventfd.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 #include <unistd.h>
+#include "array.h"
 #include "device_priv.h"
 #include "match_priv.h"
 #include "monitor_priv.h"
 #include "platform.h"
+#include "sysfs_priv.h"
+
+/* We use libudev when the udev daemon runs, because it tells us about devices once the
+   rules (permissions, etc.) have been applied. Without it (containers, initramfs) or when
+   built with HS_NO_LIBUDEV, we scan sysfs and listen to kernel uevents ourselves. Set the
+   environment variable LIBHS_LINUX_BACKEND to "udev" or "sysfs" to override. */
+typedef enum backend_type {
+    BACKEND_UDEV,
+    BACKEND_SYSFS
+} backend_type;
 
 struct hs_monitor {
     _hs_match_helper match_helper;
     _hs_htable devices;
 
+    bool started;
+#ifndef HS_NO_LIBUDEV
     struct udev_monitor *udev_mon;
+#endif
+    int uevent_fd;
     int wait_fd;
 };
 
@@ -34,11 +54,56 @@ struct device_subsystem {
     hs_device_type type;
 };
 
+#ifndef HS_NO_LIBUDEV
 struct udev_aggregate {
     struct udev_device *dev;
     struct udev_device *usb;
     struct udev_device *iface;
 };
+#endif
+
+// With udev the type is not known until we read the subsystem
+struct enumerate_item {
+    const char *path;
+    hs_device_type type;
+};
+
+struct enumerate_result {
+    bool done;
+    int r;
+    hs_device *dev;
+};
+
+struct enumerate_job {
+    const _hs_match_helper *match_helper;
+    _HS_ARRAY(struct enumerate_item) items;
+    size_t count;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    size_t next;
+    bool abort;
+    struct enumerate_result *results;
+};
+
+/* Parsing the HID report descriptor needs a few syscalls per device, and most of them
+   are root-only on old kernels. We remember the result in a cache file, which is only
+   trusted if the device node has not been recreated since (same device number and ctime). */
+struct cache_entry {
+    _hs_htable_head hnode;
+
+    char *key;
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t bcd_device;
+    uint8_t iface_number;
+    uint64_t node_rdev;
+    uint64_t node_ctime;
+
+    uint16_t usage_page;
+    uint16_t usage;
+    bool numbered_reports;
+};
 
 static struct device_subsystem device_subsystems[] = {
     {"hidraw", HS_DEVICE_TYPE_HID},
@@ -46,14 +111,39 @@ static struct device_subsystem device_subsystems[] = {
     {NULL}
 };
 
-static pthread_mutex_t udev_init_lock = PTHREAD_MUTEX_INITIALIZER;
+// Each worker handles at least this many devices, starting threads is not free
+#define ENUMERATE_WORKER_DEVICES 16
+#define ENUMERATE_MAX_WORKERS 8
+
+// Kernel uevent messages are smaller than this (UEVENT_BUFFER_SIZE)
+#define UEVENT_BUFFER_SIZE 2048
+#define UEVENT_SOCKET_BUFFER_SIZE (1024 * 1024)
+
+static pthread_mutex_t backend_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool backend_ready;
+static backend_type backend;
+#ifndef HS_NO_LIBUDEV
 static struct udev *udev;
+#endif
 static int common_eventfd = -1;
 
+#define CACHE_HEADER "libhs-cache 1"
+// The cache starts over when it gets this big, stale entries are never removed otherwise
+#define CACHE_MAX_ENTRIES 512
+
+// Enumeration workers use the cache too
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_path;
+static _hs_htable cache_entries;
+static bool cache_loaded;
+static bool cache_dirty;
+
 #ifndef _GNU_SOURCE
 int dup3(int oldfd, int newfd, int flags);
 #endif
 
+#ifndef HS_NO_LIBUDEV
+
 static int compute_device_location(struct udev_device *dev, char **rlocation)
 {
     const char *busnum, *devpath;
@@ -135,6 +225,21 @@ static int fill_device_details(struct udev_aggregate *agg, hs_device *dev)
     if (errno)
         return 0;
 
+    errno = 0;
+    buf = udev_device_get_devpath(agg->iface);
+    buf += strlen(buf) - 1;
+    dev->iface_number = (uint8_t)strtoul(buf, NULL, 10);
+    if (errno)
+        return 0;
+
+    return 1;
+}
+
+// Matching does not need these, so we only read them for devices that match
+static int fill_device_strings(struct udev_aggregate *agg, hs_device *dev)
+{
+    const char *buf;
+
     buf = udev_device_get_sysattr_value(agg->usb, "manufacturer");
     if (buf) {
         dev->manufacturer_string = strdup(buf);
@@ -156,29 +261,21 @@ static int fill_device_details(struct udev_aggregate *agg, hs_device *dev)
             return hs_error(HS_ERROR_MEMORY, NULL);
     }
 
-    errno = 0;
-    buf = udev_device_get_devpath(agg->iface);
-    buf += strlen(buf) - 1;
-    dev->iface_number = (uint8_t)strtoul(buf, NULL, 10);
-    if (errno)
-        return 0;
-
-    return 1;
+    return 0;
 }
 
-static size_t read_hid_descriptor_sysfs(struct udev_aggregate *agg, uint8_t *desc_buf,
+#endif
+
+static size_t read_hid_descriptor_sysfs(const char *hid_path, uint8_t *desc_buf,
                                         size_t desc_buf_size)
 {
-    struct udev_device *hid_dev;
     char report_path[4096];
     int fd;
     ssize_t r;
 
-    hid_dev = udev_device_get_parent_with_subsystem_devtype(agg->dev, "hid", NULL);
-    if (!hid_dev)
+    if (!hid_path)
         return 0;
-    snprintf(report_path, sizeof(report_path), "%s/report_descriptor",
-             udev_device_get_syspath(hid_dev));
+    snprintf(report_path, sizeof(report_path), "%s/report_descriptor", hid_path);
 
     fd = open(report_path, O_RDONLY);
     if (fd < 0)
@@ -191,18 +288,14 @@ static size_t read_hid_descriptor_sysfs(struct udev_aggregate *agg, uint8_t *des
     return (size_t)r;
 }
 
-static size_t read_hid_descriptor_hidraw(struct udev_aggregate *agg, uint8_t *desc_buf,
+static size_t read_hid_descriptor_hidraw(const char *node_path, uint8_t *desc_buf,
                                          size_t desc_buf_size)
 {
-    const char *node_path;
     int fd = -1;
     int hidraw_desc_size = 0;
     struct hidraw_report_descriptor hidraw_desc;
     int r;
 
-    node_path = udev_device_get_devnode(agg->dev);
-    if (!node_path)
-        goto cleanup;
     fd = open(node_path, O_RDONLY);
     if (fd < 0)
         goto cleanup;
@@ -303,15 +396,298 @@ static void parse_hid_descriptor(hs_device *dev, uint8_t *desc, size_t desc_size
     }
 }
 
-static void fill_hid_properties(struct udev_aggregate *agg, hs_device *dev)
+static void clear_cache(void)
+{
+    _hs_htable_foreach(cur, &cache_entries) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+
+        _hs_htable_remove(&cache_entries, &entry->hnode);
+        free(entry->key);
+        free(entry);
+    }
+}
+
+static void release_cache(void)
+{
+    clear_cache();
+    _hs_htable_release(&cache_entries);
+    free(cache_path);
+    cache_path = NULL;
+}
+
+static int add_cache_entry(const struct cache_entry *tmp)
+{
+    struct cache_entry *entry;
+
+    if (cache_entries.count >= CACHE_MAX_ENTRIES)
+        clear_cache();
+
+    entry = (struct cache_entry *)malloc(sizeof(*entry));
+    if (!entry)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    *entry = *tmp;
+    entry->key = strdup(tmp->key);
+    if (!entry->key) {
+        free(entry);
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    _hs_htable_add(&cache_entries, _hs_htable_hash_str(entry->key), &entry->hnode);
+    return 0;
+}
+
+static struct cache_entry *find_cache_entry(const char *key)
+{
+    _hs_htable_foreach_hash(cur, &cache_entries, _hs_htable_hash_str(key)) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+
+        if (strcmp(entry->key, key) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+// You need to lock cache_lock before you call this
+static void load_cache(void)
+{
+    FILE *fp;
+    char line[4096];
+
+    if (cache_loaded)
+        return;
+    cache_loaded = true;
+
+    // Failing to load the cache only costs time, don't bother anyone with it
+    fp = fopen(cache_path, "re");
+    if (!fp)
+        return;
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, CACHE_HEADER "\n") != 0)
+        goto cleanup;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char key[sizeof(line)];
+        unsigned int vid, pid, bcd_device, iface_number, usage_page, usage, numbered_reports;
+        struct cache_entry entry = {0};
+        int r;
+
+        r = sscanf(line, "%4095s %x %x %x %u %"SCNx64" %"SCNu64" %x %x %u", key, &vid, &pid,
+                   &bcd_device, &iface_number, &entry.node_rdev, &entry.node_ctime,
+                   &usage_page, &usage, &numbered_reports);
+        if (r != 10 || vid > 0xFFFF || pid > 0xFFFF || bcd_device > 0xFFFF ||
+                iface_number > 0xFF || usage_page > 0xFFFF || usage > 0xFFFF) {
+            hs_log(HS_LOG_DEBUG, "Ignoring malformed entry in cache file '%s'", cache_path);
+            continue;
+        }
+
+        entry.key = key;
+        entry.vid = (uint16_t)vid;
+        entry.pid = (uint16_t)pid;
+        entry.bcd_device = (uint16_t)bcd_device;
+        entry.iface_number = (uint8_t)iface_number;
+        entry.usage_page = (uint16_t)usage_page;
+        entry.usage = (uint16_t)usage;
+        entry.numbered_reports = numbered_reports;
+
+        if (find_cache_entry(key))
+            continue;
+        if (add_cache_entry(&entry) < 0)
+            break;
+    }
+
+cleanup:
+    fclose(fp);
+}
+
+/* Other processes may write the file at the same time, so we write a temporary file and
+   rename it. The last one wins, the other entries will be computed again next time. */
+static void save_cache(void)
+{
+    char *tmp_path = NULL;
+    FILE *fp = NULL;
+    bool success = false;
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_path || !cache_dirty)
+        goto cleanup;
+    cache_dirty = false;
+
+    if (_hs_asprintf(&tmp_path, "%s.%d", cache_path, (int)getpid()) < 0)
+        goto cleanup;
+
+    fp = fopen(tmp_path, "we");
+    if (!fp && errno == ENOENT) {
+        // Create the parent directory, but not the whole hierarchy
+        char *dir = strdup(cache_path);
+        char *ptr = dir ? strrchr(dir, '/') : NULL;
+
+        if (ptr && ptr != dir) {
+            *ptr = 0;
+            mkdir(dir, 0755);
+            fp = fopen(tmp_path, "we");
+        }
+        free(dir);
+    }
+    if (!fp) {
+        hs_log(HS_LOG_DEBUG, "Cannot write cache file '%s': %s", tmp_path, strerror(errno));
+        goto cleanup;
+    }
+
+    fputs(CACHE_HEADER "\n", fp);
+    _hs_htable_foreach(cur, &cache_entries) {
+        struct cache_entry *entry = _hs_container_of(cur, struct cache_entry, hnode);
+
+        fprintf(fp, "%s %04x %04x %04x %u %"PRIx64" %"PRIu64" %04x %04x %u\n", entry->key,
+                entry->vid, entry->pid, entry->bcd_device, entry->iface_number,
+                entry->node_rdev, entry->node_ctime, entry->usage_page, entry->usage,
+                entry->numbered_reports);
+    }
+    if (fflush(fp) != 0 || ferror(fp))
+        goto cleanup;
+
+    success = !rename(tmp_path, cache_path);
+
+cleanup:
+    if (fp) {
+        fclose(fp);
+        if (!success)
+            unlink(tmp_path);
+    }
+    free(tmp_path);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void make_cache_entry(const hs_device *dev, const struct stat *st,
+                             struct cache_entry *rentry)
+{
+    rentry->key = dev->key;
+    rentry->vid = dev->vid;
+    rentry->pid = dev->pid;
+    rentry->bcd_device = dev->bcd_device;
+    rentry->iface_number = dev->iface_number;
+    rentry->node_rdev = (uint64_t)st->st_rdev;
+    rentry->node_ctime = (uint64_t)st->st_ctim.tv_sec * 1000000000 + (uint64_t)st->st_ctim.tv_nsec;
+}
+
+static bool get_cached_hid_properties(hs_device *dev, const struct stat *st)
+{
+    struct cache_entry tmp;
+    struct cache_entry *entry;
+    bool found = false;
+
+    make_cache_entry(dev, st, &tmp);
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_path)
+        goto cleanup;
+    load_cache();
+
+    entry = find_cache_entry(tmp.key);
+    if (!entry || entry->vid != tmp.vid || entry->pid != tmp.pid ||
+            entry->bcd_device != tmp.bcd_device || entry->iface_number != tmp.iface_number ||
+            entry->node_rdev != tmp.node_rdev || entry->node_ctime != tmp.node_ctime)
+        goto cleanup;
+
+    dev->u.hid.usage_page = entry->usage_page;
+    dev->u.hid.usage = entry->usage;
+    dev->u.hid.numbered_reports = entry->numbered_reports;
+    found = true;
+
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
+
+static void cache_hid_properties(const hs_device *dev, const struct stat *st)
+{
+    struct cache_entry tmp;
+    struct cache_entry *entry;
+
+    make_cache_entry(dev, st, &tmp);
+    tmp.usage_page = dev->u.hid.usage_page;
+    tmp.usage = dev->u.hid.usage;
+    tmp.numbered_reports = dev->u.hid.numbered_reports;
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!cache_path)
+        goto cleanup;
+    load_cache();
+
+    entry = find_cache_entry(tmp.key);
+    if (entry) {
+        _hs_htable_remove(&cache_entries, &entry->hnode);
+        free(entry->key);
+        free(entry);
+    }
+
+    // Not a big deal if this fails, we won't use the cache for this device
+    hs_error_mask(HS_ERROR_MEMORY);
+    if (add_cache_entry(&tmp) == 0)
+        cache_dirty = true;
+    hs_error_unmask();
+
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int hs_monitor_set_cache_path(const char *path)
+{
+    static bool atexit_called;
+    char *new_path = NULL;
+    int r;
+
+    if (path) {
+        new_path = strdup(path);
+        if (!new_path)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    if (!atexit_called) {
+        atexit(release_cache);
+        atexit_called = true;
+    }
+
+    if (!cache_entries.size) {
+        r = _hs_htable_init(&cache_entries, 64);
+        if (r < 0) {
+            free(new_path);
+            goto cleanup;
+        }
+    }
+
+    clear_cache();
+    free(cache_path);
+    cache_path = new_path;
+    cache_loaded = false;
+    cache_dirty = false;
+
+    r = 0;
+cleanup:
+    pthread_mutex_unlock(&cache_lock);
+    return r;
+}
+
+// hid_path is the sysfs directory of the parent HID device, it can be NULL
+static void fill_hid_properties(hs_device *dev, const char *hid_path)
 {
     uint8_t desc[HID_MAX_DESCRIPTOR_SIZE];
     size_t desc_size;
+    struct stat st;
+    bool cacheable;
+
+    cacheable = !stat(dev->path, &st);
+    if (cacheable && get_cached_hid_properties(dev, &st))
+        return;
 
     // The sysfs report_descriptor file appeared in 2011, somewhere around Linux 2.6.38
-    desc_size = read_hid_descriptor_sysfs(agg, desc, sizeof(desc));
+    desc_size = read_hid_descriptor_sysfs(hid_path, desc, sizeof(desc));
     if (!desc_size) {
-        desc_size = read_hid_descriptor_hidraw(agg, desc, sizeof(desc));
+        desc_size = read_hid_descriptor_hidraw(dev->path, desc, sizeof(desc));
         if (!desc_size) {
             // This will happen pretty often on old kernels, most HID nodes are root-only
             hs_log(HS_LOG_DEBUG, "Cannot get HID report descriptor from '%s'", dev->path);
@@ -320,9 +696,15 @@ static void fill_hid_properties(struct udev_aggregate *agg, hs_device *dev)
     }
 
     parse_hid_descriptor(dev, desc, desc_size);
+    if (cacheable)
+        cache_hid_properties(dev, &st);
 }
 
-static int read_device_information(struct udev_device *udev_dev, hs_device **rdev)
+/* Returns 0 if the device is not interesting or does not match, in which case we skip
+   the string attributes and the HID descriptor, which are the expensive parts. */
+#ifndef HS_NO_LIBUDEV
+static int read_device_information(struct udev_device *udev_dev,
+                                   const _hs_match_helper *match_helper, hs_device **rdev)
 {
     struct udev_aggregate agg;
     hs_device *dev = NULL;
@@ -347,9 +729,20 @@ static int read_device_information(struct udev_device *udev_dev, hs_device **rde
     r = fill_device_details(&agg, dev);
     if (r <= 0)
         goto cleanup;
+    if (!_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
+        r = 0;
+        goto cleanup;
+    }
 
-    if (dev->type == HS_DEVICE_TYPE_HID)
-        fill_hid_properties(&agg, dev);
+    r = fill_device_strings(&agg, dev);
+    if (r < 0)
+        goto cleanup;
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        struct udev_device *hid_dev;
+
+        hid_dev = udev_device_get_parent_with_subsystem_devtype(agg.dev, "hid", NULL);
+        fill_hid_properties(dev, hid_dev ? udev_device_get_syspath(hid_dev) : NULL);
+    }
 
     *rdev = dev;
     dev = NULL;
@@ -359,37 +752,110 @@ cleanup:
     hs_device_unref(dev);
     return r;
 }
+#endif
 
-static void release_udev(void)
+static int read_sysfs_device_information(const char *devpath, hs_device_type type,
+                                         const _hs_match_helper *match_helper, hs_device **rdev)
+{
+    _hs_sysfs_device sysdev;
+    hs_device *dev = NULL;
+    int r;
+
+    dev = (hs_device *)calloc(1, sizeof(*dev));
+    if (!dev) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    dev->refcount = 1;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+
+    r = _hs_sysfs_read_device(&_hs_sysfs_default_root, devpath, type, &sysdev, dev);
+    if (r <= 0)
+        goto cleanup;
+    if (!_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
+        r = 0;
+        goto cleanup;
+    }
+
+    r = _hs_sysfs_read_strings(&_hs_sysfs_default_root, &sysdev, dev);
+    if (r < 0)
+        goto cleanup;
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        char hid_path[_HS_SYSFS_PATH_SIZE];
+
+        if (!_hs_sysfs_get_hid_path(&_hs_sysfs_default_root, &sysdev, hid_path, sizeof(hid_path)))
+            hid_path[0] = 0;
+        fill_hid_properties(dev, hid_path[0] ? hid_path : NULL);
+    }
+
+    *rdev = dev;
+    dev = NULL;
+
+    r = 1;
+cleanup:
+    hs_device_unref(dev);
+    return r;
+}
+
+static void release_backend(void)
 {
     close(common_eventfd);
+#ifndef HS_NO_LIBUDEV
     udev_unref(udev);
-    pthread_mutex_destroy(&udev_init_lock);
+#endif
+    pthread_mutex_destroy(&backend_init_lock);
 }
 
-static int init_udev(void)
+static backend_type select_backend(void)
+{
+    const char *env = getenv("LIBHS_LINUX_BACKEND");
+
+#ifndef HS_NO_LIBUDEV
+    if (env && strcmp(env, "udev") == 0)
+        return BACKEND_UDEV;
+    if (env && strcmp(env, "sysfs") == 0)
+        return BACKEND_SYSFS;
+    if (env)
+        hs_log(HS_LOG_WARNING, "Ignoring unknown LIBHS_LINUX_BACKEND value '%s'", env);
+
+    // The udev daemon creates this when it starts, libudev uses the same test
+    if (access("/run/udev/control", F_OK) == 0)
+        return BACKEND_UDEV;
+#else
+    if (env && strcmp(env, "sysfs") != 0)
+        hs_log(HS_LOG_WARNING, "Ignoring LIBHS_LINUX_BACKEND, libhs was built without libudev");
+#endif
+
+    return BACKEND_SYSFS;
+}
+
+static int init_backend(void)
 {
     static bool atexit_called;
     int r;
 
     // fast path
-    if (udev && common_eventfd >= 0)
+    if (backend_ready)
         return 0;
 
-    pthread_mutex_lock(&udev_init_lock);
+    pthread_mutex_lock(&backend_init_lock);
 
     if (!atexit_called) {
-        atexit(release_udev);
+        atexit(release_backend);
         atexit_called = true;
     }
 
-    if (!udev) {
+    backend = select_backend();
+
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV && !udev) {
         udev = udev_new();
         if (!udev) {
             r = hs_error(HS_ERROR_SYSTEM, "udev_new() failed");
             goto cleanup;
         }
     }
+#endif
 
     if (common_eventfd < 0) {
         /* We use this as a never-ready placeholder descriptor for all newly created monitors,
@@ -401,75 +867,329 @@ static int init_udev(void)
         }
     }
 
+    hs_log(HS_LOG_DEBUG, "Using %s backend to find devices",
+           backend == BACKEND_UDEV ? "udev" : "sysfs");
+    backend_ready = true;
+
     r = 0;
 cleanup:
-    pthread_mutex_unlock(&udev_init_lock);
+    pthread_mutex_unlock(&backend_init_lock);
     return r;
 }
 
-static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void *udata)
+static bool get_subsystem_type(const char *subsystem, hs_device_type *rtype)
+{
+    for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
+        if (strcmp(device_subsystems[i].subsystem, subsystem) == 0) {
+            *rtype = device_subsystems[i].type;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#ifndef HS_NO_LIBUDEV
+
+static int read_udev_device(struct udev *ctx, const _hs_match_helper *match_helper,
+                            const char *syspath, hs_device **rdev)
+{
+    struct udev_device *udev_dev;
+    int r;
+
+    udev_dev = udev_device_new_from_syspath(ctx, syspath);
+    if (!udev_dev) {
+        if (errno == ENOMEM)
+            return hs_error(HS_ERROR_MEMORY, NULL);
+        return 0;
+    }
+
+    r = read_device_information(udev_dev, match_helper, rdev);
+    udev_device_unref(udev_dev);
+
+    return r;
+}
+
+// The paths belong to enumerate, which must outlive the job
+static int list_udev_devices(const _hs_match_helper *match_helper, struct enumerate_job *job,
+                             struct udev_enumerate **renumerate)
 {
     struct udev_enumerate *enumerate;
+    struct udev_list_entry *cur;
     int r;
 
     enumerate = udev_enumerate_new(udev);
-    if (!enumerate) {
-        r = hs_error(HS_ERROR_MEMORY, NULL);
-        goto cleanup;
-    }
+    if (!enumerate)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    *renumerate = enumerate;
 
     udev_enumerate_add_match_is_initialized(enumerate);
     for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
         if (_hs_match_helper_has_type(match_helper, device_subsystems[i].type)) {
             r = udev_enumerate_add_match_subsystem(enumerate, device_subsystems[i].subsystem);
-            if (r < 0) {
-                r = hs_error(HS_ERROR_MEMORY, NULL);
-                goto cleanup;
-            }
+            if (r < 0)
+                return hs_error(HS_ERROR_MEMORY, NULL);
         }
     }
 
     // Current implementation of udev_enumerate_scan_devices() does not fail
     r = udev_enumerate_scan_devices(enumerate);
-    if (r < 0) {
-        r = hs_error(HS_ERROR_SYSTEM, "udev_enumerate_scan_devices() failed");
-        goto cleanup;
-    }
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "udev_enumerate_scan_devices() failed");
 
-    struct udev_list_entry *cur;
     udev_list_entry_foreach(cur, udev_enumerate_get_list_entry(enumerate)) {
-        struct udev_device *udev_dev;
-        hs_device *dev;
+        struct enumerate_item item = {udev_list_entry_get_name(cur)};
 
-        udev_dev = udev_device_new_from_syspath(udev, udev_list_entry_get_name(cur));
-        if (!udev_dev) {
-            if (errno == ENOMEM) {
-                r = hs_error(HS_ERROR_MEMORY, NULL);
-                goto cleanup;
-            }
+        r = _hs_array_push(&job->items, item);
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+#endif
+
+struct list_sysfs_context {
+    struct enumerate_job *job;
+    hs_device_type type;
+};
+
+static int list_sysfs_callback(const char *devpath, void *udata)
+{
+    struct list_sysfs_context *ctx = (struct list_sysfs_context *)udata;
+    struct enumerate_item item;
+
+    item.path = strdup(devpath);
+    if (!item.path)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    item.type = ctx->type;
+
+    if (_hs_array_push(&ctx->job->items, item) < 0) {
+        free((char *)item.path);
+        return HS_ERROR_MEMORY;
+    }
+
+    return 0;
+}
+
+// The paths are copied, free them when you are done
+static int list_sysfs_devices(const _hs_match_helper *match_helper, struct enumerate_job *job)
+{
+    for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
+        struct list_sysfs_context ctx;
+        int r;
+
+        if (!_hs_match_helper_has_type(match_helper, device_subsystems[i].type))
             continue;
-        }
 
-        r = read_device_information(udev_dev, &dev);
-        udev_device_unref(udev_dev);
+        ctx.job = job;
+        ctx.type = device_subsystems[i].type;
+
+        r = _hs_sysfs_list(&_hs_sysfs_default_root, device_subsystems[i].subsystem,
+                           list_sysfs_callback, &ctx);
         if (r < 0)
-            goto cleanup;
-        if (!r)
-            continue;
+            return r;
+    }
 
-        if (_hs_match_helper_match(match_helper, dev, &dev->match_udata)) {
-            r = (*f)(dev, udata);
-            hs_device_unref(dev);
+    return 0;
+}
+
+// ctx is only used (and can only be used) with the udev backend
+static int read_enumerated_device(void *ctx, const _hs_match_helper *match_helper,
+                                  const struct enumerate_item *item, hs_device **rdev)
+{
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV)
+        return read_udev_device((struct udev *)ctx, match_helper, item->path, rdev);
+#else
+    _HS_UNUSED(ctx);
+#endif
+
+    return read_sysfs_device_information(item->path, item->type, match_helper, rdev);
+}
+
+static void *enumerate_worker(void *udata)
+{
+    struct enumerate_job *job = (struct enumerate_job *)udata;
+    void *ctx = NULL;
+    bool ready = true;
+
+    /* The only errors we can get are memory errors, the main thread reports them when
+       it gets to the device, because the last error message is thread-local. */
+    hs_error_mask(HS_ERROR_MEMORY);
+
+#ifndef HS_NO_LIBUDEV
+    // Objects from a libudev context must not be used by several threads
+    if (backend == BACKEND_UDEV) {
+        ctx = udev_new();
+        ready = ctx;
+    }
+#endif
+
+    for (;;) {
+        size_t idx;
+        hs_device *dev = NULL;
+        int r;
+
+        pthread_mutex_lock(&job->mutex);
+        if (job->abort || job->next == job->count) {
+            pthread_mutex_unlock(&job->mutex);
+            break;
+        }
+        idx = job->next++;
+        pthread_mutex_unlock(&job->mutex);
+
+        if (ready) {
+            r = read_enumerated_device(ctx, job->match_helper, &job->items.values[idx], &dev);
+        } else {
+            r = HS_ERROR_MEMORY;
+        }
+
+        pthread_mutex_lock(&job->mutex);
+        job->results[idx].dev = dev;
+        job->results[idx].r = r;
+        job->results[idx].done = true;
+        pthread_cond_broadcast(&job->cond);
+        pthread_mutex_unlock(&job->mutex);
+    }
+
+#ifndef HS_NO_LIBUDEV
+    udev_unref((struct udev *)ctx);
+#endif
+    hs_error_unmask();
+
+    return NULL;
+}
+
+static unsigned int start_enumerate_workers(struct enumerate_job *job, pthread_t *threads)
+{
+    long cpus;
+    size_t count;
+    unsigned int started = 0;
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        cpus = 1;
+    count = (job->count + ENUMERATE_WORKER_DEVICES - 1) / ENUMERATE_WORKER_DEVICES;
+    if (count > (size_t)cpus)
+        count = (size_t)cpus;
+    if (count > ENUMERATE_MAX_WORKERS)
+        count = ENUMERATE_MAX_WORKERS;
+
+    // Not worth it for a few devices, the main thread does the work
+    if (count < 2)
+        return 0;
+
+    for (size_t i = 0; i < count; i++) {
+        int r = pthread_create(&threads[started], NULL, enumerate_worker, job);
+        if (r) {
+            hs_log(HS_LOG_DEBUG, "Cannot start enumeration thread: %s", strerror(r));
+            break;
+        }
+        started++;
+    }
+
+    return started;
+}
+
+/* Workers read the device information (in any order), and the devices are handed to f
+   in the order they were listed, as soon as each one is ready. */
+static int enumerate(_hs_match_helper *match_helper, hs_enumerate_func *f, void *udata)
+{
+#ifndef HS_NO_LIBUDEV
+    struct udev_enumerate *enumerate = NULL;
+    void *ctx = udev;
+#else
+    void *ctx = NULL;
+#endif
+    struct enumerate_job job = {0};
+    pthread_t threads[ENUMERATE_MAX_WORKERS];
+    unsigned int threads_count = 0;
+    int r;
+
+    pthread_mutex_init(&job.mutex, NULL);
+    pthread_cond_init(&job.cond, NULL);
+    job.match_helper = match_helper;
+
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV) {
+        r = list_udev_devices(match_helper, &job, &enumerate);
+    } else
+#endif
+    {
+        r = list_sysfs_devices(match_helper, &job);
+    }
+    if (r < 0)
+        goto cleanup;
+    job.count = job.items.count;
+    if (!job.count) {
+        r = 0;
+        goto cleanup;
+    }
+
+    job.results = (struct enumerate_result *)calloc(job.count, sizeof(*job.results));
+    if (!job.results) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+
+    threads_count = start_enumerate_workers(&job, threads);
+
+    for (size_t i = 0; i < job.count; i++) {
+        struct enumerate_result *result = &job.results[i];
+
+        if (threads_count) {
+            pthread_mutex_lock(&job.mutex);
+            while (!result->done)
+                pthread_cond_wait(&job.cond, &job.mutex);
+            pthread_mutex_unlock(&job.mutex);
+        } else {
+            result->r = read_enumerated_device(ctx, match_helper, &job.items.values[i],
+                                               &result->dev);
+            result->done = true;
+        }
+
+        if (result->r < 0) {
+            r = threads_count ? hs_error((hs_error_code)result->r, NULL) : result->r;
+            goto cleanup;
+        }
+        if (result->dev) {
+            r = (*f)(result->dev, udata);
+            hs_device_unref(result->dev);
+            result->dev = NULL;
             if (r)
                 goto cleanup;
-        } else {
-            hs_device_unref(dev);
         }
     }
 
     r = 0;
 cleanup:
-    udev_enumerate_unref(enumerate);
+    if (threads_count) {
+        pthread_mutex_lock(&job.mutex);
+        job.abort = true;
+        pthread_mutex_unlock(&job.mutex);
+        for (unsigned int i = 0; i < threads_count; i++)
+            pthread_join(threads[i], NULL);
+    }
+    if (job.results) {
+        for (size_t i = 0; i < job.count; i++)
+            hs_device_unref(job.results[i].dev);
+    }
+    free(job.results);
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV) {
+        udev_enumerate_unref(enumerate);
+    } else
+#endif
+    {
+        for (size_t i = 0; i < job.items.count; i++)
+            free((char *)job.items.values[i].path);
+    }
+    _hs_array_release(&job.items);
+    save_cache();
+    pthread_cond_destroy(&job.cond);
+    pthread_mutex_destroy(&job.mutex);
     return r;
 }
 
@@ -495,7 +1215,7 @@ int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_
     struct enumerate_enumerate_context ctx;
     int r;
 
-    r = init_udev();
+    r = init_backend();
     if (r < 0)
         return r;
 
@@ -524,6 +1244,7 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
         r = hs_error(HS_ERROR_MEMORY, NULL);
         goto error;
     }
+    monitor->uevent_fd = -1;
     monitor->wait_fd = -1;
 
     r = _hs_match_helper_init(&monitor->match_helper, matches, count);
@@ -534,7 +1255,7 @@ int hs_monitor_new(const hs_match_spec *matches, unsigned int count, hs_monitor
     if (r < 0)
         goto error;
 
-    r = init_udev();
+    r = init_backend();
     if (r < 0)
         goto error;
 
@@ -556,7 +1277,10 @@ void hs_monitor_free(hs_monitor *monitor)
 {
     if (monitor) {
         close(monitor->wait_fd);
+#ifndef HS_NO_LIBUDEV
         udev_monitor_unref(monitor->udev_mon);
+#endif
+        close(monitor->uevent_fd);
 
         _hs_monitor_clear_devices(&monitor->devices);
         _hs_htable_release(&monitor->devices);
@@ -572,34 +1296,82 @@ static int monitor_enumerate_callback(hs_device *dev, void *udata)
     return _hs_monitor_add(&monitor->devices, dev, NULL, NULL);
 }
 
-int hs_monitor_start(hs_monitor *monitor)
-{
-    assert(monitor);
+#ifndef HS_NO_LIBUDEV
 
+static int start_udev_monitor(hs_monitor *monitor)
+{
     int r;
 
-    if (monitor->udev_mon)
-        return 0;
-
     monitor->udev_mon = udev_monitor_new_from_netlink(udev, "udev");
-    if (!monitor->udev_mon) {
-        r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_new_from_netlink() failed");
-        goto error;
-    }
+    if (!monitor->udev_mon)
+        return hs_error(HS_ERROR_SYSTEM, "udev_monitor_new_from_netlink() failed");
 
     for (unsigned int i = 0; device_subsystems[i].subsystem; i++) {
         if (_hs_match_helper_has_type(&monitor->match_helper, device_subsystems[i].type)) {
             r = udev_monitor_filter_add_match_subsystem_devtype(monitor->udev_mon, device_subsystems[i].subsystem, NULL);
-            if (r < 0) {
-                r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_filter_add_match_subsystem_devtype() failed");
-                goto error;
-            }
+            if (r < 0)
+                return hs_error(HS_ERROR_SYSTEM, "udev_monitor_filter_add_match_subsystem_devtype() failed");
         }
     }
 
     r = udev_monitor_enable_receiving(monitor->udev_mon);
-    if (r < 0) {
-        r = hs_error(HS_ERROR_SYSTEM, "udev_monitor_enable_receiving() failed");
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "udev_monitor_enable_receiving() failed");
+
+    return udev_monitor_get_fd(monitor->udev_mon);
+}
+
+#endif
+
+// Returns the socket, which we listen to until hs_monitor_stop() closes it
+static int start_uevent_monitor(hs_monitor *monitor)
+{
+    struct sockaddr_nl addr = {0};
+    int size = UEVENT_SOCKET_BUFFER_SIZE;
+    int r;
+
+    monitor->uevent_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                                NETLINK_KOBJECT_UEVENT);
+    if (monitor->uevent_fd < 0)
+        return hs_error(HS_ERROR_SYSTEM, "socket(NETLINK_KOBJECT_UEVENT) failed: %s",
+                        strerror(errno));
+
+    // Events come in bursts when hubs are plugged in, SO_RCVBUFFORCE needs CAP_NET_ADMIN
+    if (setsockopt(monitor->uevent_fd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0)
+        setsockopt(monitor->uevent_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    // Group 1 gets the kernel messages, udev rebroadcasts them on group 2
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;
+    r = bind(monitor->uevent_fd, (struct sockaddr *)&addr, sizeof(addr));
+    if (r < 0)
+        return hs_error(HS_ERROR_SYSTEM, "bind(NETLINK_KOBJECT_UEVENT) failed: %s",
+                        strerror(errno));
+
+    return monitor->uevent_fd;
+}
+
+int hs_monitor_start(hs_monitor *monitor)
+{
+    assert(monitor);
+
+    int fd;
+    int r;
+
+    if (monitor->started)
+        return 0;
+    monitor->started = true;
+
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV) {
+        fd = start_udev_monitor(monitor);
+    } else
+#endif
+    {
+        fd = start_uevent_monitor(monitor);
+    }
+    if (fd < 0) {
+        r = fd;
         goto error;
     }
 
@@ -609,7 +1381,7 @@ int hs_monitor_start(hs_monitor *monitor)
 
     /* Given the documentation of dup3() and the kernel code handling it, I'm reasonably sure
        nothing can make this call fail. */
-    dup3(udev_monitor_get_fd(monitor->udev_mon), monitor->wait_fd, O_CLOEXEC);
+    dup3(fd, monitor->wait_fd, O_CLOEXEC);
 
     return 0;
 
@@ -622,14 +1394,20 @@ void hs_monitor_stop(hs_monitor *monitor)
 {
     assert(monitor);
 
-    if (!monitor->udev_mon)
+    if (!monitor->started)
         return;
 
     _hs_monitor_clear_devices(&monitor->devices);
 
     dup3(common_eventfd, monitor->wait_fd, O_CLOEXEC);
+#ifndef HS_NO_LIBUDEV
     udev_monitor_unref(monitor->udev_mon);
     monitor->udev_mon = NULL;
+#endif
+    close(monitor->uevent_fd);
+    monitor->uevent_fd = -1;
+
+    monitor->started = false;
 }
 
 hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
@@ -638,16 +1416,13 @@ hs_handle hs_monitor_get_poll_handle(const hs_monitor *monitor)
     return monitor->wait_fd;
 }
 
-int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
-{
-    assert(monitor);
+#ifndef HS_NO_LIBUDEV
 
+static int refresh_udev_monitor(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
     struct udev_device *udev_dev;
     int r;
 
-    if (!monitor->udev_mon)
-        return 0;
-
     errno = 0;
     while ((udev_dev = udev_monitor_receive_device(monitor->udev_mon))) {
         const char *action = udev_device_get_action(udev_dev);
@@ -656,12 +1431,9 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
         if (strcmp(action, "add") == 0) {
             hs_device *dev = NULL;
 
-            r = read_device_information(udev_dev, &dev);
-            if (r > 0) {
-                r = _hs_match_helper_match(&monitor->match_helper, dev, &dev->match_udata);
-                if (r)
-                    r = _hs_monitor_add(&monitor->devices, dev, f, udata);
-            }
+            r = read_device_information(udev_dev, &monitor->match_helper, &dev);
+            if (r > 0)
+                r = _hs_monitor_add(&monitor->devices, dev, f, udata);
 
             hs_device_unref(dev);
         } else if (strcmp(action, "remove") == 0) {
@@ -679,6 +1451,88 @@ int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
     return 0;
 }
 
+#endif
+
+static int refresh_uevent_monitor(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    char buf[UEVENT_BUFFER_SIZE];
+    int r;
+
+    for (;;) {
+        struct sockaddr_nl addr;
+        socklen_t addr_len = sizeof(addr);
+        ssize_t len;
+        _hs_uevent event;
+        hs_device_type type;
+
+        len = recvfrom(monitor->uevent_fd, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&addr,
+                       &addr_len);
+        if (len < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == EINTR)
+                continue;
+            if (errno == ENOBUFS) {
+                hs_log(HS_LOG_WARNING, "Lost device events, the uevent socket overflowed");
+                continue;
+            }
+            return hs_error(HS_ERROR_SYSTEM, "recvfrom(NETLINK_KOBJECT_UEVENT) failed: %s",
+                            strerror(errno));
+        }
+
+        // Only trust the kernel
+        if (addr.nl_pid)
+            continue;
+        buf[len] = 0;
+        if (!_hs_uevent_parse(buf, (size_t)len + 1, &event))
+            continue;
+        if (!get_subsystem_type(event.subsystem, &type) ||
+                !_hs_match_helper_has_type(&monitor->match_helper, type))
+            continue;
+
+        r = 0;
+        if (strcmp(event.action, "add") == 0) {
+            hs_device *dev = NULL;
+
+            r = read_sysfs_device_information(event.devpath, type, &monitor->match_helper, &dev);
+            if (r > 0)
+                r = _hs_monitor_add(&monitor->devices, dev, f, udata);
+
+            hs_device_unref(dev);
+        } else if (strcmp(event.action, "remove") == 0) {
+            _hs_monitor_remove(&monitor->devices, event.devpath, f, udata);
+        }
+        if (r)
+            return r;
+    }
+
+    return 0;
+}
+
+int hs_monitor_refresh(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
+{
+    assert(monitor);
+
+    int r;
+
+    if (!monitor->started)
+        return 0;
+
+#ifndef HS_NO_LIBUDEV
+    if (backend == BACKEND_UDEV) {
+        r = refresh_udev_monitor(monitor, f, udata);
+    } else
+#endif
+    {
+        r = refresh_uevent_monitor(monitor, f, udata);
+    }
+    if (r)
+        return r;
+    save_cache();
+
+    return 0;
+}
+
 int hs_monitor_list(hs_monitor *monitor, hs_enumerate_func *f, void *udata)
 {
     return _hs_monitor_list(&monitor->devices, f, udata);
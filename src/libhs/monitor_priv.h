@@ -26,4 +26,7 @@ void _hs_monitor_remove(_hs_htable *devices, const char *key, hs_enumerate_func
 
 int _hs_monitor_list(_hs_htable *devices, hs_enumerate_func *f, void *udata);
 
+// Writes the event to the file set with hs_monitor_set_record_path(), if any
+void _hs_monitor_record_event(const struct hs_device *dev);
+
 #endif
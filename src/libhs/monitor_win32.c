@@ -1104,6 +1104,13 @@ static int enumerate_enumerate_callback(hs_device *dev, void *udata)
     return (*ctx->f)(dev, ctx->udata);
 }
 
+// Getting device information is cheap enough here
+int hs_monitor_set_cache_path(const char *path)
+{
+    _HS_UNUSED(path);
+    return 0;
+}
+
 int hs_enumerate(const hs_match_spec *matches, unsigned int count, hs_enumerate_func *f, void *udata)
 {
     assert(f);
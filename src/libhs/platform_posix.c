@@ -26,7 +26,7 @@ uint64_t hs_millis(void)
 #endif
     assert(!r);
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
 }
 
 int hs_poll(hs_poll_source *sources, unsigned int count, int timeout)
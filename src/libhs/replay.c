@@ -0,0 +1,462 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libhs
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "array.h"
+#include "device_priv.h"
+#include "htable.h"
+#include "match_priv.h"
+#include "monitor_priv.h"
+#include "platform.h"
+#include "replay_priv.h"
+
+struct replay_event {
+    uint64_t time;
+    hs_device *dev;
+};
+
+struct hs_replay {
+    _hs_match_helper match_helper;
+    double speed;
+
+    _HS_ARRAY(struct replay_event) events;
+    size_t next_event;
+    uint64_t start;
+
+    _hs_htable devices;
+};
+
+#define REPLAY_LINE_SIZE 16384
+
+static FILE *record_fp;
+
+static char *encode_string(char *ptr, const char *str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+
+    if (!str || !str[0]) {
+        *ptr++ = '-';
+        return ptr;
+    }
+
+    for (const char *c = str; *c; c++) {
+        unsigned char uc = (unsigned char)*c;
+
+        if (uc <= ' ' || uc == 0x7F || uc == '%' || (uc == '-' && c == str && !c[1])) {
+            *ptr++ = '%';
+            *ptr++ = hex[uc >> 4];
+            *ptr++ = hex[uc & 0xF];
+        } else {
+            *ptr++ = *c;
+        }
+    }
+
+    return ptr;
+}
+
+static int decode_string(char *str, char **rstr)
+{
+    char *ptr = str;
+
+    if (strcmp(str, "-") == 0) {
+        *rstr = NULL;
+        return 0;
+    }
+
+    for (const char *c = str; *c; c++) {
+        if (*c == '%') {
+            char hex[3] = {0};
+
+            if (!c[1] || !c[2])
+                return hs_error(HS_ERROR_PARSE, "Truncated escape sequence in event file");
+            hex[0] = c[1];
+            hex[1] = c[2];
+            *ptr++ = (char)strtoul(hex, NULL, 16);
+            c += 2;
+        } else {
+            *ptr++ = *c;
+        }
+    }
+    *ptr = 0;
+
+    *rstr = strdup(str);
+    if (!*rstr)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    return 0;
+}
+
+int _hs_replay_write_header(FILE *fp)
+{
+    if (fputs(_HS_REPLAY_HEADER "\n", fp) == EOF)
+        return hs_error(HS_ERROR_IO, "Failed to write event file: %s", strerror(errno));
+
+    return 0;
+}
+
+int _hs_replay_write_event(FILE *fp, uint64_t time, const hs_device *dev)
+{
+    const char *strings[] = {dev->key, dev->location, dev->path, dev->manufacturer_string,
+                             dev->product_string, dev->serial_number_string};
+    size_t size = 256;
+    char *line, *ptr;
+    uint16_t usage_page = 0, usage = 0;
+    int r;
+
+    // Build the whole line first, so that events from several threads do not mix
+    for (size_t i = 0; i < _HS_COUNTOF(strings); i++)
+        size += strings[i] ? strlen(strings[i]) * 3 + 1 : 2;
+    line = malloc(size);
+    if (!line)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        usage_page = dev->u.hid.usage_page;
+        usage = dev->u.hid.usage;
+    }
+
+    ptr = line + sprintf(line, "%"PRIu64" %s %s", time,
+                         dev->status == HS_DEVICE_STATUS_ONLINE ? "add" : "remove",
+                         hs_device_type_strings[dev->type]);
+    for (size_t i = 0; i < 3; i++) {
+        *ptr++ = ' ';
+        ptr = encode_string(ptr, strings[i]);
+    }
+    ptr += sprintf(ptr, " %04"PRIx16" %04"PRIx16" %04"PRIx16" %"PRIx8" %"PRIx16" %"PRIx16,
+                   dev->vid, dev->pid, dev->bcd_device, dev->iface_number, usage_page, usage);
+    for (size_t i = 3; i < _HS_COUNTOF(strings); i++) {
+        *ptr++ = ' ';
+        ptr = encode_string(ptr, strings[i]);
+    }
+    *ptr++ = '\n';
+
+    if (fwrite(line, 1, (size_t)(ptr - line), fp) != (size_t)(ptr - line) || fflush(fp)) {
+        r = hs_error(HS_ERROR_IO, "Failed to write event file: %s", strerror(errno));
+        goto cleanup;
+    }
+
+    r = 0;
+cleanup:
+    free(line);
+    return r;
+}
+
+int _hs_replay_read_header(FILE *fp)
+{
+    char line[64];
+
+    if (!fgets(line, sizeof(line), fp) || strcmp(line, _HS_REPLAY_HEADER "\n") != 0)
+        return hs_error(HS_ERROR_PARSE, "Missing or unsupported event file header");
+
+    return 0;
+}
+
+static bool parse_hex(const char *str, unsigned long max, unsigned long *rvalue)
+{
+    char *end;
+
+    errno = 0;
+    *rvalue = strtoul(str, &end, 16);
+    return !errno && !*end && *rvalue <= max;
+}
+
+int _hs_replay_read_event(FILE *fp, uint64_t *rtime, hs_device **rdev)
+{
+    char *line = NULL;
+    char *fields[15];
+    unsigned long values[6];
+    hs_device *dev = NULL;
+    int r;
+
+    line = malloc(REPLAY_LINE_SIZE);
+    if (!line)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    do {
+        if (!fgets(line, REPLAY_LINE_SIZE, fp)) {
+            r = 0;
+            goto cleanup;
+        }
+        if (!strchr(line, '\n') && !feof(fp)) {
+            r = hs_error(HS_ERROR_PARSE, "Line too long in event file");
+            goto cleanup;
+        }
+        line[strcspn(line, "\r\n")] = 0;
+    } while (!line[0] || line[0] == '#');
+
+    // Split fields in place
+    {
+        char *ptr = line;
+        size_t count = 0;
+
+        while (*ptr && count < _HS_COUNTOF(fields)) {
+            fields[count++] = ptr;
+            ptr += strcspn(ptr, " ");
+            if (*ptr)
+                *ptr++ = 0;
+        }
+        if (count != _HS_COUNTOF(fields) || *ptr) {
+            r = hs_error(HS_ERROR_PARSE, "Malformed event in event file");
+            goto cleanup;
+        }
+    }
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    dev->refcount = 1;
+
+    if (strcmp(fields[1], "add") == 0) {
+        dev->status = HS_DEVICE_STATUS_ONLINE;
+    } else if (strcmp(fields[1], "remove") == 0) {
+        dev->status = HS_DEVICE_STATUS_DISCONNECTED;
+    } else {
+        r = hs_error(HS_ERROR_PARSE, "Unknown event '%s' in event file", fields[1]);
+        goto cleanup;
+    }
+    for (unsigned int i = 1; i < _HS_COUNTOF(hs_device_type_strings); i++) {
+        if (strcmp(fields[2], hs_device_type_strings[i]) == 0)
+            dev->type = (hs_device_type)i;
+    }
+    if (!dev->type) {
+        r = hs_error(HS_ERROR_PARSE, "Unknown device type '%s' in event file", fields[2]);
+        goto cleanup;
+    }
+
+    for (unsigned int i = 0; i < _HS_COUNTOF(values); i++) {
+        if (!parse_hex(fields[6 + i], i == 3 ? 0xFF : 0xFFFF, &values[i])) {
+            r = hs_error(HS_ERROR_PARSE, "Malformed value '%s' in event file", fields[6 + i]);
+            goto cleanup;
+        }
+    }
+    dev->vid = (uint16_t)values[0];
+    dev->pid = (uint16_t)values[1];
+    dev->bcd_device = (uint16_t)values[2];
+    dev->iface_number = (uint8_t)values[3];
+    if (dev->type == HS_DEVICE_TYPE_HID) {
+        dev->u.hid.usage_page = (uint16_t)values[4];
+        dev->u.hid.usage = (uint16_t)values[5];
+    }
+
+    if ((r = decode_string(fields[3], &dev->key)) < 0 ||
+            (r = decode_string(fields[4], &dev->location)) < 0 ||
+            (r = decode_string(fields[5], &dev->path)) < 0 ||
+            (r = decode_string(fields[12], &dev->manufacturer_string)) < 0 ||
+            (r = decode_string(fields[13], &dev->product_string)) < 0 ||
+            (r = decode_string(fields[14], &dev->serial_number_string)) < 0)
+        goto cleanup;
+    if (!dev->key || !dev->location || !dev->path) {
+        r = hs_error(HS_ERROR_PARSE, "Missing device key, location or path in event file");
+        goto cleanup;
+    }
+
+    *rtime = strtoull(fields[0], NULL, 10);
+    *rdev = dev;
+    dev = NULL;
+    r = 1;
+
+cleanup:
+    hs_device_unref(dev);
+    free(line);
+    return r;
+}
+
+static void close_record_file(void)
+{
+    if (record_fp) {
+        fclose(record_fp);
+        record_fp = NULL;
+    }
+}
+
+int hs_monitor_set_record_path(const char *path)
+{
+    static bool atexit_called;
+    FILE *fp = NULL;
+    int r;
+
+    if (path) {
+        fp = fopen(path, "w");
+        if (!fp)
+            return hs_error(HS_ERROR_IO, "Cannot open '%s' for writing: %s", path, strerror(errno));
+
+        r = _hs_replay_write_header(fp);
+        if (r < 0) {
+            fclose(fp);
+            return r;
+        }
+    }
+
+    if (!atexit_called) {
+        atexit(close_record_file);
+        atexit_called = true;
+    }
+
+    close_record_file();
+    record_fp = fp;
+
+    return 0;
+}
+
+void _hs_monitor_record_event(const hs_device *dev)
+{
+    if (!record_fp)
+        return;
+
+    // Recording is a debugging aid, don't let it break device monitoring
+    hs_error_mask(HS_ERROR_IO);
+    _hs_replay_write_event(record_fp, hs_millis(), dev);
+    hs_error_unmask();
+}
+
+int hs_replay_open(const char *path, const hs_match_spec *matches, unsigned int count,
+                   double speed, hs_replay **rreplay)
+{
+    assert(path);
+    assert(rreplay);
+
+    hs_replay *replay;
+    FILE *fp = NULL;
+    uint64_t first_time = 0;
+    int r;
+
+    replay = calloc(1, sizeof(*replay));
+    if (!replay) {
+        r = hs_error(HS_ERROR_MEMORY, NULL);
+        goto error;
+    }
+    replay->speed = speed;
+
+    r = _hs_match_helper_init(&replay->match_helper, matches, count);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&replay->devices, 64);
+    if (r < 0)
+        goto error;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        r = hs_error(errno == ENOENT ? HS_ERROR_NOT_FOUND : HS_ERROR_IO,
+                     "Cannot open '%s': %s", path, strerror(errno));
+        goto error;
+    }
+    r = _hs_replay_read_header(fp);
+    if (r < 0)
+        goto error;
+
+    while (true) {
+        struct replay_event event;
+
+        r = _hs_replay_read_event(fp, &event.time, &event.dev);
+        if (r < 0)
+            goto error;
+        if (!r)
+            break;
+
+        if (!replay->events.count)
+            first_time = event.time;
+        event.time = event.time > first_time ? event.time - first_time : 0;
+
+        if (!_hs_match_helper_match(&replay->match_helper, event.dev, &event.dev->match_udata)) {
+            hs_device_unref(event.dev);
+            continue;
+        }
+
+        r = _hs_array_push(&replay->events, event);
+        if (r < 0) {
+            hs_device_unref(event.dev);
+            goto error;
+        }
+    }
+    fclose(fp);
+
+    hs_log(HS_LOG_DEBUG, "Loaded %zu device events from '%s'", replay->events.count, path);
+
+    *rreplay = replay;
+    return 0;
+
+error:
+    if (fp)
+        fclose(fp);
+    hs_replay_free(replay);
+    return r;
+}
+
+void hs_replay_free(hs_replay *replay)
+{
+    if (replay) {
+        for (size_t i = 0; i < replay->events.count; i++)
+            hs_device_unref(replay->events.values[i].dev);
+        _hs_array_release(&replay->events);
+
+        if (replay->devices.heads)
+            _hs_monitor_clear_devices(&replay->devices);
+        _hs_htable_release(&replay->devices);
+
+        _hs_match_helper_release(&replay->match_helper);
+    }
+
+    free(replay);
+}
+
+// The events are in milliseconds since the first one, scale them to the replay speed
+static uint64_t scaled_time(const hs_replay *replay, uint64_t time)
+{
+    if (replay->speed <= 0.0)
+        return 0;
+    return (uint64_t)((double)time / replay->speed);
+}
+
+int hs_replay_refresh(hs_replay *replay, hs_enumerate_func *f, void *udata)
+{
+    assert(replay);
+
+    uint64_t elapsed;
+
+    if (!replay->start)
+        replay->start = hs_millis();
+    elapsed = hs_millis() - replay->start;
+
+    while (replay->next_event < replay->events.count) {
+        const struct replay_event *event = &replay->events.values[replay->next_event];
+        int r;
+
+        if (scaled_time(replay, event->time) > elapsed)
+            break;
+        replay->next_event++;
+
+        if (event->dev->status == HS_DEVICE_STATUS_ONLINE) {
+            r = _hs_monitor_add(&replay->devices, event->dev, f, udata);
+            if (r)
+                return r;
+        } else {
+            _hs_monitor_remove(&replay->devices, event->dev->key, f, udata);
+        }
+    }
+
+    return 0;
+}
+
+int hs_replay_get_timeout(const hs_replay *replay)
+{
+    assert(replay);
+
+    uint64_t time;
+
+    if (replay->next_event == replay->events.count)
+        return -1;
+    if (!replay->start)
+        return 0;
+
+    time = scaled_time(replay, replay->events.values[replay->next_event].time);
+    return hs_adjust_timeout(time > INT_MAX ? INT_MAX : (int)time, replay->start);
+}
@@ -0,0 +1,91 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libhs
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef HS_REPLAY_H
+#define HS_REPLAY_H
+
+#include "common.h"
+#include "monitor.h"
+
+HS_BEGIN_C
+
+/**
+ * @defgroup replay Event replay
+ * @brief Replay device events recorded with hs_monitor_set_record_path().
+ *
+ * A replay object delivers recorded device events as if they came from a device monitor,
+ * with the original timing or faster. This is useful to reproduce and benchmark complex
+ * situations (e.g. a hub full of devices rebooting) without the hardware.
+ *
+ * The replayed devices are not real, you cannot open them.
+ */
+
+/**
+ * @ingroup replay
+ * @typedef hs_replay
+ * @brief Opaque structure representing an event replay.
+ */
+struct hs_replay;
+typedef struct hs_replay hs_replay;
+
+/**
+ * @ingroup replay
+ * @brief Load recorded device events.
+ *
+ * The whole file is loaded and filtered with @p matches, the timing starts with the first
+ * call to hs_replay_refresh().
+ *
+ * @param      path     Path of the event file.
+ * @param      matches  Array of device matches, or NULL to replay all devices. This array is
+ *     not copied and must remain valid until hs_replay_free().
+ * @param      count    Number of elements in @p matches.
+ * @param      speed    Replay speed factor, e.g. 1.0 for the original timing or 10.0 to go ten
+ *     times faster. Use 0 to deliver all events immediately.
+ * @param[out] rreplay  A pointer to the variable that receives the replay object, it will stay
+ *     unchanged if the function fails.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value.
+ */
+int hs_replay_open(const char *path, const hs_match_spec *matches, unsigned int count,
+                   double speed, hs_replay **rreplay);
+/**
+ * @ingroup replay
+ * @brief Close a replay object and release the replayed devices.
+ *
+ * @param replay Replay object.
+ */
+void hs_replay_free(hs_replay *replay);
+
+/**
+ * @ingroup replay
+ * @brief Deliver the device events that are due.
+ *
+ * This works like hs_monitor_refresh(), use hs_device_get_status() to distinguish between
+ * added and removed events.
+ *
+ * @param replay Replay object.
+ * @param f      Callback to process each device event, or NULL.
+ * @param udata  Pointer to user-defined arbitrary data for the callback.
+ * @return This function returns 0 on success, or a negative @ref hs_error_code value. If the
+ *     callback returns a non-zero value, the refresh is interrupted and the value is returned.
+ */
+int hs_replay_refresh(hs_replay *replay, hs_enumerate_func *f, void *udata);
+/**
+ * @ingroup replay
+ * @brief Get the delay until the next event is due.
+ *
+ * @param replay Replay object.
+ * @return This function returns the delay in milliseconds, 0 if events are pending, or -1 if
+ *     all events have been delivered.
+ */
+int hs_replay_get_timeout(const hs_replay *replay);
+
+HS_END_C
+
+#endif
@@ -0,0 +1,36 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libhs
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _HS_REPLAY_PRIV_H
+#define _HS_REPLAY_PRIV_H
+
+#include "common_priv.h"
+#include "device.h"
+#include "replay.h"
+
+/* Event files start with _HS_REPLAY_HEADER, followed by one line per event:
+
+       <time> <add|remove> <type> <key> <location> <path> <vid> <pid> <bcd> <iface>
+           <usage page> <usage> <manufacturer> <product> <serial number>
+
+   The time is in milliseconds, any origin. Numbers other than the time are hexadecimal.
+   Strings are percent-encoded (spaces, control characters and '%'), and missing or empty
+   strings are written as "-". Lines starting with '#' are ignored. */
+
+#define _HS_REPLAY_HEADER "libhs-events 1"
+
+int _hs_replay_write_header(FILE *fp);
+int _hs_replay_write_event(FILE *fp, uint64_t time, const hs_device *dev);
+
+int _hs_replay_read_header(FILE *fp);
+// Returns 1 if an event was read, 0 at the end of the file
+int _hs_replay_read_event(FILE *fp, uint64_t *rtime, hs_device **rdev);
+
+#endif
@@ -137,6 +137,33 @@ typedef enum hs_serial_config_xonxoff {
     HS_SERIAL_CONFIG_XONXOFF_INOUT
 } hs_serial_config_xonxoff;
 
+/**
+ * @ingroup serial
+ * @brief Supported latency profiles.
+ *
+ * This controls the trade-off between reaction time and the number of wakeups needed to
+ * read a stream of data.
+ *
+ * @sa hs_serial_config
+ */
+typedef enum hs_serial_config_latency {
+    /** Leave this setting unchanged. */
+    HS_SERIAL_CONFIG_LATENCY_INVALID = 0,
+
+    /** Use the default OS settings, data is signaled as soon as it is available. This is
+     * the mode used when a device is opened. */
+    HS_SERIAL_CONFIG_LATENCY_DEFAULT,
+    /** Ask the driver to deliver data with as little delay as possible (ASYNC_LOW_LATENCY
+     * on Linux), at the cost of CPU time. Same as HS_SERIAL_CONFIG_LATENCY_DEFAULT on other
+     * platforms. */
+    HS_SERIAL_CONFIG_LATENCY_INTERACTIVE,
+    /** Coalesce incoming data and signal the device descriptor only once a sizeable
+     * chunk of data is available. On POSIX systems, small amounts of data may never be
+     * signaled: you need to poll with a timeout and call hs_serial_read() regularly to
+     * get them. */
+    HS_SERIAL_CONFIG_LATENCY_BULK
+} hs_serial_config_latency;
+
 /**
  * @ingroup serial
  * @brief Serial device configuration.
@@ -164,6 +191,9 @@ typedef struct hs_serial_config {
     hs_serial_config_dtr dtr;
     /** Serial XON/XOFF (software) flow control. */
     hs_serial_config_xonxoff xonxoff;
+
+    /** Latency profile, see @ref hs_serial_config_latency. */
+    hs_serial_config_latency latency;
 } hs_serial_config;
 
 /**
@@ -218,6 +248,9 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config);
  * Read up to @p size bytes from the serial device. If no data is available, the function
  * waits for up to @p timeout milliseconds. Use a negative value to wait indefinitely.
  *
+ * In @ref HS_SERIAL_CONFIG_LATENCY_BULK mode, the function may wait for a larger chunk
+ * of data to arrive, but any available data is returned once the timeout expires.
+ *
  * @param      port    Device handle.
  * @param[out] buf     Data buffer.
  * @param      size    Size of the buffer.
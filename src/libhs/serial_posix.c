@@ -13,10 +13,55 @@
 #include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
+#ifdef __linux__
+    #include <linux/serial.h>
+#endif
 #include "device_priv.h"
 #include "platform.h"
 #include "serial.h"
 
+// Maximum value for VMIN, c_cc members are unsigned chars
+#define BULK_MIN_BYTES 255
+
+#ifdef __linux__
+static int set_low_latency(hs_port *port, bool enable)
+{
+    struct serial_struct ss;
+    int r;
+
+    /* Many drivers (including cdc-acm on older kernels) do not implement these ioctls,
+       and ASYNC_LOW_LATENCY is only a hint anyway so ignore failures. */
+    r = ioctl(port->u.file.fd, TIOCGSERIAL, &ss);
+    if (r < 0)
+        return 0;
+
+    if (enable) {
+        ss.flags |= (int)ASYNC_LOW_LATENCY;
+    } else {
+        ss.flags &= ~(int)ASYNC_LOW_LATENCY;
+    }
+
+    r = ioctl(port->u.file.fd, TIOCSSERIAL, &ss);
+    if (r < 0 && errno != ENOTTY && errno != EINVAL && errno != EPERM)
+        return hs_error(HS_ERROR_SYSTEM, "Unable to change latency setting of '%s': %s",
+                        port->path, strerror(errno));
+
+    return 0;
+}
+
+static bool get_low_latency(hs_port *port)
+{
+    struct serial_struct ss;
+    int r;
+
+    r = ioctl(port->u.file.fd, TIOCGSERIAL, &ss);
+    if (r < 0)
+        return false;
+
+    return ss.flags & (int)ASYNC_LOW_LATENCY;
+}
+#endif
+
 int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
 {
     assert(port);
@@ -162,6 +207,26 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         }
     }
 
+    /* The port is non-blocking so read() ignores VMIN, but poll() only signals the descriptor
+       once VMIN bytes are available (when VTIME is 0). hs_serial_read() reads what is
+       available on timeout to take care of smaller amounts of data. */
+    switch (config->latency) {
+        case 0: {} break;
+        case HS_SERIAL_CONFIG_LATENCY_DEFAULT:
+        case HS_SERIAL_CONFIG_LATENCY_INTERACTIVE: {
+            tio.c_cc[VMIN] = 0;
+            tio.c_cc[VTIME] = 0;
+        } break;
+        case HS_SERIAL_CONFIG_LATENCY_BULK: {
+            tio.c_cc[VMIN] = BULK_MIN_BYTES;
+            tio.c_cc[VTIME] = 0;
+        } break;
+
+        default: {
+            return hs_error(HS_ERROR_SYSTEM, "Invalid latency setting: %d", config->latency);
+        } break;
+    }
+
     r = ioctl(port->u.file.fd, TIOCMSET, &modem_bits);
     if (r < 0)
         return hs_error(HS_ERROR_SYSTEM, "Unable to set modem bits of '%s': %s",
@@ -171,6 +236,14 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         return hs_error(HS_ERROR_SYSTEM, "Unable to change serial port settings of '%s': %s",
                         port->path, strerror(errno));
 
+#ifdef __linux__
+    if (config->latency) {
+        r = set_low_latency(port, config->latency == HS_SERIAL_CONFIG_LATENCY_INTERACTIVE);
+        if (r < 0)
+            return r;
+    }
+#endif
+
     return 0;
 }
 
@@ -266,6 +339,16 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
         case IXOFF | IXON: { config->xonxoff = HS_SERIAL_CONFIG_XONXOFF_INOUT; } break;
     }
 
+    if (tio.c_cc[VMIN] > 1 && !tio.c_cc[VTIME]) {
+        config->latency = HS_SERIAL_CONFIG_LATENCY_BULK;
+#ifdef __linux__
+    } else if (get_low_latency(port)) {
+        config->latency = HS_SERIAL_CONFIG_LATENCY_INTERACTIVE;
+#endif
+    } else {
+        config->latency = HS_SERIAL_CONFIG_LATENCY_DEFAULT;
+    }
+
     return 0;
 }
 
@@ -296,8 +379,8 @@ restart:
             return hs_error(HS_ERROR_IO, "I/O error while reading from '%s': %s", port->path,
                             strerror(errno));
         }
-        if (!r)
-            return 0;
+        /* Don't return yet on timeout, in bulk mode poll() does not signal the descriptor
+           until enough data is available. Just read what we have, if anything. */
     }
 
     r = read(port->u.file.fd, buf, size);
@@ -15,6 +15,9 @@
 #include "platform.h"
 #include "serial.h"
 
+// Time in milliseconds the driver waits for more bytes before completing bulk reads
+#define BULK_INTERVAL_TIMEOUT 10
+
 int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
 {
     assert(port);
@@ -179,6 +182,42 @@ int hs_serial_set_config(hs_port *port, const hs_serial_config *config)
         return hs_error(HS_ERROR_SYSTEM, "SetCommState() failed on '%s': %s",
                         port->dev->path, hs_win32_strerror(0));
 
+    /* There is no low-latency knob on Windows. For bulk mode, let the driver fill our read
+       buffer until the line goes quiet for a few milliseconds. The change applies to the next
+       asynchronous read request. */
+    if (config->latency) {
+        COMMTIMEOUTS timeouts;
+
+        success = GetCommTimeouts(port->u.handle.h, &timeouts);
+        if (!success)
+            return hs_error(HS_ERROR_SYSTEM, "GetCommTimeouts() failed on '%s': %s",
+                            port->dev->path, hs_win32_strerror(0));
+
+        switch (config->latency) {
+            case HS_SERIAL_CONFIG_LATENCY_DEFAULT:
+            case HS_SERIAL_CONFIG_LATENCY_INTERACTIVE: {
+                // See _hs_open_file_port() in device_win32.c
+                timeouts.ReadIntervalTimeout = ULONG_MAX;
+                timeouts.ReadTotalTimeoutMultiplier = ULONG_MAX;
+                timeouts.ReadTotalTimeoutConstant = ULONG_MAX - 1;
+            } break;
+            case HS_SERIAL_CONFIG_LATENCY_BULK: {
+                timeouts.ReadIntervalTimeout = BULK_INTERVAL_TIMEOUT;
+                timeouts.ReadTotalTimeoutMultiplier = 0;
+                timeouts.ReadTotalTimeoutConstant = 0;
+            } break;
+
+            default: {
+                return hs_error(HS_ERROR_SYSTEM, "Invalid latency setting: %d", config->latency);
+            } break;
+        }
+
+        success = SetCommTimeouts(port->u.handle.h, &timeouts);
+        if (!success)
+            return hs_error(HS_ERROR_SYSTEM, "SetCommTimeouts() failed on '%s': %s",
+                            port->dev->path, hs_win32_strerror(0));
+    }
+
     return 0;
 }
 
@@ -242,6 +281,21 @@ int hs_serial_get_config(hs_port *port, hs_serial_config *config)
         config->xonxoff = HS_SERIAL_CONFIG_XONXOFF_OFF;
     }
 
+    {
+        COMMTIMEOUTS timeouts;
+
+        success = GetCommTimeouts(port->u.handle.h, &timeouts);
+        if (!success)
+            return hs_error(HS_ERROR_SYSTEM, "GetCommTimeouts() failed on '%s': %s",
+                            port->dev->path, hs_win32_strerror(0));
+
+        if (timeouts.ReadIntervalTimeout == ULONG_MAX) {
+            config->latency = HS_SERIAL_CONFIG_LATENCY_DEFAULT;
+        } else {
+            config->latency = HS_SERIAL_CONFIG_LATENCY_BULK;
+        }
+    }
+
     return 0;
 }
 
@@ -0,0 +1,322 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libhs
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "sysfs_priv.h"
+
+const _hs_sysfs_root _hs_sysfs_default_root = {"/sys", "/dev"};
+
+const char *_hs_uevent_get(const char *buf, size_t len, const char *key)
+{
+    size_t key_len = strlen(key);
+
+    for (const char *end = buf + len; buf < end; buf += strlen(buf) + 1) {
+        if (strncmp(buf, key, key_len) == 0 && buf[key_len] == '=')
+            return buf + key_len + 1;
+    }
+
+    return NULL;
+}
+
+/* Kernel messages start with "action@devpath", followed by KEY=value fields. Each part is
+   NUL-terminated, and so must be the buffer. Messages sent by udev start with "libudev"
+   and a binary header, we ignore them. */
+bool _hs_uevent_parse(const char *buf, size_t len, _hs_uevent *ruevent)
+{
+    const char *seqnum;
+
+    if (!len || buf[len - 1] || !strchr(buf, '@'))
+        return false;
+
+    memset(ruevent, 0, sizeof(*ruevent));
+    ruevent->action = _hs_uevent_get(buf, len, "ACTION");
+    ruevent->devpath = _hs_uevent_get(buf, len, "DEVPATH");
+    ruevent->subsystem = _hs_uevent_get(buf, len, "SUBSYSTEM");
+    ruevent->devname = _hs_uevent_get(buf, len, "DEVNAME");
+    if (!ruevent->action || !ruevent->devpath || !ruevent->subsystem)
+        return false;
+
+    seqnum = _hs_uevent_get(buf, len, "SEQNUM");
+    if (seqnum)
+        ruevent->seqnum = strtoull(seqnum, NULL, 10);
+
+    return true;
+}
+
+// Returns the length of the value (without the trailing newline), or -1
+static ssize_t read_attribute(const _hs_sysfs_root *root, const char *devpath, size_t devpath_len,
+                              const char *name, char *buf, size_t size)
+{
+    char path[_HS_SYSFS_PATH_SIZE];
+    int fd;
+    ssize_t len;
+
+    if ((size_t)snprintf(path, sizeof(path), "%s%.*s/%s", root->sys_dir, (int)devpath_len,
+                         devpath, name) >= sizeof(path))
+        return -1;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    len = read(fd, buf, size - 1);
+    close(fd);
+    if (len < 0)
+        return -1;
+
+    while (len && buf[len - 1] == '\n')
+        len--;
+    buf[len] = 0;
+
+    return len;
+}
+
+// The uevent file uses newlines instead of NUL characters between fields
+static ssize_t read_uevent_file(const _hs_sysfs_root *root, const char *devpath,
+                                size_t devpath_len, char *buf, size_t size)
+{
+    ssize_t len;
+
+    len = read_attribute(root, devpath, devpath_len, "uevent", buf, size);
+    if (len < 0)
+        return -1;
+    for (ssize_t i = 0; i < len; i++) {
+        if (buf[i] == '\n')
+            buf[i] = 0;
+    }
+
+    return len + 1;
+}
+
+static bool read_hex_attribute(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                               const char *name, uint16_t *rvalue)
+{
+    char buf[32];
+    char *end;
+    unsigned long value;
+
+    if (read_attribute(root, sysdev->devpath, sysdev->usb_len, name, buf, sizeof(buf)) <= 0)
+        return false;
+
+    errno = 0;
+    value = strtoul(buf, &end, 16);
+    if (errno || *end || value > 0xFFFF)
+        return false;
+
+    *rvalue = (uint16_t)value;
+    return true;
+}
+
+// Walk up the tree, the parents are prefixes of the devpath
+static bool find_usb_parents(const _hs_sysfs_root *root, _hs_sysfs_device *sysdev)
+{
+    char buf[1024];
+    size_t len;
+
+    // Most tty devices are not USB devices, skip them without touching the filesystem
+    if (!strstr(sysdev->devpath, "/usb"))
+        return false;
+
+    len = strlen(sysdev->devpath);
+    sysdev->usb_len = 0;
+    sysdev->iface_len = 0;
+    while (len) {
+        ssize_t uevent_len;
+        const char *devtype;
+
+        while (len && sysdev->devpath[--len] != '/')
+            continue;
+        if (!len)
+            break;
+
+        uevent_len = read_uevent_file(root, sysdev->devpath, len, buf, sizeof(buf));
+        if (uevent_len < 0)
+            continue;
+        devtype = _hs_uevent_get(buf, (size_t)uevent_len, "DEVTYPE");
+        if (!devtype)
+            continue;
+
+        if (strcmp(devtype, "usb_interface") == 0) {
+            if (!sysdev->iface_len)
+                sysdev->iface_len = len;
+        } else if (strcmp(devtype, "usb_device") == 0) {
+            sysdev->usb_len = len;
+            break;
+        }
+    }
+
+    return sysdev->usb_len && sysdev->iface_len > sysdev->usb_len;
+}
+
+static int compute_location(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                            char **rlocation)
+{
+    char busnum[16], devpath[256];
+    char *location;
+    int r;
+
+    if (read_attribute(root, sysdev->devpath, sysdev->usb_len, "busnum", busnum,
+                       sizeof(busnum)) <= 0)
+        return 0;
+    if (read_attribute(root, sysdev->devpath, sysdev->usb_len, "devpath", devpath,
+                       sizeof(devpath)) <= 0)
+        return 0;
+
+    r = _hs_asprintf(&location, "usb-%s-%s", busnum, devpath);
+    if (r < 0)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    for (char *ptr = location; *ptr; ptr++) {
+        if (*ptr == '.')
+            *ptr = '-';
+    }
+
+    *rlocation = location;
+    return 1;
+}
+
+/* Same as the udev code in monitor_linux.c: fills the fields needed for matching, and
+   returns 0 if the device is not a USB device (or has no node in dev_dir). */
+int _hs_sysfs_read_device(const _hs_sysfs_root *root, const char *devpath, hs_device_type type,
+                          _hs_sysfs_device *rsysdev, hs_device *dev)
+{
+    char buf[1024];
+    ssize_t uevent_len;
+    const char *devname;
+    char path[_HS_SYSFS_PATH_SIZE];
+    int r;
+
+    if (strlen(devpath) >= sizeof(rsysdev->devpath))
+        return 0;
+    strcpy(rsysdev->devpath, devpath);
+
+    if (!find_usb_parents(root, rsysdev))
+        return 0;
+
+    uevent_len = read_uevent_file(root, devpath, strlen(devpath), buf, sizeof(buf));
+    if (uevent_len < 0)
+        return 0;
+    devname = _hs_uevent_get(buf, (size_t)uevent_len, "DEVNAME");
+    if (!devname)
+        return 0;
+    if ((size_t)snprintf(path, sizeof(path), "%s/%s", root->dev_dir, devname) >= sizeof(path))
+        return 0;
+    if (access(path, F_OK) != 0)
+        return 0;
+
+    dev->type = type;
+    dev->path = strdup(path);
+    if (!dev->path)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+    dev->key = strdup(devpath);
+    if (!dev->key)
+        return hs_error(HS_ERROR_MEMORY, NULL);
+
+    r = compute_location(root, rsysdev, &dev->location);
+    if (r <= 0)
+        return r;
+
+    if (!read_hex_attribute(root, rsysdev, "idVendor", &dev->vid) ||
+            !read_hex_attribute(root, rsysdev, "idProduct", &dev->pid) ||
+            !read_hex_attribute(root, rsysdev, "bcdDevice", &dev->bcd_device))
+        return 0;
+
+    dev->iface_number = (uint8_t)strtoul(rsysdev->devpath + rsysdev->iface_len - 1, NULL, 10);
+
+    return 1;
+}
+
+int _hs_sysfs_read_strings(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                           hs_device *dev)
+{
+    static const char *const names[] = {"manufacturer", "product", "serial"};
+    char **strings[] = {&dev->manufacturer_string, &dev->product_string,
+                        &dev->serial_number_string};
+
+    for (size_t i = 0; i < _HS_COUNTOF(names); i++) {
+        char buf[256];
+
+        if (read_attribute(root, sysdev->devpath, sysdev->usb_len, names[i], buf,
+                           sizeof(buf)) < 0)
+            continue;
+
+        *strings[i] = strdup(buf);
+        if (!*strings[i])
+            return hs_error(HS_ERROR_MEMORY, NULL);
+    }
+
+    return 0;
+}
+
+// hidraw nodes live in <hid device>/hidraw/hidrawX, the report descriptor is over there
+bool _hs_sysfs_get_hid_path(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                            char *rpath, size_t size)
+{
+    size_t len = strlen(sysdev->devpath);
+
+    for (unsigned int i = 0; i < 2; i++) {
+        while (len && sysdev->devpath[--len] != '/')
+            continue;
+    }
+    if (len <= sysdev->iface_len)
+        return false;
+
+    return (size_t)snprintf(rpath, size, "%s%.*s", root->sys_dir, (int)len,
+                            sysdev->devpath) < size;
+}
+
+int _hs_sysfs_list(const _hs_sysfs_root *root, const char *subsystem,
+                   int (*f)(const char *devpath, void *udata), void *udata)
+{
+    char sys_dir[_HS_SYSFS_PATH_SIZE];
+    size_t sys_dir_len;
+    char class_dir[_HS_SYSFS_PATH_SIZE];
+    DIR *dp;
+    struct dirent *ent;
+    int r;
+
+    if (!realpath(root->sys_dir, sys_dir))
+        return hs_error(HS_ERROR_SYSTEM, "Cannot resolve '%s': %s", root->sys_dir, strerror(errno));
+    sys_dir_len = strlen(sys_dir);
+
+    snprintf(class_dir, sizeof(class_dir), "%s/class/%s", root->sys_dir, subsystem);
+    dp = opendir(class_dir);
+    if (!dp) {
+        // The hidraw class does not exist until the module is loaded
+        if (errno == ENOENT)
+            return 0;
+        return hs_error(HS_ERROR_SYSTEM, "opendir('%s') failed: %s", class_dir, strerror(errno));
+    }
+
+    r = 0;
+    while ((ent = readdir(dp))) {
+        char link[_HS_SYSFS_PATH_SIZE];
+        char target[_HS_SYSFS_PATH_SIZE];
+
+        if (ent->d_name[0] == '.')
+            continue;
+
+        if ((size_t)snprintf(link, sizeof(link), "%s/%s", class_dir, ent->d_name) >= sizeof(link))
+            continue;
+        if (!realpath(link, target))
+            continue;
+        if (strncmp(target, sys_dir, sys_dir_len) != 0 || target[sys_dir_len] != '/')
+            continue;
+
+        r = (*f)(target + sys_dir_len, udata);
+        if (r)
+            break;
+    }
+
+    closedir(dp);
+    return r;
+}
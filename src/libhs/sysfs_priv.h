@@ -0,0 +1,60 @@
+/* libhs - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/libhs
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _HS_SYSFS_PRIV_H
+#define _HS_SYSFS_PRIV_H
+
+#include "common_priv.h"
+#include "device.h"
+
+/* Direct access to sysfs and kernel uevents, for systems without udev (e.g. containers).
+   Nothing here allocates memory, except for the strings stored in hs_device. */
+
+#define _HS_SYSFS_PATH_SIZE 4096
+
+// Tests point these to fixtures, libhs uses _hs_sysfs_default_root
+typedef struct _hs_sysfs_root {
+    const char *sys_dir;
+    const char *dev_dir;
+} _hs_sysfs_root;
+
+extern const _hs_sysfs_root _hs_sysfs_default_root;
+
+// Fields point into the message buffer, missing ones are NULL
+typedef struct _hs_uevent {
+    const char *action;
+    const char *devpath;
+    const char *subsystem;
+    const char *devname;
+    uint64_t seqnum;
+} _hs_uevent;
+
+/* The USB parents of a device are ancestors in the sysfs tree, so we only need to keep
+   the length of their devpath. */
+typedef struct _hs_sysfs_device {
+    char devpath[_HS_SYSFS_PATH_SIZE];
+    size_t usb_len;
+    size_t iface_len;
+} _hs_sysfs_device;
+
+const char *_hs_uevent_get(const char *buf, size_t len, const char *key);
+bool _hs_uevent_parse(const char *buf, size_t len, _hs_uevent *ruevent);
+
+int _hs_sysfs_list(const _hs_sysfs_root *root, const char *subsystem,
+                   int (*f)(const char *devpath, void *udata), void *udata);
+
+int _hs_sysfs_read_device(const _hs_sysfs_root *root, const char *devpath, hs_device_type type,
+                          _hs_sysfs_device *rsysdev, hs_device *dev);
+int _hs_sysfs_read_strings(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                           hs_device *dev);
+bool _hs_sysfs_get_hid_path(const _hs_sysfs_root *root, const _hs_sysfs_device *sysdev,
+                            char *rpath, size_t size);
+
+#endif
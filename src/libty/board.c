@@ -17,6 +17,7 @@
 #include "class_priv.h"
 #include "firmware.h"
 #include "monitor.h"
+#include "monitor_priv.h"
 #include "system.h"
 #include "task.h"
 #include "timer.h"
@@ -65,6 +66,7 @@ void ty_board_unref(ty_board *board)
         free(board->description);
 
         ty_mutex_release(&board->ifaces_lock);
+        ty_cond_release(&board->monitor_cond);
 
         for (size_t i = 0; i < board->ifaces.count; i++) {
             ty_board_interface *iface = board->ifaces.values[i];
@@ -162,19 +164,23 @@ int ty_board_set_tag(ty_board *board, const char *tag)
 {
     assert(board);
 
-    char *new_tag;
+    ty_monitor *monitor = board->monitor;
+    char *new_tag = NULL;
 
     if (tag) {
         new_tag = strdup(tag);
         if (!new_tag)
             return ty_error(TY_ERROR_MEMORY, NULL);
-    } else {
-        new_tag = board->id;
     }
 
+    // The hotplug thread may be updating the board identifier
+    _ty_monitor_lock_boards(monitor);
+    if (!tag)
+        new_tag = board->id;
     if (board->tag != board->id)
         free(board->tag);
     board->tag = new_tag;
+    _ty_monitor_unlock_boards(monitor);
 
     return 0;
 }
@@ -307,7 +313,7 @@ int ty_board_wait_for(ty_board *board, ty_board_capability capability, int timeo
     ctx.board = board;
     ctx.capability = capability;
 
-    return ty_monitor_wait(monitor, wait_for_callback, &ctx, timeout);
+    return _ty_monitor_wait_board(monitor, board, wait_for_callback, &ctx, timeout);
 }
 
 ssize_t ty_board_serial_read(ty_board *board, char *buf, size_t size, int timeout)
@@ -496,6 +502,29 @@ uint8_t ty_board_interface_get_interface_number(const ty_board_interface *iface)
     return iface->dev->iface_number;
 }
 
+bool ty_board_interface_is_uart_bridge(const ty_board_interface *iface)
+{
+    /* USB-serial bridges forward the data to a real UART at the configured baudrate.
+       Native USB CDC devices (such as Teensy boards) ignore it, and we cannot tell the
+       difference from the device type alone, so stick to well-known bridge vendors. */
+    static const uint16_t bridge_vids[] = {
+        0x0403, // FTDI
+        0x067B, // Prolific
+        0x10C4, // Silicon Labs
+        0x1A86  // WCH (CH340 and friends)
+    };
+
+    assert(iface);
+
+    if (iface->dev->type != HS_DEVICE_TYPE_SERIAL)
+        return false;
+    for (size_t i = 0; i < TY_COUNTOF(bridge_vids); i++) {
+        if (iface->dev->vid == bridge_vids[i])
+            return true;
+    }
+    return false;
+}
+
 hs_device *ty_board_interface_get_device(const ty_board_interface *iface)
 {
     assert(iface);
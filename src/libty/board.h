@@ -106,6 +106,7 @@ int ty_board_interface_get_capabilities(const ty_board_interface *iface);
 
 uint8_t ty_board_interface_get_interface_number(const ty_board_interface *iface);
 const char *ty_board_interface_get_path(const ty_board_interface *iface);
+bool ty_board_interface_is_uart_bridge(const ty_board_interface *iface);
 
 struct hs_device *ty_board_interface_get_device(const ty_board_interface *iface);
 struct hs_port *ty_board_interface_get_handle(const ty_board_interface *iface);
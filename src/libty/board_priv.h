@@ -19,6 +19,7 @@
 #include "../libhs/htable.h"
 #include "task.h"
 #include "thread.h"
+#include "timer.h"
 
 TY_C_BEGIN
 
@@ -43,9 +44,17 @@ struct ty_board {
     unsigned int refcount;
 
     struct ty_monitor *monitor;
+    size_t monitor_idx;
+    _hs_htable_head monitor_location_hnode;
+    _hs_htable_head monitor_serial_hnode;
+    ty_timer_queue_node monitor_drop_node;
+    // Worker threads in _ty_monitor_wait_board(), protected by the monitor refresh mutex
+    ty_cond monitor_cond;
+    unsigned int monitor_waiters;
+    // Position of the board in the pending batch plus one, 0 if not there (owner thread)
+    size_t monitor_batch_idx;
 
     ty_board_status status;
-    uint64_t missing_since;
 
     ty_model model;
     char *id;
@@ -14,6 +14,7 @@
 #include "board.h"
 #include "board_priv.h"
 #include "class_priv.h"
+#include "monitor_priv.h"
 #include "system.h"
 
 extern const struct _ty_class_vtable _ty_generic_class_vtable;
@@ -110,18 +111,19 @@ static int generic_update_board(ty_board_interface *iface, ty_board *board, bool
 
     // Everything is alright, we can commit changes
     if (serial_number) {
-        free(board->serial_number);
+        _ty_monitor_release_board_string(board->monitor, board->serial_number);
         board->serial_number = serial_number;
     }
     if (unique)
         iface->capabilities |= 1 << TY_BOARD_CAPABILITY_UNIQUE;
     if (description) {
-        free(board->description);
+        _ty_monitor_release_board_string(board->monitor, board->description);
         board->description = description;
     }
     if (!board->id) {
-        free(board->id);
         board->id = id;
+    } else {
+        free(id);
     }
 
     return 1;
@@ -16,6 +16,7 @@
 #include "board_priv.h"
 #include "class_priv.h"
 #include "firmware.h"
+#include "monitor_priv.h"
 #include "system.h"
 
 #define SEREMU_TX_SIZE 32
@@ -264,15 +265,15 @@ static int teensy_update_board(ty_board_interface *iface, ty_board *board, bool
     if (model)
         board->model = model;
     if (serial_number) {
-        free(board->serial_number);
+        _ty_monitor_release_board_string(board->monitor, board->serial_number);
         board->serial_number = serial_number;
     }
     if (description) {
-        free(board->description);
+        _ty_monitor_release_board_string(board->monitor, board->description);
         board->description = description;
     }
     if (id) {
-        free(board->id);
+        _ty_monitor_release_board_string(board->monitor, board->id);
         board->id = id;
     }
 
@@ -15,6 +15,7 @@
 #endif
 #include <stdarg.h>
 #include "../libhs/common.h"
+#include "../libhs/monitor.h"
 #include "system.h"
 #include "version.h"
 #include "task.h"
@@ -294,6 +295,16 @@ void ty_libhs_log_handler(hs_log_level level, int err, const char *log, void *ud
     ty_message(&msg);
 }
 
+// Shared by all TyTools programs, this saves a few syscalls for each HID device
+void ty_libhs_enable_cache(void)
+{
+    char path[1][TY_PATH_MAX_SIZE];
+
+    if (!ty_standard_get_paths(TY_PATH_CACHE_DIRECTORY, "TyTools/devices.cache", path, 1))
+        return;
+    hs_monitor_set_cache_path(path[0]);
+}
+
 void _ty_refcount_increase(unsigned int *rrefcount)
 {
 #ifdef _MSC_VER
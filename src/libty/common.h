@@ -172,6 +172,7 @@ void ty_progress(const char *action, uint64_t value, uint64_t max);
 
 int ty_libhs_translate_error(int err);
 void ty_libhs_log_handler(hs_log_level level, int err, const char *log, void *udata);
+void ty_libhs_enable_cache(void);
 
 TY_C_END
 
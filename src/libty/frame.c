@@ -0,0 +1,287 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "frame.h"
+
+#define SLIP_END 0xC0
+#define SLIP_ESC 0xDB
+#define SLIP_ESC_END 0xDC
+#define SLIP_ESC_ESC 0xDD
+
+static const uint16_t crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+
+static const uint32_t crc32_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+static size_t get_check_size(ty_frame_check check)
+{
+    switch (check) {
+        case TY_FRAME_CHECK_NONE: { return 0; } break;
+        case TY_FRAME_CHECK_CRC16: { return 2; } break;
+        case TY_FRAME_CHECK_CRC32: { return 4; } break;
+    }
+
+    assert(false);
+    return 0;
+}
+
+int ty_frame_decoder_init(ty_frame_decoder *decoder, ty_frame_encoding encoding,
+                          ty_frame_check check, size_t max_size)
+{
+    assert(decoder);
+    assert(encoding == TY_FRAME_ENCODING_COBS || encoding == TY_FRAME_ENCODING_SLIP);
+    assert(max_size);
+
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->encoding = encoding;
+    decoder->check = check;
+
+    decoder->size = max_size + get_check_size(check);
+    decoder->buf = (uint8_t *)malloc(decoder->size);
+    if (!decoder->buf)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    return 0;
+}
+
+void ty_frame_decoder_release(ty_frame_decoder *decoder)
+{
+    if (decoder) {
+        free(decoder->buf);
+        memset(decoder, 0, sizeof(*decoder));
+    }
+}
+
+static void reset_frame(ty_frame_decoder *decoder)
+{
+    decoder->len = 0;
+    decoder->invalid = false;
+    decoder->cobs_code = 0;
+    decoder->cobs_left = 0;
+    decoder->slip_escape = false;
+}
+
+void ty_frame_decoder_reset(ty_frame_decoder *decoder)
+{
+    assert(decoder);
+    reset_frame(decoder);
+}
+
+static inline void append_byte(ty_frame_decoder *decoder, uint8_t byte)
+{
+    if (decoder->len < decoder->size) {
+        decoder->buf[decoder->len++] = byte;
+    } else {
+        decoder->invalid = true;
+    }
+}
+
+static bool verify_check(ty_frame_decoder *decoder, size_t *rlen)
+{
+    size_t check_size = get_check_size(decoder->check);
+    size_t len;
+
+    if (decoder->len <= check_size)
+        return false;
+    len = decoder->len - check_size;
+
+    switch (decoder->check) {
+        case TY_FRAME_CHECK_NONE: {} break;
+
+        case TY_FRAME_CHECK_CRC16: {
+            uint16_t crc = (uint16_t)(decoder->buf[len] | (decoder->buf[len + 1] << 8));
+            if (ty_crc16(decoder->buf, len) != crc)
+                return false;
+        } break;
+
+        case TY_FRAME_CHECK_CRC32: {
+            uint32_t crc = (uint32_t)decoder->buf[len] | ((uint32_t)decoder->buf[len + 1] << 8) |
+                           ((uint32_t)decoder->buf[len + 2] << 16) |
+                           ((uint32_t)decoder->buf[len + 3] << 24);
+            if (ty_crc32(decoder->buf, len) != crc)
+                return false;
+        } break;
+    }
+
+    *rlen = len;
+    return true;
+}
+
+static int finish_frame(ty_frame_decoder *decoder, ty_frame_decoder_func *f, void *udata)
+{
+    size_t len;
+    int r;
+
+    // Empty frames (such as COBS "01 00") carry nothing, not even check bytes
+    if (!decoder->len && !decoder->invalid) {
+        reset_frame(decoder);
+        return 0;
+    }
+
+    if (decoder->invalid || !verify_check(decoder, &len)) {
+        decoder->invalid_count++;
+        reset_frame(decoder);
+        return 0;
+    }
+
+    decoder->valid_count++;
+    r = (*f)(decoder->buf, len, udata);
+    reset_frame(decoder);
+
+    return r;
+}
+
+static int process_cobs(ty_frame_decoder *decoder, const uint8_t *buf, size_t len,
+                        ty_frame_decoder_func *f, void *udata)
+{
+    int r;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = buf[i];
+
+        if (!byte) {
+            // Ignore empty frames, they are commonly used to resynchronize the stream
+            if (!decoder->cobs_code) {
+                reset_frame(decoder);
+                continue;
+            }
+
+            // The last block must be complete or the frame was truncated
+            if (decoder->cobs_left)
+                decoder->invalid = true;
+            r = finish_frame(decoder, f, udata);
+            if (r)
+                return r;
+        } else if (!decoder->cobs_left) {
+            // Each block but the last (and those of maximum length) implies a zero byte
+            if (decoder->cobs_code && decoder->cobs_code < 0xFF)
+                append_byte(decoder, 0);
+            decoder->cobs_code = byte;
+            decoder->cobs_left = (uint8_t)(byte - 1);
+        } else {
+            append_byte(decoder, byte);
+            decoder->cobs_left--;
+        }
+    }
+
+    return 0;
+}
+
+static int process_slip(ty_frame_decoder *decoder, const uint8_t *buf, size_t len,
+                        ty_frame_decoder_func *f, void *udata)
+{
+    int r;
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = buf[i];
+
+        if (byte == SLIP_END) {
+            if (!decoder->len && !decoder->invalid && !decoder->slip_escape)
+                continue;
+
+            if (decoder->slip_escape)
+                decoder->invalid = true;
+            r = finish_frame(decoder, f, udata);
+            if (r)
+                return r;
+        } else if (decoder->slip_escape) {
+            if (byte == SLIP_ESC_END) {
+                append_byte(decoder, SLIP_END);
+            } else if (byte == SLIP_ESC_ESC) {
+                append_byte(decoder, SLIP_ESC);
+            } else {
+                decoder->invalid = true;
+            }
+            decoder->slip_escape = false;
+        } else if (byte == SLIP_ESC) {
+            decoder->slip_escape = true;
+        } else {
+            append_byte(decoder, byte);
+        }
+    }
+
+    return 0;
+}
+
+/* Bytes following a frame for which f returned a non-zero value are dropped, and the
+   value is returned. Partial frames are kept until the next call. */
+int ty_frame_decoder_process(ty_frame_decoder *decoder, const void *buf, size_t len,
+                             ty_frame_decoder_func *f, void *udata)
+{
+    assert(decoder);
+    assert(decoder->buf);
+    assert(buf || !len);
+    assert(f);
+
+    switch (decoder->encoding) {
+        case TY_FRAME_ENCODING_NONE: {} break;
+        case TY_FRAME_ENCODING_COBS: { return process_cobs(decoder, (const uint8_t *)buf, len, f, udata); } break;
+        case TY_FRAME_ENCODING_SLIP: { return process_slip(decoder, (const uint8_t *)buf, len, f, udata); } break;
+    }
+
+    assert(false);
+    return 0;
+}
+
+const char *ty_frame_encoding_get_name(ty_frame_encoding encoding)
+{
+    switch (encoding) {
+        case TY_FRAME_ENCODING_NONE: { return "none"; } break;
+        case TY_FRAME_ENCODING_COBS: { return "cobs"; } break;
+        case TY_FRAME_ENCODING_SLIP: { return "slip"; } break;
+    }
+
+    assert(false);
+    return NULL;
+}
+
+const char *ty_frame_check_get_name(ty_frame_check check)
+{
+    switch (check) {
+        case TY_FRAME_CHECK_NONE: { return "none"; } break;
+        case TY_FRAME_CHECK_CRC16: { return "crc16"; } break;
+        case TY_FRAME_CHECK_CRC32: { return "crc32"; } break;
+    }
+
+    assert(false);
+    return NULL;
+}
+
+uint16_t ty_crc16(const void *buf, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)buf;
+    uint16_t crc = 0xFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc = (uint16_t)((crc << 4) ^ crc16_table[((crc >> 12) ^ (bytes[i] >> 4)) & 0xF]);
+        crc = (uint16_t)((crc << 4) ^ crc16_table[((crc >> 12) ^ bytes[i]) & 0xF]);
+    }
+
+    return crc;
+}
+
+uint32_t ty_crc32(const void *buf, size_t len)
+{
+    const uint8_t *bytes = (const uint8_t *)buf;
+    uint32_t crc = 0xFFFFFFFF;
+
+    for (size_t i = 0; i < len; i++) {
+        crc = (crc >> 4) ^ crc32_table[(crc ^ bytes[i]) & 0xF];
+        crc = (crc >> 4) ^ crc32_table[(crc ^ (uint32_t)(bytes[i] >> 4)) & 0xF];
+    }
+
+    return ~crc;
+}
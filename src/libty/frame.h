@@ -0,0 +1,66 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_FRAME_H
+#define TY_FRAME_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+typedef enum ty_frame_encoding {
+    TY_FRAME_ENCODING_NONE,
+    TY_FRAME_ENCODING_COBS,
+    TY_FRAME_ENCODING_SLIP
+} ty_frame_encoding;
+
+// CRCs are appended to the payload, least significant byte first
+typedef enum ty_frame_check {
+    TY_FRAME_CHECK_NONE,
+    TY_FRAME_CHECK_CRC16, // CRC-16/CCITT-FALSE
+    TY_FRAME_CHECK_CRC32 // CRC-32 (same as zlib)
+} ty_frame_check;
+
+typedef struct ty_frame_decoder {
+    ty_frame_encoding encoding;
+    ty_frame_check check;
+
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool invalid;
+
+    uint8_t cobs_code;
+    uint8_t cobs_left;
+    bool slip_escape;
+
+    uint64_t valid_count;
+    uint64_t invalid_count;
+} ty_frame_decoder;
+
+typedef int ty_frame_decoder_func(const uint8_t *frame, size_t len, void *udata);
+
+int ty_frame_decoder_init(ty_frame_decoder *decoder, ty_frame_encoding encoding,
+                          ty_frame_check check, size_t max_size);
+void ty_frame_decoder_release(ty_frame_decoder *decoder);
+
+void ty_frame_decoder_reset(ty_frame_decoder *decoder);
+int ty_frame_decoder_process(ty_frame_decoder *decoder, const void *buf, size_t len,
+                             ty_frame_decoder_func *f, void *udata);
+
+const char *ty_frame_encoding_get_name(ty_frame_encoding encoding);
+const char *ty_frame_check_get_name(ty_frame_check check);
+
+uint16_t ty_crc16(const void *buf, size_t len);
+uint32_t ty_crc32(const void *buf, size_t len);
+
+TY_C_END
+
+#endif
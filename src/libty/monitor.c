@@ -12,62 +12,179 @@
 #include "../libhs/device.h"
 #include "../libhs/array.h"
 #include "../libhs/monitor.h"
+#include "../libhs/replay.h"
 #include "board_priv.h"
 #include "class_priv.h"
 #include "monitor.h"
+#include "monitor_priv.h"
 #include "system.h"
 #include "timer.h"
 
 struct callback {
     int id;
+    // Only one of them is set
     ty_monitor_callback_func *f;
+    ty_monitor_batch_func *batch_f;
     void *udata;
 };
 
+// Queued by the hotplug thread for the owner thread, which holds a board reference
+struct pending_event {
+    ty_board *board;
+    ty_monitor_event event;
+};
+
 struct ty_monitor {
     int drop_delay;
 
     bool started;
     hs_monitor *device_monitor;
     ty_timer *timer;
-    bool timer_running;
+
+    // Missing boards by drop deadline, the timer is armed for the first one
+    ty_timer_queue drop_queue;
+    uint64_t drop_deadline;
+
+    // When set, devices come from the recorded events instead of device_monitor
+    hs_replay *replay;
+    ty_timer *replay_timer;
+
+    /* In threaded mode, the hotplug thread processes device events and drops boards while
+       holding refresh_mutex, which protects the board registry. Callbacks are queued in
+       pending_events, and notify_timer wakes up the owner thread to run them with the lock
+       held (callbacks_locked), so boards don't change under them. Don't wait in them. */
+    bool threaded;
+    bool thread_running;
+    bool callbacks_locked;
+    ty_thread hotplug_thread;
+    ty_timer *stop_timer;
+    ty_timer *notify_timer;
+    _HS_ARRAY(struct pending_event) pending_events;
+    _HS_ARRAY(char *) released_strings;
+    int thread_ret;
 
     _HS_ARRAY(struct callback) callbacks;
     int current_callback_id;
 
+    /* Changes for batch callbacks, one per board (see board->monitor_batch_idx) with a
+       reference, delivered at the end of each refresh. Only used when batch_callbacks > 0. */
+    unsigned int batch_callbacks;
+    _HS_ARRAY(ty_monitor_change) batch_changes;
+
+    /* Worker threads wait on refresh_cond in ty_monitor_wait(), or on the board condition
+       in _ty_monitor_wait_board(). Waiter counts and stats are protected by refresh_mutex. */
     ty_mutex refresh_mutex;
     ty_cond refresh_cond;
+    unsigned int refresh_waiters;
+    _ty_monitor_wait_stats wait_stats;
     int refresh_callback_ret;
 
+    /* Dropped boards leave a hole (NULL) in the array until it gets compacted, so removal
+       is O(1) and the boards are always listed in the order they appeared. */
     _HS_ARRAY(ty_board *) boards;
+    size_t boards_holes;
+    _hs_htable boards_by_location;
+    _hs_htable boards_by_serial;
     _hs_htable ifaces;
 
     ty_thread_id main_thread_id;
+
+    // Set while ty_monitor_start() runs, to report how fast the first board shows up
+    uint64_t start_time;
 };
 
 #define DROP_BOARD_DELAY 15000
+/* Drop boards that are about to expire (< 20 ms) to deal with limited timer resolution
+   (e.g. TickCount64() on Windows). */
+#define DROP_BOARD_TOLERANCE 20
 
-static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
+// Arm the timer for the first deadline, unless it is already armed for it
+static int update_drop_timer(ty_monitor *monitor)
+{
+    ty_timer_queue_node *node = ty_timer_queue_peek(&monitor->drop_queue);
+    uint64_t deadline = node ? node->deadline : 0;
+    int r;
+
+    if (deadline == monitor->drop_deadline)
+        return 0;
+
+    r = ty_timer_set(monitor->timer, ty_timer_queue_get_timeout(&monitor->drop_queue, ty_millis()),
+                     TY_TIMER_ONESHOT);
+    if (r < 0)
+        return r;
+    monitor->drop_deadline = deadline;
+
+    return 0;
+}
+
+static void wake_board_waiters(ty_board *board)
 {
     ty_monitor *monitor = board->monitor;
-    int r = 0;
 
-    // Set new board status, engage drop timer if needed
-    if (status == TY_BOARD_STATUS_MISSING && status != board->status) {
-        board->status = TY_BOARD_STATUS_MISSING;
-        board->missing_since = ty_millis();
+    // The hotplug thread already holds the lock
+    if (monitor->thread_running) {
+        if (board->monitor_waiters)
+            ty_cond_broadcast(&board->monitor_cond);
+    } else {
+        ty_mutex_lock(&monitor->refresh_mutex);
+        if (board->monitor_waiters)
+            ty_cond_broadcast(&board->monitor_cond);
+        ty_mutex_unlock(&monitor->refresh_mutex);
+    }
+}
 
-        if (!monitor->timer_running) {
-            int timer_delay = ty_adjust_timeout(monitor->drop_delay, board->missing_since);
-            r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
-            if (r < 0)
-                return r;
-            monitor->timer_running = true;
+/* Merge the change with the one already pending for this board, if any. Boards keep the
+   ADDED event until the batch is delivered, and boards that were added and dropped in the
+   same batch disappear from it. */
+static int add_batch_change(ty_monitor *monitor, ty_board *board, ty_monitor_event event)
+{
+    ty_monitor_change *change;
+    int r;
+
+    if (board->monitor_batch_idx) {
+        change = &monitor->batch_changes.values[board->monitor_batch_idx - 1];
+
+        if (change->event == TY_MONITOR_EVENT_ADDED) {
+            if (event == TY_MONITOR_EVENT_DROPPED) {
+                change->board = NULL;
+                board->monitor_batch_idx = 0;
+                ty_board_unref(board);
+            }
+        } else {
+            change->event = event;
         }
-    } else {
-        board->status = status;
+
+        return 0;
     }
 
+    r = _hs_array_grow(&monitor->batch_changes, 1);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    change = &monitor->batch_changes.values[monitor->batch_changes.count++];
+    change->board = ty_board_ref(board);
+    change->event = event;
+    board->monitor_batch_idx = monitor->batch_changes.count;
+
+    return 0;
+}
+
+static void clear_batch_changes(ty_monitor *monitor)
+{
+    for (size_t i = 0; i < monitor->batch_changes.count; i++) {
+        ty_board *board_it = monitor->batch_changes.values[i].board;
+
+        if (board_it) {
+            board_it->monitor_batch_idx = 0;
+            ty_board_unref(board_it);
+        }
+    }
+    _hs_array_release(&monitor->batch_changes);
+}
+
+static int notify_callbacks(ty_monitor *monitor, ty_board *board, ty_monitor_event event)
+{
+    int r = 0;
+
     /* Notify callbacks and do some additional stuff as we go:
        - Drop callback that return r > 0
        - Stop calling them is one returns r < 0 */
@@ -77,7 +194,7 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
         if (remove_count)
             *callback_it = monitor->callbacks.values[i];
 
-        if (!r) {
+        if (!r && callback_it->f) {
             r = (*callback_it->f)(board, event, callback_it->udata);
             if (r > 0) {
                 remove_count++;
@@ -87,9 +204,184 @@ static int change_board_status(ty_board *board, ty_board_status status, ty_monit
     }
     monitor->callbacks.count -= remove_count;
 
+    if (!r && monitor->batch_callbacks)
+        r = add_batch_change(monitor, board, event);
+
+    return r;
+}
+
+// Deliver the changes collected since the last call to batch callbacks
+static int notify_batch_callbacks(ty_monitor *monitor)
+{
+    _HS_ARRAY(ty_monitor_change) changes;
+    size_t j = 0;
+    int r = 0;
+
+    if (!monitor->batch_changes.count)
+        return 0;
+    _hs_array_move(&monitor->batch_changes, &changes);
+
+    // Compact away the boards that came and went in this batch
+    for (size_t i = 0; i < changes.count; i++) {
+        if (changes.values[i].board) {
+            changes.values[i].board->monitor_batch_idx = 0;
+            changes.values[j++] = changes.values[i];
+        }
+    }
+    changes.count = j;
+
+    // Same rules as notify_callbacks()
+    size_t remove_count = 0;
+    for (size_t i = 0; i < monitor->callbacks.count; i++) {
+        struct callback *callback_it = &monitor->callbacks.values[i - remove_count];
+        if (remove_count)
+            *callback_it = monitor->callbacks.values[i];
+
+        if (!r && callback_it->batch_f && changes.count) {
+            r = (*callback_it->batch_f)(changes.values, (unsigned int)changes.count,
+                                        callback_it->udata);
+            if (r > 0) {
+                monitor->batch_callbacks--;
+                remove_count++;
+                r = 0;
+            }
+        }
+    }
+    monitor->callbacks.count -= remove_count;
+
+    for (size_t i = 0; i < changes.count; i++)
+        ty_board_unref(changes.values[i].board);
+    _hs_array_release(&changes);
+
     return r;
 }
 
+// Called on the hotplug thread, the owner thread runs the callbacks in ty_monitor_refresh()
+static int queue_event(ty_monitor *monitor, ty_board *board, ty_monitor_event event)
+{
+    struct pending_event pending;
+    int r;
+
+    pending.board = ty_board_ref(board);
+    pending.event = event;
+    r = _hs_array_push(&monitor->pending_events, pending);
+    if (r < 0) {
+        ty_board_unref(board);
+        return ty_libhs_translate_error(r);
+    }
+
+    if (monitor->pending_events.count == 1)
+        return ty_timer_set(monitor->notify_timer, 0, TY_TIMER_ONESHOT);
+    return 0;
+}
+
+static int change_board_status(ty_board *board, ty_board_status status, ty_monitor_event event)
+{
+    ty_monitor *monitor = board->monitor;
+    int r = 0;
+
+    // Set new board status, schedule or cancel the drop
+    if (status == TY_BOARD_STATUS_MISSING && status != board->status) {
+        board->status = TY_BOARD_STATUS_MISSING;
+
+        r = ty_timer_queue_add(&monitor->drop_queue, &board->monitor_drop_node,
+                               ty_millis() + (uint64_t)monitor->drop_delay);
+        if (r < 0)
+            return r;
+        r = update_drop_timer(monitor);
+        if (r < 0)
+            return r;
+    } else if (status != TY_BOARD_STATUS_MISSING) {
+        board->status = status;
+
+        if (ty_timer_queue_has(&board->monitor_drop_node)) {
+            ty_timer_queue_remove(&monitor->drop_queue, &board->monitor_drop_node);
+            r = update_drop_timer(monitor);
+            if (r < 0)
+                return r;
+        }
+    }
+
+    // Status and capabilities only change through here, this is when board waiters care
+    wake_board_waiters(board);
+
+    if (monitor->thread_running)
+        return queue_event(monitor, board, event);
+    return notify_callbacks(monitor, board, event);
+}
+
+static void compact_monitor_boards(ty_monitor *monitor)
+{
+    size_t j = 0;
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board_it = monitor->boards.values[i];
+
+        if (board_it) {
+            board_it->monitor_idx = j;
+            monitor->boards.values[j++] = board_it;
+        }
+    }
+    monitor->boards.count = j;
+    monitor->boards_holes = 0;
+}
+
+// The serial number may change when the board is updated, call this each time
+static void index_board_serial(ty_board *board)
+{
+    ty_monitor *monitor = board->monitor;
+
+    if (board->monitor_serial_hnode.next)
+        _hs_htable_remove(&monitor->boards_by_serial, &board->monitor_serial_hnode);
+    if (board->serial_number)
+        _hs_htable_add(&monitor->boards_by_serial, _hs_htable_hash_str(board->serial_number),
+                       &board->monitor_serial_hnode);
+}
+
+static int add_monitor_board(ty_monitor *monitor, ty_board *board)
+{
+    int r;
+
+    /* Compact before the array grows, so the cost is amortized over the removals. This
+       only happens when a device is added, never while we iterate over the boards. */
+    if (monitor->boards_holes > monitor->boards.count / 2)
+        compact_monitor_boards(monitor);
+
+    r = _hs_array_push(&monitor->boards, board);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    board->monitor = monitor;
+    board->monitor_idx = monitor->boards.count - 1;
+
+    _hs_htable_add(&monitor->boards_by_location, _hs_htable_hash_str(board->location),
+                   &board->monitor_location_hnode);
+    index_board_serial(board);
+
+    if (monitor->start_time) {
+        ty_log(TY_LOG_DEBUG, "Found first board '%s' after %"PRIu64" ms", board->tag,
+               ty_millis() - monitor->start_time);
+        monitor->start_time = 0;
+    }
+
+    return 0;
+}
+
+static void remove_monitor_board(ty_board *board)
+{
+    ty_monitor *monitor = board->monitor;
+
+    _hs_htable_remove(&monitor->boards_by_location, &board->monitor_location_hnode);
+    if (board->monitor_serial_hnode.next)
+        _hs_htable_remove(&monitor->boards_by_serial, &board->monitor_serial_hnode);
+
+    monitor->boards.values[board->monitor_idx] = NULL;
+    monitor->boards_holes++;
+    while (monitor->boards.count && !monitor->boards.values[monitor->boards.count - 1]) {
+        monitor->boards.count--;
+        monitor->boards_holes--;
+    }
+    board->monitor = NULL;
+}
+
 static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board **rboard)
 {
     ty_board *board;
@@ -109,6 +401,9 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
     }
 
     r = ty_mutex_init(&board->ifaces_lock);
+    if (r < 0)
+        goto error;
+    r = ty_cond_init(&board->monitor_cond);
     if (r < 0)
         goto error;
 
@@ -120,12 +415,9 @@ static int create_board(ty_monitor *monitor, ty_board_interface *iface, ty_board
         goto error;
     board->tag = board->id;
 
-    board->monitor = monitor;
-    r = _hs_array_push(&monitor->boards, board);
-    if (r < 0) {
-        r = ty_libhs_translate_error(r);
+    r = add_monitor_board(monitor, board);
+    if (r < 0)
         goto error;
-    }
 
     *rboard = board;
     return 1;
@@ -137,6 +429,7 @@ error:
 
 static int close_board(ty_board *board)
 {
+    ty_monitor *monitor = board->monitor;
     _HS_ARRAY(ty_board_interface *) ifaces;
     int r;
 
@@ -155,7 +448,7 @@ static int close_board(ty_board *board)
         ty_board_interface *iface_it = ifaces.values[i];
 
         if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
+            _hs_htable_remove(&monitor->ifaces, &iface_it->monitor_hnode);
         ty_board_interface_unref(iface_it);
     }
     _hs_array_release(&ifaces);
@@ -165,26 +458,20 @@ static int close_board(ty_board *board)
 
 static void drop_board(ty_board *board)
 {
-    ty_monitor *monitor = board->monitor;
-
     // Change board status
     change_board_status(board, TY_BOARD_STATUS_DROPPED, TY_MONITOR_EVENT_DROPPED);
 
     // Remove this board from the monitor list
-    board->monitor = NULL;
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        if (monitor->boards.values[i] == board)
-            _hs_array_remove(&monitor->boards, i, 1);
-    }
+    remove_monitor_board(board);
 }
 
 static ty_board *find_monitor_board(ty_monitor *monitor, const char *location)
 {
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board_it = monitor->boards.values[i];
+    _hs_htable_foreach_hash(cur, &monitor->boards_by_location, _hs_htable_hash_str(location)) {
+        ty_board *board = ty_container_of(cur, ty_board, monitor_location_hnode);
 
-        if (strcmp(board_it->location, location) == 0)
-            return board_it;
+        if (strcmp(board->location, location) == 0)
+            return board;
     }
 
     return NULL;
@@ -261,6 +548,7 @@ static int update_or_create_board(ty_monitor *monitor, ty_board_interface *iface
             return r;
         if (update_tag_pointer)
             board->tag = board->id;
+        index_board_serial(board);
 
         /* The class function update_board() returns 1 if the interface is compatible with
            this board, or 0 if not. In the latter case, the old board is dropped and a new
@@ -373,7 +661,7 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     board = iface->board;
 
     // Unregister from monitor
-    _hs_htable_remove(&iface->monitor_hnode);
+    _hs_htable_remove(&monitor->ifaces, &iface->monitor_hnode);
     ty_board_interface_unref(iface);
 
     ty_mutex_lock(&board->ifaces_lock);
@@ -410,24 +698,65 @@ static int remove_interface_with_device(ty_monitor *monitor, hs_device *dev)
     return r;
 }
 
+int _ty_monitor_process_device(ty_monitor *monitor, hs_device *dev)
+{
+    switch (dev->status) {
+        case HS_DEVICE_STATUS_ONLINE: { return add_interface_for_device(monitor, dev); } break;
+        case HS_DEVICE_STATUS_DISCONNECTED: { return remove_interface_with_device(monitor, dev); } break;
+    }
+
+    assert(false);
+    return 0;
+}
+
 static int device_callback(hs_device *dev, void *udata)
 {
     ty_monitor *monitor = udata;
 
-    switch (dev->status) {
-        case HS_DEVICE_STATUS_ONLINE: {
-            monitor->refresh_callback_ret = add_interface_for_device(monitor, dev);
-            return !!monitor->refresh_callback_ret;
-        } break;
+    monitor->refresh_callback_ret = _ty_monitor_process_device(monitor, dev);
+    return !!monitor->refresh_callback_ret;
+}
 
-        case HS_DEVICE_STATUS_DISCONNECTED: {
-            monitor->refresh_callback_ret = remove_interface_with_device(monitor, dev);
-            return !!monitor->refresh_callback_ret;
-        } break;
+static int translate_refresh_error(ty_monitor *monitor, int r)
+{
+    /* The callback is in libty, and we need a way to get the error code without it
+       being converted from a libhs error code. */
+    if (monitor->refresh_callback_ret) {
+        r = monitor->refresh_callback_ret;
+        monitor->refresh_callback_ret = 0;
+        return r;
     }
 
-    assert(false);
-    return 0;
+    return ty_libhs_translate_error(r);
+}
+
+static void clear_monitor_boards(ty_monitor *monitor)
+{
+    // Clear registered boards, they may be referenced elsewhere so unqueue them first
+    ty_timer_queue_clear(&monitor->drop_queue);
+    monitor->drop_deadline = 0;
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board_it = monitor->boards.values[i];
+
+        if (board_it) {
+            board_it->monitor = NULL;
+            ty_board_unref(board_it);
+        }
+    }
+    _hs_array_release(&monitor->boards);
+    monitor->boards_holes = 0;
+    _hs_htable_clear(&monitor->boards_by_location);
+    _hs_htable_clear(&monitor->boards_by_serial);
+
+    // Clear registered interfaces
+    _hs_htable_foreach(cur, &monitor->ifaces) {
+        ty_board_interface *iface_it = ty_container_of(cur, ty_board_interface, monitor_hnode);
+
+        if (iface_it->monitor_hnode.next)
+            _hs_htable_remove(&monitor->ifaces, &iface_it->monitor_hnode);
+        ty_board_interface_unref(iface_it);
+    }
+    _hs_htable_clear(&monitor->ifaces);
 }
 
 int ty_monitor_new(ty_monitor **rmonitor)
@@ -455,6 +784,29 @@ int ty_monitor_new(ty_monitor **rmonitor)
         goto error;
     }
 
+    if (getenv("TYTOOLS_RECORD")) {
+        r = hs_monitor_set_record_path(getenv("TYTOOLS_RECORD"));
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto error;
+        }
+    }
+    if (getenv("TYTOOLS_REPLAY")) {
+        double speed = 1.0;
+
+        if (getenv("TYTOOLS_REPLAY_SPEED"))
+            speed = strtod(getenv("TYTOOLS_REPLAY_SPEED"), NULL);
+
+        r = ty_monitor_set_replay(monitor, getenv("TYTOOLS_REPLAY"), speed);
+        if (r < 0)
+            goto error;
+    }
+    if (getenv("TYTOOLS_MONITOR_THREAD")) {
+        r = ty_monitor_set_threaded(monitor, true);
+        if (r < 0)
+            goto error;
+    }
+
     r = ty_timer_new(&monitor->timer);
     if (r < 0)
         goto error;
@@ -467,6 +819,12 @@ int ty_monitor_new(ty_monitor **rmonitor)
     if (r < 0)
         goto error;
 
+    r = _hs_htable_init(&monitor->boards_by_location, 64);
+    if (r < 0)
+        goto error;
+    r = _hs_htable_init(&monitor->boards_by_serial, 64);
+    if (r < 0)
+        goto error;
     r = _hs_htable_init(&monitor->ifaces, 64);
     if (r < 0)
         goto error;
@@ -485,42 +843,306 @@ void ty_monitor_free(ty_monitor *monitor)
 {
     if (monitor) {
         ty_monitor_stop(monitor);
+        if (monitor->wait_stats.wakeups)
+            ty_log(TY_LOG_DEBUG, "Monitor waiters woke up %"PRIu64" times (%"PRIu64" for nothing)",
+                   monitor->wait_stats.wakeups, monitor->wait_stats.useless_wakeups);
+        // Boards can be injected with _ty_monitor_process_device() without starting
+        clear_batch_changes(monitor);
+        if (monitor->ifaces.heads)
+            clear_monitor_boards(monitor);
 
         _hs_array_release(&monitor->callbacks);
+        _hs_htable_release(&monitor->boards_by_location);
+        _hs_htable_release(&monitor->boards_by_serial);
         _hs_htable_release(&monitor->ifaces);
+        ty_timer_queue_release(&monitor->drop_queue);
 
         ty_cond_release(&monitor->refresh_cond);
         ty_mutex_release(&monitor->refresh_mutex);
         hs_monitor_free(monitor->device_monitor);
         ty_timer_free(monitor->timer);
+        hs_replay_free(monitor->replay);
+        ty_timer_free(monitor->replay_timer);
+        _hs_array_release(&monitor->pending_events);
+        ty_timer_free(monitor->stop_timer);
+        ty_timer_free(monitor->notify_timer);
     }
 
     free(monitor);
 }
 
+int ty_monitor_set_replay(ty_monitor *monitor, const char *path, double speed)
+{
+    assert(monitor);
+    assert(!monitor->started);
+
+    hs_replay *replay = NULL;
+    int r;
+
+    if (path) {
+        r = hs_replay_open(path, _ty_class_match_specs, _ty_class_match_specs_count, speed,
+                           &replay);
+        if (r < 0)
+            return ty_libhs_translate_error(r);
+
+        if (!monitor->replay_timer) {
+            r = ty_timer_new(&monitor->replay_timer);
+            if (r < 0) {
+                hs_replay_free(replay);
+                return r;
+            }
+        }
+
+        ty_log(TY_LOG_DEBUG, "Replaying device events from '%s'", path);
+    }
+
+    hs_replay_free(monitor->replay);
+    monitor->replay = replay;
+
+    return 0;
+}
+
+int ty_monitor_set_threaded(ty_monitor *monitor, bool threaded)
+{
+    assert(monitor);
+    assert(!monitor->started);
+
+    int r;
+
+    // The owner thread needs the notification timer for ty_monitor_get_descriptors()
+    if (threaded && !monitor->notify_timer) {
+        r = ty_timer_new(&monitor->stop_timer);
+        if (r < 0)
+            return r;
+        r = ty_timer_new(&monitor->notify_timer);
+        if (r < 0) {
+            ty_timer_free(monitor->stop_timer);
+            monitor->stop_timer = NULL;
+            return r;
+        }
+    }
+    monitor->threaded = threaded;
+
+    return 0;
+}
+
+// Same as hs_monitor_refresh(), but for recorded events
+static int refresh_replay(ty_monitor *monitor)
+{
+    int r;
+
+    r = hs_replay_refresh(monitor->replay, device_callback, monitor);
+    if (r)
+        return translate_refresh_error(monitor, r);
+
+    return ty_timer_set(monitor->replay_timer, hs_replay_get_timeout(monitor->replay),
+                        TY_TIMER_ONESHOT);
+}
+
+static void get_device_descriptors(const ty_monitor *monitor, ty_descriptor_set *set, int id)
+{
+    if (monitor->replay) {
+        ty_timer_get_descriptors(monitor->replay_timer, set, id);
+    } else {
+        ty_descriptor_set_add(set, hs_monitor_get_poll_handle(monitor->device_monitor), id);
+    }
+    ty_timer_get_descriptors(monitor->timer, set, id);
+}
+
+// Drop expired boards and process device events
+static int refresh_devices(ty_monitor *monitor)
+{
+    int r;
+
+    if (ty_timer_rearm(monitor->timer)) {
+        uint64_t now = ty_millis();
+        ty_timer_queue_node *node;
+
+        // The timer has expired, make sure update_drop_timer() arms it again
+        monitor->drop_deadline = 0;
+
+        while ((node = ty_timer_queue_pop(&monitor->drop_queue, now + DROP_BOARD_TOLERANCE))) {
+            ty_board *board = ty_container_of(node, ty_board, monitor_drop_node);
+
+            drop_board(board);
+            ty_board_unref(board);
+        }
+
+        r = update_drop_timer(monitor);
+        if (r < 0)
+            return r;
+    }
+
+    if (monitor->replay) {
+        ty_timer_rearm(monitor->replay_timer);
+        r = refresh_replay(monitor);
+        if (r < 0)
+            return r;
+    } else {
+        r = hs_monitor_refresh(monitor->device_monitor, device_callback, monitor);
+        if (r < 0)
+            return translate_refresh_error(monitor, r);
+    }
+
+    return 0;
+}
+
+static int run_hotplug_thread(void *udata)
+{
+    ty_monitor *monitor = udata;
+    ty_descriptor_set set = {0};
+    int r;
+
+    // ty_poll() returns the first ready descriptor, put the stop timer first
+    ty_timer_get_descriptors(monitor->stop_timer, &set, 0);
+    get_device_descriptors(monitor, &set, 1);
+
+    while (true) {
+        r = ty_poll(&set, -1);
+        if (r <= 0)
+            break;
+
+        ty_mutex_lock(&monitor->refresh_mutex);
+        r = refresh_devices(monitor);
+        if (monitor->refresh_waiters)
+            ty_cond_broadcast(&monitor->refresh_cond);
+        ty_mutex_unlock(&monitor->refresh_mutex);
+        if (r < 0)
+            break;
+    }
+
+    // The owner thread gets the error from ty_monitor_refresh()
+    if (r < 0) {
+        ty_mutex_lock(&monitor->refresh_mutex);
+        monitor->thread_ret = r;
+        ty_mutex_unlock(&monitor->refresh_mutex);
+        ty_timer_set(monitor->notify_timer, 0, TY_TIMER_ONESHOT);
+    }
+
+    return 0;
+}
+
+static int start_hotplug_thread(ty_monitor *monitor)
+{
+    int r;
+
+    monitor->thread_ret = 0;
+    monitor->thread_running = true;
+
+    r = ty_thread_create(&monitor->hotplug_thread, run_hotplug_thread, monitor);
+    if (r < 0) {
+        monitor->thread_running = false;
+        return r;
+    }
+
+    return 0;
+}
+
+static void stop_hotplug_thread(ty_monitor *monitor)
+{
+    ty_timer_set(monitor->stop_timer, 0, TY_TIMER_ONESHOT);
+    ty_thread_join(&monitor->hotplug_thread);
+    ty_timer_rearm(monitor->stop_timer);
+    monitor->thread_running = false;
+
+    // Callbacks that did not run yet are lost, like the boards
+    ty_timer_rearm(monitor->notify_timer);
+    for (size_t i = 0; i < monitor->pending_events.count; i++)
+        ty_board_unref(monitor->pending_events.values[i].board);
+    _hs_array_release(&monitor->pending_events);
+    for (size_t i = 0; i < monitor->released_strings.count; i++)
+        free(monitor->released_strings.values[i]);
+    _hs_array_release(&monitor->released_strings);
+}
+
+// Run the callbacks queued by the hotplug thread
+static int run_pending_events(ty_monitor *monitor)
+{
+    _HS_ARRAY(struct pending_event) events;
+    _HS_ARRAY(char *) strings;
+    int r;
+
+    // Rearm first, events queued from now on will set the timer again
+    ty_timer_rearm(monitor->notify_timer);
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    _hs_array_move(&monitor->pending_events, &events);
+    _hs_array_move(&monitor->released_strings, &strings);
+    r = monitor->thread_ret;
+
+    monitor->callbacks_locked = true;
+    for (size_t i = 0; !r && i < events.count; i++) {
+        struct pending_event *pending = &events.values[i];
+        r = notify_callbacks(monitor, pending->board, pending->event);
+    }
+    if (!r)
+        r = notify_batch_callbacks(monitor);
+    monitor->callbacks_locked = false;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    for (size_t i = 0; i < events.count; i++)
+        ty_board_unref(events.values[i].board);
+    _hs_array_release(&events);
+
+    for (size_t i = 0; i < strings.count; i++)
+        free(strings.values[i]);
+    _hs_array_release(&strings);
+
+    return r;
+}
+
 int ty_monitor_start(ty_monitor *monitor)
 {
     assert(monitor);
 
+    uint64_t start;
     int r;
 
     if (monitor->started)
         return 0;
 
-    r = hs_monitor_start(monitor->device_monitor);
-    if (r < 0) {
-        r = ty_libhs_translate_error(r);
-        goto error;
+    start = ty_millis();
+    monitor->start_time = start;
+
+    if (monitor->replay) {
+        monitor->started = true;
+
+        r = refresh_replay(monitor);
+        if (r < 0)
+            goto error;
+    } else {
+        r = hs_monitor_start(monitor->device_monitor);
+        if (r < 0) {
+            r = ty_libhs_translate_error(r);
+            goto error;
+        }
+        monitor->started = true;
+        ty_log(TY_LOG_DEBUG, "Enumerated devices in %"PRIu64" ms", ty_millis() - start);
+
+        r = hs_monitor_list(monitor->device_monitor, device_callback, monitor);
+        if (r < 0)
+            goto error;
     }
-    monitor->started = true;
 
-    r = hs_monitor_list(monitor->device_monitor, device_callback, monitor);
+    r = notify_batch_callbacks(monitor);
     if (r < 0)
         goto error;
 
+    // Callbacks for the boards found so far run directly, before the thread starts
+    if (monitor->threaded) {
+        r = start_hotplug_thread(monitor);
+        if (r < 0)
+            goto error;
+    }
+
+    monitor->start_time = 0;
+    ty_log(TY_LOG_DEBUG, "Found %zu boards in %"PRIu64" ms",
+           monitor->boards.count - monitor->boards_holes, ty_millis() - start);
+
     return 0;
 
 error:
+    monitor->start_time = 0;
     ty_monitor_stop(monitor);
     return r;
 }
@@ -532,29 +1154,19 @@ void ty_monitor_stop(ty_monitor *monitor)
     if (!monitor->started)
         return;
 
-    // Stop device monitor and timer
-    hs_monitor_stop(monitor->device_monitor);
-    ty_timer_set(monitor->timer, -1, 0);
-    monitor->timer_running = false;
-
-    // Clear registered boards
-    for (size_t i = 0; i < monitor->boards.count; i++) {
-        ty_board *board_it = monitor->boards.values[i];
+    if (monitor->thread_running)
+        stop_hotplug_thread(monitor);
 
-        board_it->monitor = NULL;
-        ty_board_unref(board_it);
+    // Stop device monitor and timer
+    if (monitor->replay) {
+        ty_timer_set(monitor->replay_timer, -1, 0);
+    } else {
+        hs_monitor_stop(monitor->device_monitor);
     }
-    _hs_array_release(&monitor->boards);
+    ty_timer_set(monitor->timer, -1, 0);
 
-    // Clear registered interfaces
-    _hs_htable_foreach(cur, &monitor->ifaces) {
-        ty_board_interface *iface_it = ty_container_of(cur, ty_board_interface, monitor_hnode);
-
-        if (iface_it->monitor_hnode.next)
-            _hs_htable_remove(&iface_it->monitor_hnode);
-        ty_board_interface_unref(iface_it);
-    }
-    _hs_htable_clear(&monitor->ifaces);
+    clear_batch_changes(monitor);
+    clear_monitor_boards(monitor);
 
     monitor->started = false;
 }
@@ -564,8 +1176,11 @@ void ty_monitor_get_descriptors(const ty_monitor *monitor, ty_descriptor_set *se
     assert(monitor);
     assert(set);
 
-    ty_descriptor_set_add(set, hs_monitor_get_poll_handle(monitor->device_monitor), id);
-    ty_timer_get_descriptors(monitor->timer, set, id);
+    if (monitor->threaded) {
+        ty_timer_get_descriptors(monitor->notify_timer, set, id);
+    } else {
+        get_device_descriptors(monitor, set, id);
+    }
 }
 
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
@@ -581,6 +1196,27 @@ int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *
     return ty_libhs_translate_error(_hs_array_push(&monitor->callbacks, callback));
 }
 
+int ty_monitor_register_batch_callback(ty_monitor *monitor, ty_monitor_batch_func *f,
+                                       void *udata)
+{
+    assert(monitor);
+    assert(f);
+
+    struct callback callback = {
+        .id = monitor->current_callback_id++,
+        .batch_f = f,
+        .udata = udata
+    };
+    int r;
+
+    r = _hs_array_push(&monitor->callbacks, callback);
+    if (r < 0)
+        return ty_libhs_translate_error(r);
+    monitor->batch_callbacks++;
+
+    return 0;
+}
+
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
 {
     assert(monitor);
@@ -588,6 +1224,8 @@ void ty_monitor_deregister_callback(ty_monitor *monitor, int id)
 
     for (size_t i = 0; i < monitor->callbacks.count; i++) {
         if (monitor->callbacks.values[i].id == id) {
+            if (monitor->callbacks.values[i].batch_f)
+                monitor->batch_callbacks--;
             _hs_array_remove(&monitor->callbacks, i, 1);
             break;
         }
@@ -600,90 +1238,184 @@ int ty_monitor_refresh(ty_monitor *monitor)
 
     int r;
 
-    if (ty_timer_rearm(monitor->timer)) {
-        int timer_delay = -1;
-
-        for (size_t i = 0; i < monitor->boards.count; i++) {
-            ty_board *board_it = monitor->boards.values[i];
-
-            if (board_it->status == TY_BOARD_STATUS_MISSING) {
-                int board_timeout = ty_adjust_timeout(monitor->drop_delay, board_it->missing_since);
-                /* Drop boards that are about to expire (< 20 ms) to deal with limited timer
-                   resolution (e.g. TickCount64() on Windows). */
-                if (board_timeout < 20) {
-                    drop_board(board_it);
-                    ty_board_unref(board_it);
-                } else if (board_timeout < timer_delay || timer_delay == -1) {
-                    timer_delay = board_timeout;
-                }
-            }
-        }
-
-        r = ty_timer_set(monitor->timer, timer_delay, TY_TIMER_ONESHOT);
-        if (r < 0)
-            return r;
-        monitor->timer_running = (timer_delay >= 0);
+    if (monitor->thread_running) {
+        // Refreshing from a callback would lock the registry again
+        if (monitor->callbacks_locked)
+            return 0;
+        return run_pending_events(monitor);
     }
 
-    r = hs_monitor_refresh(monitor->device_monitor, device_callback, monitor);
-    if (r < 0) {
-        /* The callback is in libty, and we need a way to get the error code without it
-           being converted from a libhs error code. */
-        if (monitor->refresh_callback_ret) {
-            r = monitor->refresh_callback_ret;
-            monitor->refresh_callback_ret = 0;
-            return r;
-        }
-
-        return ty_libhs_translate_error(r);
-    }
+    r = refresh_devices(monitor);
+    if (r < 0)
+        return r;
+    r = notify_batch_callbacks(monitor);
+    if (r < 0)
+        return r;
 
     ty_mutex_lock(&monitor->refresh_mutex);
-    ty_cond_broadcast(&monitor->refresh_cond);
+    if (monitor->refresh_waiters)
+        ty_cond_broadcast(&monitor->refresh_cond);
     ty_mutex_unlock(&monitor->refresh_mutex);
 
     return 0;
 }
 
-int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
+static int wait_cond(ty_monitor *monitor, ty_cond *cond, unsigned int *waiters,
+                     ty_monitor_wait_func *f, void *udata, int timeout)
 {
-    assert(monitor);
-    assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
+    uint64_t start = ty_millis();
+    int r;
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    (*waiters)++;
+    while (!(r = (*f)(monitor, udata))) {
+        if (!ty_cond_wait(cond, &monitor->refresh_mutex, ty_adjust_timeout(timeout, start)))
+            break;
 
+        monitor->wait_stats.wakeups++;
+        r = (*f)(monitor, udata);
+        if (r)
+            break;
+        monitor->wait_stats.useless_wakeups++;
+    }
+    (*waiters)--;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+
+    return r;
+}
+
+static int wait_main_thread(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata,
+                            int timeout)
+{
     ty_descriptor_set set = {0};
     uint64_t start;
     int r;
 
     start = ty_millis();
-    if (monitor->main_thread_id != ty_thread_get_self_id()) {
-        ty_mutex_lock(&monitor->refresh_mutex);
-        while (!(r = (*f)(monitor, udata))) {
-            r = ty_cond_wait(&monitor->refresh_cond, &monitor->refresh_mutex,
-                             ty_adjust_timeout(timeout, start));
-            if (!r)
-                break;
+    ty_monitor_get_descriptors(monitor, &set, 1);
+
+    do {
+        r = ty_monitor_refresh(monitor);
+        if (r < 0)
+            return (int)r;
+
+        if (f) {
+            r = (*f)(monitor, udata);
+            if (r)
+                return r;
         }
-        ty_mutex_unlock(&monitor->refresh_mutex);
 
-        return r;
+        r = ty_poll(&set, ty_adjust_timeout(timeout, start));
+    } while (r > 0);
+    return r;
+}
+
+int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout)
+{
+    assert(monitor);
+    assert(f || (monitor->main_thread_id == ty_thread_get_self_id()));
+
+    if (monitor->main_thread_id != ty_thread_get_self_id()) {
+        return wait_cond(monitor, &monitor->refresh_cond, &monitor->refresh_waiters, f, udata,
+                         timeout);
+    } else {
+        return wait_main_thread(monitor, f, udata, timeout);
+    }
+}
+
+int _ty_monitor_wait_board(ty_monitor *monitor, ty_board *board, ty_monitor_wait_func *f,
+                           void *udata, int timeout)
+{
+    assert(monitor);
+    assert(board);
+    assert(f);
+
+    if (monitor->main_thread_id != ty_thread_get_self_id()) {
+        return wait_cond(monitor, &board->monitor_cond, &board->monitor_waiters, f, udata,
+                         timeout);
     } else {
-        ty_monitor_get_descriptors(monitor, &set, 1);
+        return wait_main_thread(monitor, f, udata, timeout);
+    }
+}
+
+void _ty_monitor_get_wait_stats(ty_monitor *monitor, _ty_monitor_wait_stats *rstats)
+{
+    assert(monitor);
+    assert(rstats);
+
+    ty_mutex_lock(&monitor->refresh_mutex);
+    *rstats = monitor->wait_stats;
+    ty_mutex_unlock(&monitor->refresh_mutex);
+}
 
-        do {
-            r = ty_monitor_refresh(monitor);
+// Don't run the callback with the registry locked, it may want to wait for something
+static int list_locked_boards(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
+{
+    _HS_ARRAY(ty_board *) boards = {0};
+    int r = 0;
+
+    _ty_monitor_lock_boards(monitor);
+    for (size_t i = 0; i < monitor->boards.count; i++) {
+        ty_board *board_it = monitor->boards.values[i];
+
+        if (board_it && board_it->status == TY_BOARD_STATUS_ONLINE) {
+            r = _hs_array_push(&boards, board_it);
             if (r < 0)
-                return (int)r;
+                break;
+            ty_board_ref(board_it);
+        }
+    }
+    _ty_monitor_unlock_boards(monitor);
+    if (r < 0) {
+        r = ty_libhs_translate_error(r);
+        goto cleanup;
+    }
 
-            if (f) {
-                r = (*f)(monitor, udata);
-                if (r)
-                    return r;
-            }
+    for (size_t i = 0; i < boards.count; i++) {
+        r = (*f)(boards.values[i], TY_MONITOR_EVENT_ADDED, udata);
+        if (r)
+            break;
+    }
 
-            r = ty_poll(&set, ty_adjust_timeout(timeout, start));
-        } while (r > 0);
-        return r;
+cleanup:
+    for (size_t i = 0; i < boards.count; i++)
+        ty_board_unref(boards.values[i]);
+    _hs_array_release(&boards);
+    return r;
+}
+
+void _ty_monitor_release_board_string(ty_monitor *monitor, char *str)
+{
+    // Only the hotplug thread updates boards while it runs, and it holds the lock
+    if (str && monitor && monitor->thread_running) {
+        if (_hs_array_push(&monitor->released_strings, str) >= 0)
+            return;
     }
+
+    free(str);
+}
+
+// Callbacks run on the owner thread with the lock held, only it can read callbacks_locked
+static bool need_boards_lock(ty_monitor *monitor)
+{
+    if (!monitor || !monitor->thread_running)
+        return false;
+    if (ty_thread_get_self_id() == monitor->main_thread_id && monitor->callbacks_locked)
+        return false;
+
+    return true;
+}
+
+void _ty_monitor_lock_boards(ty_monitor *monitor)
+{
+    if (need_boards_lock(monitor))
+        ty_mutex_lock(&monitor->refresh_mutex);
+}
+
+void _ty_monitor_unlock_boards(ty_monitor *monitor)
+{
+    if (need_boards_lock(monitor))
+        ty_mutex_unlock(&monitor->refresh_mutex);
 }
 
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata)
@@ -691,10 +1423,13 @@ int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udat
     assert(monitor);
     assert(f);
 
+    if (monitor->thread_running)
+        return list_locked_boards(monitor, f, udata);
+
     for (size_t i = 0; i < monitor->boards.count; i++) {
         ty_board *board_it = monitor->boards.values[i];
 
-        if (board_it->status == TY_BOARD_STATUS_ONLINE) {
+        if (board_it && board_it->status == TY_BOARD_STATUS_ONLINE) {
             int r = (*f)(board_it, TY_MONITOR_EVENT_ADDED, udata);
             if (r)
                 return r;
@@ -703,3 +1438,34 @@ int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udat
 
     return 0;
 }
+
+// Returns a new reference (or NULL), call ty_board_unref() when you are done
+ty_board *ty_monitor_find_board(ty_monitor *monitor, const char *serial_number)
+{
+    assert(monitor);
+    assert(serial_number);
+
+    ty_board *found = NULL;
+
+    /* In threaded mode, the hotplug thread may drop the board as soon as we unlock, so
+       take a reference while it is still in the index. */
+    _ty_monitor_lock_boards(monitor);
+    _hs_htable_foreach_hash(cur, &monitor->boards_by_serial, _hs_htable_hash_str(serial_number)) {
+        ty_board *board = ty_container_of(cur, ty_board, monitor_serial_hnode);
+
+        if (strcmp(board->serial_number, serial_number) == 0) {
+            // Prefer online boards, an old board may be waiting to be dropped
+            if (board->status == TY_BOARD_STATUS_ONLINE) {
+                found = board;
+                break;
+            }
+            if (!found)
+                found = board;
+        }
+    }
+    if (found)
+        ty_board_ref(found);
+    _ty_monitor_unlock_boards(monitor);
+
+    return found;
+}
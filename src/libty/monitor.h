@@ -26,24 +26,37 @@ typedef enum ty_monitor_event {
     TY_MONITOR_EVENT_DROPPED
 } ty_monitor_event;
 
+typedef struct ty_monitor_change {
+    struct ty_board *board;
+    ty_monitor_event event;
+} ty_monitor_change;
+
 typedef int ty_monitor_callback_func(struct ty_board *board, ty_monitor_event event, void *udata);
+typedef int ty_monitor_batch_func(const ty_monitor_change *changes, unsigned int count,
+                                  void *udata);
 typedef int ty_monitor_wait_func(ty_monitor *monitor, void *udata);
 
 int ty_monitor_new(ty_monitor **rmonitor);
 void ty_monitor_free(ty_monitor *monitor);
 
+int ty_monitor_set_replay(ty_monitor *monitor, const char *path, double speed);
+int ty_monitor_set_threaded(ty_monitor *monitor, bool threaded);
+
 int ty_monitor_start(ty_monitor *monitor);
 void ty_monitor_stop(ty_monitor *monitor);
 
 void ty_monitor_get_descriptors(const ty_monitor *monitor, struct ty_descriptor_set *set, int id);
 
 int ty_monitor_register_callback(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+int ty_monitor_register_batch_callback(ty_monitor *monitor, ty_monitor_batch_func *f,
+                                       void *udata);
 void ty_monitor_deregister_callback(ty_monitor *monitor, int id);
 
 int ty_monitor_refresh(ty_monitor *monitor);
 int ty_monitor_wait(ty_monitor *monitor, ty_monitor_wait_func *f, void *udata, int timeout);
 
 int ty_monitor_list(ty_monitor *monitor, ty_monitor_callback_func *f, void *udata);
+struct ty_board *ty_monitor_find_board(ty_monitor *monitor, const char *serial_number);
 
 TY_C_END
 
@@ -0,0 +1,47 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_MONITOR_PRIV_H
+#define TY_MONITOR_PRIV_H
+
+#include "common_priv.h"
+#include "../libhs/device.h"
+#include "monitor.h"
+
+TY_C_BEGIN
+
+/* Feeds a device event to the monitor, as if it came from the libhs device monitor. This
+   is what ty_monitor_refresh() does for each event, tests and benchmarks use it to simulate
+   devices. The monitor does not need to be started. */
+int _ty_monitor_process_device(ty_monitor *monitor, hs_device *dev);
+
+/* Same as ty_monitor_wait(), but worker threads only wake up when the status or the
+   capabilities of this board change, instead of after every refresh. */
+int _ty_monitor_wait_board(ty_monitor *monitor, struct ty_board *board, ty_monitor_wait_func *f,
+                           void *udata, int timeout);
+
+typedef struct _ty_monitor_wait_stats {
+    uint64_t wakeups;
+    // Wakeups after which the predicate was still false
+    uint64_t useless_wakeups;
+} _ty_monitor_wait_stats;
+
+void _ty_monitor_get_wait_stats(ty_monitor *monitor, _ty_monitor_wait_stats *rstats);
+
+/* Classes use this to free the board strings they replace in update_board(). In threaded
+   mode, the owner thread may still use them, so they live until its next refresh. */
+void _ty_monitor_release_board_string(ty_monitor *monitor, char *str);
+// Lock the board registry against the hotplug thread, does nothing in the default mode
+void _ty_monitor_lock_boards(ty_monitor *monitor);
+void _ty_monitor_unlock_boards(ty_monitor *monitor);
+
+TY_C_END
+
+#endif
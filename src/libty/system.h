@@ -37,7 +37,8 @@ typedef enum ty_standard_stream {
 
 typedef enum ty_standard_path {
     TY_PATH_EXECUTABLE_DIRECTORY = 0,
-    TY_PATH_CONFIG_DIRECTORY
+    TY_PATH_CONFIG_DIRECTORY,
+    TY_PATH_CACHE_DIRECTORY
 } ty_standard_path;
 
 enum {
@@ -63,6 +64,7 @@ char *ty_win32_strerror(unsigned long err);
 #endif
 
 uint64_t ty_millis(void);
+uint64_t ty_micros(void);
 void ty_delay(unsigned int ms);
 
 int ty_adjust_timeout(int timeout, uint64_t start);
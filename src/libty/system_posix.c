@@ -44,6 +44,15 @@ uint64_t ty_millis(void)
     return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000000;
 }
 
+uint64_t ty_micros(void)
+{
+    static mach_timebase_info_data_t tb;
+    if (!tb.numer)
+        mach_timebase_info(&tb);
+
+    return (uint64_t)mach_absolute_time() * tb.numer / tb.denom / 1000;
+}
+
 #else
 
 uint64_t ty_millis(void)
@@ -61,7 +70,25 @@ uint64_t ty_millis(void)
         return 0;
     }
 
-    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 10000000;
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+uint64_t ty_micros(void)
+{
+    struct timespec ts;
+    int r;
+
+#ifdef CLOCK_MONOTONIC_RAW
+    r = clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    r = clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    if (r < 0) {
+        ty_log(TY_LOG_WARNING, "clock_gettime() failed: %s", strerror(errno));
+        return 0;
+    }
+
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
 #endif
@@ -159,6 +186,13 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
                 ADD_DIRECTORY("%s/Library/Preferences", home_dir);
             ADD_DIRECTORY("/Library/Preferences");
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            const char *home_dir = getenv("HOME");
+            if (!home_dir)
+                return 0;
+            ADD_DIRECTORY("%s/Library/Caches", home_dir);
+        } break;
     }
 
 #undef ADD_DIRECTORY
@@ -239,6 +273,18 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
                 config_dirs += len + !!config_dirs[len];
             }
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            const char *cache_home_dir = getenv("XDG_CACHE_HOME");
+            if (cache_home_dir) {
+                ADD_DIRECTORY("%s", cache_home_dir);
+            } else {
+                const char *home_dir = getenv("HOME");
+                if (!home_dir)
+                    return 0;
+                ADD_DIRECTORY("%s/.cache", home_dir);
+            }
+        } break;
     }
 
 #undef ADD_DIRECTORY
@@ -80,6 +80,24 @@ uint64_t ty_millis(void)
     return GetTickCount64_();
 }
 
+uint64_t ty_micros(void)
+{
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    BOOL success TY_POSSIBLY_UNUSED;
+
+    if (!freq.QuadPart) {
+        success = QueryPerformanceFrequency(&freq);
+        assert(success);
+    }
+    success = QueryPerformanceCounter(&now);
+    assert(success);
+
+    // Split the computation to avoid overflows with high-frequency counters
+    return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000 +
+           (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000 / (uint64_t)freq.QuadPart;
+}
+
 void ty_delay(unsigned int ms)
 {
     Sleep(ms);
@@ -168,6 +186,10 @@ unsigned int ty_standard_get_paths(ty_standard_path std_path, const char *suffix
             ADD_SHELL_DIRECTORY(CSIDL_APPDATA);
             ADD_SHELL_DIRECTORY(CSIDL_COMMON_APPDATA);
         } break;
+
+        case TY_PATH_CACHE_DIRECTORY: {
+            ADD_SHELL_DIRECTORY(CSIDL_LOCAL_APPDATA);
+        } break;
     }
 
 #undef ADD_SHELL_DIRECTORY
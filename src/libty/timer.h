@@ -31,6 +31,37 @@ void ty_timer_get_descriptors(const ty_timer *timer, struct ty_descriptor_set *s
 int ty_timer_set(ty_timer *timer, int value, int flags);
 uint64_t ty_timer_rearm(ty_timer *timer);
 
+/* Timer queues keep track of many deadlines (in ty_millis() time), the earliest one comes
+   first. Nodes are embedded in the objects they schedule and know their position, so adding,
+   moving and removing a node are O(log n). Use ty_timer_queue_get_timeout() to arm a ty_timer
+   (or to poll) for the next deadline. Zeroed queues and nodes are valid and empty. */
+
+typedef struct ty_timer_queue_node {
+    uint64_t deadline;
+    // Position in the heap plus one, or 0 when the node is not queued
+    size_t heap_idx;
+} ty_timer_queue_node;
+
+typedef struct ty_timer_queue {
+    ty_timer_queue_node **nodes;
+    size_t count;
+    size_t allocated;
+} ty_timer_queue;
+
+void ty_timer_queue_release(ty_timer_queue *queue);
+void ty_timer_queue_clear(ty_timer_queue *queue);
+
+int ty_timer_queue_add(ty_timer_queue *queue, ty_timer_queue_node *node, uint64_t deadline);
+void ty_timer_queue_remove(ty_timer_queue *queue, ty_timer_queue_node *node);
+static inline bool ty_timer_queue_has(const ty_timer_queue_node *node)
+{
+    return node->heap_idx;
+}
+
+ty_timer_queue_node *ty_timer_queue_peek(const ty_timer_queue *queue);
+ty_timer_queue_node *ty_timer_queue_pop(ty_timer_queue *queue, uint64_t now);
+int ty_timer_queue_get_timeout(const ty_timer_queue *queue, uint64_t now);
+
 TY_C_END
 
 #endif
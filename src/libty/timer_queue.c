@@ -0,0 +1,179 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "timer.h"
+
+// Binary min-heap, node->heap_idx is always the node position plus one
+
+static void set_node(ty_timer_queue *queue, size_t idx, ty_timer_queue_node *node)
+{
+    queue->nodes[idx] = node;
+    node->heap_idx = idx + 1;
+}
+
+static void sift_up(ty_timer_queue *queue, size_t idx)
+{
+    ty_timer_queue_node *node = queue->nodes[idx];
+
+    while (idx) {
+        size_t parent_idx = (idx - 1) / 2;
+        ty_timer_queue_node *parent = queue->nodes[parent_idx];
+
+        if (parent->deadline <= node->deadline)
+            break;
+
+        set_node(queue, idx, parent);
+        idx = parent_idx;
+    }
+    set_node(queue, idx, node);
+}
+
+static void sift_down(ty_timer_queue *queue, size_t idx)
+{
+    ty_timer_queue_node *node = queue->nodes[idx];
+
+    while (true) {
+        size_t child_idx = idx * 2 + 1;
+        ty_timer_queue_node *child;
+
+        if (child_idx >= queue->count)
+            break;
+        if (child_idx + 1 < queue->count &&
+                queue->nodes[child_idx + 1]->deadline < queue->nodes[child_idx]->deadline)
+            child_idx++;
+        child = queue->nodes[child_idx];
+
+        if (node->deadline <= child->deadline)
+            break;
+
+        set_node(queue, idx, child);
+        idx = child_idx;
+    }
+    set_node(queue, idx, node);
+}
+
+void ty_timer_queue_release(ty_timer_queue *queue)
+{
+    assert(queue);
+
+    ty_timer_queue_clear(queue);
+    free(queue->nodes);
+    queue->nodes = NULL;
+    queue->allocated = 0;
+}
+
+void ty_timer_queue_clear(ty_timer_queue *queue)
+{
+    assert(queue);
+
+    for (size_t i = 0; i < queue->count; i++)
+        queue->nodes[i]->heap_idx = 0;
+    queue->count = 0;
+}
+
+int ty_timer_queue_add(ty_timer_queue *queue, ty_timer_queue_node *node, uint64_t deadline)
+{
+    assert(queue);
+    assert(node);
+
+    // Already queued, move it to the right place
+    if (node->heap_idx) {
+        uint64_t old_deadline = node->deadline;
+
+        node->deadline = deadline;
+        if (deadline < old_deadline) {
+            sift_up(queue, node->heap_idx - 1);
+        } else {
+            sift_down(queue, node->heap_idx - 1);
+        }
+
+        return 0;
+    }
+
+    if (queue->count == queue->allocated) {
+        size_t new_allocated = queue->allocated ? queue->allocated * 2 : 16;
+        ty_timer_queue_node **new_nodes;
+
+        new_nodes = realloc(queue->nodes, new_allocated * sizeof(*new_nodes));
+        if (!new_nodes)
+            return ty_error(TY_ERROR_MEMORY, NULL);
+        queue->nodes = new_nodes;
+        queue->allocated = new_allocated;
+    }
+
+    node->deadline = deadline;
+    queue->nodes[queue->count++] = node;
+    sift_up(queue, queue->count - 1);
+
+    return 0;
+}
+
+void ty_timer_queue_remove(ty_timer_queue *queue, ty_timer_queue_node *node)
+{
+    assert(queue);
+    assert(node);
+
+    size_t idx;
+    ty_timer_queue_node *last;
+
+    if (!node->heap_idx)
+        return;
+    idx = node->heap_idx - 1;
+    assert(idx < queue->count && queue->nodes[idx] == node);
+    node->heap_idx = 0;
+
+    // Put the last node in the hole, it may need to go either way
+    last = queue->nodes[--queue->count];
+    if (last != node) {
+        set_node(queue, idx, last);
+        if (idx && queue->nodes[(idx - 1) / 2]->deadline > last->deadline) {
+            sift_up(queue, idx);
+        } else {
+            sift_down(queue, idx);
+        }
+    }
+}
+
+ty_timer_queue_node *ty_timer_queue_peek(const ty_timer_queue *queue)
+{
+    assert(queue);
+    return queue->count ? queue->nodes[0] : NULL;
+}
+
+ty_timer_queue_node *ty_timer_queue_pop(ty_timer_queue *queue, uint64_t now)
+{
+    assert(queue);
+
+    ty_timer_queue_node *node;
+
+    if (!queue->count || queue->nodes[0]->deadline > now)
+        return NULL;
+
+    node = queue->nodes[0];
+    ty_timer_queue_remove(queue, node);
+
+    return node;
+}
+
+int ty_timer_queue_get_timeout(const ty_timer_queue *queue, uint64_t now)
+{
+    assert(queue);
+
+    uint64_t deadline;
+
+    if (!queue->count)
+        return -1;
+
+    deadline = queue->nodes[0]->deadline;
+    if (deadline <= now)
+        return 0;
+    return deadline - now < INT_MAX ? (int)(deadline - now) : INT_MAX;
+}
@@ -0,0 +1,68 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "common_priv.h"
+#include "timestamp.h"
+
+void ty_line_stamper_init(ty_line_stamper *stamper, uint64_t byte_time)
+{
+    assert(stamper);
+
+    stamper->byte_time = byte_time;
+    ty_line_stamper_reset(stamper);
+}
+
+void ty_line_stamper_reset(ty_line_stamper *stamper)
+{
+    assert(stamper);
+
+    stamper->last_time = 0;
+    stamper->line_start = true;
+}
+
+int ty_line_stamper_process(ty_line_stamper *stamper, const void *buf, size_t len,
+                            uint64_t time, ty_line_stamper_func *f, void *udata)
+{
+    const char *ptr = buf;
+    const char *end = ptr + len;
+    uint64_t span;
+    int r;
+
+    assert(stamper);
+    assert(buf || !len);
+    assert(f);
+
+    if (!len)
+        return 0;
+
+    // The first read has nothing before it, and the clock may be wrong after a reset
+    span = stamper->byte_time * len;
+    if (!stamper->last_time || time < stamper->last_time) {
+        span = 0;
+    } else if (span > time - stamper->last_time) {
+        span = time - stamper->last_time;
+    }
+    stamper->last_time = time;
+
+    while (ptr < end) {
+        const char *nl = memchr(ptr, '\n', (size_t)(end - ptr));
+        const char *part_end = nl ? nl + 1 : end;
+        uint64_t part_time = time - span + span * (uint64_t)(ptr - (const char *)buf) / len;
+
+        r = (*f)(ptr, (size_t)(part_end - ptr), part_time, stamper->line_start, udata);
+        if (r < 0)
+            return r;
+
+        stamper->line_start = !!nl;
+        ptr = part_end;
+    }
+
+    return 0;
+}
@@ -0,0 +1,43 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef TY_TIMESTAMP_H
+#define TY_TIMESTAMP_H
+
+#include "common.h"
+
+TY_C_BEGIN
+
+/* Gives each line of serial data the time its first byte arrived, using the (monotonic)
+   time of each read. When the duration of a byte is known (real serial ports), the bytes of
+   a chunk are spread back over the time it took to receive them, but never before the
+   previous read. USB devices send whole packets at once, use 0 and lines get the time of
+   the read. Times are in microseconds, see ty_micros(). */
+typedef struct ty_line_stamper {
+    uint64_t byte_time;
+
+    uint64_t last_time;
+    bool line_start;
+} ty_line_stamper;
+
+/* Called for each part of a chunk: line_start is true if buf starts a new line, and time is
+   the time of its first byte. */
+typedef int ty_line_stamper_func(const char *buf, size_t len, uint64_t time, bool line_start,
+                                 void *udata);
+
+void ty_line_stamper_init(ty_line_stamper *stamper, uint64_t byte_time);
+void ty_line_stamper_reset(ty_line_stamper *stamper);
+
+int ty_line_stamper_process(ty_line_stamper *stamper, const void *buf, size_t len,
+                            uint64_t time, ty_line_stamper_func *f, void *udata);
+
+TY_C_END
+
+#endif
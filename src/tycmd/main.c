@@ -25,6 +25,7 @@ struct command {
 int identify(int argc, char *argv[]);
 int list(int argc, char *argv[]);
 int monitor(int argc, char *argv[]);
+int probe(int argc, char *argv[]);
 int reset(int argc, char *argv[]);
 int upload(int argc, char *argv[]);
 
@@ -32,6 +33,7 @@ static const struct command commands[] = {
     {"identify", identify, "Identify models compatible with firmware"},
     {"list",     list,     "List available boards"},
     {"monitor",  monitor,  "Open serial (or emulated) connection with board"},
+    {"probe",    probe,    "Measure serial latency and throughput"},
     {"reset",    reset,    "Reset board"},
     {"upload",   upload,   "Upload new firmware"},
     {0}
@@ -202,6 +204,7 @@ int main(int argc, char *argv[])
     }
 
     hs_log_set_handler(ty_libhs_log_handler, NULL);
+    ty_libhs_enable_cache();
     r = ty_models_load_patch(NULL);
     if (r == TY_ERROR_MEMORY)
         return EXIT_FAILURE;
@@ -13,9 +13,14 @@
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
 #endif
+#ifdef __linux__
+    #include <fcntl.h>
+#endif
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
+#include "../libty/frame.h"
 #include "../libty/system.h"
+#include "../libty/timestamp.h"
 #include "main.h"
 
 enum {
@@ -24,16 +29,31 @@ enum {
 };
 
 #define BUFFER_SIZE 8192
+#define BULK_BUFFER_SIZE 131072
+#define BULK_FLUSH_DELAY 50
 #define ERROR_IO_TIMEOUT 5000
+#define SPLICE_SIZE 65536
+#define FRAME_MAX_SIZE 65536
 
 static int monitor_term_flags = 0;
 static hs_serial_config monitor_serial_config = {
     .baudrate = 115200
 };
+static bool monitor_baudrate_set = false;
 static int monitor_directions = DIRECTION_INPUT | DIRECTION_OUTPUT;
 static bool monitor_reconnect = false;
 static int monitor_timeout_eof = 200;
 
+static ty_frame_encoding monitor_frame_encoding = TY_FRAME_ENCODING_NONE;
+static ty_frame_check monitor_frame_check = TY_FRAME_CHECK_NONE;
+static ty_frame_decoder monitor_frame_decoder;
+
+static bool monitor_timestamps = false;
+static uint64_t monitor_start_time;
+static ty_line_stamper monitor_stamper;
+static char monitor_stamp_buf[BULK_BUFFER_SIZE];
+static size_t monitor_stamp_len;
+
 #ifdef _WIN32
 static bool monitor_fake_echo;
 
@@ -47,6 +67,13 @@ static char monitor_input_line[BUFFER_SIZE];
 static ssize_t monitor_input_ret;
 #endif
 
+#ifdef __linux__
+static bool monitor_splice = false;
+static int monitor_splice_pipe[2] = {-1, -1};
+static int monitor_splice_fd = -1;
+static size_t monitor_splice_pending;
+#endif
+
 static void print_monitor_usage(FILE *f)
 {
     fprintf(f, "usage: %s monitor [options]\n\n", tycmd_executable_name);
@@ -56,13 +83,24 @@ static void print_monitor_usage(FILE *f)
 
     fprintf(f, "Monitor options:\n"
                "   -r, --raw                Disable line-buffering and line-editing\n"
-               "   -s, --silent             Disable echoing of local input on terminal\n\n"
+               "   -s, --silent             Disable echoing of local input on terminal\n"
+               "   -T, --timestamps         Prefix each line with the time it was received\n"
+               "                            (in seconds since the start, e.g. [    12.345])\n\n"
                "   -R, --reconnect          Try to reconnect on I/O errors\n"
                "   -D, --direction <dir>    Open serial connection in given direction\n"
                "                            Supports input, output, both (default)\n"
                "       --timeout-eof <ms>   Time before closing after EOF on standard input\n"
                "                            Defaults to %d ms, use -1 to disable\n\n", monitor_timeout_eof);
 
+    fprintf(f, "Framing options:\n"
+               "       --frame <encoding>   Decode binary frames from the serial data\n"
+               "                            Must be one of: none (default), cobs or slip\n"
+               "       --frame-check <crc>  Verify and strip the CRC at the end of each frame\n"
+               "                            Must be one of: none (default), crc16 or crc32\n\n"
+               "Decoded frames are written as length-prefixed records: the payload size as\n"
+               "a 32-bit little-endian integer, followed by the payload. Invalid frames are\n"
+               "counted and dropped.\n\n");
+
     fprintf(f, "Serial settings:\n"
                "   -b, --baudrate <rate>    Use baudrate for serial port\n"
                "                            Default: %u bauds\n"
@@ -73,7 +111,9 @@ static void print_monitor_usage(FILE *f)
                "   -f, --flow <control>     Define flow-control mode\n"
                "                            Must be one of: off, rtscts or xonxoff\n"
                "   -y, --parity <bits>      Change parity mode to use for the serial port\n"
-               "                            Must be one of: off, even, or odd\n\n"
+               "                            Must be one of: off, even, or odd\n"
+               "   -L, --latency <mode>     Trade latency for fewer wakeups (or the reverse)\n"
+               "                            Must be one of: default, interactive or bulk\n\n"
                "These settings are mostly ignored by the USB serial emulation, but you can still\n"
                "access them in your embedded code (e.g. the Serial object API on Teensy).\n",
                monitor_serial_config.baudrate);
@@ -95,6 +135,202 @@ static int redirect_stdout(int *routfd)
     return 0;
 }
 
+#ifdef __linux__
+
+/* Serial data can be moved to pipes and files with splice(), through an intermediate pipe,
+   without ever copying it to user space. This makes a big difference for high-throughput
+   logging. Terminals and files opened in append mode do not support splice(). */
+static int init_splice(int outfd)
+{
+    unsigned int modes;
+    int flags, r;
+
+    if (!(monitor_directions & DIRECTION_INPUT))
+        return 0;
+    if (monitor_frame_encoding != TY_FRAME_ENCODING_NONE || monitor_timestamps)
+        return 0;
+
+    modes = ty_descriptor_get_modes(outfd);
+    if (!(modes & (TY_DESCRIPTOR_MODE_FIFO | TY_DESCRIPTOR_MODE_FILE)))
+        return 0;
+    flags = fcntl(outfd, F_GETFL);
+    if (flags < 0 || flags & O_APPEND)
+        return 0;
+
+    r = pipe2(monitor_splice_pipe, O_CLOEXEC | O_NONBLOCK);
+    if (r < 0)
+        return ty_error(TY_ERROR_SYSTEM, "pipe2() failed: %s", strerror(errno));
+
+    monitor_splice = true;
+    return 0;
+}
+
+static void release_splice(void)
+{
+    if (monitor_splice_pipe[0] >= 0) {
+        close(monitor_splice_pipe[0]);
+        close(monitor_splice_pipe[1]);
+    }
+    monitor_splice = false;
+}
+
+#endif
+
+static ssize_t read_serial(ty_board *board, char *buf, size_t size)
+{
+#ifdef __linux__
+    if (monitor_splice_fd >= 0) {
+        ssize_t r;
+
+        assert(!monitor_splice_pending);
+
+        r = splice(monitor_splice_fd, NULL, monitor_splice_pipe[1], NULL, SPLICE_SIZE,
+                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (r >= 0) {
+            monitor_splice_pending = (size_t)r;
+            return r;
+        }
+
+        switch (errno) {
+            case EAGAIN:
+            case EINTR: {
+                return 0;
+            } break;
+
+            case EINVAL:
+            case ENOSYS: {
+                // Older kernels cannot splice from ttys
+                ty_log(TY_LOG_DEBUG, "Cannot use splice() with serial device, using read()");
+                monitor_splice_fd = -1;
+                monitor_splice = false;
+            } break;
+
+            default: {
+                return ty_error(TY_ERROR_IO, "I/O error while reading from '%s': %s",
+                                ty_board_get_tag(board), strerror(errno));
+            } break;
+        }
+    }
+#endif
+
+    return ty_board_serial_read(board, buf, size, 0);
+}
+
+static int write_output(int outfd, const char *buf, size_t len)
+{
+    ssize_t r;
+
+#ifdef __linux__
+    if (monitor_splice_pending) {
+        while (monitor_splice_pending) {
+            r = splice(monitor_splice_pipe[0], NULL, outfd, NULL, monitor_splice_pending,
+                       SPLICE_F_MOVE);
+            if (r < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EIO)
+                    return ty_error(TY_ERROR_IO, "I/O error on standard output");
+                return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                                strerror(errno));
+            }
+            monitor_splice_pending -= (size_t)r;
+        }
+
+        return 0;
+    }
+#endif
+
+#ifdef _WIN32
+    r = write(outfd, buf, (unsigned int)len);
+#else
+    r = write(outfd, buf, len);
+#endif
+    if (r < 0) {
+        if (errno == EIO)
+            return ty_error(TY_ERROR_IO, "I/O error on standard output");
+        return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
+                        strerror(errno));
+    }
+
+    return 0;
+}
+
+static int write_frame(const uint8_t *frame, size_t len, void *udata)
+{
+    static char record[4 + FRAME_MAX_SIZE];
+    int outfd = *(int *)udata;
+
+    record[0] = (char)(len & 0xFF);
+    record[1] = (char)((len >> 8) & 0xFF);
+    record[2] = (char)((len >> 16) & 0xFF);
+    record[3] = (char)((len >> 24) & 0xFF);
+    memcpy(record + 4, frame, len);
+
+    return write_output(outfd, record, 4 + len);
+}
+
+static int write_stamped(const char *buf, size_t len, uint64_t time, bool line_start,
+                         void *udata)
+{
+    int outfd = *(int *)udata;
+    int r;
+
+    // Make room for the prefix and at least some of the data
+    if (monitor_stamp_len + 64 > sizeof(monitor_stamp_buf)) {
+        r = write_output(outfd, monitor_stamp_buf, monitor_stamp_len);
+        if (r < 0)
+            return r;
+        monitor_stamp_len = 0;
+    }
+
+    if (line_start) {
+        uint64_t ms = (time - monitor_start_time) / 1000;
+
+        monitor_stamp_len += (size_t)snprintf(monitor_stamp_buf + monitor_stamp_len,
+                                              sizeof(monitor_stamp_buf) - monitor_stamp_len,
+                                              "[%6" PRIu64 ".%03u] ", ms / 1000,
+                                              (unsigned int)(ms % 1000));
+    }
+
+    while (len) {
+        size_t part_len = TY_MIN(len, sizeof(monitor_stamp_buf) - monitor_stamp_len);
+
+        memcpy(monitor_stamp_buf + monitor_stamp_len, buf, part_len);
+        monitor_stamp_len += part_len;
+        buf += part_len;
+        len -= part_len;
+
+        if (monitor_stamp_len == sizeof(monitor_stamp_buf)) {
+            r = write_output(outfd, monitor_stamp_buf, monitor_stamp_len);
+            if (r < 0)
+                return r;
+            monitor_stamp_len = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int forward_serial(int outfd, const char *buf, size_t len, uint64_t time)
+{
+    if (monitor_frame_encoding != TY_FRAME_ENCODING_NONE)
+        return ty_frame_decoder_process(&monitor_frame_decoder, buf, len, write_frame, &outfd);
+
+    if (monitor_timestamps) {
+        int r;
+
+        r = ty_line_stamper_process(&monitor_stamper, buf, len, time, write_stamped, &outfd);
+        if (r < 0)
+            return r;
+
+        r = write_output(outfd, monitor_stamp_buf, monitor_stamp_len);
+        monitor_stamp_len = 0;
+        return r;
+    }
+
+    return write_output(outfd, buf, len);
+}
+
 #ifdef _WIN32
 
 static unsigned int __stdcall stdin_thread(void *udata)
@@ -227,6 +463,25 @@ static int fill_descriptor_set(ty_descriptor_set *set, ty_board *board)
 
     if (monitor_directions & DIRECTION_INPUT)
         ty_board_interface_get_descriptors(iface, set, 2);
+
+    /* Spread the lines of each read over the time the bytes took to come in. This only
+       makes sense for real UARTs, the baudrate means nothing to USB CDC devices and their
+       reads must keep the read time as is. */
+    if (ty_board_interface_get_device(iface)->type == HS_DEVICE_TYPE_SERIAL &&
+            monitor_serial_config.baudrate &&
+            (monitor_baudrate_set || ty_board_interface_is_uart_bridge(iface))) {
+        unsigned int bits = 1 + (monitor_serial_config.databits ? monitor_serial_config.databits : 8) +
+                            (monitor_serial_config.parity > HS_SERIAL_CONFIG_PARITY_OFF) +
+                            (monitor_serial_config.stopbits ? monitor_serial_config.stopbits : 1);
+        ty_line_stamper_init(&monitor_stamper, bits * 1000000ull / monitor_serial_config.baudrate);
+    } else {
+        ty_line_stamper_init(&monitor_stamper, 0);
+    }
+#ifdef __linux__
+    monitor_splice_fd = -1;
+    if (monitor_splice && ty_board_interface_get_device(iface)->type == HS_DEVICE_TYPE_SERIAL)
+        monitor_splice_fd = hs_port_get_poll_handle(ty_board_interface_get_handle(iface));
+#endif
 #ifdef _WIN32
     if (monitor_directions & DIRECTION_OUTPUT) {
         if (monitor_input_available) {
@@ -252,22 +507,59 @@ static int loop(ty_board *board, int outfd)
 {
     ty_descriptor_set set = {0};
     int timeout;
-    char buf[BUFFER_SIZE];
+    bool flush;
+    static char buf[BULK_BUFFER_SIZE];
+    size_t read_size;
+    uint64_t read_time;
     ssize_t r;
 
+    read_size = BUFFER_SIZE;
+    if (monitor_serial_config.latency == HS_SERIAL_CONFIG_LATENCY_BULK)
+        read_size = sizeof(buf);
+
 restart:
     r = fill_descriptor_set(&set, board);
     if (r < 0)
         return (int)r;
     timeout = -1;
 
+    /* In bulk mode, the serial descriptor is only signaled once enough data is available.
+       Wake up regularly to pick up what is left in the buffer. */
+    flush = monitor_serial_config.latency == HS_SERIAL_CONFIG_LATENCY_BULK &&
+            (monitor_directions & DIRECTION_INPUT);
+
+    // Whatever was left of the last frame is lost after a reconnection
+    if (monitor_frame_encoding != TY_FRAME_ENCODING_NONE)
+        ty_frame_decoder_reset(&monitor_frame_decoder);
+
     ty_log(TY_LOG_INFO, "Monitoring '%s'", ty_board_get_tag(board));
 
     while (true) {
         if (!set.count)
             return 0;
 
-        r = ty_poll(&set, timeout);
+        if (flush) {
+            uint64_t idle_start;
+            int poll_timeout;
+
+            idle_start = ty_millis();
+            do {
+                poll_timeout = ty_adjust_timeout(timeout, idle_start);
+                if (poll_timeout < 0 || poll_timeout > BULK_FLUSH_DELAY)
+                    poll_timeout = BULK_FLUSH_DELAY;
+
+                r = ty_poll(&set, poll_timeout);
+                if (!r) {
+                    r = read_serial(board, buf, read_size);
+                    if (r) {
+                        // Forward it with the usual code, including error handling
+                        goto serial_data;
+                    }
+                }
+            } while (!r && ty_adjust_timeout(timeout, idle_start));
+        } else {
+            r = ty_poll(&set, timeout);
+        }
         if (r < 0)
             return (int)r;
 
@@ -295,10 +587,13 @@ restart:
             } break;
 
             case 2: {
-                r = ty_board_serial_read(board, buf, sizeof(buf), 0);
+                r = read_serial(board, buf, read_size);
+serial_data:
+                read_time = ty_micros();
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
+                        flush = false;
                         ty_descriptor_set_remove(&set, 2);
                         ty_descriptor_set_remove(&set, 3);
                         break;
@@ -306,17 +601,9 @@ restart:
                     return (int)r;
                 }
 
-#ifdef _WIN32
-                r = write(outfd, buf, (unsigned int)r);
-#else
-                r = write(outfd, buf, (size_t)r);
-#endif
-                if (r < 0) {
-                    if (errno == EIO)
-                        return ty_error(TY_ERROR_IO, "I/O error on standard output");
-                    return ty_error(TY_ERROR_IO, "Failed to write to standard output: %s",
-                                    strerror(errno));
-                }
+                r = forward_serial(outfd, buf, (size_t)r, read_time);
+                if (r < 0)
+                    return (int)r;
             } break;
 
             case 3: {
@@ -331,10 +618,10 @@ restart:
                     ResetEvent(monitor_input_available);
                     SetEvent(monitor_input_processed);
                 } else {
-                    r = read(STDIN_FILENO, buf, sizeof(buf));
+                    r = read(STDIN_FILENO, buf, BUFFER_SIZE);
                 }
 #else
-                r = read(STDIN_FILENO, buf, sizeof(buf));
+                r = read(STDIN_FILENO, buf, BUFFER_SIZE);
 #endif
                 if (r < 0) {
                     if (errno == EIO)
@@ -365,6 +652,7 @@ restart:
                 if (r < 0) {
                     if (r == TY_ERROR_IO && monitor_reconnect) {
                         timeout = ERROR_IO_TIMEOUT;
+                        flush = false;
                         ty_descriptor_set_remove(&set, 2);
                         ty_descriptor_set_remove(&set, 3);
                         break;
@@ -404,6 +692,7 @@ int monitor(int argc, char *argv[])
                 print_monitor_usage(stderr);
                 return EXIT_FAILURE;
             }
+            monitor_baudrate_set = true;
         } else if (strcmp(opt, "--databits") == 0 || strcmp(opt, "-d") == 0) {
             char *value = ty_optline_get_value(&optl);
             if (!value) {
@@ -496,12 +785,71 @@ int monitor(int argc, char *argv[])
                 print_monitor_usage(stderr);
                 return EXIT_FAILURE;
             }
+        } else if (strcmp(opt, "--latency") == 0 || strcmp(opt, "-L") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--latency' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "default") == 0) {
+                monitor_serial_config.latency = HS_SERIAL_CONFIG_LATENCY_DEFAULT;
+            } else if (strcmp(value, "interactive") == 0) {
+                monitor_serial_config.latency = HS_SERIAL_CONFIG_LATENCY_INTERACTIVE;
+            } else if (strcmp(value, "bulk") == 0) {
+                monitor_serial_config.latency = HS_SERIAL_CONFIG_LATENCY_BULK;
+            } else {
+                ty_log(TY_LOG_ERROR, "--latency must be one of: default, interactive or bulk");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--frame") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--frame' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "none") == 0) {
+                monitor_frame_encoding = TY_FRAME_ENCODING_NONE;
+            } else if (strcmp(value, "cobs") == 0) {
+                monitor_frame_encoding = TY_FRAME_ENCODING_COBS;
+            } else if (strcmp(value, "slip") == 0) {
+                monitor_frame_encoding = TY_FRAME_ENCODING_SLIP;
+            } else {
+                ty_log(TY_LOG_ERROR, "--frame must be one of: none, cobs or slip");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--frame-check") == 0) {
+            char *value = ty_optline_get_value(&optl);
+            if (!value) {
+                ty_log(TY_LOG_ERROR, "Option '--frame-check' takes an argument");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
+
+            if (strcmp(value, "none") == 0) {
+                monitor_frame_check = TY_FRAME_CHECK_NONE;
+            } else if (strcmp(value, "crc16") == 0) {
+                monitor_frame_check = TY_FRAME_CHECK_CRC16;
+            } else if (strcmp(value, "crc32") == 0) {
+                monitor_frame_check = TY_FRAME_CHECK_CRC32;
+            } else {
+                ty_log(TY_LOG_ERROR, "--frame-check must be one of: none, crc16 or crc32");
+                print_monitor_usage(stderr);
+                return EXIT_FAILURE;
+            }
         } else if (strcmp(opt, "--raw") == 0 || strcmp(opt, "-r") == 0) {
             monitor_term_flags |= TY_TERMINAL_RAW;
         } else if (strcmp(opt, "--reconnect") == 0 || strcmp(opt, "-R") == 0) {
             monitor_reconnect = true;
         } else if (strcmp(opt, "--silent") == 0 || strcmp(opt, "-s") == 0) {
             monitor_term_flags |= TY_TERMINAL_SILENT;
+        } else if (strcmp(opt, "--timestamps") == 0 || strcmp(opt, "-T") == 0) {
+            monitor_timestamps = true;
         } else if (strcmp(opt, "--timeout-eof") == 0) {
             char *value = ty_optline_get_value(&optl);
             if (!value) {
@@ -529,6 +877,12 @@ int monitor(int argc, char *argv[])
         print_monitor_usage(stderr);
         return EXIT_FAILURE;
     }
+    if (monitor_timestamps && monitor_frame_encoding != TY_FRAME_ENCODING_NONE) {
+        ty_log(TY_LOG_ERROR, "Option '--timestamps' cannot be used with '--frame'");
+        print_monitor_usage(stderr);
+        return EXIT_FAILURE;
+    }
+    monitor_start_time = ty_micros();
 
     if (ty_standard_get_modes(TY_STREAM_INPUT) & TY_DESCRIPTOR_MODE_TERMINAL) {
 #ifdef _WIN32
@@ -561,9 +915,21 @@ int monitor(int argc, char *argv[])
             goto cleanup;
     }
 
+    if (monitor_frame_encoding != TY_FRAME_ENCODING_NONE) {
+        r = ty_frame_decoder_init(&monitor_frame_decoder, monitor_frame_encoding,
+                                  monitor_frame_check, FRAME_MAX_SIZE);
+        if (r < 0)
+            goto cleanup;
+    }
+
     r = redirect_stdout(&outfd);
     if (r < 0)
         goto cleanup;
+#ifdef __linux__
+    r = init_splice(outfd);
+    if (r < 0)
+        goto cleanup;
+#endif
 
     r = get_board(&board);
     if (r < 0)
@@ -575,6 +941,14 @@ cleanup:
 #ifdef _WIN32
     stop_stdin_thread();
 #endif
+#ifdef __linux__
+    release_splice();
+#endif
+    if (monitor_frame_decoder.buf) {
+        ty_log(TY_LOG_INFO, "Decoded %"PRIu64" frames (%"PRIu64" invalid)",
+               monitor_frame_decoder.valid_count, monitor_frame_decoder.invalid_count);
+        ty_frame_decoder_release(&monitor_frame_decoder);
+    }
     ty_board_unref(board);
     return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
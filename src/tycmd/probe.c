@@ -0,0 +1,640 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <termios.h>
+    #include <unistd.h>
+#endif
+#include "../libty/system.h"
+#include "../libty/thread.h"
+#include "main.h"
+
+#define PROBE_HEADER_SIZE 13
+#define PROBE_MAX_PACKET_SIZE 4096
+#define PROBE_STREAM_CHUNK 1024
+#define PROBE_ECHO_TIMEOUT 1000
+#define PROBE_DRAIN_TIMEOUT 200
+#define PROBE_LOOPBACK_WAIT 5
+
+struct probe_target {
+    ty_board *board;
+    ty_board_interface *iface;
+#ifndef _WIN32
+    int fd;
+#endif
+};
+
+struct probe_latency {
+    unsigned int sent;
+    unsigned int received;
+
+    uint64_t min;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t max;
+};
+
+struct probe_throughput {
+    uint64_t duration;
+
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t rx_duration;
+};
+
+static unsigned int probe_count = 1000;
+static unsigned int probe_size = 32;
+static unsigned int probe_duration = 2000;
+#ifndef _WIN32
+static const char *probe_device;
+static bool probe_loopback;
+
+static int probe_loopback_fd = -1;
+static bool probe_loopback_run;
+static ty_thread probe_loopback_thread;
+#endif
+
+static void print_probe_usage(FILE *f)
+{
+    fprintf(f, "usage: %s probe [options]\n\n", tycmd_executable_name);
+
+    print_common_options(f);
+    fprintf(f, "\n");
+
+    fprintf(f, "Probe options:\n"
+               "   -n, --count <count>      Number of round trips to measure (default: %u)\n"
+               "   -s, --size <bytes>       Size of each round trip packet (default: %u)\n"
+               "   -t, --duration <ms>      Duration of the echo throughput test (default: %u)\n"
+               "                            Use 0 to skip the echo throughput test\n\n",
+               probe_count, probe_size, probe_duration);
+#ifndef _WIN32
+    fprintf(f, "Target options:\n"
+               "       --device <path>      Use serial device or pseudo-terminal at <path>\n"
+               "       --loopback           Use an internal pseudo-terminal echo loop\n\n");
+#endif
+
+    fprintf(f, "The target must echo back everything it receives. Results are written to\n"
+               "standard output as a JSON object, latencies are given in microseconds.\n"
+               "Throughput goes through the echo loop and is limited by the slower direction,\n"
+               "it is not a one-way measurement.\n");
+}
+
+#ifndef _WIN32
+
+static int open_probe_device(const char *path, int *rfd)
+{
+    struct termios tio;
+    int fd, r;
+
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "open('%s') failed: %s", path, strerror(errno));
+
+    r = tcgetattr(fd, &tio);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "tcgetattr() failed on '%s': %s", path, strerror(errno));
+        goto error;
+    }
+    cfmakeraw(&tio);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    r = tcsetattr(fd, TCSANOW, &tio);
+    if (r < 0) {
+        r = ty_error(TY_ERROR_SYSTEM, "tcsetattr() failed on '%s': %s", path, strerror(errno));
+        goto error;
+    }
+
+    *rfd = fd;
+    return 0;
+
+error:
+    close(fd);
+    return r;
+}
+
+static int loopback_thread(void *udata)
+{
+    TY_UNUSED(udata);
+
+    struct pollfd pfd;
+    char buf[PROBE_STREAM_CHUNK];
+
+    pfd.fd = probe_loopback_fd;
+    pfd.events = POLLIN;
+
+    while (__atomic_load_n(&probe_loopback_run, __ATOMIC_RELAXED)) {
+        ssize_t len, r;
+
+        r = poll(&pfd, 1, 100);
+        if (r <= 0)
+            continue;
+
+        len = read(probe_loopback_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            if (len < 0 && (errno == EAGAIN || errno == EINTR))
+                continue;
+            break;
+        }
+
+        /* Wait a little for room instead of spinning when the pseudo-terminal is full (pty
+           drivers signal POLLOUT late, so only poll after a failed write), and give up if we
+           are asked to stop while the other side is not reading anymore. */
+        for (ssize_t written = 0; written < len;) {
+            if (!__atomic_load_n(&probe_loopback_run, __ATOMIC_RELAXED))
+                return 0;
+
+            r = write(probe_loopback_fd, buf + written, (size_t)(len - written));
+            if (r < 0) {
+                if (errno == EAGAIN) {
+                    pfd.events = POLLOUT;
+                    r = poll(&pfd, 1, PROBE_LOOPBACK_WAIT);
+                    pfd.events = POLLIN;
+                    if (r < 0 && errno != EINTR)
+                        return 0;
+                    continue;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                return 0;
+            }
+            written += r;
+        }
+    }
+
+    return 0;
+}
+
+static int start_loopback(int *rfd)
+{
+    const char *slave_path;
+    int r;
+
+    probe_loopback_fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (probe_loopback_fd < 0)
+        return ty_error(TY_ERROR_SYSTEM, "posix_openpt() failed: %s", strerror(errno));
+    if (grantpt(probe_loopback_fd) < 0 || unlockpt(probe_loopback_fd) < 0)
+        return ty_error(TY_ERROR_SYSTEM, "Failed to unlock pseudo-terminal: %s", strerror(errno));
+    slave_path = ptsname(probe_loopback_fd);
+    if (!slave_path)
+        return ty_error(TY_ERROR_SYSTEM, "ptsname() failed: %s", strerror(errno));
+
+    r = open_probe_device(slave_path, rfd);
+    if (r < 0)
+        return r;
+
+    probe_loopback_run = true;
+    r = ty_thread_create(&probe_loopback_thread, loopback_thread, NULL);
+    if (r < 0) {
+        probe_loopback_run = false;
+        return r;
+    }
+
+    return 0;
+}
+
+static void stop_loopback(void)
+{
+    if (probe_loopback_run) {
+        __atomic_store_n(&probe_loopback_run, false, __ATOMIC_RELAXED);
+        ty_thread_join(&probe_loopback_thread);
+    }
+    if (probe_loopback_fd >= 0) {
+        close(probe_loopback_fd);
+        probe_loopback_fd = -1;
+    }
+}
+
+#endif
+
+static ssize_t probe_read(struct probe_target *target, char *buf, size_t size, int timeout)
+{
+#ifndef _WIN32
+    if (!target->board) {
+        struct pollfd pfd;
+        ssize_t r;
+
+        pfd.fd = target->fd;
+        pfd.events = POLLIN;
+
+        r = poll(&pfd, 1, timeout);
+        if (r < 0) {
+            if (errno == EINTR)
+                return 0;
+            return ty_error(TY_ERROR_IO, "poll() failed: %s", strerror(errno));
+        }
+        if (!r)
+            return 0;
+
+        r = read(target->fd, buf, size);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                return 0;
+            return ty_error(TY_ERROR_IO, "I/O error while reading from target: %s",
+                            strerror(errno));
+        }
+        return r;
+    }
+#endif
+
+    return ty_board_serial_read(target->board, buf, size, timeout);
+}
+
+static ssize_t probe_write(struct probe_target *target, const char *buf, size_t size)
+{
+#ifndef _WIN32
+    if (!target->board) {
+        struct pollfd pfd;
+        ssize_t r;
+
+        pfd.fd = target->fd;
+        pfd.events = POLLOUT;
+
+        r = poll(&pfd, 1, PROBE_ECHO_TIMEOUT);
+        if (r < 0) {
+            if (errno == EINTR)
+                return 0;
+            return ty_error(TY_ERROR_IO, "poll() failed: %s", strerror(errno));
+        }
+        if (!r)
+            return 0;
+
+        r = write(target->fd, buf, size);
+        if (r < 0) {
+            if (errno == EAGAIN || errno == EINTR)
+                return 0;
+            return ty_error(TY_ERROR_IO, "I/O error while writing to target: %s",
+                            strerror(errno));
+        }
+        return r;
+    }
+#endif
+
+    return ty_board_serial_write(target->board, buf, size);
+}
+
+static int probe_drain(struct probe_target *target, uint64_t *rlen)
+{
+    char buf[PROBE_STREAM_CHUNK];
+    ssize_t r;
+
+    do {
+        r = probe_read(target, buf, sizeof(buf), PROBE_DRAIN_TIMEOUT);
+        if (r < 0)
+            return (int)r;
+        if (rlen)
+            *rlen += (uint64_t)r;
+    } while (r);
+
+    return 0;
+}
+
+static int compare_samples(const void *a, const void *b)
+{
+    uint64_t sample1 = *(const uint64_t *)a;
+    uint64_t sample2 = *(const uint64_t *)b;
+
+    return (sample1 > sample2) - (sample1 < sample2);
+}
+
+static int measure_latency(struct probe_target *target, struct probe_latency *rlatency)
+{
+    uint64_t *samples;
+    char packet[PROBE_MAX_PACKET_SIZE];
+    char echo[PROBE_MAX_PACKET_SIZE];
+    struct probe_latency latency = {0};
+    uint64_t total = 0;
+    int r;
+
+    samples = (uint64_t *)malloc(probe_count * sizeof(*samples));
+    if (!samples)
+        return ty_error(TY_ERROR_MEMORY, NULL);
+
+    r = probe_drain(target, NULL);
+    if (r < 0)
+        goto cleanup;
+
+    for (uint32_t seq = 0; seq < probe_count; seq++) {
+        uint64_t start_millis, start;
+        size_t len;
+
+        start_millis = ty_millis();
+        start = ty_micros();
+
+        /* Each packet starts with a marker byte, the sequence number and the send time,
+           the rest is a pattern derived from the sequence number. */
+        packet[0] = 'P';
+        memcpy(packet + 1, &seq, sizeof(seq));
+        memcpy(packet + 5, &start, sizeof(start));
+        for (size_t i = PROBE_HEADER_SIZE; i < probe_size; i++)
+            packet[i] = (char)('0' + (seq + i) % 64);
+
+        for (len = 0; len < probe_size;) {
+            ssize_t ret = probe_write(target, packet + len, probe_size - len);
+            if (ret < 0) {
+                r = (int)ret;
+                goto cleanup;
+            }
+            if (!ret)
+                break;
+            len += (size_t)ret;
+        }
+        latency.sent++;
+        if (len < probe_size)
+            continue;
+
+        for (len = 0; len < probe_size;) {
+            ssize_t ret = probe_read(target, echo + len, probe_size - len,
+                                     ty_adjust_timeout(PROBE_ECHO_TIMEOUT, start_millis));
+            if (ret < 0) {
+                r = (int)ret;
+                goto cleanup;
+            }
+            if (!ret)
+                break;
+            len += (size_t)ret;
+        }
+        if (len < probe_size || memcmp(packet, echo, probe_size)) {
+            // Out of sync, get rid of late or garbled data before the next round trip
+            r = probe_drain(target, NULL);
+            if (r < 0)
+                goto cleanup;
+            continue;
+        }
+
+        samples[latency.received] = ty_micros() - start;
+        total += samples[latency.received];
+        latency.received++;
+    }
+
+    if (latency.received) {
+        qsort(samples, latency.received, sizeof(*samples), compare_samples);
+
+#define PERCENTILE(p) (samples[(latency.received - 1) * (p) / 100])
+        latency.min = samples[0];
+        latency.mean = total / latency.received;
+        latency.p50 = PERCENTILE(50);
+        latency.p90 = PERCENTILE(90);
+        latency.p99 = PERCENTILE(99);
+        latency.max = samples[latency.received - 1];
+#undef PERCENTILE
+    }
+
+    *rlatency = latency;
+    r = 0;
+cleanup:
+    free(samples);
+    return r;
+}
+
+static int measure_throughput(struct probe_target *target, struct probe_throughput *rthroughput)
+{
+    char chunk[PROBE_STREAM_CHUNK];
+    char buf[PROBE_STREAM_CHUNK];
+    struct probe_throughput throughput = {0};
+    uint64_t start, last_rx;
+    int r;
+
+    for (size_t i = 0; i < sizeof(chunk); i++)
+        chunk[i] = (char)('0' + i % 64);
+
+    r = probe_drain(target, NULL);
+    if (r < 0)
+        return r;
+
+    /* Send as fast as possible and count what comes back at the same time. The target
+       would stall if we did not read the echoed data while writing. Both rates measure the
+       echo loop: the receive rate is capped by the echo path, and the send rate includes
+       what the host buffers. One-way rates would need a sink/source mode on the target. */
+    start = ty_millis();
+    last_rx = start;
+    while (ty_millis() - start < probe_duration) {
+        ssize_t ret;
+
+        ret = probe_write(target, chunk, sizeof(chunk));
+        if (ret < 0)
+            return (int)ret;
+        throughput.tx_bytes += (uint64_t)ret;
+
+        do {
+            ret = probe_read(target, buf, sizeof(buf), 0);
+            if (ret < 0)
+                return (int)ret;
+            if (ret) {
+                throughput.rx_bytes += (uint64_t)ret;
+                last_rx = ty_millis();
+            }
+        } while (ret);
+    }
+    throughput.duration = ty_millis() - start;
+
+    // Collect what is still in flight to get an accurate receive rate
+    while (true) {
+        ssize_t ret = probe_read(target, buf, sizeof(buf), PROBE_DRAIN_TIMEOUT);
+        if (ret < 0)
+            return (int)ret;
+        if (!ret)
+            break;
+
+        throughput.rx_bytes += (uint64_t)ret;
+        last_rx = ty_millis();
+    }
+    throughput.rx_duration = last_rx - start;
+
+    *rthroughput = throughput;
+    return 0;
+}
+
+static uint64_t bytes_per_second(uint64_t bytes, uint64_t duration)
+{
+    return duration ? bytes * 1000 / duration : 0;
+}
+
+static void print_results(const char *target_name, const struct probe_latency *latency,
+                          const struct probe_throughput *throughput)
+{
+    printf("{\"target\": \"");
+    for (const char *ptr = target_name; *ptr; ptr++) {
+        if (*ptr == '"' || *ptr == '\\')
+            putchar('\\');
+        putchar(*ptr);
+    }
+    printf("\"");
+
+    printf(", \"latency\": {\"size\": %u, \"sent\": %u, \"received\": %u, \"lost\": %u",
+           probe_size, latency->sent, latency->received, latency->sent - latency->received);
+    if (latency->received)
+        printf(", \"min\": %" PRIu64 ", \"mean\": %" PRIu64 ", \"p50\": %" PRIu64
+               ", \"p90\": %" PRIu64 ", \"p99\": %" PRIu64 ", \"max\": %" PRIu64,
+               latency->min, latency->mean, latency->p50, latency->p90, latency->p99,
+               latency->max);
+    printf("}");
+
+    if (throughput) {
+        printf(", \"throughput\": {\"duration\": %" PRIu64 ", \"echo_tx_bytes\": %" PRIu64
+               ", \"echo_tx_rate\": %" PRIu64 ", \"echo_rx_bytes\": %" PRIu64
+               ", \"echo_rx_rate\": %" PRIu64 "}",
+               throughput->duration, throughput->tx_bytes,
+               bytes_per_second(throughput->tx_bytes, throughput->duration),
+               throughput->rx_bytes,
+               bytes_per_second(throughput->rx_bytes, throughput->rx_duration));
+    }
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+static bool parse_probe_number(ty_optline_context *optl, const char *name,
+                               unsigned int min, unsigned int max, unsigned int *rvalue)
+{
+    char *value, *end;
+    unsigned long number;
+
+    value = ty_optline_get_value(optl);
+    if (!value) {
+        ty_log(TY_LOG_ERROR, "Option '%s' takes an argument", name);
+        return false;
+    }
+
+    errno = 0;
+    number = strtoul(value, &end, 10);
+    if (errno || end == value || *end || number < min || number > max) {
+        ty_log(TY_LOG_ERROR, "%s requires a number between %u and %u", name, min, max);
+        return false;
+    }
+
+    *rvalue = (unsigned int)number;
+    return true;
+}
+
+int probe(int argc, char *argv[])
+{
+    ty_optline_context optl;
+    char *opt;
+    struct probe_target target = {0};
+    const char *target_name;
+    struct probe_latency latency = {0};
+    struct probe_throughput throughput = {0};
+    int r;
+
+#ifndef _WIN32
+    target.fd = -1;
+#endif
+
+    ty_optline_init_argv(&optl, argc, argv);
+    while ((opt = ty_optline_next_option(&optl))) {
+        if (strcmp(opt, "--help") == 0) {
+            print_probe_usage(stdout);
+            return EXIT_SUCCESS;
+        } else if (strcmp(opt, "--count") == 0 || strcmp(opt, "-n") == 0) {
+            if (!parse_probe_number(&optl, "--count", 1, 10000000, &probe_count)) {
+                print_probe_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--size") == 0 || strcmp(opt, "-s") == 0) {
+            if (!parse_probe_number(&optl, "--size", PROBE_HEADER_SIZE, PROBE_MAX_PACKET_SIZE,
+                                    &probe_size)) {
+                print_probe_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--duration") == 0 || strcmp(opt, "-t") == 0) {
+            if (!parse_probe_number(&optl, "--duration", 0, 3600000, &probe_duration)) {
+                print_probe_usage(stderr);
+                return EXIT_FAILURE;
+            }
+#ifndef _WIN32
+        } else if (strcmp(opt, "--device") == 0) {
+            probe_device = ty_optline_get_value(&optl);
+            if (!probe_device) {
+                ty_log(TY_LOG_ERROR, "Option '--device' takes an argument");
+                print_probe_usage(stderr);
+                return EXIT_FAILURE;
+            }
+        } else if (strcmp(opt, "--loopback") == 0) {
+            probe_loopback = true;
+#endif
+        } else if (!parse_common_option(&optl, opt)) {
+            print_probe_usage(stderr);
+            return EXIT_FAILURE;
+        }
+    }
+    if (ty_optline_consume_non_option(&optl)) {
+        ty_log(TY_LOG_ERROR, "No positional argument is allowed");
+        print_probe_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+#ifndef _WIN32
+    if (probe_device && probe_loopback) {
+        ty_log(TY_LOG_ERROR, "Options '--device' and '--loopback' are mutually exclusive");
+        print_probe_usage(stderr);
+        return EXIT_FAILURE;
+    }
+
+    if (probe_loopback) {
+        r = start_loopback(&target.fd);
+        if (r < 0)
+            goto cleanup;
+        target_name = "loopback";
+    } else if (probe_device) {
+        r = open_probe_device(probe_device, &target.fd);
+        if (r < 0)
+            goto cleanup;
+        target_name = probe_device;
+    } else
+#endif
+    {
+        r = get_board(&target.board);
+        if (r < 0)
+            goto cleanup;
+
+        // Keep the interface open between reads and writes
+        r = ty_board_open_interface(target.board, TY_BOARD_CAPABILITY_SERIAL, &target.iface);
+        if (r < 0)
+            goto cleanup;
+        if (!r) {
+            r = ty_error(TY_ERROR_MODE, "Board '%s' is not available for serial I/O",
+                         ty_board_get_tag(target.board));
+            goto cleanup;
+        }
+        target_name = ty_board_get_tag(target.board);
+    }
+
+    ty_log(TY_LOG_INFO, "Measuring round trip latency with %u packets of %u bytes",
+           probe_count, probe_size);
+    r = measure_latency(&target, &latency);
+    if (r < 0)
+        goto cleanup;
+
+    if (probe_duration) {
+        ty_log(TY_LOG_INFO, "Measuring echo throughput for %u ms", probe_duration);
+        r = measure_throughput(&target, &throughput);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    print_results(target_name, &latency, probe_duration ? &throughput : NULL);
+
+    if (!latency.received)
+        r = ty_error(TY_ERROR_IO, "No echo received from '%s'", target_name);
+
+cleanup:
+#ifndef _WIN32
+    if (target.fd >= 0)
+        close(target.fd);
+    stop_loopback();
+#endif
+    ty_board_interface_close(target.iface);
+    ty_board_unref(target.board);
+    return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -11,43 +11,81 @@
 #include <QCoreApplication>
 #include <QDateTime>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFileInfo>
+#include <QFontInfo>
 #include <QMutexLocker>
-#include <QPlainTextDocumentLayout>
-#include <QTextBlock>
-#include <QTextCursor>
 
 #include "board.hpp"
 #include "../libhs/device.h"
 #include "../libhs/serial.h"
 #include "../libty/class.h"
+#include "../libty/system.h"
 #include "database.hpp"
 #include "monitor.hpp"
 
 using namespace std;
 
 #define MAX_RECENT_FIRMWARES 4
-#define SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+#define SERIAL_LOG_RING_SIZE 4194304
+#define SERIAL_RING_SIZE 1048576
+#define SERIAL_READ_SIZE 65536
+#define SERIAL_DECODE_GROWTH 3
+#define SERIAL_SPILL_CHUNK 1048576
+#define SERIAL_BULK_FLUSH_DELAY 50
+#define SERIAL_FRAME_MAX_SIZE 4096
+#define SERIAL_SCROLLBACK_SIZE 10000000
+#define SERIAL_SCROLLBACK_MIN_SIZE 100000
+#define SERIAL_SCROLLBACK_MAX_SIZE 999999000
+// Used to convert the old line-based limit, 200000 lines used to be the default
+#define SERIAL_SCROLLBACK_LINE_SIZE 50
+#define SERIAL_PLOT_SIZE 1048576
+#define SERIAL_LOG_ANCHOR_INTERVAL 60000
+
+static const char *const serial_latency_names[] = {
+    nullptr,
+    "default",
+    "interactive",
+    "bulk"
+};
+
+static const char *const serial_overflow_names[] = {
+    "drop-oldest",
+    "block",
+    "spill"
+};
 
 Board::Board(ty_board *board, QObject *parent)
-    : QObject(parent), board_(ty_board_ref(board))
+    : QObject(parent), board_(ty_board_ref(board)), serial_ring_(SERIAL_RING_SIZE),
+      serial_buffer_(SERIAL_SCROLLBACK_SIZE), serial_samples_(SERIAL_PLOT_SIZE)
 {
-    serial_document_.setDocumentLayout(new QPlainTextDocumentLayout(&serial_document_));
-    serial_document_.setUndoRedoEnabled(false);
+    ty_line_stamper_init(&serial_stamper_, 0);
+    ty_line_stamper_init(&serial_log_stamper_, 0);
+    serial_clock_offset_ = QDateTime::currentMSecsSinceEpoch() * 1000 -
+                           static_cast<int64_t>(ty_micros());
+
+    serial_log_ = make_shared<SerialLog>(SERIAL_LOG_RING_SIZE);
+    connect(serial_log_.get(), &SerialLog::writeFailed, this, [=](const QString &msg) {
+        ty_log(TY_LOG_ERROR, "%s", msg.toUtf8().constData());
+        notifyLog(TY_LOG_ERROR, msg);
+        emit settingsChanged();
+    });
+    connect(serial_log_.get(), &SerialLog::overrun, this, [=](quint64 lost) {
+        ty_log(TY_LOG_WARNING, "Serial log of '%s' cannot keep up, lost %llu bytes",
+               ty_board_get_tag(board_), static_cast<unsigned long long>(lost));
+    });
 
-    /* Doing font changes in Board is ugly, but the whole shared serial document thing
-       we do is ugly and will need to change eventually. */
-    {
-        QFont font("monospace", 9);
-        if (!QFontInfo(font).fixedPitch()) {
-            font.setStyleHint(QFont::Monospace);
-            if (!QFontInfo(font).fixedPitch())
-                font.setStyleHint(QFont::TypeWriter);
-        }
-        serial_document_.setDefaultFont(font);
+    /* Doing font changes in Board is ugly, but the views share the serial buffer and
+       they need to agree on the font (SerialView assumes a fixed pitch). */
+    serial_font_ = QFont("monospace", 9);
+    if (!QFontInfo(serial_font_).fixedPitch()) {
+        serial_font_.setStyleHint(QFont::Monospace);
+        if (!QFontInfo(serial_font_).fixedPitch())
+            serial_font_.setStyleHint(QFont::TypeWriter);
     }
 
-    // The monitor will move the serial notifier to a dedicated thread
+    /* The monitor will move the serial notifier to a dedicated thread. The bulk mode flush
+       (see applySerialLatency()) goes through the notifier too, so it runs there as well. */
     connect(&serial_notifier_, &DescriptorNotifier::activated, this, &Board::serialReceived,
             Qt::DirectConnection);
 
@@ -59,6 +97,7 @@ Board::Board(ty_board *board, QObject *parent)
 Board::~Board()
 {
     ty_board_interface_close(serial_iface_);
+    ty_frame_decoder_release(&serial_frame_decoder_);
     ty_board_unref(board_);
 }
 
@@ -86,9 +125,22 @@ void Board::loadSettings(Monitor *monitor)
         serial_codec_name_ = "UTF-8";
         serial_codec_ = QTextCodec::codecForName("UTF-8");
     }
-    serial_decoder_.reset(serial_codec_->makeDecoder());
+    serial_decoder_.setCodec(serial_codec_);
     clear_on_reset_ = db_.get("clearOnReset", false).toBool();
-    serial_document_.setMaximumBlockCount(db_.get("scrollBackLimit", 200000).toInt());
+    {
+        // Older versions limited the scrollback in lines ("scrollBackLimit"), convert it once
+        auto old_limit = db_.get("scrollBackLimit");
+        if (old_limit.isValid()) {
+            if (!db_.get("scrollBackSize").isValid()) {
+                qulonglong size = old_limit.toULongLong() * SERIAL_SCROLLBACK_LINE_SIZE;
+                size = qBound<qulonglong>(SERIAL_SCROLLBACK_MIN_SIZE, size,
+                                          SERIAL_SCROLLBACK_MAX_SIZE);
+                db_.put("scrollBackSize", size);
+            }
+            db_.remove("scrollBackLimit");
+        }
+    }
+    serial_buffer_.setLimit(db_.get("scrollBackSize", SERIAL_SCROLLBACK_SIZE).toULongLong());
     {
         bool default_serial;
         if (model() != TY_MODEL_GENERIC && monitor) {
@@ -98,9 +150,57 @@ void Board::loadSettings(Monitor *monitor)
         }
         enable_serial_ = db_.get("enableSerial", default_serial).toBool();
     }
+    {
+        auto latency_name = db_.get("serialLatency", "default").toString();
+
+        serial_latency_ = HS_SERIAL_CONFIG_LATENCY_DEFAULT;
+        for (unsigned int i = 1; i < TY_COUNTOF(serial_latency_names); i++) {
+            if (latency_name == serial_latency_names[i]) {
+                serial_latency_ = static_cast<hs_serial_config_latency>(i);
+                break;
+            }
+        }
+    }
+    {
+        auto overflow_name = db_.get("serialOverflow", "drop-oldest").toString();
+
+        serial_overflow_ = SERIAL_OVERFLOW_DROP_OLDEST;
+        for (unsigned int i = 0; i < TY_COUNTOF(serial_overflow_names); i++) {
+            if (overflow_name == serial_overflow_names[i]) {
+                serial_overflow_ = static_cast<SerialOverflow>(i);
+                break;
+            }
+        }
+    }
+    {
+        auto encoding_name = db_.get("serialFrame", "none").toString();
+        auto check_name = db_.get("serialFrameCheck", "none").toString();
+
+        serial_frame_encoding_ = TY_FRAME_ENCODING_NONE;
+        for (int i = TY_FRAME_ENCODING_NONE; i <= TY_FRAME_ENCODING_SLIP; i++) {
+            auto encoding = static_cast<ty_frame_encoding>(i);
+            if (encoding_name == ty_frame_encoding_get_name(encoding)) {
+                serial_frame_encoding_ = encoding;
+                break;
+            }
+        }
+        serial_frame_check_ = TY_FRAME_CHECK_NONE;
+        for (int i = TY_FRAME_CHECK_NONE; i <= TY_FRAME_CHECK_CRC32; i++) {
+            auto check = static_cast<ty_frame_check>(i);
+            if (check_name == ty_frame_check_get_name(check)) {
+                serial_frame_check_ = check;
+                break;
+            }
+        }
+        applySerialFrame();
+    }
     serial_log_size_ = db_.get(
         "serialLogSize",
         static_cast<quint64>(monitor ? monitor->serialLogSize() : 0)).toULongLong();
+    serial_plot_ = db_.get("serialPlot", false).toBool();
+    serial_filters_ = db_.get("serialFilters", QStringList()).toStringList();
+    applySerialFilters();
+    serial_timestamps_ = db_.get("serialTimestamps", false).toBool();
 
     /* Even if the user decides to enable persistence for ambiguous identifiers,
        we still don't want to cache the board model. */
@@ -136,6 +236,21 @@ bool Board::updateSerialInterface()
     return true;
 }
 
+size_t Board::memoryUsage() const
+{
+    size_t usage = sizeof(*this);
+
+    if (serial_ring_.isAllocated())
+        usage += serial_ring_.capacity();
+    usage += serial_buffer_.memoryUsage();
+    usage += serial_log_->memoryUsage();
+    usage += serial_samples_.memoryUsage();
+    if (serial_frame_decoder_.buf)
+        usage += SERIAL_FRAME_MAX_SIZE;
+
+    return usage;
+}
+
 bool Board::matchesTag(const QString &id)
 {
     return ty_board_matches_tag(board_, id.toLocal8Bit().constData());
@@ -377,16 +492,14 @@ TaskInterface Board::sendFile(const QString &filename)
 
 void Board::appendFakeSerialRead(const QString &s)
 {
-    if (serial_log_file_.isOpen()) {
+    if (serial_log_->isOpen()) {
         auto buf = serial_codec_->fromUnicode(s);
         QMutexLocker locker(&serial_lock_);
-        writeToSerialLog(buf.constData(), buf.size());
+        logSerialData(buf.constData(), static_cast<size_t>(buf.size()), ty_micros());
         locker.unlock();
     }
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(s);
+    serial_buffer_.append(s.toUtf8());
 }
 
 void Board::setTag(const QString &tag)
@@ -448,7 +561,10 @@ void Board::setSerialCodecName(QString codec_name)
 
     serial_codec_name_ = codec_name;
     serial_codec_ = codec;
-    serial_decoder_.reset(serial_codec_->makeDecoder());
+    {
+        QMutexLocker locker(&serial_lock_);
+        serial_decoder_.setCodec(serial_codec_);
+    }
 
     db_.put("serialCodec", codec_name);
     emit settingsChanged();
@@ -465,14 +581,14 @@ void Board::setClearOnReset(bool clear_on_reset)
     emit settingsChanged();
 }
 
-void Board::setScrollBackLimit(unsigned int limit)
+void Board::setScrollBackSize(size_t size)
 {
-    if (static_cast<int>(limit) == serial_document_.maximumBlockCount())
+    if (size == serial_buffer_.limit())
         return;
 
-    serial_document_.setMaximumBlockCount(static_cast<int>(limit));
+    serial_buffer_.setLimit(size);
 
-    db_.put("scrollBackLimit", limit);
+    db_.put("scrollBackSize", static_cast<qulonglong>(size));
     emit settingsChanged();
 }
 
@@ -489,6 +605,51 @@ void Board::setEnableSerial(bool enable, bool persist)
     emit settingsChanged();
 }
 
+void Board::setSerialLatency(hs_serial_config_latency latency)
+{
+    if (latency == serial_latency_ || !latency ||
+            static_cast<size_t>(latency) >= TY_COUNTOF(serial_latency_names))
+        return;
+
+    serial_latency_ = latency;
+    applySerialLatency();
+
+    db_.put("serialLatency", serial_latency_names[latency]);
+    emit settingsChanged();
+}
+
+void Board::setSerialFrame(ty_frame_encoding encoding, ty_frame_check check)
+{
+    if (encoding == serial_frame_encoding_ && check == serial_frame_check_)
+        return;
+
+    serial_frame_encoding_ = encoding;
+    serial_frame_check_ = check;
+    applySerialFrame();
+
+    db_.put("serialFrame", ty_frame_encoding_get_name(encoding));
+    db_.put("serialFrameCheck", ty_frame_check_get_name(check));
+    emit settingsChanged();
+}
+
+void Board::setSerialOverflow(SerialOverflow overflow)
+{
+    if (overflow == serial_overflow_ ||
+            static_cast<size_t>(overflow) >= TY_COUNTOF(serial_overflow_names))
+        return;
+
+    QMutexLocker locker(&serial_lock_);
+    serial_overflow_ = overflow;
+    locker.unlock();
+
+    // The previous policy may have suspended reading
+    if (serial_blocked_.exchange(false))
+        serial_notifier_.setEnabled(true);
+
+    db_.put("serialOverflow", serial_overflow_names[overflow]);
+    emit settingsChanged();
+}
+
 void Board::setSerialLogSize(size_t size)
 {
     if (size == serial_log_size_)
@@ -501,6 +662,50 @@ void Board::setSerialLogSize(size_t size)
     emit settingsChanged();
 }
 
+void Board::setSerialPlot(bool enable)
+{
+    if (enable == serial_plot_)
+        return;
+
+    // Start from scratch, the old samples are stale now (and useless if we stop plotting)
+    QMutexLocker locker(&serial_lock_);
+    serial_samples_.release();
+    serial_plot_ = enable;
+    locker.unlock();
+
+    db_.put("serialPlot", enable);
+    emit settingsChanged();
+}
+
+void Board::setSerialFilters(const QStringList &filters)
+{
+    if (filters == serial_filters_)
+        return;
+
+    serial_filters_ = filters;
+    applySerialFilters();
+
+    db_.put("serialFilters", filters);
+    emit settingsChanged();
+}
+
+void Board::setSerialTimestamps(bool enable)
+{
+    if (enable == serial_timestamps_)
+        return;
+
+    // Start with a fresh anchor in the log, and don't stamp the middle of a line
+    QMutexLocker locker(&serial_lock_);
+    serial_timestamps_ = enable;
+    ty_line_stamper_reset(&serial_stamper_);
+    ty_line_stamper_reset(&serial_log_stamper_);
+    serial_log_anchor_ = 0;
+    locker.unlock();
+
+    db_.put("serialTimestamps", enable);
+    emit settingsChanged();
+}
+
 TaskInterface Board::startUpload(const QString &filename)
 {
     auto task = upload(filename);
@@ -573,88 +778,312 @@ void Board::serialReceived(ty_descriptor desc)
 
     QMutexLocker locker(&serial_lock_);
 
+    // In block mode, appendSerialData() resumes reading once it has made room
+    if (serial_blocked_)
+        return;
+
+    // SerialPool uses this to spread busy boards across threads
+    QElapsedTimer busy_timer;
+    busy_timer.start();
+
     ty_error_mask(TY_ERROR_MODE);
     ty_error_mask(TY_ERROR_IO);
 
-    size_t previous_len = serial_buf_len_;
+    bool failed = false;
     /* On OSX El Capitan (at least), serial device reads are often partial (512 and 1020 bytes
        reads happen pretty often), so try hard to empty the OS buffer. The Qt event loop may not
        give us back control before some time, and we want to avoid buffer overruns. */
     for (unsigned int i = 0; i < 4; i++) {
-        if (serial_buf_len_ == sizeof(serial_buf_))
-            break;
+        char buf[SERIAL_READ_SIZE];
+        size_t read_size = sizeof(buf);
+
+        /* Leave what we cannot store in the OS buffer, the device will have to wait. Decoding
+           can make the data up to three times larger (e.g. U+FFFD replacements). */
+        if (serial_overflow_ == SERIAL_OVERFLOW_BLOCK && !serial_spilling_) {
+            size_t room = serial_ring_.available() / SERIAL_DECODE_GROWTH;
+            if (!room) {
+                serial_blocked_ = true;
+                break;
+            }
+            if (!serial_frame_decoder_.buf)
+                read_size = min(read_size, room);
+        }
 
-        int r = ty_board_serial_read(board_, serial_buf_ + serial_buf_len_,
-                                     sizeof(serial_buf_) - serial_buf_len_, 0);
+        int r = ty_board_serial_read(board_, buf, read_size, 0);
         if (r < 0) {
-            serial_notifier_.clear();
+            failed = true;
             break;
         }
         if (!r)
             break;
-        serial_buf_len_ += static_cast<size_t>(r);
+        // Take the time now, anything later would include our own processing delays
+        uint64_t time = ty_micros();
+
+        if (serial_frame_decoder_.buf) {
+            // Frames are rendered and logged by decodeSerialFrames(), raw data is dropped
+            decodeSerialFrames(buf, static_cast<size_t>(r));
+        } else {
+            logSerialData(buf, static_cast<size_t>(r), time);
+
+            // Decode here so the GUI thread only has to copy and index lines
+            size_t len;
+            const char *utf8 = serial_decoder_.decode(buf, static_cast<size_t>(r), &len);
+            if (len)
+                pushSerialData(utf8, len, time);
+        }
     }
 
     ty_error_unmask();
     ty_error_unmask();
 
-    if (serial_log_file_.isOpen())
-        writeToSerialLog(serial_buf_ + previous_len, serial_buf_len_ - previous_len);
-
+    serial_busy_ += static_cast<uint64_t>(busy_timer.nsecsElapsed());
+    bool blocked = serial_blocked_;
     locker.unlock();
 
-    if (!previous_len && serial_buf_len_)
-        QMetaObject::invokeMethod(this, "appendBufferToSerialDocument", Qt::QueuedConnection);
+    /* If we run in the serial thread, this takes effect immediately, before the GUI thread
+       gets a chance to enable it again. Never do this with serial_lock_ held: from another
+       thread, the notifier blocks until its own thread is done, and that thread may be
+       waiting for the lock in this very function. */
+    if (failed) {
+        serial_notifier_.clear();
+    } else if (blocked) {
+        serial_notifier_.setEnabled(false);
+    }
 }
 
 // You need to lock serial_lock_ before you call this
-void Board::writeToSerialLog(const char *buf, size_t len)
+void Board::pushSerialData(const char *buf, size_t len, uint64_t time)
 {
-    serial_log_file_.unsetError();
+    if (serial_filter_.isActive()) {
+        serial_filtered_.clear();
+        serial_filter_.process(buf, len, &serial_filtered_);
+        if (serial_filtered_.empty())
+            return;
+
+        buf = serial_filtered_.data();
+        len = serial_filtered_.size();
+    }
 
-    qint64 pos = serial_log_file_.pos();
-    if (pos + len > serial_log_size_) {
-        auto part_len = serial_log_size_ - pos;
-        serial_log_file_.write(buf, part_len);
-        serial_log_file_.seek(0);
-        serial_log_file_.write(buf + part_len, len - part_len);
-    } else {
-        serial_log_file_.write(buf, len);
+    // Filter first, hidden lines would only cost the stamper some time
+    if (serial_timestamps_) {
+        serial_stamped_.clear();
+        ty_line_stamper_process(&serial_stamper_, buf, len, time,
+                                [](const char *part, size_t part_len, uint64_t part_time,
+                                   bool line_start, void *udata) {
+            auto self = static_cast<Board *>(udata);
+
+            if (line_start) {
+                char marker[SERIAL_BUFFER_TIMESTAMP_SIZE];
+                uint64_t wall_time = part_time + static_cast<uint64_t>(self->serial_clock_offset_);
+                self->serial_stamped_.append(marker, SerialBuffer::encodeTimestamp(wall_time, marker));
+            }
+            self->serial_stamped_.append(part, part_len);
+
+            return 0;
+        }, this);
+
+        buf = serial_stamped_.data();
+        len = serial_stamped_.size();
     }
 
-    if (!serial_log_file_.atEnd()) {
-        pos = serial_log_file_.pos();
-        if (pos + sizeof(SERIAL_LOG_DELIMITER) >= serial_log_size_) {
-            serial_log_file_.resize(pos);
-            serial_log_file_.seek(0);
-        } else {
-            serial_log_file_.write(SERIAL_LOG_DELIMITER);
-            serial_log_file_.seek(pos);
+    // Parse on the serial thread, the GUI thread only reads the rings when it paints
+    if (serial_plot_)
+        serial_samples_.parse(buf, len);
+
+    // Once we start spilling, everything goes to the spill file until the GUI catches up
+    if (serial_spilling_) {
+        spillSerialData(buf, len);
+    } else {
+        switch (serial_overflow_) {
+            case SERIAL_OVERFLOW_DROP_OLDEST: {
+                size_t dropped = serial_ring_.overwrite(buf, len);
+                if (dropped) {
+                    serial_dropped_ += dropped;
+                    serial_overruns_++;
+                }
+            } break;
+
+            case SERIAL_OVERFLOW_BLOCK: {
+                size_t written = serial_ring_.write(buf, len);
+                if (written < len) {
+                    serial_dropped_ += len - written;
+                    serial_overruns_++;
+                }
+            } break;
+
+            case SERIAL_OVERFLOW_SPILL: {
+                size_t written = serial_ring_.write(buf, len);
+                if (written < len)
+                    spillSerialData(buf + written, len - written);
+            } break;
         }
     }
 
-    if (serial_log_file_.error() != QFileDevice::NoError) {
-        auto error_msg = QString("Closed serial log file after error: %1")
-                         .arg(serial_log_file_.errorString());
-        ty_log(TY_LOG_ERROR, "%s", error_msg.toUtf8().constData());
-        QMetaObject::invokeMethod(this, "notifyLog", Qt::QueuedConnection,
-                                  Q_ARG(ty_log_level, TY_LOG_ERROR), Q_ARG(QString, error_msg));
+    if (!serial_pending_.exchange(true))
+        QMetaObject::invokeMethod(this, "appendSerialData", Qt::QueuedConnection);
+}
 
-        serial_log_file_.close();
-        emit settingsChanged();
+/* With timestamps, each line of the log starts with the number of milliseconds since the
+   previous line (e.g. "+12 "). Anchor lines give the absolute time (e.g. "@1700000000000",
+   in milliseconds since the epoch), at the start and then every minute, so that deltas can
+   be resolved from any point of the log. You need to lock serial_lock_ before you call
+   this. */
+void Board::logSerialData(const char *buf, size_t len, uint64_t time)
+{
+    if (!serial_log_->isOpen())
+        return;
+    if (!serial_timestamps_) {
+        serial_log_->append(buf, len);
+        return;
     }
+
+    serial_stamped_.clear();
+    ty_line_stamper_process(&serial_log_stamper_, buf, len, time,
+                            [](const char *part, size_t part_len, uint64_t part_time,
+                               bool line_start, void *udata) {
+        auto self = static_cast<Board *>(udata);
+
+        if (line_start) {
+            char prefix[48];
+
+            uint64_t ms = part_time / 1000;
+            if (!self->serial_log_anchor_ ||
+                    ms - self->serial_log_anchor_ >= SERIAL_LOG_ANCHOR_INTERVAL) {
+                uint64_t wall_ms = (part_time + static_cast<uint64_t>(self->serial_clock_offset_)) / 1000;
+                int prefix_len = snprintf(prefix, sizeof(prefix), "@%llu\n",
+                                          static_cast<unsigned long long>(wall_ms));
+                self->serial_stamped_.append(prefix, static_cast<size_t>(prefix_len));
+
+                self->serial_log_anchor_ = ms;
+                self->serial_log_last_ = ms;
+            }
+
+            int prefix_len = snprintf(prefix, sizeof(prefix), "+%llu ",
+                                      static_cast<unsigned long long>(ms - self->serial_log_last_));
+            self->serial_stamped_.append(prefix, static_cast<size_t>(prefix_len));
+            self->serial_log_last_ = ms;
+        }
+        self->serial_stamped_.append(part, part_len);
+
+        return 0;
+    }, this);
+
+    serial_log_->append(serial_stamped_.data(), serial_stamped_.size());
 }
 
-void Board::appendBufferToSerialDocument()
+// You need to lock serial_lock_ before you call this
+void Board::spillSerialData(const char *buf, size_t len)
 {
-    QMutexLocker locker(&serial_lock_);
-    auto str = serial_decoder_->toUnicode(serial_buf_, static_cast<int>(serial_buf_len_));
-    serial_buf_len_ = 0;
-    locker.unlock();
+    QMutexLocker locker(&serial_spill_lock_);
+
+    // The GUI thread may have emptied the spill file since we last checked
+    if (!serial_spilling_) {
+        size_t written = serial_ring_.write(buf, len);
+        buf += written;
+        len -= written;
+        if (!len)
+            return;
+    }
+
+    if (!serial_spill_file_.isOpen() && !serial_spill_file_.open()) {
+        serial_dropped_ += len;
+        serial_overruns_++;
+        return;
+    }
+    serial_spill_file_.seek(serial_spill_file_.size());
+    if (serial_spill_file_.write(buf, static_cast<qint64>(len)) != static_cast<qint64>(len)) {
+        serial_dropped_ += len;
+        serial_overruns_++;
+        return;
+    }
+
+    serial_spilled_ += len;
+    serial_spilling_ = true;
+}
+
+/* Valid frames are rendered as hexadecimal lines, and logged as length-prefixed records
+   (32-bit little-endian size followed by the payload). Invalid frames are only counted by
+   the decoder. You need to lock serial_lock_ before you call this. */
+void Board::decodeSerialFrames(const char *buf, size_t len)
+{
+    ty_frame_decoder_process(&serial_frame_decoder_, buf, len,
+                             [](const uint8_t *frame, size_t frame_len, void *udata) {
+        static const char hex_digits[] = "0123456789ABCDEF";
+        auto self = static_cast<Board *>(udata);
+
+        if (self->serial_log_->isOpen()) {
+            char record[4 + SERIAL_FRAME_MAX_SIZE];
+
+            record[0] = static_cast<char>(frame_len & 0xFF);
+            record[1] = static_cast<char>((frame_len >> 8) & 0xFF);
+            record[2] = static_cast<char>((frame_len >> 16) & 0xFF);
+            record[3] = static_cast<char>((frame_len >> 24) & 0xFF);
+            memcpy(record + 4, frame, frame_len);
+
+            self->serial_log_->append(record, 4 + frame_len);
+        }
+
+        // Each byte takes three characters, plus the size prefix
+        char line[16 + SERIAL_FRAME_MAX_SIZE * 3];
+        char *ptr = line;
+
+        ptr += snprintf(ptr, 16, "[%4u]", static_cast<unsigned int>(frame_len));
+        for (size_t i = 0; i < frame_len; i++) {
+            *ptr++ = ' ';
+            *ptr++ = hex_digits[frame[i] >> 4];
+            *ptr++ = hex_digits[frame[i] & 0xF];
+        }
+        *ptr++ = '\n';
+        self->pushSerialData(line, static_cast<size_t>(ptr - line), ty_micros());
+
+        return 0;
+    }, this);
+}
+
+void Board::appendSerialData()
+{
+    serial_pending_ = false;
+
+    QByteArray buf(static_cast<int>(serial_ring_.size()), Qt::Uninitialized);
+    buf.resize(static_cast<int>(serial_ring_.read(buf.data(), static_cast<size_t>(buf.size()))));
+
+    if (serial_spilling_) {
+        QMutexLocker locker(&serial_spill_lock_);
+
+        /* The serial thread does not touch the ring while it spills, so pick up what it
+           wrote before it started. The spill file is more recent. */
+        auto len = buf.size();
+        buf.resize(len + static_cast<int>(serial_ring_.size()));
+        buf.resize(len + static_cast<int>(serial_ring_.read(buf.data() + len,
+                                                            static_cast<size_t>(buf.size() - len))));
+
+        serial_spill_file_.seek(serial_spill_offset_);
+        auto spill_buf = serial_spill_file_.read(SERIAL_SPILL_CHUNK);
+        serial_spill_offset_ += spill_buf.size();
+        buf.append(spill_buf);
+
+        if (serial_spill_offset_ >= serial_spill_file_.size()) {
+            serial_spill_file_.resize(0);
+            serial_spill_offset_ = 0;
+            serial_spilling_ = false;
+        } else if (!serial_pending_.exchange(true)) {
+            // Keep the GUI responsive, don't load everything at once
+            QMetaObject::invokeMethod(this, "appendSerialData", Qt::QueuedConnection);
+        }
+    }
 
-    QTextCursor cursor(&serial_document_);
-    cursor.movePosition(QTextCursor::End);
-    cursor.insertText(str);
+    if (serial_blocked_.exchange(false))
+        serial_notifier_.setEnabled(true);
+
+    uint64_t dropped = serial_dropped_;
+    if (dropped > serial_reported_dropped_) {
+        ty_log(TY_LOG_WARNING, "Dropped %" PRIu64 " bytes of serial data from '%s'",
+               dropped - serial_reported_dropped_, ty_board_get_tag(board_));
+        serial_reported_dropped_ = dropped;
+    }
+
+    // The serial thread has already converted everything to valid UTF-8
+    serial_buffer_.append(buf);
 }
 
 void Board::notifyFinished(bool success, std::shared_ptr<void> result)
@@ -680,7 +1109,7 @@ void Board::refreshBoard()
     if (clear_on_reset_) {
         if (hasCapability(TY_BOARD_CAPABILITY_SERIAL)) {
             if (serial_clear_when_available_) {
-                serial_document_.clear();
+                serial_buffer_.clear();
                 updateSerialLogState(true);
             }
             serial_clear_when_available_ = false;
@@ -714,18 +1143,47 @@ bool Board::openSerialInterface()
     }
     if (!r)
         return false;
+
+    // Idle boards don't keep these around, see closeSerialInterface()
+    serial_ring_.allocate();
+    serial_log_->reserve();
+
     ty_board_interface_get_descriptors(serial_iface_, &set, 1);
     serial_notifier_.setDescriptorSet(&set);
+    if (serial_blocked_.exchange(false))
+        serial_notifier_.setEnabled(true);
 
     // TODO: Make serial settings (mainly speed) configurable in the GUI
     hs_device *dev = ty_board_interface_get_device(serial_iface_);
+    uint64_t byte_time = 0;
     if (dev->type == HS_DEVICE_TYPE_SERIAL) {
         hs_port *port = ty_board_interface_get_handle(serial_iface_);
         hs_serial_config config = {};
         config.baudrate = 115200;
         hs_serial_set_config(port, &config);
+
+        // Start bit, 8 data bits and a stop bit (in microseconds), USB CDC reads keep their time
+        if (ty_board_interface_is_uart_bridge(serial_iface_))
+            byte_time = 10 * 1000000 / config.baudrate;
     }
 
+    // Drop whatever was left of the last frame or character from the previous connection
+    {
+        QMutexLocker locker(&serial_lock_);
+        if (serial_frame_decoder_.buf)
+            ty_frame_decoder_reset(&serial_frame_decoder_);
+        serial_decoder_.reset();
+        serial_filter_.reset();
+
+        /* Lines are stamped with the monotonic clock, map it to the wall clock once per
+           connection so that the user can compare times across boards. */
+        ty_line_stamper_init(&serial_stamper_, byte_time);
+        ty_line_stamper_init(&serial_log_stamper_, byte_time);
+        serial_clock_offset_ = QDateTime::currentMSecsSinceEpoch() * 1000 -
+                               static_cast<int64_t>(ty_micros());
+    }
+    applySerialLatency();
+
     return true;
 }
 
@@ -737,34 +1195,99 @@ void Board::closeSerialInterface()
     serial_notifier_.clear();
     ty_board_interface_close(serial_iface_);
     serial_iface_ = nullptr;
+
+    /* The serial thread is done with this board once clear() returns, so we can move what
+       is left to the scrollback and the log, and release the rings until the next time. */
+    appendSerialData();
+    serial_ring_.release();
+    serial_log_->release();
 }
 
-void Board::updateSerialLogState(bool new_file)
+void Board::applySerialLatency()
 {
-    if (!hasCapability(TY_BOARD_CAPABILITY_UNIQUE)) {
+    if (!serial_iface_)
+        return;
+
+    hs_device *dev = ty_board_interface_get_device(serial_iface_);
+    if (dev->type != HS_DEVICE_TYPE_SERIAL)
         return;
+
+    hs_port *port = ty_board_interface_get_handle(serial_iface_);
+    hs_serial_config config = {};
+    config.latency = serial_latency_;
+    if (hs_serial_set_config(port, &config) < 0)
+        notifyLog(TY_LOG_ERROR, ty_error_last_message());
+
+#ifndef _WIN32
+    /* In bulk mode, the OS does not signal the serial descriptor until enough data is
+       available, so we need to pick up what is left from time to time. */
+    serial_notifier_.setPollInterval(serial_latency_ == HS_SERIAL_CONFIG_LATENCY_BULK ?
+                                     SERIAL_BULK_FLUSH_DELAY : 0);
+#endif
+}
+
+void Board::applySerialFrame()
+{
+    QMutexLocker locker(&serial_lock_);
+
+    if (serial_frame_decoder_.buf) {
+        ty_log(TY_LOG_INFO, "Decoded %" PRIu64 " frames from '%s' (%" PRIu64 " invalid)",
+               serial_frame_decoder_.valid_count, ty_board_get_tag(board_),
+               serial_frame_decoder_.invalid_count);
+        ty_frame_decoder_release(&serial_frame_decoder_);
+    }
+
+    if (serial_frame_encoding_ != TY_FRAME_ENCODING_NONE) {
+        int r = ty_frame_decoder_init(&serial_frame_decoder_, serial_frame_encoding_,
+                                      serial_frame_check_, SERIAL_FRAME_MAX_SIZE);
+        if (r < 0)
+            throw bad_alloc();
+    }
+}
+
+void Board::applySerialFilters()
+{
+    vector<SerialFilterRule> rules;
+    QStringList valid_filters;
+    for (auto &filter: serial_filters_) {
+        SerialFilterRule rule;
+        QString err;
+        if (!SerialFilterRule::parse(filter, &rule, &err)) {
+            ty_log(TY_LOG_WARNING, "Ignoring serial filter '%s' of '%s': %s",
+                   filter.toUtf8().constData(), ty_board_get_tag(board_), err.toUtf8().constData());
+            continue;
+        }
+        rules.push_back(rule);
+        valid_filters.append(filter);
     }
+    // Keep the list in sync with the rules, the hit counters use the same indexes
+    serial_filters_ = valid_filters;
 
     QMutexLocker locker(&serial_lock_);
+    serial_filter_.setRules(rules);
+}
 
-    if (serial_log_file_.fileName().isEmpty() || new_file) {
-        serial_log_file_.close();
-        serial_log_file_.setFileName(findLogFilename(id(), 4));
+void Board::updateSerialLogState(bool new_file)
+{
+    if (!hasCapability(TY_BOARD_CAPABILITY_UNIQUE)) {
+        return;
     }
 
+    if (serial_log_->fileName().isEmpty() || new_file)
+        serial_log_->setFileName(findLogFilename(id(), 4), serialLogPrefix(id()));
+
     if (serial_log_size_) {
-        if (!serial_log_file_.isOpen()) {
-            if (!serial_log_file_.open(QIODevice::WriteOnly)) {
-                ty_log(TY_LOG_ERROR, "Cannot open board log '%s' for writing",
-                       serial_log_file_.fileName().toUtf8().constData());
-            }
+        // New log files need their own anchor
+        QMutexLocker locker(&serial_lock_);
+        serial_log_anchor_ = 0;
+        locker.unlock();
+
+        if (!serial_log_->open(serial_log_size_, serial_archive_size_)) {
+            ty_log(TY_LOG_ERROR, "Cannot open board log '%s' for writing",
+                   serial_log_->fileName().toUtf8().constData());
         }
-        if (serial_log_file_.isOpen() &&
-                static_cast<size_t>(serial_log_file_.size()) > serial_log_size_)
-            serial_log_file_.resize(serial_log_size_);
     } else {
-        serial_log_file_.close();
-        serial_log_file_.remove();
+        serial_log_->remove();
     }
 }
 
@@ -806,13 +1329,19 @@ void Board::addUploadedFirmware(ty_firmware *fw)
     emit settingsChanged();
 }
 
+// The log files rotate, the serial archive uses the prefix alone and carries over
+QString Board::serialLogPrefix(const QString &id) const
+{
+    auto dir = serial_log_dir_.isEmpty() ? QDir::tempPath() : serial_log_dir_;
+    return QString("%1/%2-%3").arg(dir, QCoreApplication::applicationName(), id);
+}
+
 QString Board::findLogFilename(const QString &id, unsigned int max)
 {
     QDateTime oldest_mtime;
     QString oldest_filename;
 
-    auto dir = serial_log_dir_.isEmpty() ? QDir::tempPath() : serial_log_dir_;
-    auto prefix = QString("%1/%2-%3").arg(dir, QCoreApplication::applicationName(), id);
+    auto prefix = serialLogPrefix(id);
     for (unsigned int i = 1; i <= max; i++) {
         auto filename = QString("%1-%2.txt").arg(prefix).arg(i);
         QFileInfo info(filename);
@@ -12,23 +12,33 @@
 #define BOARD_HH
 
 #include <QFile>
+#include <QFont>
 #include <QIcon>
 #include <QMutex>
 #include <QStringList>
+#include <QTemporaryFile>
 #include <QTextCodec>
-#include <QTextDecoder>
-#include <QTextDocument>
 #include <QThread>
 #include <QTimer>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "../libhs/serial.h"
 #include "../libty/board.h"
+#include "../libty/frame.h"
+#include "../libty/timestamp.h"
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
 #include "firmware.hpp"
 #include "../libty/monitor.h"
+#include "ring_buffer.hpp"
+#include "serial_buffer.hpp"
+#include "serial_decoder.hpp"
+#include "serial_filter.hpp"
+#include "serial_log.hpp"
+#include "serial_samples.hpp"
 #include "task.hpp"
 
 class Monitor;
@@ -45,6 +55,15 @@ struct BoardInterfaceInfo {
 class Board : public QObject, public std::enable_shared_from_this<Board> {
     Q_OBJECT
 
+public:
+    // What the serial thread does when the GUI thread does not keep up
+    enum SerialOverflow {
+        SERIAL_OVERFLOW_DROP_OLDEST,
+        SERIAL_OVERFLOW_BLOCK,
+        SERIAL_OVERFLOW_SPILL
+    };
+
+private:
     DatabaseInterface db_;
     DatabaseInterface cache_;
 
@@ -53,13 +72,34 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     ty_board_interface *serial_iface_ = nullptr;
     DescriptorNotifier serial_notifier_;
     QTextCodec *serial_codec_;
-    std::unique_ptr<QTextDecoder> serial_decoder_;
+    SerialDecoder serial_decoder_;
+    SerialFilter serial_filter_;
+    std::string serial_filtered_;
+    ty_line_stamper serial_stamper_;
+    ty_line_stamper serial_log_stamper_;
+    std::string serial_stamped_;
+    int64_t serial_clock_offset_ = 0;
+    uint64_t serial_log_anchor_ = 0;
+    uint64_t serial_log_last_ = 0;
     QMutex serial_lock_;
-    char serial_buf_[262144];
-    size_t serial_buf_len_ = 0;
-    QTextDocument serial_document_;
-    QFile serial_log_file_;
+    RingBuffer serial_ring_;
+    std::atomic<bool> serial_pending_ {false};
+    std::atomic<bool> serial_blocked_ {false};
+    std::atomic<uint64_t> serial_busy_ {0};
+    QMutex serial_spill_lock_;
+    QTemporaryFile serial_spill_file_;
+    qint64 serial_spill_offset_ = 0;
+    std::atomic<bool> serial_spilling_ {false};
+    std::atomic<uint64_t> serial_dropped_ {0};
+    std::atomic<uint64_t> serial_overruns_ {0};
+    std::atomic<uint64_t> serial_spilled_ {0};
+    uint64_t serial_reported_dropped_ = 0;
+    SerialBuffer serial_buffer_;
+    QFont serial_font_;
+    SerialSamples serial_samples_;
+    std::shared_ptr<SerialLog> serial_log_;
     bool serial_clear_when_available_ = false;
+    ty_frame_decoder serial_frame_decoder_ = {};
 
     QTimer error_timer_;
 
@@ -68,8 +108,16 @@ class Board : public QObject, public std::enable_shared_from_this<Board> {
     QString serial_codec_name_;
     bool clear_on_reset_;
     bool enable_serial_;
+    hs_serial_config_latency serial_latency_;
+    ty_frame_encoding serial_frame_encoding_;
+    ty_frame_check serial_frame_check_;
+    SerialOverflow serial_overflow_;
     QString serial_log_dir_;
+    size_t serial_archive_size_ = 0;
     size_t serial_log_size_;
+    bool serial_plot_;
+    QStringList serial_filters_;
+    bool serial_timestamps_;
 
     QString status_text_;
     QString status_icon_name_;
@@ -109,6 +157,9 @@ public:
 
     std::vector<BoardInterfaceInfo> interfaces() const;
 
+    // Approximate, this only counts the big serial buffers
+    size_t memoryUsage() const;
+
     bool errorOccured() const { return error_timer_.remainingTime() > 0; }
 
     QString statusText() const { return status_text_; }
@@ -120,13 +171,31 @@ public:
     QString serialCodecName() const { return serial_codec_name_; }
     QTextCodec *serialCodec() const { return serial_codec_; }
     bool clearOnReset() const { return clear_on_reset_; }
-    unsigned int scrollBackLimit() const { return serial_document_.maximumBlockCount(); }
+    size_t scrollBackSize() const { return serial_buffer_.limit(); }
     bool enableSerial() const { return enable_serial_; }
+    hs_serial_config_latency serialLatency() const { return serial_latency_; }
+    ty_frame_encoding serialFrameEncoding() const { return serial_frame_encoding_; }
+    ty_frame_check serialFrameCheck() const { return serial_frame_check_; }
+    SerialOverflow serialOverflow() const { return serial_overflow_; }
+    uint64_t serialDroppedBytes() const { return serial_dropped_; }
+    uint64_t serialOverruns() const { return serial_overruns_; }
+    uint64_t serialSpilledBytes() const { return serial_spilled_; }
+    // Time spent reading serial data (in nanoseconds), so far
+    uint64_t serialBusyTime() const { return serial_busy_; }
     size_t serialLogSize() const { return serial_log_size_; }
-    QString serialLogFilename() const { return serial_log_file_.fileName(); }
+    QString serialLogFilename() const { return serial_log_->fileName(); }
+    SerialLog::Stats serialLogStats() const { return serial_log_->stats(); }
+    bool serialPlot() const { return serial_plot_; }
+    QStringList serialFilters() const { return serial_filters_; }
+    const SerialFilter &serialFilter() const { return serial_filter_; }
+    bool serialTimestamps() const { return serial_timestamps_; }
+    QStringList searchSerialLog(const SerialSearchQuery &query, int max_matches)
+        { return serial_log_->search(query, max_matches); }
 
     bool serialOpen() const { return serial_iface_; }
-    QTextDocument &serialDocument() { return serial_document_; }
+    SerialBuffer &serialBuffer() { return serial_buffer_; }
+    QFont serialFont() const { return serial_font_; }
+    const SerialSamples &serialSamples() const { return serial_samples_; }
 
     static QStringList makeCapabilityList(uint16_t capabilities);
     static QString makeCapabilityString(uint16_t capabilities, QString empty_str = QString());
@@ -153,9 +222,15 @@ public slots:
     void setResetAfter(bool reset_after);
     void setSerialCodecName(QString codec_name);
     void setClearOnReset(bool clear_on_reset);
-    void setScrollBackLimit(unsigned int limit);
+    void setScrollBackSize(size_t size);
     void setEnableSerial(bool enable, bool persist = true);
+    void setSerialLatency(hs_serial_config_latency latency);
+    void setSerialFrame(ty_frame_encoding encoding, ty_frame_check check);
+    void setSerialOverflow(SerialOverflow overflow);
     void setSerialLogSize(size_t size);
+    void setSerialPlot(bool enable);
+    void setSerialTimestamps(bool enable);
+    void setSerialFilters(const QStringList &filters);
 
     TaskInterface startUpload(const QString &filename = QString());
     TaskInterface startUpload(const std::vector<std::shared_ptr<Firmware>> &fws);
@@ -181,30 +256,38 @@ private slots:
     void updateStatus();
 
     void serialReceived(ty_descriptor desc);
-    void appendBufferToSerialDocument();
+    void appendSerialData();
 
     void notifyFinished(bool success, std::shared_ptr<void> result);
 
 private:
     Board(ty_board *board, QObject *parent = nullptr);
     void loadSettings(Monitor *monitor);
+    QString serialLogPrefix(const QString &id) const;
     QString findLogFilename(const QString &id, unsigned int max);
 
     void setThreadPool(ty_pool *pool) { pool_ = pool; }
 
-    void writeToSerialLog(const char *buf, size_t len);
+    void pushSerialData(const char *buf, size_t len, uint64_t time);
+    void logSerialData(const char *buf, size_t len, uint64_t time);
+    void spillSerialData(const char *buf, size_t len);
+    void decodeSerialFrames(const char *buf, size_t len);
 
     void refreshBoard();
     bool updateSerialInterface();
     bool openSerialInterface();
     void closeSerialInterface();
     void updateSerialLogState(bool new_file);
+    void applySerialLatency();
+    void applySerialFrame();
+    void applySerialFilters();
 
     void addUploadedFirmware(ty_firmware *fw);
 
     TaskInterface watchTask(TaskInterface task);
 
     friend class Monitor;
+    friend class SerialPool;
 };
 
 #endif
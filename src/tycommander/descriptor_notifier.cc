@@ -9,6 +9,7 @@
    See the LICENSE file for more details. */
 
 #include <QThread>
+#include <QTimer>
 
 #include "descriptor_notifier.hpp"
 
@@ -64,9 +65,38 @@ void DescriptorNotifier::clear()
         for (auto notifier: notifiers_)
             delete notifier;
         notifiers_.clear();
+        if (poll_timer_)
+            poll_timer_->stop();
     });
 }
 
+void DescriptorNotifier::setPollInterval(int msec)
+{
+    execute([=]() {
+        if (!msec) {
+            if (poll_timer_)
+                poll_timer_->stop();
+            return;
+        }
+
+        // Like the notifiers, the timer is our child and moves with us
+        if (!poll_timer_) {
+            poll_timer_ = new QTimer(this);
+            connect(poll_timer_, &QTimer::timeout, this, [=]() {
+                if (enabled_)
+                    emit activated(ty_descriptor());
+            });
+        }
+        poll_timer_->start(msec);
+    });
+}
+
+void DescriptorNotifier::setThread(QThread *thread)
+{
+    // The notifiers are our children, they move with us
+    execute([=]() { moveToThread(thread); });
+}
+
 void DescriptorNotifier::execute(function<void()> f)
 {
     if (thread() != QThread::currentThread()) {
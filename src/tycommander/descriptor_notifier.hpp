@@ -22,6 +22,8 @@
 
 #include "../libty/system.h"
 
+class QTimer;
+
 class DescriptorNotifier : public QObject {
     Q_OBJECT
 
@@ -32,6 +34,7 @@ class DescriptorNotifier : public QObject {
 #endif
 
     bool enabled_ = true;
+    QTimer *poll_timer_ = nullptr;
 
 public:
     DescriptorNotifier(QObject *parent = nullptr)
@@ -55,6 +58,13 @@ public:
 
     bool isEnabled() const { return enabled_; }
 
+    /* Emit activated() every msec milliseconds (0 to stop), in addition to the descriptor
+       events. The timer lives in our thread, and clear() stops it. */
+    void setPollInterval(int msec);
+
+    // Unlike moveToThread(), this works from any thread
+    void setThread(QThread *thread);
+
 public slots:
     void setEnabled(bool enable);
     void clear();
@@ -13,7 +13,6 @@
 
 #include <QComboBox>
 #include <QGroupBox>
-#include <QPlainTextEdit>
 #include <QProxyStyle>
 #include <QStringList>
 
@@ -86,31 +85,4 @@ private:
     void moveInHistory(int movement);
 };
 
-// --------------------------------------------------------
-// EnhancedPlainText
-// --------------------------------------------------------
-
-class EnhancedPlainText: public QPlainTextEdit {
-    Q_OBJECT
-
-    bool monitor_autoscroll_ = true;
-    QTextCursor monitor_cursor_;
-
-public:
-    EnhancedPlainText(QWidget *parent = nullptr)
-        : EnhancedPlainText(QString(), parent) {}
-    EnhancedPlainText(const QString &text, QWidget *parent = nullptr);
-
-protected:
-    void showEvent(QShowEvent *e) override;
-    void scrollContentsBy(int dx, int dy) override;
-    void keyPressEvent(QKeyEvent *e) override;
-
-private slots:
-    void fixScrollValue();
-
-private:
-    void updateScrollInfo();
-};
-
 #endif
@@ -136,6 +136,7 @@ int main(int argc, char *argv[])
 #endif
 
     hs_log_set_handler(ty_libhs_log_handler, NULL);
+    ty_libhs_enable_cache();
     if (ty_models_load_patch(nullptr) == TY_ERROR_MEMORY)
         return 1;
 
@@ -9,10 +9,12 @@
    See the LICENSE file for more details. */
 
 #include <QDesktopServices>
+#include <QDialog>
 #include <QFileDialog>
-#include <QScrollBar>
+#include <QPlainTextEdit>
 #include <QShortcut>
 #include <QTextCodec>
+#include <QTimer>
 #include <QToolButton>
 #include <QUrl>
 
@@ -23,10 +25,13 @@
 #include "main_window.hpp"
 #include "monitor.hpp"
 #include "preferences_dialog.hpp"
+#include "serial_search.hpp"
 #include "tycommander.hpp"
 
 using namespace std;
 
+#define SERIAL_LOG_SEARCH_MAX_MATCHES 10000
+
 QStringList MainWindow::codecs_;
 QHash<QString, int> MainWindow::codec_indexes_;
 
@@ -76,6 +81,9 @@ MainWindow::MainWindow(QWidget *parent)
     menuBoardContext->addSeparator();
     menuBoardContext->addAction(actionEnableSerial);
     menuBoardContext->addAction(actionSendFile);
+    menuBoardContext->addAction(actionFindSerial);
+    menuBoardContext->addAction(actionSerialPlot);
+    menuBoardContext->addAction(actionSerialTimestamps);
     menuBoardContext->addAction(actionClearSerial);
     menuBoardContext->addSeparator();
     menuBoardContext->addAction(actionRenameBoard);
@@ -83,6 +91,8 @@ MainWindow::MainWindow(QWidget *parent)
     menuEnableSerial = new QMenu(this);
     menuEnableSerial->addAction(actionSendFile);
     menuEnableSerial->addAction(actionClearSerial);
+    menuEnableSerial->addAction(actionSerialPlot);
+    menuEnableSerial->addAction(actionSerialTimestamps);
 
     auto serialButton = qobject_cast<QToolButton *>(toolBar->widgetForAction(actionEnableSerial));
     if (serialButton) {
@@ -118,6 +128,10 @@ MainWindow::MainWindow(QWidget *parent)
     connect(actionEnableSerial, &QAction::triggered, this,
             &MainWindow::setEnableSerialForSelection);
     connect(actionSendFile, &QAction::triggered, this, &MainWindow::sendFileToSelection);
+    connect(actionFindSerial, &QAction::triggered, this, &MainWindow::openSerialSearch);
+    connect(actionSerialPlot, &QAction::triggered, this, &MainWindow::setSerialPlotForSelection);
+    connect(actionSerialTimestamps, &QAction::triggered, this,
+            &MainWindow::setSerialTimestampsForSelection);
     connect(actionClearSerial, &QAction::triggered, this, &MainWindow::clearSerialDocument);
 
     // View menu
@@ -216,9 +230,33 @@ MainWindow::MainWindow(QWidget *parent)
         if (!tabWidget->hasFocus())
             autoFocusBoardWidgets();
     });
-    serialText->setWordWrapMode(QTextOption::NoWrap);
-    connect(serialText, &QPlainTextEdit::customContextMenuRequested, this,
+    connect(serialText, &SerialView::customContextMenuRequested, this,
             &MainWindow::openSerialContextMenu);
+    serialSearchBar->hide();
+    connect(serialSearchEdit, &QLineEdit::textChanged, this, [=]() {
+        serialText->resetSearch();
+        findNextInSerial();
+    });
+    connect(serialSearchEdit, &QLineEdit::returnPressed, this, &MainWindow::findNextInSerial);
+    connect(new QShortcut(Qt::SHIFT | Qt::Key_Return, serialSearchEdit, nullptr, nullptr,
+                          Qt::WidgetShortcut),
+            &QShortcut::activated, this, &MainWindow::findPreviousInSerial);
+    connect(new QShortcut(Qt::Key_Escape, serialSearchBar, nullptr, nullptr,
+                          Qt::WidgetWithChildrenShortcut),
+            &QShortcut::activated, this, &MainWindow::closeSerialSearch);
+    connect(serialSearchNextButton, &QToolButton::clicked, this, &MainWindow::findNextInSerial);
+    connect(serialSearchPreviousButton, &QToolButton::clicked, this,
+            &MainWindow::findPreviousInSerial);
+    connect(serialSearchRegexCheck, &QCheckBox::toggled, this, [=]() {
+        serialText->resetSearch();
+        findNextInSerial();
+    });
+    connect(serialSearchCaseCheck, &QCheckBox::toggled, this, [=]() {
+        serialText->resetSearch();
+        findNextInSerial();
+    });
+    connect(serialSearchLogButton, &QToolButton::clicked, this, &MainWindow::searchSerialLog);
+    connect(serialSearchCloseButton, &QToolButton::clicked, this, &MainWindow::closeSerialSearch);
     connect(serialEdit, &EnhancedLineInput::textCommitted, this, &MainWindow::sendToSelectedBoards);
     connect(sendButton, &QToolButton::clicked, serialEdit, &EnhancedLineInput::commit);
     serialEdit->lineEdit()->setPlaceholderText(tr("Send data..."));
@@ -251,10 +289,25 @@ MainWindow::MainWindow(QWidget *parent)
     connect(resetAfterCheck, &QCheckBox::clicked, this, &MainWindow::setResetAfterForSelection);
     connect(codecComboBox, &QComboBox::currentTextChanged, this, &MainWindow::setSerialCodecForSelection);
     connect(clearOnResetCheck, &QCheckBox::clicked, this, &MainWindow::setClearOnResetForSelection);
-    connect(scrollBackLimitSpin, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
-            this, &MainWindow::setScrollBackLimitForSelection);
+    connect(scrollBackSizeSpin, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            this, &MainWindow::setScrollBackSizeForSelection);
     connect(serialLogSizeSpin, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
             this, &MainWindow::setSerialLogSizeForSelection);
+    connect(latencyComboBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated),
+            this, &MainWindow::setSerialLatencyForSelection);
+    connect(frameComboBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated),
+            this, &MainWindow::setSerialFrameForSelection);
+    connect(overflowComboBox, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated),
+            this, &MainWindow::setSerialOverflowForSelection);
+    connect(serialFilterEdit, &QLineEdit::returnPressed, this, &MainWindow::addSerialFilterToSelection);
+    connect(serialFilterAddButton, &QToolButton::clicked, this,
+            &MainWindow::addSerialFilterToSelection);
+    connect(serialFilterRemoveButton, &QToolButton::clicked, this,
+            &MainWindow::removeSerialFilterFromSelection);
+    // The filters count on the serial thread, we just poll the counters
+    serialFilterTimer = new QTimer(this);
+    serialFilterTimer->setInterval(1000);
+    connect(serialFilterTimer, &QTimer::timeout, this, &MainWindow::refreshSerialFilterHits);
 
     initCodecList();
     for (auto codec: codecs_)
@@ -624,6 +677,90 @@ void MainWindow::clearSerialDocument()
     serialText->clear();
 }
 
+void MainWindow::openSerialSearch()
+{
+    if (!current_board_)
+        return;
+
+    tabWidget->setCurrentWidget(serialTab);
+    serialSearchBar->show();
+    serialSearchEdit->setFocus();
+    serialSearchEdit->selectAll();
+}
+
+void MainWindow::closeSerialSearch()
+{
+    serialSearchBar->hide();
+    serialSearchLabel->clear();
+    serialText->setFocus();
+}
+
+void MainWindow::findNextInSerial()
+{
+    findInSerial(false);
+}
+
+void MainWindow::findPreviousInSerial()
+{
+    findInSerial(true);
+}
+
+void MainWindow::searchSerialLog()
+{
+    if (!current_board_)
+        return;
+
+    SerialSearchQuery query(serialSearchEdit->text(), serialSearchRegexCheck->isChecked(),
+                            serialSearchCaseCheck->isChecked());
+    if (!query.isValid())
+        return;
+    if (current_board_->serialLogFilename().isEmpty() || !current_board_->serialLogSize()) {
+        serialSearchLabel->setText(tr("No serial log available"));
+        return;
+    }
+
+    auto matches = current_board_->searchSerialLog(query, SERIAL_LOG_SEARCH_MAX_MATCHES);
+
+    auto dialog = new QDialog(this);
+    dialog->setAttribute(Qt::WA_DeleteOnClose);
+    dialog->setWindowTitle(tr("Search '%1' in %2")
+                           .arg(serialSearchEdit->text(), current_board_->serialLogFilename()));
+    dialog->resize(700, 400);
+
+    auto layout = new QVBoxLayout(dialog);
+    auto label = new QLabel(dialog);
+    if (matches.count() >= SERIAL_LOG_SEARCH_MAX_MATCHES) {
+        label->setText(tr("Showing the first %1 matching lines").arg(matches.count()));
+    } else {
+        label->setText(tr("%n matching line(s)", nullptr, matches.count()));
+    }
+    layout->addWidget(label);
+    auto text = new QPlainTextEdit(dialog);
+    text->setReadOnly(true);
+    text->setWordWrapMode(QTextOption::NoWrap);
+    text->setFont(current_board_->serialFont());
+    text->setPlainText(matches.join('\n'));
+    layout->addWidget(text);
+
+    dialog->show();
+}
+
+void MainWindow::findInSerial(bool backward)
+{
+    SerialSearchQuery query(serialSearchEdit->text(), serialSearchRegexCheck->isChecked(),
+                            serialSearchCaseCheck->isChecked());
+
+    if (serialSearchEdit->text().isEmpty()) {
+        serialSearchLabel->clear();
+    } else if (!query.isValid()) {
+        serialSearchLabel->setText(query.errorString());
+    } else if (!serialText->find(query, backward)) {
+        serialSearchLabel->setText(tr("No match"));
+    } else {
+        serialSearchLabel->clear();
+    }
+}
+
 void MainWindow::initCodecList()
 {
     if (!codecs_.isEmpty())
@@ -660,15 +797,17 @@ void MainWindow::enableBoardWidgets()
     infoTab->setEnabled(true);
     serialTab->setEnabled(true);
     actionClearSerial->setEnabled(true);
+    actionFindSerial->setEnabled(true);
+    actionSerialPlot->setEnabled(true);
+    actionSerialTimestamps->setEnabled(true);
     optionsTab->setEnabled(true);
     actionEnableSerial->setEnabled(true);
 
-    QTextDocument *document = &current_board_->serialDocument();
-    serialText->setDocument(document);
-    serialText->moveCursor(QTextCursor::End);
-    serialText->verticalScrollBar()->setValue(serialText->verticalScrollBar()->maximum());
-    serialText->setFont(document->defaultFont());
-    serialEdit->setFont(document->defaultFont());
+    serialText->setBuffer(&current_board_->serialBuffer());
+    serialText->setFont(current_board_->serialFont());
+    serialPlot->setSamples(&current_board_->serialSamples());
+    serialEdit->setFont(current_board_->serialFont());
+    serialFilterTimer->start();
 
     actionRenameBoard->setEnabled(true);
 }
@@ -687,9 +826,20 @@ void MainWindow::disableBoardWidgets()
     serialNumberText->clear();
     descriptionText->clear();
     interfaceTree->clear();
+    serialFilterTree->clear();
+    serialFilterLabel->clear();
+    serialFilterTimer->stop();
 
     serialTab->setEnabled(false);
     actionClearSerial->setEnabled(false);
+    actionFindSerial->setEnabled(false);
+    actionSerialPlot->setEnabled(false);
+    actionSerialPlot->setChecked(false);
+    actionSerialTimestamps->setEnabled(false);
+    actionSerialTimestamps->setChecked(false);
+    serialText->setShowTimestamps(false);
+    serialPlot->setVisible(false);
+    serialText->setVisible(true);
     optionsTab->setEnabled(false);
     actionEnableSerial->setEnabled(false);
     updateSerialLogLink();
@@ -833,7 +983,8 @@ void MainWindow::selectionChanged(const QItemSelection &newsel, const QItemSelec
 
     for (auto &board: selected_boards_)
         board->disconnect(this);
-    serialText->setDocument(nullptr);
+    serialText->setBuffer(nullptr);
+    serialPlot->setSamples(nullptr);
     selected_boards_.clear();
     current_board_ = nullptr;
 
@@ -943,6 +1094,11 @@ void MainWindow::refreshSettings()
 {
     actionEnableSerial->setChecked(current_board_->enableSerial());
     serialEdit->setEnabled(current_board_->serialOpen());
+    actionSerialPlot->setChecked(current_board_->serialPlot());
+    serialPlot->setVisible(current_board_->serialPlot());
+    serialText->setVisible(!current_board_->serialPlot());
+    actionSerialTimestamps->setChecked(current_board_->serialTimestamps());
+    serialText->setShowTimestamps(current_board_->serialTimestamps());
 
     firmwarePath->setText(current_board_->firmware());
     resetAfterCheck->setChecked(current_board_->resetAfter());
@@ -950,13 +1106,28 @@ void MainWindow::refreshSettings()
     codecComboBox->setCurrentIndex(codec_indexes_.value(current_board_->serialCodecName(), 0));
     codecComboBox->blockSignals(false);
     clearOnResetCheck->setChecked(current_board_->clearOnReset());
-    scrollBackLimitSpin->blockSignals(true);
-    scrollBackLimitSpin->setValue(current_board_->scrollBackLimit());
-    scrollBackLimitSpin->blockSignals(false);
+    latencyComboBox->setCurrentIndex(current_board_->serialLatency() - 1);
+    if (current_board_->serialFrameEncoding() != TY_FRAME_ENCODING_NONE) {
+        frameComboBox->setCurrentIndex(1 + (current_board_->serialFrameEncoding() - 1) * 3 +
+                                       current_board_->serialFrameCheck());
+    } else {
+        frameComboBox->setCurrentIndex(0);
+    }
+    overflowComboBox->setCurrentIndex(current_board_->serialOverflow());
+    scrollBackSizeSpin->blockSignals(true);
+    scrollBackSizeSpin->setValue(static_cast<int>(current_board_->scrollBackSize() / 1000));
+    scrollBackSizeSpin->blockSignals(false);
     updateSerialLogLink();
     serialLogSizeSpin->blockSignals(true);
     serialLogSizeSpin->setValue(static_cast<int>(current_board_->serialLogSize() / 1000));
     serialLogSizeSpin->blockSignals(false);
+    serialFilterTree->clear();
+    for (auto &filter: current_board_->serialFilters()) {
+        auto item = new QTreeWidgetItem();
+        item->setText(0, filter);
+        serialFilterTree->addTopLevelItem(item);
+    }
+    refreshSerialFilterHits();
 
     updateFirmwareMenus();
 }
@@ -1062,10 +1233,10 @@ void MainWindow::setClearOnResetForSelection(bool clear_on_reset)
         board->setClearOnReset(clear_on_reset);
 }
 
-void MainWindow::setScrollBackLimitForSelection(int limit)
+void MainWindow::setScrollBackSizeForSelection(int size)
 {
     for (auto &board: selected_boards_)
-        board->setScrollBackLimit(limit);
+        board->setScrollBackSize(static_cast<size_t>(size) * 1000);
 }
 
 void MainWindow::setEnableSerialForSelection(bool enable)
@@ -1074,8 +1245,108 @@ void MainWindow::setEnableSerialForSelection(bool enable)
         board->setEnableSerial(enable);
 }
 
+void MainWindow::setSerialLatencyForSelection(int index)
+{
+    auto latency = static_cast<hs_serial_config_latency>(HS_SERIAL_CONFIG_LATENCY_DEFAULT + index);
+    for (auto &board: selected_boards_)
+        board->setSerialLatency(latency);
+}
+
+// Indexes follow the order of frameComboBox: None, then each encoding without and with CRCs
+void MainWindow::setSerialFrameForSelection(int index)
+{
+    auto encoding = TY_FRAME_ENCODING_NONE;
+    auto check = TY_FRAME_CHECK_NONE;
+    if (index > 0) {
+        encoding = static_cast<ty_frame_encoding>(TY_FRAME_ENCODING_COBS + (index - 1) / 3);
+        check = static_cast<ty_frame_check>((index - 1) % 3);
+    }
+
+    for (auto &board: selected_boards_)
+        board->setSerialFrame(encoding, check);
+}
+
+void MainWindow::setSerialOverflowForSelection(int index)
+{
+    auto overflow = static_cast<Board::SerialOverflow>(index);
+    for (auto &board: selected_boards_)
+        board->setSerialOverflow(overflow);
+}
+
+void MainWindow::setSerialPlotForSelection(bool enable)
+{
+    for (auto &board: selected_boards_)
+        board->setSerialPlot(enable);
+}
+
+void MainWindow::setSerialTimestampsForSelection(bool enable)
+{
+    for (auto &board: selected_boards_)
+        board->setSerialTimestamps(enable);
+}
+
 void MainWindow::setSerialLogSizeForSelection(int size)
 {
     for (auto &board: selected_boards_)
         board->setSerialLogSize(size * 1000);
 }
+
+void MainWindow::addSerialFilterToSelection()
+{
+    static const char *const actions[] = {"include", "exclude", "highlight"};
+
+    if (serialFilterEdit->text().isEmpty())
+        return;
+
+    auto filter = QString("%1 %2").arg(actions[serialFilterActionCombo->currentIndex()],
+                                       serialFilterEdit->text());
+    SerialFilterRule rule;
+    QString err;
+    if (!SerialFilterRule::parse(filter, &rule, &err)) {
+        showErrorMessage(err);
+        return;
+    }
+    filter = rule.toString();
+
+    for (auto &board: selected_boards_) {
+        auto filters = board->serialFilters();
+        if (!filters.contains(filter)) {
+            filters.append(filter);
+            board->setSerialFilters(filters);
+        }
+    }
+    serialFilterEdit->clear();
+}
+
+void MainWindow::removeSerialFilterFromSelection()
+{
+    QStringList removed;
+    for (auto &item: serialFilterTree->selectedItems())
+        removed.append(item->text(0));
+    if (removed.isEmpty())
+        return;
+
+    for (auto &board: selected_boards_) {
+        auto filters = board->serialFilters();
+        for (auto &filter: removed)
+            filters.removeAll(filter);
+        board->setSerialFilters(filters);
+    }
+}
+
+void MainWindow::refreshSerialFilterHits()
+{
+    if (!current_board_)
+        return;
+
+    auto &filter = current_board_->serialFilter();
+    for (int i = 0; i < serialFilterTree->topLevelItemCount(); i++) {
+        auto item = serialFilterTree->topLevelItem(i);
+        item->setText(1, QString::number(filter.hits(static_cast<unsigned int>(i))));
+    }
+    if (filter.isActive()) {
+        serialFilterLabel->setText(tr("%1 lines hidden").arg(filter.hiddenLines()));
+    } else {
+        serialFilterLabel->clear();
+    }
+}
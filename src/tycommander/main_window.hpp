@@ -24,6 +24,7 @@ class AboutDialog;
 class ArduinoDialog;
 class Board;
 class Monitor;
+class QTimer;
 
 class MainWindow : public QMainWindow, private Ui::MainWindow {
     Q_OBJECT
@@ -54,6 +55,7 @@ class MainWindow : public QMainWindow, private Ui::MainWindow {
     QProgressBar *statusProgressBar;
     EnhancedGroupBox *lastOpenOptionBox = nullptr;
     int saved_splitter_pos_ = 1;
+    QTimer *serialFilterTimer;
 
     Monitor *monitor_;
     std::vector<std::shared_ptr<Board>> selected_boards_;
@@ -95,6 +97,12 @@ public slots:
     void sendFileToSelection();
     void clearSerialDocument();
 
+    void openSerialSearch();
+    void closeSerialSearch();
+    void findNextInSerial();
+    void findPreviousInSerial();
+    void searchSerialLog();
+
 private:
     static void initCodecList();
 
@@ -104,6 +112,7 @@ private:
     void updateWindowTitle();
     void updateFirmwareMenus();
     void updateSerialLogLink();
+    void findInSerial(bool backward);
 
     QString browseFirmwareDirectory() const;
     QString browseFirmwareFilter() const;
@@ -129,9 +138,17 @@ private slots:
     void setResetAfterForSelection(bool reset_after);
     void setSerialCodecForSelection(const QString &codec_name);
     void setClearOnResetForSelection(bool clear_on_reset);
-    void setScrollBackLimitForSelection(int limit);
+    void setScrollBackSizeForSelection(int size);
     void setEnableSerialForSelection(bool enable);
+    void setSerialLatencyForSelection(int index);
+    void setSerialFrameForSelection(int index);
+    void setSerialOverflowForSelection(int index);
+    void setSerialPlotForSelection(bool enable);
+    void setSerialTimestampsForSelection(bool enable);
     void setSerialLogSizeForSelection(int size);
+    void addSerialFilterToSelection();
+    void removeSerialFilterFromSelection();
+    void refreshSerialFilterHits();
 };
 
 #endif
@@ -11,6 +11,8 @@
 #include <QBrush>
 #include <QIcon>
 
+#include <algorithm>
+
 #include "board.hpp"
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
@@ -59,6 +61,9 @@ void Monitor::loadSettings()
     default_serial_ = db_.get("serialByDefault", true).toBool();
     serial_log_size_ = db_.get("serialLogSize", 20000000ull).toULongLong();
     serial_log_dir_ = db_.get("serialLogDir", "").toString();
+    serial_archive_size_ = db_.get("serialArchiveSize", 50000000ull).toULongLong();
+    serial_threads_ = db_.get("serialThreads", 0).toUInt();
+    serial_pool_.setThreadCount(serial_threads_ ? serial_threads_ : defaultSerialThreads());
 
     emit settingsChanged();
 
@@ -167,6 +172,40 @@ void Monitor::setSerialLogDir(const QString &dir)
     emit settingsChanged();
 }
 
+void Monitor::setSerialArchiveSize(size_t size)
+{
+    if (size == serial_archive_size_)
+        return;
+
+    serial_archive_size_ = size;
+
+    for (auto &board: boards_) {
+        board->serial_archive_size_ = size;
+        board->updateSerialLogState(false);
+    }
+
+    db_.put("serialArchiveSize", static_cast<qulonglong>(size));
+    emit settingsChanged();
+}
+
+// Each thread can handle quite a few boards, and we need the other cores for the GUI
+unsigned int Monitor::defaultSerialThreads()
+{
+    return static_cast<unsigned int>(max(1, min(QThread::idealThreadCount() / 2, 4)));
+}
+
+void Monitor::setSerialThreads(unsigned int threads)
+{
+    if (threads == serial_threads_)
+        return;
+
+    serial_threads_ = threads;
+    serial_pool_.setThreadCount(threads ? threads : defaultSerialThreads());
+
+    db_.put("serialThreads", threads);
+    emit settingsChanged();
+}
+
 bool Monitor::start()
 {
     if (started_)
@@ -182,7 +221,7 @@ bool Monitor::start()
             return false;
         unique_ptr<ty_monitor, decltype(&ty_monitor_free)> monitor_ptr(monitor, ty_monitor_free);
 
-        r = ty_monitor_register_callback(monitor, handleEvent, this);
+        r = ty_monitor_register_batch_callback(monitor, handleChanges, this);
         if (r < 0)
             return false;
 
@@ -194,7 +233,8 @@ bool Monitor::start()
         monitor_ = monitor_ptr.release();
     }
 
-    serial_thread_.start();
+    serial_pool_.start();
+    serial_log_writer_.start(QThread::LowPriority);
 
     r = ty_monitor_start(monitor_);
     if (r < 0)
@@ -210,8 +250,8 @@ void Monitor::stop()
     if (!started_)
         return;
 
-    serial_thread_.quit();
-    serial_thread_.wait();
+    serial_pool_.stop();
+    serial_log_writer_.stop();
 
     if (!boards_.empty()) {
         beginRemoveRows(QModelIndex(), 0, static_cast<int>(boards_.size()));
@@ -310,13 +350,24 @@ QVariant Monitor::data(const QModelIndex &index, int role) const
 
     if (index.column() == 0) {
         switch (role) {
-            case Qt::ToolTipRole:
-                return tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5")
-                       .arg(board->modelName())
-                       .arg(board->location())
-                       .arg(board->serialNumber())
-                       .arg(board->statusText())
-                       .arg(Board::makeCapabilityString(board->capabilities(), tr("(none)")));
+            case Qt::ToolTipRole: {
+                auto tooltip = tr("%1\n+ Location: %2\n+ Serial Number: %3\n+ Status: %4\n+ Capabilities: %5\n+ Memory: %6 kB")
+                               .arg(board->modelName())
+                               .arg(board->location())
+                               .arg(board->serialNumber())
+                               .arg(board->statusText())
+                               .arg(Board::makeCapabilityString(board->capabilities(), tr("(none)")))
+                               .arg((board->memoryUsage() + 999) / 1000);
+
+                int thread = serial_pool_.boardThread(board.get());
+                if (thread >= 0 && board->serialOpen()) {
+                    tooltip += tr("\n+ Serial Thread: #%1 (%2% busy)")
+                               .arg(thread + 1)
+                               .arg(serial_pool_.threadBusy(static_cast<unsigned int>(thread)) * 100.0, 0, 'f', 0);
+                }
+
+                return tooltip;
+            }
             case Qt::DecorationRole:
                 return board->statusIcon();
             case Qt::EditRole:
@@ -388,18 +439,50 @@ int Monitor::handleEvent(ty_board *board, ty_monitor_event event, void *udata)
     return 0;
 }
 
+/* A hub reset can change dozens of boards in one refresh. Process all the changes first and
+   signal the affected rows by range afterwards, instead of one row at a time. */
+int Monitor::handleChanges(const ty_monitor_change *changes, unsigned int count, void *udata)
+{
+    auto self = static_cast<Monitor *>(udata);
+    vector<shared_ptr<Board>> added;
+
+    self->batching_ = true;
+    self->batch_first_changed_ = INT_MAX;
+    self->batch_last_changed_ = -1;
+    for (unsigned int i = 0; i < count; i++) {
+        switch (changes[i].event) {
+        case TY_MONITOR_EVENT_ADDED: {
+            auto board = self->createBoard(changes[i].board);
+            if (board)
+                added.push_back(board);
+        } break;
+
+        case TY_MONITOR_EVENT_CHANGED:
+        case TY_MONITOR_EVENT_DISAPPEARED:
+        case TY_MONITOR_EVENT_DROPPED: {
+            self->handleChangedEvent(changes[i].board);
+        } break;
+        }
+    }
+    self->batching_ = false;
+
+    self->applyBatch(added);
+
+    return 0;
+}
+
 Monitor::iterator Monitor::findBoardIterator(ty_board *board)
 {
     return find_if(boards_.begin(), boards_.end(),
                    [=](std::shared_ptr<Board> &ptr) { return ptr->board() == board; });
 }
 
-void Monitor::handleAddedEvent(ty_board *board)
+shared_ptr<Board> Monitor::createBoard(ty_board *board)
 {
     if (ignore_generic_ && ty_board_get_model(board) == TY_MODEL_GENERIC)
-        return;
+        return nullptr;
     if (findBoardIterator(board) != boards_.end())
-        return;
+        return nullptr;
 
     // Work around the private constructor for make_shared()
     struct BoardSharedEnabler : public Board {
@@ -412,10 +495,12 @@ void Monitor::handleAddedEvent(ty_board *board)
     if (board_wrapper->hasCapability(TY_BOARD_CAPABILITY_UNIQUE))
         configureBoardDatabase(*board_wrapper);
     board_wrapper->serial_log_dir_ = serial_log_dir_;
+    board_wrapper->serial_archive_size_ = serial_archive_size_;
     board_wrapper->loadSettings(this);
 
     board_wrapper->setThreadPool(pool_);
-    board_wrapper->serial_notifier_.moveToThread(&serial_thread_);
+    serial_pool_.addBoard(board_wrapper_ptr);
+    serial_log_writer_.addLog(board_wrapper->serial_log_);
 
     connect(board_wrapper, &Board::infoChanged, this, [=]() {
         refreshBoardItem(findBoardIterator(board));
@@ -439,12 +524,21 @@ void Monitor::handleAddedEvent(ty_board *board)
         removeBoardItem(findBoardIterator(board));
     });
 
+    return board_wrapper_ptr;
+}
+
+void Monitor::handleAddedEvent(ty_board *board)
+{
+    auto board_wrapper = createBoard(board);
+    if (!board_wrapper)
+        return;
+
     beginInsertRows(QModelIndex(), static_cast<int>(boards_.size()),
                     static_cast<int>(boards_.size()));
-    boards_.push_back(board_wrapper_ptr);
+    boards_.push_back(board_wrapper);
     endInsertRows();
 
-    emit boardAdded(board_wrapper);
+    emit boardAdded(board_wrapper.get());
 }
 
 void Monitor::handleChangedEvent(ty_board *board)
@@ -459,17 +553,73 @@ void Monitor::handleChangedEvent(ty_board *board)
 
 void Monitor::refreshBoardItem(iterator it)
 {
-    auto index = createIndex(it - boards_.begin(), 0);
+    if (it == boards_.end())
+        return;
+    int row = static_cast<int>(it - boards_.begin());
+
+    if (batching_) {
+        batch_first_changed_ = min(batch_first_changed_, row);
+        batch_last_changed_ = max(batch_last_changed_, row);
+        return;
+    }
+
+    auto index = createIndex(row, 0);
     dataChanged(index, index);
 }
 
 void Monitor::removeBoardItem(iterator it)
 {
-    beginRemoveRows(QModelIndex(), it - boards_.begin(), it - boards_.begin());
+    if (it == boards_.end())
+        return;
+    int row = static_cast<int>(it - boards_.begin());
+
+    // Rows must not move until the batch is over
+    if (batching_) {
+        batch_dropped_.push_back(row);
+        return;
+    }
+
+    beginRemoveRows(QModelIndex(), row, row);
     boards_.erase(it);
     endRemoveRows();
 }
 
+void Monitor::applyBatch(const vector<shared_ptr<Board>> &added)
+{
+    if (batch_last_changed_ >= 0)
+        dataChanged(createIndex(batch_first_changed_, 0), createIndex(batch_last_changed_, 0));
+
+    // Remove dropped rows starting from the end, one signal for each contiguous range
+    sort(batch_dropped_.begin(), batch_dropped_.end());
+    batch_dropped_.erase(unique(batch_dropped_.begin(), batch_dropped_.end()),
+                         batch_dropped_.end());
+    while (!batch_dropped_.empty()) {
+        int last = batch_dropped_.back();
+        int first = last;
+
+        batch_dropped_.pop_back();
+        while (!batch_dropped_.empty() && batch_dropped_.back() == first - 1) {
+            first--;
+            batch_dropped_.pop_back();
+        }
+
+        beginRemoveRows(QModelIndex(), first, last);
+        boards_.erase(boards_.begin() + first, boards_.begin() + last + 1);
+        endRemoveRows();
+    }
+
+    if (!added.empty()) {
+        int first = static_cast<int>(boards_.size());
+
+        beginInsertRows(QModelIndex(), first, first + static_cast<int>(added.size()) - 1);
+        boards_.insert(boards_.end(), added.begin(), added.end());
+        endInsertRows();
+
+        for (auto &board: added)
+            emit boardAdded(board.get());
+    }
+}
+
 void Monitor::configureBoardDatabase(Board &board)
 {
     board.setDatabase(db_.subDatabase(board.id()));
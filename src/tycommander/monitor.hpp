@@ -14,11 +14,14 @@
 #include <QAbstractListModel>
 #include <QThread>
 
+#include <climits>
 #include <memory>
 #include <vector>
 
 #include "database.hpp"
 #include "descriptor_notifier.hpp"
+#include "serial_log.hpp"
+#include "serial_pool.hpp"
 #include "../libty/monitor.h"
 
 class Board;
@@ -36,15 +39,24 @@ class Monitor : public QAbstractListModel {
     DescriptorNotifier monitor_notifier_;
 
     ty_pool *pool_;
-    QThread serial_thread_;
+    SerialPool serial_pool_;
+    SerialLogWriter serial_log_writer_;
 
     bool ignore_generic_;
     bool default_serial_;
     size_t serial_log_size_;
     QString serial_log_dir_;
+    size_t serial_archive_size_;
+    unsigned int serial_threads_;
 
     std::vector<std::shared_ptr<Board>> boards_;
 
+    // Rows touched while we process a batch of changes, see handleChanges()
+    bool batching_ = false;
+    int batch_first_changed_ = INT_MAX;
+    int batch_last_changed_ = -1;
+    std::vector<int> batch_dropped_;
+
 public:
     typedef decltype(boards_)::iterator iterator;
     typedef decltype(boards_)::const_iterator const_iterator;
@@ -80,6 +92,11 @@ public:
     bool serialByDefault() const { return default_serial_; }
     size_t serialLogSize() const { return serial_log_size_; }
     QString serialLogDir() const { return serial_log_dir_; }
+    // Compressed size of the archive kept for each board log, zero disables it
+    size_t serialArchiveSize() const { return serial_archive_size_; }
+    // Zero means the default, see defaultSerialThreads()
+    unsigned int serialThreads() const { return serial_threads_; }
+    static unsigned int defaultSerialThreads();
 
     bool start();
     void stop();
@@ -118,6 +135,8 @@ public slots:
     void setSerialByDefault(bool default_serial);
     void setSerialLogSize(size_t default_size);
     void setSerialLogDir(const QString &dir);
+    void setSerialArchiveSize(size_t size);
+    void setSerialThreads(unsigned int threads);
 
 signals:
     void settingsChanged();
@@ -131,8 +150,11 @@ private:
     iterator findBoardIterator(ty_board *board);
 
     static int handleEvent(ty_board *board, ty_monitor_event event, void *udata);
+    static int handleChanges(const ty_monitor_change *changes, unsigned int count, void *udata);
+    std::shared_ptr<Board> createBoard(ty_board *board);
     void handleAddedEvent(ty_board *board);
     void handleChangedEvent(ty_board *board);
+    void applyBatch(const std::vector<std::shared_ptr<Board>> &added);
 
     void refreshBoardItem(iterator it);
     void removeBoardItem(iterator it);
@@ -54,6 +54,8 @@ void PreferencesDialog::apply()
     monitor->setSerialByDefault(serialByDefaultCheck->isChecked());
     monitor->setSerialLogSize(serialLogSizeDefaultSpin->value() * 1000);
     monitor->setSerialLogDir(serialLogDir->text());
+    monitor->setSerialArchiveSize(static_cast<size_t>(serialArchiveSizeSpin->value()) * 1000000);
+    monitor->setSerialThreads(static_cast<unsigned int>(serialThreadsSpin->value()));
     monitor->setMaxTasks(maxTasksSpin->value());
 }
 
@@ -79,6 +81,8 @@ void PreferencesDialog::refresh()
     serialByDefaultCheck->setChecked(monitor->serialByDefault());
     serialLogSizeDefaultSpin->setValue(static_cast<int>(monitor->serialLogSize() / 1000));
     serialLogDir->setText(monitor->serialLogDir());
+    serialArchiveSizeSpin->setValue(static_cast<int>(monitor->serialArchiveSize() / 1000000));
+    serialThreadsSpin->setValue(static_cast<int>(monitor->serialThreads()));
     maxTasksSpin->setValue(monitor->maxTasks());
 }
 
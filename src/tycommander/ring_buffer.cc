@@ -0,0 +1,144 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <cstring>
+
+#include "ring_buffer.hpp"
+
+using namespace std;
+
+RingBuffer::RingBuffer(size_t size)
+    : size_(size), head_(0), tail_(0)
+{
+    Q_ASSERT(size && !(size & (size - 1)));
+}
+
+void RingBuffer::allocate()
+{
+    if (!buf_)
+        buf_.reset(new char[size_]);
+}
+
+void RingBuffer::release()
+{
+    buf_.reset();
+    head_ = 0;
+    tail_ = 0;
+}
+
+void RingBuffer::copyIn(size_t head, const char *buf, size_t len)
+{
+    size_t offset = head & (size_ - 1);
+    size_t part_len = min(len, size_ - offset);
+
+    memcpy(buf_.get() + offset, buf, part_len);
+    memcpy(buf_.get(), buf + part_len, len - part_len);
+}
+
+// Returns the number of bytes written, which is less than len if the ring is full
+size_t RingBuffer::write(const char *buf, size_t len)
+{
+    if (!buf_)
+        return 0;
+
+    size_t head = head_.load(memory_order_relaxed);
+    size_t tail = tail_.load(memory_order_acquire);
+
+    len = min(len, size_ - (head - tail));
+    copyIn(head, buf, len);
+    head_.store(head + len, memory_order_release);
+
+    return len;
+}
+
+// Returns the number of bytes dropped to make room, including from buf itself
+size_t RingBuffer::overwrite(const char *buf, size_t len)
+{
+    size_t dropped = 0;
+
+    if (!buf_)
+        return len;
+    if (len > size_) {
+        dropped = len - size_;
+        buf += dropped;
+        len = size_;
+    }
+
+    size_t head = head_.load(memory_order_relaxed);
+    size_t tail = tail_.load(memory_order_acquire);
+    while (head - tail + len > size_) {
+        size_t new_tail = head + len - size_;
+        if (tail_.compare_exchange_weak(tail, new_tail, memory_order_acq_rel)) {
+            dropped += new_tail - tail;
+            break;
+        }
+    }
+
+    copyIn(head, buf, len);
+    head_.store(head + len, memory_order_release);
+
+    return dropped;
+}
+
+size_t RingBuffer::read(char *buf, size_t len)
+{
+    if (!buf_)
+        return 0;
+
+    size_t tail = tail_.load(memory_order_acquire);
+
+    while (true) {
+        size_t head = head_.load(memory_order_acquire);
+        // Same as in size(), the CAS will fail if the producer went past us
+        size_t read_len = min(len, min(head - tail, size_));
+
+        /* This works like the read side of a seqlock. With overwrite(), the producer can
+           rewrite the bytes we are copying, but only after it has moved the tail past them
+           with a CAS. Our own CAS below then fails and we start over with the new tail, so
+           torn bytes are never returned. The copy cannot move after the CAS (release), and
+           the producer cannot write before its CAS (acquire). This relies on plain memcpy
+           tolerating concurrent writes, as seqlock implementations do, which is why
+           peek()/consume() (without retry) must not be mixed with overwrite(). */
+        size_t offset = tail & (size_ - 1);
+        size_t part_len = min(read_len, size_ - offset);
+        memcpy(buf, buf_.get() + offset, part_len);
+        memcpy(buf + part_len, buf_.get(), read_len - part_len);
+
+        if (tail_.compare_exchange_strong(tail, tail + read_len, memory_order_acq_rel))
+            return read_len;
+    }
+}
+
+// Returns the first contiguous readable part, there may be more after consume()
+size_t RingBuffer::peek(const char **rbuf) const
+{
+    if (!buf_)
+        return 0;
+
+    size_t head = head_.load(memory_order_acquire);
+    size_t tail = tail_.load(memory_order_relaxed);
+    size_t offset = tail & (size_ - 1);
+
+    *rbuf = buf_.get() + offset;
+    return min(head - tail, size_ - offset);
+}
+
+void RingBuffer::consume(size_t len)
+{
+    tail_.fetch_add(len, memory_order_release);
+}
+
+void RingBuffer::clear()
+{
+    tail_.store(head_.load(memory_order_acquire), memory_order_release);
+}
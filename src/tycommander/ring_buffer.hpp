@@ -0,0 +1,68 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef RING_BUFFER_HH
+#define RING_BUFFER_HH
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+/* Lock-free byte ring for exactly one producer thread and one consumer thread. The size
+   must be a power of two. Positions grow forever and are masked on access, so the ring can
+   be completely filled.
+
+   The producer may also call overwrite() to make room by dropping the oldest bytes. This
+   moves the tail under the feet of the consumer, so read() detects it and starts over,
+   but peek() and consume() must not be mixed with overwrite().
+
+   Storage is only allocated by allocate(), and freed by release(). Neither side may run
+   during these calls. Until then the ring behaves as if it was always full and empty. */
+class RingBuffer {
+    std::unique_ptr<char[]> buf_;
+    size_t size_;
+
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+
+public:
+    RingBuffer(size_t size);
+
+    bool isAllocated() const { return !!buf_; }
+    void allocate();
+    void release();
+
+    size_t capacity() const { return size_; }
+    size_t size() const
+    {
+        /* Load the tail first: overwrite() may move both positions in between, and a newer
+           head with an older tail can only make the difference too large, never negative. */
+        size_t tail = tail_.load(std::memory_order_acquire);
+        size_t head = head_.load(std::memory_order_acquire);
+        return std::min(head - tail, size_);
+    }
+    size_t available() const { return size_ - size(); }
+    bool empty() const { return !size(); }
+
+    // Producer side
+    size_t write(const char *buf, size_t len);
+    size_t overwrite(const char *buf, size_t len);
+
+    // Consumer side
+    size_t read(char *buf, size_t len);
+    size_t peek(const char **rbuf) const;
+    void consume(size_t len);
+    void clear();
+
+private:
+    void copyIn(size_t head, const char *buf, size_t len);
+};
+
+#endif
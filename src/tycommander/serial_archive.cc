@@ -0,0 +1,355 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+#include "serial_archive.hpp"
+
+using namespace std;
+
+#define SERIAL_ARCHIVE_SEGMENT_SIZE 1048576
+#define SERIAL_ARCHIVE_CHECKPOINT_INTERVAL 10000
+
+SerialArchive::~SerialArchive()
+{
+    close();
+}
+
+bool SerialArchive::isOpen() const
+{
+    QMutexLocker locker(&lock_);
+    return !prefix_.isEmpty();
+}
+
+/* Unlike the log file, the archive picks up where it was left: the segments listed in the
+   index are kept, within the (possibly new) budget. If it is already open, only the budget
+   changes. */
+bool SerialArchive::open(const QString &prefix, size_t max_size)
+{
+    QMutexLocker compress_locker(&compress_lock_);
+    QMutexLocker locker(&lock_);
+
+    if (prefix != prefix_) {
+        clearState();
+        prefix_ = prefix;
+        loadIndex();
+    }
+    max_size_ = max_size;
+    trim();
+
+    return writeIndex();
+}
+
+// Keeps the files around, the user may want to look at them
+void SerialArchive::close()
+{
+    compress(true);
+
+    QMutexLocker compress_locker(&compress_lock_);
+    QMutexLocker locker(&lock_);
+
+    prefix_.clear();
+    clearState();
+}
+
+// Deletes the archive files, even if the archive is not open (e.g. disabled at startup)
+void SerialArchive::remove(const QString &prefix)
+{
+    QMutexLocker compress_locker(&compress_lock_);
+    QMutexLocker locker(&lock_);
+
+    if (prefix.isEmpty())
+        return;
+
+    prefix_ = prefix;
+    clearFiles();
+    prefix_.clear();
+}
+
+void SerialArchive::append(const char *buf, size_t len)
+{
+    QMutexLocker locker(&lock_);
+
+    if (prefix_.isEmpty() || !len)
+        return;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (checkpoints_.empty() || now - checkpoints_.back().time >= SERIAL_ARCHIVE_CHECKPOINT_INTERVAL)
+        checkpoints_.push_back({now, offset_});
+
+    while (len) {
+        if (pending_.isEmpty())
+            pending_.reserve(SERIAL_ARCHIVE_SEGMENT_SIZE);
+
+        size_t part_len = min(len, SERIAL_ARCHIVE_SEGMENT_SIZE - static_cast<size_t>(pending_.size()));
+        pending_.append(buf, static_cast<int>(part_len));
+        offset_ += part_len;
+        buf += part_len;
+        len -= part_len;
+
+        if (pending_.size() == SERIAL_ARCHIVE_SEGMENT_SIZE) {
+            queue_.emplace_back(offset_ - SERIAL_ARCHIVE_SEGMENT_SIZE, pending_);
+            pending_ = QByteArray();
+        }
+    }
+}
+
+/* Compresses the full segments, and the incomplete one if partial is true. The segments
+   stay readable from memory until they have been written, so read() never misses data. */
+bool SerialArchive::compress(bool partial)
+{
+    QMutexLocker compress_locker(&compress_lock_);
+
+    bool success = true;
+    for (;;) {
+        uint64_t offset;
+        QByteArray raw;
+        uint64_t seq;
+        QString filename;
+        {
+            QMutexLocker locker(&lock_);
+
+            if (prefix_.isEmpty())
+                break;
+            if (queue_.empty()) {
+                if (!partial || pending_.isEmpty())
+                    break;
+                queue_.emplace_back(offset_ - static_cast<uint64_t>(pending_.size()), pending_);
+                pending_ = QByteArray();
+            }
+
+            offset = queue_.front().first;
+            raw = queue_.front().second;
+            seq = next_seq_++;
+            filename = segmentFileName(seq);
+        }
+
+        auto compressed = qCompress(raw);
+
+        QFile file(filename);
+        bool written = file.open(QIODevice::WriteOnly) &&
+                       file.write(compressed) == compressed.size() && file.flush();
+        file.close();
+
+        QMutexLocker locker(&lock_);
+
+        // This data is lost if we could not write it, keeping it in memory would not help
+        queue_.pop_front();
+        if (!written) {
+            file.remove();
+            success = false;
+            break;
+        }
+
+        segments_.push_back({seq, offset, static_cast<size_t>(raw.size()),
+                             static_cast<size_t>(compressed.size())});
+        size_ += static_cast<size_t>(compressed.size());
+        trim();
+
+        success &= writeIndex();
+    }
+
+    return success;
+}
+
+uint64_t SerialArchive::offset() const
+{
+    QMutexLocker locker(&lock_);
+    return offset_;
+}
+
+/* Calls f with the archived data, from the oldest to the most recent, until f returns false
+   or the stream offset end is reached. Segments are decompressed one at a time, without
+   holding lock_, so compress() can go on meanwhile (segments it deletes are skipped). */
+void SerialArchive::scan(uint64_t end, const function<bool(const char *, size_t)> &f) const
+{
+    deque<Segment> segments;
+    deque<pair<uint64_t, QByteArray>> parts;
+    QString prefix;
+    {
+        QMutexLocker locker(&lock_);
+
+        if (prefix_.isEmpty())
+            return;
+
+        segments = segments_;
+        parts = queue_;
+        if (!pending_.isEmpty())
+            parts.emplace_back(offset_ - static_cast<uint64_t>(pending_.size()), pending_);
+        prefix = prefix_;
+    }
+
+    auto visit = [&](uint64_t part_offset, const QByteArray &part) {
+        if (part_offset >= end)
+            return false;
+        auto len = min(static_cast<size_t>(part.size()), static_cast<size_t>(end - part_offset));
+        return f(part.constData(), len);
+    };
+
+    for (auto &segment: segments) {
+        QFile file(QString("%1.%2.z").arg(prefix).arg(segment.seq));
+        if (!file.open(QIODevice::ReadOnly))
+            continue;
+        if (!visit(segment.offset, qUncompress(file.readAll())))
+            return;
+    }
+    for (auto &part: parts) {
+        if (!visit(part.first, part.second))
+            return;
+    }
+}
+
+size_t SerialArchive::size() const
+{
+    QMutexLocker locker(&lock_);
+    return size_;
+}
+
+size_t SerialArchive::memoryUsage() const
+{
+    QMutexLocker locker(&lock_);
+
+    size_t usage = static_cast<size_t>(pending_.capacity());
+    for (auto &part: queue_)
+        usage += static_cast<size_t>(part.second.size());
+    usage += segments_.size() * sizeof(Segment) + checkpoints_.size() * sizeof(Checkpoint);
+
+    return usage;
+}
+
+QString SerialArchive::segmentFileName(uint64_t seq) const
+{
+    return QString("%1.%2.z").arg(prefix_).arg(seq);
+}
+
+/* The index is rewritten after each segment, it is small. Lines look like "S <seq>
+   <offset> <length> <compressed length>" for segments and "T <time> <offset>" for
+   checkpoints. You need to lock lock_ before you call this. */
+bool SerialArchive::writeIndex()
+{
+    QFile file(prefix_ + ".idx");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray buf;
+    for (auto &segment: segments_) {
+        buf += "S " + QByteArray::number(static_cast<qulonglong>(segment.seq)) + " " +
+               QByteArray::number(static_cast<qulonglong>(segment.offset)) + " " +
+               QByteArray::number(static_cast<qulonglong>(segment.len)) + " " +
+               QByteArray::number(static_cast<qulonglong>(segment.compressed_len)) + "\n";
+    }
+    for (auto &checkpoint: checkpoints_) {
+        buf += "T " + QByteArray::number(checkpoint.time) + " " +
+               QByteArray::number(static_cast<qulonglong>(checkpoint.offset)) + "\n";
+    }
+
+    return file.write(buf) == buf.size() && file.flush();
+}
+
+/* Segments that are missing or don't have the expected size are ignored, and segment files
+   that the index does not know about (e.g. after a crash) are deleted. You need to lock
+   lock_ before you call this. */
+void SerialArchive::loadIndex()
+{
+    QFile file(prefix_ + ".idx");
+    if (file.open(QIODevice::ReadOnly)) {
+        while (!file.atEnd()) {
+            auto fields = file.readLine().trimmed().split(' ');
+
+            if (fields.size() == 5 && fields[0] == "S") {
+                Segment segment;
+                segment.seq = fields[1].toULongLong();
+                segment.offset = fields[2].toULongLong();
+                segment.len = static_cast<size_t>(fields[3].toULongLong());
+                segment.compressed_len = static_cast<size_t>(fields[4].toULongLong());
+
+                QFileInfo info(segmentFileName(segment.seq));
+                if (!info.exists() ||
+                        static_cast<size_t>(info.size()) != segment.compressed_len)
+                    continue;
+                if (!segments_.empty() && segment.offset < segments_.back().offset + segments_.back().len)
+                    continue;
+
+                segments_.push_back(segment);
+                size_ += segment.compressed_len;
+            } else if (fields.size() == 3 && fields[0] == "T") {
+                Checkpoint checkpoint;
+                checkpoint.time = fields[1].toLongLong();
+                checkpoint.offset = fields[2].toULongLong();
+
+                checkpoints_.push_back(checkpoint);
+            }
+        }
+    }
+
+    if (!segments_.empty()) {
+        offset_ = segments_.back().offset + segments_.back().len;
+        next_seq_ = segments_.back().seq + 1;
+    }
+    while (!checkpoints_.empty() && checkpoints_.back().offset > offset_)
+        checkpoints_.pop_back();
+
+    QFileInfo info(prefix_);
+    QDir dir = info.absoluteDir();
+    auto segment_prefix = info.fileName() + ".";
+    for (auto &filename: dir.entryList({segment_prefix + "*.z"}, QDir::Files)) {
+        bool valid;
+        auto seq = filename.mid(segment_prefix.size(), filename.size() - segment_prefix.size() - 2)
+                           .toULongLong(&valid);
+        if (!valid || none_of(segments_.begin(), segments_.end(),
+                              [&](const Segment &segment) { return segment.seq == seq; }))
+            dir.remove(filename);
+    }
+}
+
+/* Always keeps the last segment, even if it is bigger than the budget on its own. You need
+   to lock lock_ before you call this. */
+void SerialArchive::trim()
+{
+    while (size_ > max_size_ && segments_.size() > 1) {
+        QFile::remove(segmentFileName(segments_.front().seq));
+        size_ -= segments_.front().compressed_len;
+        segments_.pop_front();
+    }
+    if (!segments_.empty()) {
+        while (checkpoints_.size() > 1 && checkpoints_[1].offset <= segments_.front().offset)
+            checkpoints_.pop_front();
+    }
+}
+
+// You need to lock lock_ before you call this
+void SerialArchive::clearFiles()
+{
+    QFileInfo info(prefix_);
+    QDir dir = info.absoluteDir();
+    for (auto &filename: dir.entryList({info.fileName() + ".*.z"}, QDir::Files))
+        dir.remove(filename);
+    QFile::remove(prefix_ + ".idx");
+
+    clearState();
+}
+
+// Forgets everything in memory, you need to lock lock_ before you call this
+void SerialArchive::clearState()
+{
+    segments_.clear();
+    checkpoints_.clear();
+    size_ = 0;
+    next_seq_ = 0;
+    queue_.clear();
+    pending_ = QByteArray();
+    offset_ = 0;
+}
@@ -0,0 +1,90 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_ARCHIVE_HH
+#define SERIAL_ARCHIVE_HH
+
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+/* Compressed history of a serial log. The data stream is cut into segments, each one is
+   compressed with zlib and stored in its own file next to the log. Once the compressed size
+   goes over the budget, the oldest segments are deleted.
+
+   The index file lists the segments (with their offset in the uncompressed stream) and
+   checkpoints mapping wall-clock time to stream offsets. open() loads it back, so the
+   history survives restarts, and scan() only has to decompress the segments it needs.
+
+   append() only copies data, compress() does the actual work and should be called without
+   holding other locks because it is slow. SerialLog calls both from the writer thread. */
+class SerialArchive {
+public:
+    struct Segment {
+        uint64_t seq;
+        uint64_t offset;
+        size_t len;
+        size_t compressed_len;
+    };
+
+    struct Checkpoint {
+        qint64 time;
+        uint64_t offset;
+    };
+
+private:
+    // Protects everything but compress_lock_, held for short periods only
+    mutable QMutex lock_;
+    QMutex compress_lock_;
+
+    QString prefix_;
+    size_t max_size_ = 0;
+
+    std::deque<Segment> segments_;
+    std::deque<Checkpoint> checkpoints_;
+    size_t size_ = 0;
+    uint64_t next_seq_ = 0;
+
+    // Uncompressed data, full segments wait in queue_ until compress() gets to them
+    std::deque<std::pair<uint64_t, QByteArray>> queue_;
+    QByteArray pending_;
+    uint64_t offset_ = 0;
+
+public:
+    ~SerialArchive();
+
+    bool isOpen() const;
+    bool open(const QString &prefix, size_t max_size);
+    void close();
+    void remove(const QString &prefix);
+
+    void append(const char *buf, size_t len);
+    bool compress(bool partial);
+
+    uint64_t offset() const;
+    void scan(uint64_t end, const std::function<bool(const char *, size_t)> &f) const;
+
+    size_t size() const;
+    size_t memoryUsage() const;
+
+private:
+    QString segmentFileName(uint64_t seq) const;
+    void loadIndex();
+    bool writeIndex();
+    void trim();
+    void clearFiles();
+    void clearState();
+};
+
+#endif
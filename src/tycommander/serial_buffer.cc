@@ -0,0 +1,434 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
+
+#include "serial_buffer.hpp"
+
+using namespace std;
+
+#define CHUNK_SIZE 65536
+#define SWAP_DELAY 60000
+
+SerialBuffer::SerialBuffer(size_t limit, QObject *parent)
+    : QObject(parent), limit_(limit)
+{
+    lines_.push_back(0);
+
+    swap_timer_.setInterval(SWAP_DELAY);
+    swap_timer_.setSingleShot(true);
+    connect(&swap_timer_, &QTimer::timeout, this, &SerialBuffer::swapOut);
+    // Nobody looks at the buffer yet
+    swap_timer_.start();
+}
+
+size_t SerialBuffer::memoryUsage() const
+{
+    size_t usage = 0;
+    for (auto &chunk: chunks_) {
+        if (chunk)
+            usage += CHUNK_SIZE;
+    }
+    usage += filters_.size() * SerialSearchFilter::memoryUsage();
+    usage += lines_.size() * sizeof(uint64_t);
+
+    return usage;
+}
+
+void SerialBuffer::attach()
+{
+    views_++;
+    swap_timer_.stop();
+    if (swapped_)
+        swapIn();
+}
+
+void SerialBuffer::detach()
+{
+    if (!--views_)
+        swap_timer_.start();
+}
+
+void SerialBuffer::setLimit(size_t limit)
+{
+    if (limit == limit_)
+        return;
+
+    limit_ = limit;
+    trim();
+}
+
+void SerialBuffer::append(const char *buf, size_t len)
+{
+    if (!len)
+        return;
+
+    const char *end = buf + len;
+    while (buf < end) {
+        size_t chunk_offset = static_cast<size_t>((end_ - start_) % CHUNK_SIZE);
+        if (!chunk_offset && end_ - start_ == chunks_.size() * CHUNK_SIZE) {
+            // Nobody is watching, the previous chunk is full and can go to disk
+            if (swapped_ && !chunks_.empty())
+                swapChunk(chunks_.size() - 1);
+
+            chunks_.emplace_back(new char[CHUNK_SIZE]);
+            filters_.emplace_back();
+            swap_offsets_.push_back(-1);
+        }
+
+        size_t part_len = min(static_cast<size_t>(end - buf), CHUNK_SIZE - chunk_offset);
+        char *chunk = chunks_.back().get() + chunk_offset;
+        memcpy(chunk, buf, part_len);
+        filters_.back().add(chunk, part_len, &filter_state_);
+
+        // Index lines as we go, memchr() is much faster than a byte loop
+        const char *ptr = chunk;
+        const char *chunk_end = chunk + part_len;
+        while ((ptr = static_cast<const char *>(memchr(ptr, '\n', static_cast<size_t>(chunk_end - ptr))))) {
+            uint64_t line_end = end_ + static_cast<uint64_t>(ptr - chunk);
+            max_line_length_ = max(max_line_length_, static_cast<size_t>(line_end - lines_.back()));
+            lines_.push_back(line_end + 1);
+            ptr++;
+        }
+
+        buf += part_len;
+        end_ += part_len;
+    }
+    max_line_length_ = max(max_line_length_, static_cast<size_t>(end_ - lines_.back()));
+
+    trim();
+    emit appended();
+}
+
+void SerialBuffer::clear()
+{
+    chunks_.clear();
+    filters_.clear();
+    swap_offsets_.clear();
+    filter_state_ = 0;
+    start_ = 0;
+    end_ = 0;
+
+    lines_.clear();
+    lines_.push_back(0);
+    first_line_ = 0;
+    max_line_length_ = 0;
+
+    if (swap_file_.isOpen())
+        swap_file_.resize(0);
+    swap_end_ = 0;
+    swap_free_.clear();
+
+    emit cleared();
+}
+
+QByteArray SerialBuffer::lineData(uint64_t line) const
+{
+    if (line < first_line_ || line >= endLine())
+        return QByteArray();
+
+    auto idx = static_cast<size_t>(line - first_line_);
+    uint64_t begin = lines_[idx];
+    uint64_t end = idx + 1 < lines_.size() ? lines_[idx + 1] - 1 : end_;
+    if (end > begin) {
+        char last;
+        copyOut(end - 1, &last, 1);
+        if (last == '\r')
+            end--;
+    }
+    begin += readMarkers(line, nullptr, nullptr);
+    if (begin > end)
+        begin = end;
+
+    QByteArray data(static_cast<int>(end - begin), Qt::Uninitialized);
+    copyOut(begin, data.data(), static_cast<size_t>(data.size()));
+
+    return data;
+}
+
+bool SerialBuffer::isHighlighted(uint64_t line) const
+{
+    if (line < first_line_ || line >= endLine())
+        return false;
+
+    bool highlight;
+    readMarkers(line, nullptr, &highlight);
+    return highlight;
+}
+
+qint64 SerialBuffer::lineTime(uint64_t line) const
+{
+    if (line < first_line_ || line >= endLine())
+        return -1;
+
+    uint64_t time = UINT64_MAX;
+    readMarkers(line, &time, nullptr);
+    return time != UINT64_MAX ? static_cast<qint64>(time / 1000) : -1;
+}
+
+size_t SerialBuffer::encodeTimestamp(uint64_t time, char *r_buf)
+{
+    r_buf[0] = SERIAL_BUFFER_TIMESTAMP;
+    for (unsigned int i = 1; i < SERIAL_BUFFER_TIMESTAMP_SIZE; i++)
+        r_buf[i] = static_cast<char>(0x80 | ((time >> (60 - i * 6)) & 0x3F));
+
+    return SERIAL_BUFFER_TIMESTAMP_SIZE;
+}
+
+// Checks every byte, in case the ring dropped the end of a marker
+bool SerialBuffer::decodeTimestamp(const char *buf, size_t len, uint64_t *r_time)
+{
+    if (len < SERIAL_BUFFER_TIMESTAMP_SIZE || buf[0] != SERIAL_BUFFER_TIMESTAMP)
+        return false;
+
+    uint64_t time = 0;
+    for (unsigned int i = 1; i < SERIAL_BUFFER_TIMESTAMP_SIZE; i++) {
+        auto c = static_cast<uint8_t>(buf[i]);
+        if ((c & 0xC0) != 0x80)
+            return false;
+        time = (time << 6) | (c & 0x3F);
+    }
+
+    *r_time = time;
+    return true;
+}
+
+bool SerialBuffer::search(const SerialSearchQuery &query, uint64_t line, int from, bool backward,
+                          SerialSearchMatch *r_match) const
+{
+    if (line < first_line_) {
+        if (backward)
+            return false;
+        line = first_line_;
+        from = 0;
+    } else if (line >= endLine()) {
+        if (!backward)
+            return false;
+        line = endLine() - 1;
+        from = INT_MAX;
+    }
+
+    // Most lines fit in a single chunk, remember what we know about each chunk
+    vector<signed char> candidates(filters_.size(), -1);
+    auto may_match = [&](size_t first_chunk, size_t last_chunk) {
+        if (first_chunk == last_chunk) {
+            if (candidates[first_chunk] < 0)
+                candidates[first_chunk] = query.mayMatch(filters_[first_chunk]);
+            return !!candidates[first_chunk];
+        }
+        return query.mayMatch(filters_.begin() + static_cast<ptrdiff_t>(first_chunk),
+                              filters_.begin() + static_cast<ptrdiff_t>(last_chunk) + 1);
+    };
+    auto line_at = [&](uint64_t offset) {
+        return static_cast<size_t>(upper_bound(lines_.begin(), lines_.end(), offset) -
+                                   lines_.begin()) - 1;
+    };
+
+    auto idx = static_cast<size_t>(line - first_line_);
+    for (;;) {
+        uint64_t begin = lines_[idx];
+        uint64_t end = idx + 1 < lines_.size() ? lines_[idx + 1] - 1 : end_;
+
+        bool candidate;
+        if (end > begin) {
+            auto first_chunk = static_cast<size_t>((begin - start_) / CHUNK_SIZE);
+            auto last_chunk = static_cast<size_t>((end - 1 - start_) / CHUNK_SIZE);
+
+            candidate = may_match(first_chunk, last_chunk);
+
+            // Skip the other lines of this chunk, the next line we look at may straddle two
+            if (!candidate && first_chunk == last_chunk) {
+                uint64_t chunk_start = start_ + first_chunk * CHUNK_SIZE;
+
+                if (!backward) {
+                    idx = max(idx + 1, line_at(chunk_start + CHUNK_SIZE));
+                    if (idx >= lines_.size())
+                        return false;
+                } else {
+                    if (!first_chunk || !idx)
+                        return false;
+                    idx = min(idx - 1, line_at(chunk_start - 1));
+                }
+                from = backward ? INT_MAX : 0;
+                continue;
+            }
+        } else {
+            candidate = query.keys().empty();
+        }
+
+        if (candidate) {
+            int start, length;
+            if (query.match(lineText(first_line_ + idx), from, backward, &start, &length)) {
+                r_match->line = first_line_ + idx;
+                r_match->start = start;
+                r_match->length = length;
+                return true;
+            }
+        }
+
+        if (!backward) {
+            if (++idx >= lines_.size())
+                return false;
+            from = 0;
+        } else {
+            if (!idx--)
+                return false;
+            from = INT_MAX;
+        }
+    }
+}
+
+void SerialBuffer::trim()
+{
+    if (end_ - start_ <= limit_ || chunks_.size() < 2)
+        return;
+
+    while (end_ - start_ > limit_ && chunks_.size() > 1) {
+        if (swap_offsets_.front() >= 0)
+            swap_free_.push_back(swap_offsets_.front());
+        chunks_.pop_front();
+        filters_.pop_front();
+        swap_offsets_.pop_front();
+        start_ += CHUNK_SIZE;
+    }
+
+    while (lines_.size() > 1 && lines_[1] <= start_) {
+        lines_.pop_front();
+        first_line_++;
+    }
+    // The first line may have lost its beginning
+    if (lines_[0] < start_)
+        lines_[0] = start_;
+
+    emit trimmed();
+}
+
+// Returns the size of the markers at the start of the line, the line must exist
+size_t SerialBuffer::readMarkers(uint64_t line, uint64_t *r_time, bool *r_highlight) const
+{
+    auto idx = static_cast<size_t>(line - first_line_);
+    uint64_t begin = lines_[idx];
+    uint64_t end = idx + 1 < lines_.size() ? lines_[idx + 1] : end_;
+
+    char buf[SERIAL_BUFFER_TIMESTAMP_SIZE + 1];
+    auto len = static_cast<size_t>(min(end - begin, static_cast<uint64_t>(sizeof(buf))));
+    copyOut(begin, buf, len);
+
+    size_t size = 0;
+    uint64_t time;
+    if (decodeTimestamp(buf, len, &time)) {
+        if (r_time)
+            *r_time = time;
+        size += SERIAL_BUFFER_TIMESTAMP_SIZE;
+    }
+    bool highlight = size < len && buf[size] == SERIAL_BUFFER_HIGHLIGHT;
+    if (r_highlight)
+        *r_highlight = highlight;
+    size += highlight;
+
+    return size;
+}
+
+void SerialBuffer::copyOut(uint64_t offset, char *buf, size_t len) const
+{
+    offset -= start_;
+    while (len) {
+        auto chunk = static_cast<size_t>(offset / CHUNK_SIZE);
+        auto chunk_offset = static_cast<size_t>(offset % CHUNK_SIZE);
+        size_t part_len = min(len, CHUNK_SIZE - chunk_offset);
+
+        if (chunks_[chunk]) {
+            memcpy(buf, chunks_[chunk].get() + chunk_offset, part_len);
+        } else {
+            // Read errors are unlikely, and there is nothing better to show anyway
+            qint64 swap_offset = swap_offsets_[chunk] + static_cast<qint64>(chunk_offset);
+            if (!swap_file_.seek(swap_offset) ||
+                    swap_file_.read(buf, static_cast<qint64>(part_len)) != static_cast<qint64>(part_len))
+                memset(buf, '?', part_len);
+        }
+        buf += part_len;
+        offset += part_len;
+        len -= part_len;
+    }
+}
+
+// Chunks are written to the first free slot, the file does not grow unless it is full
+bool SerialBuffer::swapChunk(size_t idx)
+{
+    if (!chunks_[idx])
+        return true;
+    if (!swap_file_.isOpen() && !swap_file_.open())
+        return false;
+
+    qint64 offset;
+    if (!swap_free_.empty()) {
+        offset = swap_free_.back();
+    } else {
+        offset = swap_end_;
+    }
+    if (!swap_file_.seek(offset) ||
+            swap_file_.write(chunks_[idx].get(), CHUNK_SIZE) != CHUNK_SIZE)
+        return false;
+
+    if (!swap_free_.empty()) {
+        swap_free_.pop_back();
+    } else {
+        swap_end_ += CHUNK_SIZE;
+    }
+    chunks_[idx].reset();
+    swap_offsets_[idx] = offset;
+
+    return true;
+}
+
+void SerialBuffer::swapOut()
+{
+    if (views_)
+        return;
+
+    // The last chunk is still being written to
+    swapped_ = true;
+    for (size_t i = 0; i + 1 < chunks_.size(); i++) {
+        if (!swapChunk(i))
+            break;
+    }
+}
+
+void SerialBuffer::swapIn()
+{
+    swapped_ = false;
+
+    bool complete = true;
+    for (size_t i = 0; i < chunks_.size(); i++) {
+        if (chunks_[i])
+            continue;
+
+        unique_ptr<char[]> chunk(new char[CHUNK_SIZE]);
+        if (!swap_file_.seek(swap_offsets_[i]) ||
+                swap_file_.read(chunk.get(), CHUNK_SIZE) != CHUNK_SIZE) {
+            complete = false;
+            continue;
+        }
+
+        chunks_[i] = move(chunk);
+        swap_free_.push_back(swap_offsets_[i]);
+        swap_offsets_[i] = -1;
+    }
+
+    // Give the disk space back if everything is in memory again
+    if (complete && swap_file_.isOpen()) {
+        swap_file_.resize(0);
+        swap_end_ = 0;
+        swap_free_.clear();
+    }
+}
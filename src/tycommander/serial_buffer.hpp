@@ -0,0 +1,120 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_BUFFER_HH
+#define SERIAL_BUFFER_HH
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QTemporaryFile>
+#include <QTimer>
+
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include "serial_search.hpp"
+
+// Marks highlighted lines (see SerialFilter), this byte never appears in UTF-8 text
+#define SERIAL_BUFFER_HIGHLIGHT '\xFF'
+/* Starts lines received while timestamps are enabled (see Board), before the highlight
+   marker. It is followed by the time in microseconds since the epoch, in 10 bytes of 6
+   bits, each one with the high bit set so they never look like a newline. */
+#define SERIAL_BUFFER_TIMESTAMP '\xFE'
+#define SERIAL_BUFFER_TIMESTAMP_SIZE 11
+
+/* Serial scrollback, stored as UTF-8 in fixed-size chunks with the offset of every line
+   start. Appending is O(1) (amortized), and once the size limit is reached whole chunks
+   are dropped from the front along with the lines they contain. Each chunk gets a search
+   filter, built as data comes in, so that searches only look at chunks that may match.
+
+   Offsets and line numbers are absolute: they keep growing when old data is dropped, so
+   views can keep track of their position. Only clear() resets them.
+
+   Views call attach() and detach(). When nobody has looked at the buffer for a while, the
+   full chunks are moved to a temporary file (along with new ones as they fill up), and
+   they are loaded back when a view attaches again. Line offsets and search filters always
+   stay in memory. */
+class SerialBuffer : public QObject {
+    Q_OBJECT
+
+    std::deque<std::unique_ptr<char[]>> chunks_;
+    std::deque<SerialSearchFilter> filters_;
+    std::deque<qint64> swap_offsets_;
+    uint32_t filter_state_ = 0;
+    uint64_t start_ = 0;
+    uint64_t end_ = 0;
+    size_t limit_;
+
+    std::deque<uint64_t> lines_;
+    uint64_t first_line_ = 0;
+    size_t max_line_length_ = 0;
+
+    unsigned int views_ = 0;
+    QTimer swap_timer_;
+    bool swapped_ = false;
+    mutable QTemporaryFile swap_file_;
+    qint64 swap_end_ = 0;
+    std::vector<qint64> swap_free_;
+
+public:
+    SerialBuffer(size_t limit, QObject *parent = nullptr);
+
+    size_t limit() const { return limit_; }
+    void setLimit(size_t limit);
+
+    uint64_t size() const { return end_ - start_; }
+    size_t memoryUsage() const;
+
+    void attach();
+    void detach();
+
+    // The last line is the one being written to, it is empty after a newline
+    uint64_t firstLine() const { return first_line_; }
+    uint64_t endLine() const { return first_line_ + lines_.size(); }
+    uint64_t lineCount() const { return lines_.size(); }
+    size_t maxLineLength() const { return max_line_length_; }
+
+    QByteArray lineData(uint64_t line) const;
+    QString lineText(uint64_t line) const { return QString::fromUtf8(lineData(line)); }
+    bool isHighlighted(uint64_t line) const;
+    // In milliseconds since the epoch, or -1 if the line was not timestamped
+    qint64 lineTime(uint64_t line) const;
+
+    static size_t encodeTimestamp(uint64_t time, char *r_buf);
+    static bool decodeTimestamp(const char *buf, size_t len, uint64_t *r_time);
+
+    /* Looks for the first match after (or the last match before) position from in line,
+       then in the lines after (or before) it. Positions are QString indexes. */
+    bool search(const SerialSearchQuery &query, uint64_t line, int from, bool backward,
+                SerialSearchMatch *r_match) const;
+
+public slots:
+    void append(const char *buf, size_t len);
+    void append(const QByteArray &buf) { append(buf.constData(), static_cast<size_t>(buf.size())); }
+    void clear();
+
+signals:
+    void appended();
+    void trimmed();
+    void cleared();
+
+private:
+    void trim();
+    void copyOut(uint64_t offset, char *buf, size_t len) const;
+    size_t readMarkers(uint64_t line, uint64_t *r_time, bool *r_highlight) const;
+
+    void swapOut();
+    void swapIn();
+    bool swapChunk(size_t idx);
+};
+
+#endif
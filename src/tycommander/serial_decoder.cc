@@ -0,0 +1,193 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <cstring>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+
+#include "serial_decoder.hpp"
+
+using namespace std;
+
+#define UTF8_MIB 106
+
+void SerialDecoder::setCodec(QTextCodec *codec)
+{
+    codec_ = codec;
+    utf8_ = !codec || codec->mibEnum() == UTF8_MIB;
+    decoder_.reset(utf8_ ? nullptr : codec->makeDecoder());
+
+    partial_len_ = 0;
+}
+
+/* Returns the length of the sequence starting at ptr if it is valid, 0 if it is truncated
+   but may be valid once we get the rest, or minus the length of the maximal invalid part
+   (which gets replaced by a single U+FFFD, as recommended by Unicode). */
+static int check_sequence(const uint8_t *ptr, size_t len)
+{
+    uint8_t c = ptr[0];
+    uint8_t lo = 0x80, hi = 0xBF;
+    size_t need;
+
+    if (c < 0x80) {
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        need = 1;
+    } else if (c == 0xE0) {
+        need = 2;
+        lo = 0xA0;
+    } else if (c == 0xED) {
+        need = 2;
+        hi = 0x9F;
+    } else if (c >= 0xE1 && c <= 0xEF) {
+        need = 2;
+    } else if (c == 0xF0) {
+        need = 3;
+        lo = 0x90;
+    } else if (c == 0xF4) {
+        need = 3;
+        hi = 0x8F;
+    } else if (c >= 0xF1 && c <= 0xF3) {
+        need = 3;
+    } else {
+        return -1;
+    }
+
+    for (size_t i = 1; i <= need; i++) {
+        if (i >= len)
+            return 0;
+        if (ptr[i] < lo || ptr[i] > hi)
+            return -static_cast<int>(i);
+        lo = 0x80;
+        hi = 0xBF;
+    }
+
+    return static_cast<int>(need + 1);
+}
+
+size_t SerialDecoder::validUtf8Length(const char *buf, size_t len)
+{
+    auto ptr = reinterpret_cast<const uint8_t *>(buf);
+    size_t i = 0;
+
+    while (i < len) {
+        // Serial output is mostly ASCII, skip it in blocks
+#ifdef __SSE2__
+        while (len - i >= 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ptr + i));
+            if (_mm_movemask_epi8(block))
+                break;
+            i += 16;
+        }
+#endif
+        while (len - i >= 8) {
+            uint64_t block;
+            memcpy(&block, ptr + i, 8);
+            if (block & 0x8080808080808080ull)
+                break;
+            i += 8;
+        }
+        if (i >= len)
+            break;
+
+        int r = check_sequence(ptr + i, len - i);
+        if (r <= 0)
+            break;
+        i += static_cast<size_t>(r);
+    }
+
+    return i;
+}
+
+const char *SerialDecoder::decode(const char *buf, size_t len, size_t *r_len)
+{
+    if (!utf8_) {
+        scratch_ = decoder_->toUnicode(buf, static_cast<int>(len)).toUtf8();
+        *r_len = static_cast<size_t>(scratch_.size());
+        return scratch_.constData();
+    }
+
+    // Fast path, nothing to fix
+    if (!partial_len_) {
+        size_t valid_len = validUtf8Length(buf, len);
+        if (valid_len == len) {
+            *r_len = len;
+            return buf;
+        }
+    }
+
+    scratch_.clear();
+    scratch_.reserve(static_cast<int>(partial_len_ + len + 16));
+
+    /* Complete the sequence left over by the previous call, we only need a few bytes for
+       that so do it separately and avoid copying buf. */
+    while (partial_len_) {
+        size_t take = min(len, sizeof(partial_) - partial_len_);
+        uint8_t seq[8];
+        memcpy(seq, partial_, partial_len_);
+        memcpy(seq + partial_len_, buf, take);
+
+        int r = check_sequence(seq, partial_len_ + take);
+        if (!r) {
+            // Still incomplete, which means we consumed all of buf
+            memcpy(partial_ + partial_len_, buf, take);
+            partial_len_ += take;
+            *r_len = 0;
+            return scratch_.constData();
+        }
+
+        size_t seq_len = static_cast<size_t>(r > 0 ? r : -r);
+        if (r > 0) {
+            scratch_.append(reinterpret_cast<const char *>(seq), static_cast<int>(seq_len));
+        } else {
+            scratch_.append("\xEF\xBF\xBD");
+        }
+        if (seq_len >= partial_len_) {
+            buf += seq_len - partial_len_;
+            len -= seq_len - partial_len_;
+            partial_len_ = 0;
+        } else {
+            // Rare case: the invalid part ends inside partial_, start over with the rest
+            memmove(partial_, partial_ + seq_len, partial_len_ - seq_len);
+            partial_len_ -= seq_len;
+        }
+    }
+
+    auto ptr = reinterpret_cast<const uint8_t *>(buf);
+    size_t i = 0;
+    while (i < len) {
+        size_t valid_len = validUtf8Length(buf + i, len - i);
+        scratch_.append(buf + i, static_cast<int>(valid_len));
+        i += valid_len;
+        if (i >= len)
+            break;
+
+        int r = check_sequence(ptr + i, len - i);
+        if (!r) {
+            partial_len_ = len - i;
+            memcpy(partial_, buf + i, partial_len_);
+            break;
+        }
+
+        scratch_.append("\xEF\xBF\xBD");
+        i += static_cast<size_t>(-r);
+    }
+
+    *r_len = static_cast<size_t>(scratch_.size());
+    return scratch_.constData();
+}
+
+void SerialDecoder::reset()
+{
+    if (decoder_)
+        decoder_.reset(codec_->makeDecoder());
+    partial_len_ = 0;
+}
@@ -0,0 +1,48 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_DECODER_HH
+#define SERIAL_DECODER_HH
+
+#include <QByteArray>
+#include <QTextCodec>
+#include <QTextDecoder>
+
+#include <memory>
+
+/* Converts raw serial data to valid UTF-8 for SerialBuffer, so that the GUI thread only
+   has to copy it. UTF-8 input is validated in place with a vectorized fast path for ASCII
+   runs, and decode() returns the input itself when nothing needs fixing. Invalid sequences
+   are replaced with U+FFFD, and sequences cut between two reads are kept for the next call.
+   Other codecs go through QTextDecoder. */
+class SerialDecoder {
+    QTextCodec *codec_ = nullptr;
+    bool utf8_ = true;
+    std::unique_ptr<QTextDecoder> decoder_;
+
+    char partial_[4];
+    size_t partial_len_ = 0;
+
+    QByteArray scratch_;
+
+public:
+    SerialDecoder(QTextCodec *codec = nullptr) { setCodec(codec); }
+
+    QTextCodec *codec() const { return codec_; }
+    void setCodec(QTextCodec *codec);
+
+    // The returned pointer is valid until the next call
+    const char *decode(const char *buf, size_t len, size_t *r_len);
+    void reset();
+
+    static size_t validUtf8Length(const char *buf, size_t len);
+};
+
+#endif
@@ -0,0 +1,262 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QObject>
+
+#include <algorithm>
+#include <cstring>
+
+#include "serial_buffer.hpp"
+#include "serial_filter.hpp"
+#include "serial_search.hpp"
+
+using namespace std;
+
+// Incomplete lines longer than this are let through without filtering
+#define MAX_PENDING_LINE 4096
+
+static const char *const action_names[] = {
+    "include",
+    "exclude",
+    "highlight"
+};
+
+bool SerialFilterRule::parse(const QString &str, SerialFilterRule *r_rule, QString *r_error)
+{
+    auto fail = [&](const QString &msg) {
+        if (r_error)
+            *r_error = msg;
+        return false;
+    };
+
+    int space = str.indexOf(' ');
+    auto name = str.left(space);
+    auto pattern = space >= 0 ? str.mid(space + 1) : QString();
+
+    SerialFilterRule rule;
+    unsigned int i;
+    for (i = 0; i < sizeof(action_names) / sizeof(*action_names); i++) {
+        if (name == action_names[i])
+            break;
+    }
+    if (i == sizeof(action_names) / sizeof(*action_names))
+        return fail(QObject::tr("Unknown filter action '%1'").arg(name));
+    rule.action = static_cast<Action>(i);
+
+    if (pattern.size() > 2 && pattern.startsWith('/') && pattern.endsWith('/')) {
+        rule.pattern = pattern.mid(1, pattern.size() - 2);
+        rule.regex = true;
+
+        QRegularExpression re(rule.pattern);
+        if (!re.isValid())
+            return fail(QObject::tr("Invalid regular expression: %1").arg(re.errorString()));
+    } else {
+        rule.pattern = pattern;
+        rule.regex = false;
+    }
+    if (rule.pattern.isEmpty())
+        return fail(QObject::tr("Empty filter pattern"));
+
+    *r_rule = rule;
+    return true;
+}
+
+QString SerialFilterRule::toString() const
+{
+    return QString("%1 %2").arg(action_names[action], regex ? "/" + pattern + "/" : pattern);
+}
+
+SerialFilter::SerialFilter()
+{
+    setRules({});
+}
+
+void SerialFilter::setRules(const vector<SerialFilterRule> &rules)
+{
+    vector<string> keys;
+    vector<unsigned int> key_rules;
+
+    rules_.clear();
+    has_include_ = false;
+    for (unsigned int i = 0; i < rules.size(); i++) {
+        auto &rule = rules[i];
+        CompiledRule compiled;
+
+        compiled.action = rule.action;
+        compiled.literal = !rule.regex;
+        compiled.always = false;
+        if (rule.regex) {
+            compiled.re.setPattern(rule.pattern);
+            compiled.re.optimize();
+
+            // Any required literal will do, the longest one should be the rarest
+            QString longest;
+            for (auto &literal: SerialSearchQuery::requiredLiterals(rule.pattern)) {
+                if (literal.size() > longest.size())
+                    longest = literal;
+            }
+            if (!longest.isEmpty()) {
+                keys.push_back(longest.toUtf8().toStdString());
+                key_rules.push_back(i);
+            } else {
+                compiled.always = true;
+            }
+        } else {
+            keys.push_back(rule.pattern.toUtf8().toStdString());
+            key_rules.push_back(i);
+        }
+        has_include_ |= (rule.action == SerialFilterRule::ACTION_INCLUDE);
+
+        rules_.push_back(compiled);
+    }
+
+    hits_.reset(new atomic<uint64_t>[rules_.size()]);
+    for (size_t i = 0; i < rules_.size(); i++)
+        hits_[i] = 0;
+    hidden_ = 0;
+    matched_.assign(rules_.size(), 0);
+
+    buildAutomaton(keys, key_rules);
+    line_.clear();
+}
+
+void SerialFilter::process(const char *buf, size_t len, string *out)
+{
+    const char *end = buf + len;
+
+    while (buf < end) {
+        auto nl = static_cast<const char *>(memchr(buf, '\n', static_cast<size_t>(end - buf)));
+        if (!nl) {
+            line_.append(buf, static_cast<size_t>(end - buf));
+            if (line_.size() >= MAX_PENDING_LINE) {
+                out->append(line_);
+                line_.clear();
+            }
+            break;
+        }
+
+        auto part_len = static_cast<size_t>(nl + 1 - buf);
+        if (line_.empty()) {
+            processLine(buf, part_len, out);
+        } else {
+            line_.append(buf, part_len);
+            processLine(line_.data(), line_.size(), out);
+            line_.clear();
+        }
+
+        buf = nl + 1;
+    }
+}
+
+void SerialFilter::buildAutomaton(const vector<string> &keys, const vector<unsigned int> &key_rules)
+{
+    memset(classes_, 0, sizeof(classes_));
+    class_count_ = 1;
+    for (auto &key: keys) {
+        for (auto c: key) {
+            auto &cls = classes_[static_cast<uint8_t>(c)];
+            if (!cls)
+                cls = static_cast<uint16_t>(class_count_++);
+        }
+    }
+
+    // Build the trie, a zero transition means there is no child (the root is nobody's child)
+    transitions_.assign(class_count_, 0);
+    outputs_.assign(1, {});
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint32_t node = 0;
+        for (auto c: keys[i]) {
+            size_t idx = node * class_count_ + classes_[static_cast<uint8_t>(c)];
+            if (!transitions_[idx]) {
+                transitions_[idx] = static_cast<uint32_t>(outputs_.size());
+                transitions_.resize(transitions_.size() + class_count_, 0);
+                outputs_.emplace_back();
+            }
+            node = transitions_[idx];
+        }
+        outputs_[node].push_back(key_rules[i]);
+    }
+
+    /* Walk the trie breadth-first to compute failure links, and use them to complete the
+       missing transitions so that matching is a single table lookup per byte. */
+    vector<uint32_t> fail(outputs_.size(), 0);
+    vector<uint32_t> queue;
+    for (unsigned int cls = 0; cls < class_count_; cls++) {
+        if (transitions_[cls])
+            queue.push_back(transitions_[cls]);
+    }
+    for (size_t i = 0; i < queue.size(); i++) {
+        uint32_t node = queue[i];
+
+        auto &fail_outputs = outputs_[fail[node]];
+        outputs_[node].insert(outputs_[node].end(), fail_outputs.begin(), fail_outputs.end());
+
+        for (unsigned int cls = 0; cls < class_count_; cls++) {
+            uint32_t &next = transitions_[node * class_count_ + cls];
+            uint32_t fail_next = transitions_[fail[node] * class_count_ + cls];
+
+            if (next) {
+                fail[next] = fail_next;
+                queue.push_back(next);
+            } else {
+                next = fail_next;
+            }
+        }
+    }
+}
+
+void SerialFilter::processLine(const char *line, size_t len, string *out)
+{
+    size_t text_len = len;
+    while (text_len && (line[text_len - 1] == '\n' || line[text_len - 1] == '\r'))
+        text_len--;
+
+    fill(matched_.begin(), matched_.end(), 0);
+    uint32_t state = 0;
+    for (size_t i = 0; i < text_len; i++) {
+        state = transitions_[state * class_count_ + classes_[static_cast<uint8_t>(line[i])]];
+        for (auto rule: outputs_[state])
+            matched_[rule] = 1;
+    }
+
+    QString text;
+    bool converted = false;
+    bool include = false, exclude = false, highlight = false;
+    for (unsigned int i = 0; i < rules_.size(); i++) {
+        auto &rule = rules_[i];
+
+        bool hit = matched_[i];
+        if (!rule.literal && (hit || rule.always)) {
+            if (!converted) {
+                text = QString::fromUtf8(line, static_cast<int>(text_len));
+                converted = true;
+            }
+            hit = rule.re.match(text).hasMatch();
+        }
+        if (!hit)
+            continue;
+
+        hits_[i].fetch_add(1, memory_order_relaxed);
+        switch (rule.action) {
+            case SerialFilterRule::ACTION_INCLUDE: { include = true; } break;
+            case SerialFilterRule::ACTION_EXCLUDE: { exclude = true; } break;
+            case SerialFilterRule::ACTION_HIGHLIGHT: { highlight = true; } break;
+        }
+    }
+
+    if (exclude || (has_include_ && !include)) {
+        hidden_.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+
+    if (highlight)
+        out->push_back(SERIAL_BUFFER_HIGHLIGHT);
+    out->append(line, len);
+}
@@ -0,0 +1,90 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_FILTER_HH
+#define SERIAL_FILTER_HH
+
+#include <QRegularExpression>
+#include <QString>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct SerialFilterRule {
+    enum Action {
+        ACTION_INCLUDE,
+        ACTION_EXCLUDE,
+        ACTION_HIGHLIGHT
+    };
+
+    Action action;
+    QString pattern;
+    bool regex;
+
+    // Rules look like "exclude DEBUG" or "highlight /err(or)?/"
+    static bool parse(const QString &str, SerialFilterRule *r_rule, QString *r_error = nullptr);
+    QString toString() const;
+};
+
+/* Drops and highlights complete lines of serial data. When there are include rules, lines
+   must match one of them to be shown, and lines matching an exclude rule are never shown.
+   Highlighted lines start with SERIAL_BUFFER_HIGHLIGHT.
+
+   Literal patterns (and the longest literal required by each regular expression) are all
+   looked for in a single pass with an Aho-Corasick automaton, so the cost per line barely
+   depends on the number of rules. Regular expressions only run on lines that contain their
+   literal, or on every line if they don't have any.
+
+   Call process() and reset() from one thread at a time (Board does that under serial_lock_).
+   Counters can be read from any thread, but only the thread calling setRules() can safely
+   look at them because it reallocates them. */
+class SerialFilter {
+    struct CompiledRule {
+        SerialFilterRule::Action action;
+        bool literal;
+        bool always;
+        QRegularExpression re;
+    };
+
+    std::vector<CompiledRule> rules_;
+    bool has_include_ = false;
+    std::unique_ptr<std::atomic<uint64_t>[]> hits_;
+    std::atomic<uint64_t> hidden_ {0};
+
+    // Automaton over byte classes, only the bytes used by the keys get their own class
+    uint16_t classes_[256];
+    unsigned int class_count_ = 1;
+    std::vector<uint32_t> transitions_;
+    std::vector<std::vector<unsigned int>> outputs_;
+
+    std::string line_;
+    std::vector<char> matched_;
+
+public:
+    SerialFilter();
+
+    bool isActive() const { return !rules_.empty(); }
+    void setRules(const std::vector<SerialFilterRule> &rules);
+
+    uint64_t hits(unsigned int rule) const { return hits_[rule].load(std::memory_order_relaxed); }
+    uint64_t hiddenLines() const { return hidden_.load(std::memory_order_relaxed); }
+
+    void process(const char *buf, size_t len, std::string *out);
+    void reset() { line_.clear(); }
+
+private:
+    void buildAutomaton(const std::vector<std::string> &keys,
+                        const std::vector<unsigned int> &key_rules);
+    void processLine(const char *line, size_t len, std::string *out);
+};
+
+#endif
@@ -0,0 +1,549 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+#include "serial_log.hpp"
+
+using namespace std;
+
+#define SERIAL_LOG_DELIMITER "\n@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@\n"
+#define SERIAL_LOG_FLUSH_DELAY 100
+#define SERIAL_LOG_BLOCK_SIZE 65536
+#define SERIAL_LOG_PARTIAL_DELAY 1000
+#define SERIAL_LOG_SEARCH_MARGIN 65536
+
+SerialLog::SerialLog(size_t ring_size, QObject *parent)
+    : QObject(parent), ring_(ring_size), enabled_(false), writer_(nullptr), written_(0),
+      dropped_(0), overruns_(0), peak_fill_(0)
+{
+    partial_timer_.start();
+}
+
+SerialLog::~SerialLog()
+{
+    drain(false, true);
+    archive_.close();
+}
+
+// Pending data is written to the previous file first
+void SerialLog::setFileName(const QString &filename, const QString &archive_prefix)
+{
+    flush();
+    archive_.close();
+
+    QMutexLocker locker(&file_lock_);
+
+    enabled_ = false;
+    file_.close();
+    file_.setFileName(filename);
+    archive_prefix_ = archive_prefix;
+}
+
+// The archive is disabled (and deleted) if archive_size is zero
+bool SerialLog::open(size_t size, size_t archive_size)
+{
+    QMutexLocker locker(&file_lock_);
+
+    bool truncated = false;
+    if (!file_.isOpen()) {
+        // We already write big batches, QFile would only split them in smaller writes
+        if (!file_.open(QIODevice::WriteOnly | QIODevice::Unbuffered))
+            return false;
+
+        // The file has been truncated
+        filters_.clear();
+        pending_block_ = SIZE_MAX;
+        filter_state_ = 0;
+        truncated = true;
+    }
+    // Whole blocks only, so that batches stay aligned when the log wraps around
+    file_size_ = max(size / SERIAL_LOG_BLOCK_SIZE, static_cast<size_t>(1)) * SERIAL_LOG_BLOCK_SIZE;
+    if (static_cast<size_t>(file_.size()) > file_size_)
+        file_.resize(static_cast<qint64>(file_size_));
+    filters_.resize((file_size_ + SERIAL_LOG_BLOCK_SIZE - 1) / SERIAL_LOG_BLOCK_SIZE);
+
+    if (archive_size) {
+        bool was_open = archive_.isOpen();
+        if (!archive_.open(archive_prefix_, archive_size))
+            emit writeFailed(QString("Cannot write serial archive index for '%1'").arg(archive_prefix_));
+
+        // What the archive had before that (maybe from a previous run) is not in the file
+        if (truncated || !was_open)
+            file_archive_start_ = archive_.offset();
+    } else {
+        archive_.remove(archive_prefix_);
+    }
+
+    enabled_ = true;
+    return true;
+}
+
+void SerialLog::remove()
+{
+    QMutexLocker locker(&file_lock_);
+
+    enabled_ = false;
+    ring_.clear();
+
+    file_.close();
+    file_.remove();
+    filters_.clear();
+
+    archive_.remove(archive_prefix_);
+}
+
+/* Like append(), these must not run at the same time as the producer. Board calls them when
+   the serial interface is opened and closed. */
+void SerialLog::reserve()
+{
+    QMutexLocker locker(&file_lock_);
+    ring_.allocate();
+}
+
+void SerialLog::release()
+{
+    drain(true, true);
+    archive_.compress(true);
+
+    QMutexLocker locker(&file_lock_);
+    ring_.release();
+}
+
+/* This is the producer side of the ring: only one thread may call it at a time, Board
+   takes care of this with serial_lock_. */
+void SerialLog::append(const char *buf, size_t len)
+{
+    if (!enabled_ || !len || !ring_.isAllocated())
+        return;
+
+    size_t written = ring_.write(buf, len);
+    if (written < len) {
+        dropped_ += len - written;
+        overruns_++;
+    }
+
+    size_t fill = ring_.size();
+    if (fill > peak_fill_.load(memory_order_relaxed))
+        peak_fill_.store(fill, memory_order_relaxed);
+
+    // Let the writer sleep until there is enough data for a big write
+    auto writer = writer_.load();
+    if (writer && fill >= ring_.capacity() / 4)
+        writer->wake();
+}
+
+SerialLog::Stats SerialLog::stats() const
+{
+    Stats stats;
+
+    stats.written = written_;
+    stats.dropped = dropped_;
+    stats.overruns = overruns_;
+    stats.peak_fill = peak_fill_;
+    stats.capacity = ring_.capacity();
+    stats.archived = archive_.size();
+
+    return stats;
+}
+
+// Only the GUI thread changes these, no need to wait for the writer
+size_t SerialLog::memoryUsage() const
+{
+    size_t usage = ring_.isAllocated() ? ring_.capacity() : 0;
+    usage += filters_.size() * SerialSearchFilter::memoryUsage();
+    usage += archive_.memoryUsage();
+
+    return usage;
+}
+
+void SerialLog::flush()
+{
+    drain(true, true);
+}
+
+// The writer thread leaves the end of the last block alone unless partial is true
+void SerialLog::drain(bool notify, bool partial)
+{
+    QMutexLocker locker(&file_lock_);
+
+    // Don't loop until the ring is empty, or a fast producer could keep us here forever
+    size_t pending = ring_.size();
+    if (!partial && file_.isOpen() && !partial_timer_.hasExpired(SERIAL_LOG_PARTIAL_DELAY)) {
+        /* The file size is a multiple of the block size, so this also works when the batch
+           wraps around. */
+        auto pos = static_cast<size_t>(file_.pos());
+        size_t end = (pos + pending) / SERIAL_LOG_BLOCK_SIZE * SERIAL_LOG_BLOCK_SIZE;
+        pending = end > pos ? end - pos : 0;
+    } else {
+        partial_timer_.restart();
+    }
+
+    while (pending) {
+        const char *buf;
+        size_t len = min(ring_.peek(&buf), pending);
+
+        if (file_.isOpen()) {
+            if (!writeFile(buf, len)) {
+                auto error_msg = QString("Closed serial log file after error: %1")
+                                 .arg(file_.errorString());
+
+                enabled_ = false;
+                file_.close();
+                if (notify)
+                    emit writeFailed(error_msg);
+            } else {
+                archive_.append(buf, len);
+                written_ += len;
+            }
+        }
+
+        ring_.consume(len);
+        pending -= len;
+    }
+
+    uint64_t dropped = dropped_;
+    if (dropped > reported_dropped_) {
+        if (notify)
+            emit overrun(dropped - reported_dropped_);
+        reported_dropped_ = dropped;
+    }
+    locker.unlock();
+
+    // Compression is slow, don't make search() and the GUI wait for it
+    if (!archive_.compress(false) && notify)
+        emit writeFailed("Failed to write compressed serial archive, some data was lost");
+}
+
+// You need to lock file_lock_ before you call this
+bool SerialLog::writeFile(const char *buf, size_t len)
+{
+    file_.unsetError();
+
+    // Wrap around as many times as needed, batches can be bigger than the log file
+    while (len) {
+        auto pos = static_cast<size_t>(file_.pos());
+        if (pos >= file_size_) {
+            file_.seek(0);
+            pos = 0;
+        }
+
+        auto part_len = min(len, file_size_ - pos);
+        file_.write(buf, static_cast<qint64>(part_len));
+        indexFile(pos, buf, part_len);
+        buf += part_len;
+        len -= part_len;
+
+        if (pos + part_len >= file_size_)
+            file_.seek(0);
+    }
+
+    if (!file_.atEnd()) {
+        auto pos = static_cast<size_t>(file_.pos());
+        if (pos + sizeof(SERIAL_LOG_DELIMITER) >= file_size_) {
+            file_.resize(static_cast<qint64>(pos));
+            file_.seek(0);
+        } else {
+            file_.write(SERIAL_LOG_DELIMITER);
+            file_.seek(static_cast<qint64>(pos));
+        }
+    }
+
+    return file_.error() == QFileDevice::NoError;
+}
+
+/* Blocks are rewritten in order when the log wraps around. A block keeps the keys of the
+   data being overwritten until it has been completely rewritten, at which point we switch
+   to the filter built for the new data only. You need to lock file_lock_ before you call
+   this. */
+void SerialLog::indexFile(size_t offset, const char *buf, size_t len)
+{
+    while (len) {
+        size_t block = offset / SERIAL_LOG_BLOCK_SIZE;
+        size_t block_offset = offset % SERIAL_LOG_BLOCK_SIZE;
+        size_t part_len = min(len, SERIAL_LOG_BLOCK_SIZE - block_offset);
+
+        if (!block_offset) {
+            pending_filter_.clear();
+            pending_block_ = block;
+        }
+
+        uint32_t pending_state = filter_state_;
+        filters_[block].add(buf, part_len, &filter_state_);
+        if (block == pending_block_) {
+            pending_filter_.add(buf, part_len, &pending_state);
+
+            if (block_offset + part_len == SERIAL_LOG_BLOCK_SIZE || offset + part_len >= file_size_) {
+                swap(filters_[block], pending_filter_);
+                pending_block_ = SIZE_MAX;
+            }
+        }
+
+        offset += part_len;
+        buf += part_len;
+        len -= part_len;
+    }
+}
+
+/* Returns up to max_matches matching lines, from the oldest to the most recent data. The
+   archive (if any) is scanned first for what the log file no longer holds. The writer
+   thread waits while we search, but the filters make it quick. Only lines spanning at most
+   two blocks can be found in the log file. */
+QStringList SerialLog::search(const SerialSearchQuery &query, int max_matches)
+{
+    QStringList matches;
+
+    QMutexLocker locker(&file_lock_);
+
+    if (!file_.isOpen() || !query.isValid())
+        return matches;
+    file_.flush();
+
+    // Returns false once we have enough matches
+    auto match_line = [&](const char *data, int len) {
+        if (len && data[len - 1] == '\r')
+            len--;
+
+        auto line = QString::fromUtf8(data, len);
+        int match_start, match_len;
+        if (query.match(line, 0, false, &match_start, &match_len)) {
+            matches.append(line);
+            if (matches.count() >= max_matches)
+                return false;
+        }
+        return true;
+    };
+
+    // Older lines come from the archive, stop where the log file takes over
+    if (archive_.isOpen()) {
+        uint64_t archive_end = archive_.offset();
+        uint64_t file_start = min(file_archive_start_, archive_end);
+        uint64_t in_file = min(archive_end - file_start,
+                               static_cast<uint64_t>(file_size_ - (sizeof(SERIAL_LOG_DELIMITER) - 1)));
+
+        QByteArray partial;
+        bool more = true;
+        archive_.scan(archive_end - in_file, [&](const char *data, size_t len) {
+            size_t start = 0;
+            for (size_t i = 0; i < len && more; i++) {
+                if (data[i] != '\n')
+                    continue;
+
+                if (partial.isEmpty()) {
+                    more = match_line(data + start, static_cast<int>(i - start));
+                } else {
+                    partial.append(data + start, static_cast<int>(i - start));
+                    more = match_line(partial.constData(), partial.size());
+                    partial.clear();
+                }
+                start = i + 1;
+            }
+            if (more)
+                partial.append(data + start, static_cast<int>(len - start));
+            return more;
+        });
+        if (!more || (!partial.isEmpty() && !match_line(partial.constData(), partial.size())))
+            return matches;
+    }
+
+    if (filters_.empty())
+        return matches;
+
+    QFile file(file_.fileName());
+    if (!file.open(QIODevice::ReadOnly))
+        return matches;
+
+    // Unroll the ring: the oldest data follows the delimiter, if the log has wrapped around
+    struct Segment {
+        qint64 offset;
+        qint64 len;
+    };
+    vector<Segment> segments;
+    {
+        qint64 pos = file_.pos();
+        qint64 size = file.size();
+
+        if (pos < size) {
+            qint64 start = pos;
+            file.seek(pos);
+            if (file.read(sizeof(SERIAL_LOG_DELIMITER) - 1) == SERIAL_LOG_DELIMITER)
+                start += static_cast<qint64>(sizeof(SERIAL_LOG_DELIMITER) - 1);
+            segments.push_back({start, size - start});
+        }
+        if (pos)
+            segments.push_back({0, pos});
+    }
+
+    auto read_stream = [&](qint64 offset, qint64 len) {
+        QByteArray buf;
+        for (auto &segment: segments) {
+            if (offset < segment.len && len) {
+                qint64 part_len = min(len, segment.len - offset);
+                file.seek(segment.offset + offset);
+                buf.append(file.read(part_len));
+                len -= part_len;
+                offset = 0;
+            } else {
+                offset -= segment.len;
+            }
+        }
+        return buf;
+    };
+
+    // Find the parts of the stream that may contain matches
+    vector<pair<qint64, qint64>> ranges;
+    {
+        qint64 stream_offset = 0;
+        size_t blocks = filters_.size();
+
+        for (auto &segment: segments) {
+            for (qint64 offset = segment.offset; offset < segment.offset + segment.len;) {
+                auto block = static_cast<size_t>(offset) / SERIAL_LOG_BLOCK_SIZE;
+                qint64 block_end = min(static_cast<qint64>((block + 1) * SERIAL_LOG_BLOCK_SIZE),
+                                       segment.offset + segment.len);
+
+                // Include the previous block for lines that straddle the two
+                auto &prev_filter = filters_[(block + blocks - 1) % blocks];
+                auto &filter = filters_[block];
+                bool candidate = all_of(query.keys().begin(), query.keys().end(), [&](uint32_t key) {
+                    return prev_filter.mayContain(key) || filter.mayContain(key);
+                });
+                if (candidate) {
+                    qint64 start = stream_offset + offset - segment.offset;
+                    qint64 end = stream_offset + block_end - segment.offset;
+
+                    if (!ranges.empty() && ranges.back().second == start) {
+                        ranges.back().second = end;
+                    } else {
+                        ranges.emplace_back(start, end);
+                    }
+                }
+
+                offset = block_end;
+            }
+
+            stream_offset += segment.len;
+        }
+    }
+
+    // Check whole lines around each candidate range
+    qint64 done = 0;
+    for (auto &range: ranges) {
+        if (range.second <= done)
+            continue;
+
+        qint64 read_offset = max(range.first - SERIAL_LOG_SEARCH_MARGIN, done);
+        auto buf = read_stream(read_offset, range.second + SERIAL_LOG_SEARCH_MARGIN - read_offset);
+
+        int start = 0;
+        if (read_offset < range.first)
+            start = buf.lastIndexOf('\n', static_cast<int>(range.first - read_offset) - 1) + 1;
+        int end = buf.indexOf('\n', static_cast<int>(range.second - read_offset) - 1);
+        if (end < 0)
+            end = buf.size();
+
+        while (start < end) {
+            int line_end = buf.indexOf('\n', start);
+            if (line_end < 0 || line_end > end)
+                line_end = end;
+
+            if (!match_line(buf.constData() + start, line_end - start))
+                return matches;
+
+            start = line_end + 1;
+        }
+
+        done = read_offset + end + 1;
+    }
+
+    return matches;
+}
+
+SerialLogWriter::~SerialLogWriter()
+{
+    stop();
+
+    // Boards may outlive the writer, make sure they don't try to wake it up
+    QMutexLocker locker(&logs_lock_);
+    for (auto &log: logs_) {
+        auto log_ptr = log.lock();
+        if (log_ptr)
+            log_ptr->writer_ = nullptr;
+    }
+}
+
+void SerialLogWriter::addLog(shared_ptr<SerialLog> log)
+{
+    QMutexLocker locker(&logs_lock_);
+
+    logs_.push_back(log);
+    log->writer_ = this;
+}
+
+void SerialLogWriter::wake()
+{
+    QMutexLocker locker(&wake_lock_);
+
+    wake_ = true;
+    wake_cond_.wakeOne();
+}
+
+void SerialLogWriter::stop()
+{
+    if (!isRunning())
+        return;
+
+    {
+        QMutexLocker locker(&wake_lock_);
+
+        run_ = false;
+        wake_cond_.wakeOne();
+    }
+    wait();
+
+    run_ = true;
+}
+
+void SerialLogWriter::run()
+{
+    vector<shared_ptr<SerialLog>> logs;
+    bool run;
+
+    do {
+        {
+            QMutexLocker locker(&wake_lock_);
+
+            if (!wake_ && run_)
+                wake_cond_.wait(&wake_lock_, SERIAL_LOG_FLUSH_DELAY);
+            wake_ = false;
+            run = run_;
+        }
+
+        {
+            QMutexLocker locker(&logs_lock_);
+
+            logs_.erase(remove_if(logs_.begin(), logs_.end(),
+                                  [](const weak_ptr<SerialLog> &log) { return log.expired(); }),
+                        logs_.end());
+            for (auto &log: logs_) {
+                auto log_ptr = log.lock();
+                if (log_ptr)
+                    logs.push_back(log_ptr);
+            }
+        }
+
+        // Don't hold logs_lock_ while writing, the disk may be slow
+        for (auto &log: logs)
+            log->drain(true, false);
+        logs.clear();
+    } while (run);
+}
@@ -0,0 +1,141 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_LOG_HH
+#define SERIAL_LOG_HH
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "ring_buffer.hpp"
+#include "serial_archive.hpp"
+#include "serial_search.hpp"
+
+class SerialLogWriter;
+
+/* The serial thread pushes data to a lock-free single-producer/single-consumer ring, and
+   the writer thread drains it to the file in large batches. These end on block boundaries,
+   and the rest waits for more data (for a bounded time) or for flush(). A slow disk can fill
+   the ring, in which case the new data is dropped and counted, but the serial thread never
+   waits.
+
+   The ring only exists between reserve() and release(), so idle boards don't pay for it.
+   Data appended outside of this is ignored.
+
+   Everything written to the file also goes to the compressed archive if there is one, the
+   writer thread compresses it once it is done with the file. The archive has its own name
+   because it outlives the log file, and search() looks there for what the file has lost. */
+class SerialLog : public QObject {
+    Q_OBJECT
+
+    RingBuffer ring_;
+
+    std::atomic<bool> enabled_;
+    std::atomic<SerialLogWriter *> writer_;
+
+    std::atomic<uint64_t> written_;
+    std::atomic<uint64_t> dropped_;
+    std::atomic<uint64_t> overruns_;
+    std::atomic<size_t> peak_fill_;
+    uint64_t reported_dropped_ = 0;
+
+    // Protects the file against concurrent writes (writer) and changes (GUI)
+    QMutex file_lock_;
+    QFile file_;
+    size_t file_size_ = 0;
+    QElapsedTimer partial_timer_;
+    SerialArchive archive_;
+    QString archive_prefix_;
+    // Archive stream offset of the first byte written to the current file
+    uint64_t file_archive_start_ = 0;
+
+    // Search filters for each block of the file, see indexFile()
+    std::vector<SerialSearchFilter> filters_;
+    SerialSearchFilter pending_filter_;
+    size_t pending_block_ = SIZE_MAX;
+    uint32_t filter_state_ = 0;
+
+public:
+    struct Stats {
+        uint64_t written;
+        uint64_t dropped;
+        uint64_t overruns;
+        size_t peak_fill;
+        size_t capacity;
+        size_t archived;
+    };
+
+    SerialLog(size_t ring_size, QObject *parent = nullptr);
+    virtual ~SerialLog();
+
+    QString fileName() const { return file_.fileName(); }
+    void setFileName(const QString &filename, const QString &archive_prefix);
+    bool open(size_t size, size_t archive_size);
+    void remove();
+
+    bool isOpen() const { return enabled_; }
+    void reserve();
+    void release();
+    void append(const char *buf, size_t len);
+
+    Stats stats() const;
+    size_t memoryUsage() const;
+
+    QStringList search(const SerialSearchQuery &query, int max_matches);
+
+    void flush();
+
+signals:
+    void writeFailed(const QString &msg);
+    void overrun(quint64 lost);
+
+private:
+    void drain(bool notify, bool partial);
+    bool writeFile(const char *buf, size_t len);
+    void indexFile(size_t offset, const char *buf, size_t len);
+
+    friend class SerialLogWriter;
+};
+
+class SerialLogWriter : public QThread {
+    Q_OBJECT
+
+    QMutex logs_lock_;
+    std::vector<std::weak_ptr<SerialLog>> logs_;
+
+    QMutex wake_lock_;
+    QWaitCondition wake_cond_;
+    bool wake_ = false;
+    bool run_ = true;
+
+public:
+    SerialLogWriter(QObject *parent = nullptr)
+        : QThread(parent) {}
+    virtual ~SerialLogWriter();
+
+    void addLog(std::shared_ptr<SerialLog> log);
+
+    void wake();
+    void stop();
+
+protected:
+    void run() override;
+};
+
+#endif
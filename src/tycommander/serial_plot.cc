@@ -0,0 +1,215 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QPainter>
+#include <QWheelEvent>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "serial_plot.hpp"
+#include "serial_samples.hpp"
+
+using namespace std;
+
+#define DEFAULT_WINDOW 100000
+#define MIN_WINDOW 16
+#define REFRESH_INTERVAL 16
+#define PLOT_MARGIN 8
+
+static const QColor channel_colors[SERIAL_SAMPLES_MAX_CHANNELS] = {
+    Qt::blue, Qt::red, Qt::darkGreen, Qt::magenta,
+    Qt::darkYellow, Qt::darkCyan, Qt::darkRed, Qt::darkGray
+};
+
+SerialPlot::SerialPlot(QWidget *parent)
+    : QWidget(parent), window_(DEFAULT_WINDOW)
+{
+    setBackgroundRole(QPalette::Base);
+    setAutoFillBackground(true);
+
+    refresh_timer_.setInterval(REFRESH_INTERVAL);
+    connect(&refresh_timer_, &QTimer::timeout, this, &SerialPlot::refresh);
+}
+
+void SerialPlot::setSamples(const SerialSamples *samples)
+{
+    samples_ = samples;
+    drawn_count_ = UINT64_MAX;
+    update();
+}
+
+void SerialPlot::setWindow(size_t window)
+{
+    window = max<size_t>(window, MIN_WINDOW);
+    if (samples_)
+        window = min(window, samples_->capacity());
+    if (window == window_)
+        return;
+
+    window_ = window;
+    update();
+}
+
+void SerialPlot::paintEvent(QPaintEvent *e)
+{
+    Q_UNUSED(e);
+
+    QPainter painter(this);
+    auto text_color = palette().color(QPalette::Text);
+
+    if (!samples_)
+        return;
+
+    /* The serial thread keeps writing while we read, so stay away from the oldest part
+       of the ring. Torn values only make for a wrong pixel until the next frame. */
+    uint64_t count = samples_->count();
+    uint64_t window = min<uint64_t>(window_, samples_->capacity() - samples_->capacity() / 16);
+    window = min(window, count);
+    unsigned int channels = samples_->channelCount();
+    drawn_count_ = count;
+
+    QRect area = rect().adjusted(fontMetrics().width("-0.0000e+00") + PLOT_MARGIN, PLOT_MARGIN,
+                                 -PLOT_MARGIN, -fontMetrics().height() - PLOT_MARGIN);
+    if (!window || !channels || area.width() <= 0 || area.height() <= 0) {
+        painter.setPen(text_color);
+        painter.drawText(rect(), Qt::AlignCenter, tr("Waiting for numeric data..."));
+        return;
+    }
+
+    // Reduce each channel to one min/max pair per pixel column
+    auto columns = static_cast<size_t>(area.width());
+    uint64_t start = count - window;
+    mins_.assign(channels * columns, numeric_limits<float>::quiet_NaN());
+    maxs_.assign(channels * columns, numeric_limits<float>::quiet_NaN());
+    float low = numeric_limits<float>::infinity();
+    float high = -numeric_limits<float>::infinity();
+    for (unsigned int i = 0; i < channels; i++) {
+        for (size_t x = 0; x < columns; x++) {
+            uint64_t first = start + window * x / columns;
+            uint64_t last = max(start + window * (x + 1) / columns, first + 1);
+
+            float column_min, column_max;
+            if (samples_->range(i, first, last, &column_min, &column_max)) {
+                mins_[i * columns + x] = column_min;
+                maxs_[i * columns + x] = column_max;
+                low = min(low, column_min);
+                high = max(high, column_max);
+            }
+        }
+    }
+    if (low > high) {
+        painter.setPen(text_color);
+        painter.drawText(rect(), Qt::AlignCenter, tr("Waiting for numeric data..."));
+        return;
+    }
+    if (low == high) {
+        low -= 1.0f;
+        high += 1.0f;
+    }
+
+    painter.setPen(palette().color(QPalette::Mid));
+    painter.drawRect(area.adjusted(0, 0, -1, -1));
+    painter.setPen(text_color);
+    painter.drawText(QRect(0, area.top(), area.left() - 4, fontMetrics().height()),
+                     Qt::AlignRight | Qt::AlignTop, QString::number(high, 'g', 5));
+    painter.drawText(QRect(0, area.bottom() - fontMetrics().height(), area.left() - 4,
+                           fontMetrics().height()),
+                     Qt::AlignRight | Qt::AlignBottom, QString::number(low, 'g', 5));
+    painter.drawText(QRect(area.left(), area.bottom() + 2, area.width(), fontMetrics().height()),
+                     Qt::AlignRight | Qt::AlignTop, tr("%1 samples").arg(window));
+
+    auto scale = static_cast<double>(area.height() - 1) / (static_cast<double>(high) - low);
+    auto to_y = [&](float value) {
+        return area.bottom() - (static_cast<double>(value) - low) * scale;
+    };
+
+    QVector<QLineF> lines;
+    for (unsigned int i = 0; i < channels; i++) {
+        const float *mins = mins_.data() + i * columns;
+        const float *maxs = maxs_.data() + i * columns;
+
+        lines.clear();
+        bool previous = false;
+        double previous_y = 0.0;
+        for (size_t x = 0; x < columns; x++) {
+            if (std::isnan(mins[x])) {
+                previous = false;
+                continue;
+            }
+
+            double px = area.left() + static_cast<double>(x) + 0.5;
+            double y1 = to_y(mins[x]);
+            double y2 = to_y(maxs[x]);
+            double mid = (y1 + y2) / 2.0;
+
+            if (previous) {
+                lines.append(QLineF(px - 1.0, previous_y, px, mid));
+            } else if (y1 == y2) {
+                lines.append(QLineF(px, y1 - 0.5, px, y1 + 0.5));
+            }
+            if (y1 != y2)
+                lines.append(QLineF(px, y1, px, y2));
+
+            previous = true;
+            previous_y = mid;
+        }
+
+        painter.setPen(channel_colors[i]);
+        painter.drawLines(lines);
+    }
+
+    // Legend
+    int legend_y = area.top() + 4;
+    for (unsigned int i = 0; i < channels; i++) {
+        auto name = samples_->channelName(i);
+        if (name.isEmpty())
+            name = tr("#%1").arg(i + 1);
+
+        int height = fontMetrics().height();
+        painter.fillRect(area.left() + 6, legend_y + height / 4, height / 2, height / 2,
+                         channel_colors[i]);
+        painter.setPen(text_color);
+        painter.drawText(area.left() + 10 + height / 2, legend_y + fontMetrics().ascent(), name);
+        legend_y += height;
+    }
+}
+
+void SerialPlot::wheelEvent(QWheelEvent *e)
+{
+    int delta = e->angleDelta().y();
+    if (!delta) {
+        e->ignore();
+        return;
+    }
+
+    setWindow(delta > 0 ? window_ / 2 : window_ * 2);
+    e->accept();
+}
+
+void SerialPlot::showEvent(QShowEvent *e)
+{
+    QWidget::showEvent(e);
+    refresh_timer_.start();
+}
+
+void SerialPlot::hideEvent(QHideEvent *e)
+{
+    refresh_timer_.stop();
+    QWidget::hideEvent(e);
+}
+
+// Repaint at most once per frame, and only when something new came in
+void SerialPlot::refresh()
+{
+    if (samples_ && samples_->count() != drawn_count_)
+        update();
+}
@@ -0,0 +1,54 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_PLOT_HH
+#define SERIAL_PLOT_HH
+
+#include <QTimer>
+#include <QWidget>
+
+#include <vector>
+
+class SerialSamples;
+
+/* Plots the most recent samples of each channel. When there are more samples than pixels,
+   each pixel column shows the minimum and maximum of the samples it covers, so spikes
+   remain visible and the cost of a frame depends on the window, not on the data rate. */
+class SerialPlot : public QWidget {
+    Q_OBJECT
+
+    const SerialSamples *samples_ = nullptr;
+    size_t window_;
+
+    QTimer refresh_timer_;
+    uint64_t drawn_count_ = UINT64_MAX;
+
+    std::vector<float> mins_;
+    std::vector<float> maxs_;
+
+public:
+    SerialPlot(QWidget *parent = nullptr);
+
+    void setSamples(const SerialSamples *samples);
+
+    size_t window() const { return window_; }
+    void setWindow(size_t window);
+
+protected:
+    void paintEvent(QPaintEvent *e) override;
+    void wheelEvent(QWheelEvent *e) override;
+    void showEvent(QShowEvent *e) override;
+    void hideEvent(QHideEvent *e) override;
+
+private slots:
+    void refresh();
+};
+
+#endif
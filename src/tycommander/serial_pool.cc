@@ -0,0 +1,207 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+
+#include "board.hpp"
+#include "serial_pool.hpp"
+
+using namespace std;
+
+#define BALANCE_INTERVAL 2000
+// Threads closer than this (in percent of the interval) are considered balanced
+#define BALANCE_THRESHOLD 10
+
+SerialPool::SerialPool(QObject *parent)
+    : QObject(parent), balance_interval_(BALANCE_INTERVAL * 1000000ull)
+{
+    balance_timer_.setInterval(BALANCE_INTERVAL);
+    connect(&balance_timer_, &QTimer::timeout, this, &SerialPool::balance);
+}
+
+SerialPool::~SerialPool()
+{
+    stop();
+}
+
+void SerialPool::setThreadCount(unsigned int count)
+{
+    count = max(count, 1u);
+    if (count == threads_.size())
+        return;
+
+    while (threads_.size() < count) {
+        threads_.emplace_back(new QThread);
+        thread_loads_.push_back(0);
+        if (started_)
+            threads_.back()->start();
+    }
+
+    if (threads_.size() > count) {
+        // Keep the first threads, their boards don't have to move
+        for (size_t i = count; i < thread_loads_.size(); i++)
+            thread_loads_[i] = UINT64_MAX;
+        for (auto &member: members_) {
+            if (member.thread >= count)
+                moveBoard(member, findIdlestThread());
+        }
+
+        for (size_t i = count; i < threads_.size(); i++) {
+            threads_[i]->quit();
+            threads_[i]->wait();
+        }
+        threads_.resize(count);
+        thread_loads_.resize(count);
+    }
+}
+
+void SerialPool::start()
+{
+    if (started_)
+        return;
+
+    if (threads_.empty())
+        setThreadCount(1);
+    for (auto &thread: threads_)
+        thread->start();
+    balance_timer_.start();
+
+    started_ = true;
+}
+
+// Boards must not be used after this, Monitor drops them right away
+void SerialPool::stop()
+{
+    if (!started_)
+        return;
+
+    balance_timer_.stop();
+    for (auto &thread: threads_) {
+        thread->quit();
+        thread->wait();
+    }
+    members_.clear();
+    fill(thread_loads_.begin(), thread_loads_.end(), 0);
+
+    started_ = false;
+}
+
+void SerialPool::addBoard(shared_ptr<Board> board)
+{
+    Member member;
+
+    member.board = board;
+    member.thread = findIdlestThread();
+    member.last_busy = board->serialBusyTime();
+    member.load = 0;
+
+    board->serial_notifier_.setThread(threads_[member.thread].get());
+    members_.push_back(member);
+}
+
+double SerialPool::threadBusy(unsigned int thread) const
+{
+    if (thread >= thread_loads_.size())
+        return 0.0;
+
+    return static_cast<double>(thread_loads_[thread]) / static_cast<double>(balance_interval_);
+}
+
+int SerialPool::boardThread(const Board *board) const
+{
+    for (auto &member: members_) {
+        if (member.board.lock().get() == board)
+            return static_cast<int>(member.thread);
+    }
+
+    return -1;
+}
+
+void SerialPool::balance()
+{
+    members_.erase(remove_if(members_.begin(), members_.end(),
+                             [](const Member &member) { return member.board.expired(); }),
+                   members_.end());
+
+    fill(thread_loads_.begin(), thread_loads_.end(), 0);
+    for (auto &member: members_) {
+        uint64_t busy = member.board.lock()->serialBusyTime();
+
+        member.load = busy - member.last_busy;
+        member.last_busy = busy;
+        thread_loads_[member.thread] += member.load;
+    }
+
+    if (threads_.size() < 2)
+        return;
+
+    auto busiest = static_cast<unsigned int>(max_element(thread_loads_.begin(), thread_loads_.end()) -
+                                             thread_loads_.begin());
+    auto idlest = static_cast<unsigned int>(min_element(thread_loads_.begin(), thread_loads_.end()) -
+                                            thread_loads_.begin());
+    uint64_t gap = thread_loads_[busiest] - thread_loads_[idlest];
+    if (gap * 100 < balance_interval_ * BALANCE_THRESHOLD)
+        return;
+
+    /* Moving a board busier than the gap would only swap the roles of the two threads, the
+       best we can do is to move the board closest to half the gap. One board at a time, the
+       loads will be measured again before we move another one. */
+    Member *best = nullptr;
+    uint64_t best_distance = UINT64_MAX;
+    for (auto &member: members_) {
+        if (member.thread != busiest || !member.load || member.load >= gap)
+            continue;
+
+        uint64_t distance = member.load * 2 > gap ? member.load * 2 - gap : gap - member.load * 2;
+        if (distance < best_distance) {
+            best = &member;
+            best_distance = distance;
+        }
+    }
+    if (!best)
+        return;
+
+    auto board = best->board.lock();
+    ty_log(TY_LOG_DEBUG, "Moving serial I/O of '%s' from thread #%u to thread #%u",
+           board->tag().toUtf8().constData(), busiest + 1, idlest + 1);
+    moveBoard(*best, idlest);
+}
+
+unsigned int SerialPool::findIdlestThread() const
+{
+    vector<unsigned int> counts(threads_.size());
+    for (auto &member: members_) {
+        if (member.thread < counts.size())
+            counts[member.thread]++;
+    }
+
+    unsigned int idlest = 0;
+    for (unsigned int i = 1; i < threads_.size(); i++) {
+        if (thread_loads_[i] < thread_loads_[idlest] ||
+                (thread_loads_[i] == thread_loads_[idlest] && counts[i] < counts[idlest]))
+            idlest = i;
+    }
+
+    return idlest;
+}
+
+void SerialPool::moveBoard(Member &member, unsigned int thread)
+{
+    auto board = member.board.lock();
+    if (!board || thread == member.thread)
+        return;
+
+    board->serial_notifier_.setThread(threads_[thread].get());
+
+    if (thread_loads_[member.thread] != UINT64_MAX)
+        thread_loads_[member.thread] -= min(thread_loads_[member.thread], member.load);
+    thread_loads_[thread] += member.load;
+    member.thread = thread;
+}
@@ -0,0 +1,71 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_POOL_HH
+#define SERIAL_POOL_HH
+
+#include <QThread>
+#include <QTimer>
+
+#include <memory>
+#include <vector>
+
+class Board;
+
+/* Threads running the serial notifiers of the boards, so that reading, decoding and
+   logging scale with the number of busy boards. The load of a board is the time spent in
+   Board::serialReceived(). New boards go to the least loaded thread, and the pool moves one
+   board at a time from the busiest thread to the idlest one when they drift apart.
+
+   Everything here happens on the GUI thread. */
+class SerialPool : public QObject {
+    Q_OBJECT
+
+    struct Member {
+        std::weak_ptr<Board> board;
+        unsigned int thread;
+        uint64_t last_busy;
+        uint64_t load;
+    };
+
+    std::vector<std::unique_ptr<QThread>> threads_;
+    std::vector<uint64_t> thread_loads_;
+    bool started_ = false;
+
+    std::vector<Member> members_;
+
+    QTimer balance_timer_;
+    uint64_t balance_interval_;
+
+public:
+    SerialPool(QObject *parent = nullptr);
+    virtual ~SerialPool();
+
+    unsigned int threadCount() const { return static_cast<unsigned int>(threads_.size()); }
+    void setThreadCount(unsigned int count);
+
+    void start();
+    void stop();
+
+    void addBoard(std::shared_ptr<Board> board);
+
+    // Fraction of the last balance interval each thread spent reading serial data
+    double threadBusy(unsigned int thread) const;
+    int boardThread(const Board *board) const;
+
+private slots:
+    void balance();
+
+private:
+    unsigned int findIdlestThread() const;
+    void moveBoard(Member &member, unsigned int thread);
+};
+
+#endif
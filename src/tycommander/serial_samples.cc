@@ -0,0 +1,278 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QMutexLocker>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "serial_buffer.hpp"
+#include "serial_samples.hpp"
+
+using namespace std;
+
+#define MAX_LINE_LENGTH 1024
+
+SerialSamples::SerialSamples(size_t capacity)
+    : capacity_(capacity)
+{
+    for (auto &channel: channels_)
+        channel = nullptr;
+}
+
+SerialSamples::~SerialSamples()
+{
+    for (auto &channel: channels_)
+        delete[] channel.load();
+}
+
+QString SerialSamples::channelName(unsigned int channel) const
+{
+    QMutexLocker locker(&names_lock_);
+    return channel < SERIAL_SAMPLES_MAX_CHANNELS ? names_[channel] : QString();
+}
+
+float SerialSamples::value(unsigned int channel, uint64_t sample) const
+{
+    auto values = channel < SERIAL_SAMPLES_MAX_CHANNELS
+                  ? channels_[channel].load(memory_order_acquire) : nullptr;
+    if (!values)
+        return numeric_limits<float>::quiet_NaN();
+
+    return values[sample % capacity_].load(memory_order_relaxed);
+}
+
+// Returns false if there is no value (only NaN) in [start, end)
+bool SerialSamples::range(unsigned int channel, uint64_t start, uint64_t end, float *r_min,
+                          float *r_max) const
+{
+    auto values = channel < SERIAL_SAMPLES_MAX_CHANNELS
+                  ? channels_[channel].load(memory_order_acquire) : nullptr;
+    if (!values)
+        return false;
+
+    float min = numeric_limits<float>::infinity();
+    float max = -numeric_limits<float>::infinity();
+    for (uint64_t i = start; i < end; i++) {
+        float value = values[i % capacity_].load(memory_order_relaxed);
+
+        // NaN fails both comparisons
+        if (value < min)
+            min = value;
+        if (value > max)
+            max = value;
+    }
+    if (min > max)
+        return false;
+
+    *r_min = min;
+    *r_max = max;
+    return true;
+}
+
+void SerialSamples::parse(const char *buf, size_t len)
+{
+    const char *end = buf + len;
+
+    while (buf < end) {
+        auto nl = static_cast<const char *>(memchr(buf, '\n', static_cast<size_t>(end - buf)));
+        if (!nl) {
+            // Keep the beginning of the line for later, unless it is way too long to be useful
+            if (line_.size() + static_cast<size_t>(end - buf) <= MAX_LINE_LENGTH)
+                line_.append(buf, static_cast<size_t>(end - buf));
+            break;
+        }
+
+        if (line_.empty()) {
+            parseLine(buf, static_cast<size_t>(nl - buf));
+        } else {
+            if (line_.size() + static_cast<size_t>(nl - buf) <= MAX_LINE_LENGTH) {
+                line_.append(buf, static_cast<size_t>(nl - buf));
+                parseLine(line_.data(), line_.size());
+            }
+            line_.clear();
+        }
+
+        buf = nl + 1;
+    }
+}
+
+void SerialSamples::clear()
+{
+    count_.store(0, memory_order_release);
+    channel_count_ = 0;
+    line_.clear();
+
+    QMutexLocker locker(&names_lock_);
+    for (unsigned int i = 0; i < SERIAL_SAMPLES_MAX_CHANNELS; i++) {
+        names_[i].clear();
+        parsed_names_[i].clear();
+    }
+}
+
+/* Frees the rings as well. Unlike clear(), nothing else may use the samples during this
+   call: Board does it on the GUI thread (the only reader), under serial_lock_. */
+void SerialSamples::release()
+{
+    clear();
+    for (auto &channel: channels_) {
+        delete[] channel.load();
+        channel = nullptr;
+    }
+}
+
+size_t SerialSamples::memoryUsage() const
+{
+    size_t usage = 0;
+    for (auto &channel: channels_) {
+        if (channel.load(memory_order_relaxed))
+            usage += capacity_ * sizeof(float);
+    }
+
+    return usage;
+}
+
+static inline bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == ',' || c == ';' ||
+           c == SERIAL_BUFFER_HIGHLIGHT;
+}
+
+/* strtod() depends on the locale, and Qt changes it on some platforms. Sketches print
+   numbers with Serial.print() anyway, so we only need the simple forms. */
+static bool parse_number(const char *str, size_t len, double *r_value)
+{
+    const char *end = str + len;
+    bool negative = false;
+    double value = 0.0;
+    bool digits = false;
+
+    if (str < end && (*str == '-' || *str == '+'))
+        negative = (*str++ == '-');
+    while (str < end && *str >= '0' && *str <= '9') {
+        value = value * 10.0 + (*str++ - '0');
+        digits = true;
+    }
+    if (str < end && *str == '.') {
+        double scale = 0.1;
+        for (str++; str < end && *str >= '0' && *str <= '9'; str++) {
+            value += (*str - '0') * scale;
+            scale *= 0.1;
+            digits = true;
+        }
+    }
+    if (!digits)
+        return false;
+    if (str < end && (*str == 'e' || *str == 'E')) {
+        bool exp_negative = false;
+        int exp = 0;
+
+        str++;
+        if (str < end && (*str == '-' || *str == '+'))
+            exp_negative = (*str++ == '-');
+        if (str == end)
+            return false;
+        while (str < end && *str >= '0' && *str <= '9' && exp < 1000)
+            exp = exp * 10 + (*str++ - '0');
+        value *= pow(10.0, exp_negative ? -exp : exp);
+    }
+    if (str != end)
+        return false;
+
+    *r_value = negative ? -value : value;
+    return true;
+}
+
+void SerialSamples::parseLine(const char *line, size_t len)
+{
+    const char *end = line + len;
+    float values[SERIAL_SAMPLES_MAX_CHANNELS];
+    unsigned int columns = 0;
+    unsigned int numeric_columns = 0;
+
+    uint64_t time;
+    if (SerialBuffer::decodeTimestamp(line, len, &time))
+        line += SERIAL_BUFFER_TIMESTAMP_SIZE;
+
+    while (line < end && columns < SERIAL_SAMPLES_MAX_CHANNELS) {
+        while (line < end && is_separator(*line))
+            line++;
+        const char *token = line;
+        while (line < end && !is_separator(*line))
+            line++;
+        auto token_len = static_cast<size_t>(line - token);
+        if (!token_len)
+            break;
+
+        // Accept "name:value" and "name=value", like the Arduino plotter
+        const char *value = token;
+        size_t value_len = token_len;
+        size_t name_len = 0;
+        for (size_t i = token_len; i-- > 0;) {
+            if (token[i] == ':' || token[i] == '=') {
+                name_len = i;
+                value = token + i + 1;
+                value_len = token_len - i - 1;
+                break;
+            }
+        }
+
+        /* Keep the column so that later values stay in their channel, for example
+           with "a=1 b=? c=3". */
+        double number;
+        if (parse_number(value, value_len, &number)) {
+            values[columns] = static_cast<float>(number);
+            numeric_columns = columns + 1;
+        } else {
+            values[columns] = numeric_limits<float>::quiet_NaN();
+        }
+
+        // Only take the lock when a name changes, which should not happen often
+        auto &parsed_name = parsed_names_[columns];
+        if (name_len != parsed_name.size() || memcmp(token, parsed_name.data(), name_len)) {
+            parsed_name.assign(token, name_len);
+
+            QMutexLocker locker(&names_lock_);
+            names_[columns] = QString::fromUtf8(token, static_cast<int>(name_len));
+        }
+
+        columns++;
+    }
+
+    // Plain text lines make no sample, and trailing words make no channel
+    if (!numeric_columns)
+        return;
+    columns = numeric_columns;
+
+    // Channels that appear (or reappear after clear()) start with NaN for older samples
+    unsigned int channel_count = channel_count_;
+    for (unsigned int i = channel_count; i < columns; i++) {
+        auto channel = channels_[i].load();
+        if (!channel) {
+            channel = new atomic<float>[capacity_];
+            channels_[i].store(channel, memory_order_release);
+        }
+        for (size_t j = 0; j < capacity_; j++)
+            channel[j].store(numeric_limits<float>::quiet_NaN(), memory_order_relaxed);
+    }
+    if (columns > channel_count) {
+        channel_count = columns;
+        channel_count_ = channel_count;
+    }
+
+    uint64_t sample = count_.load(memory_order_relaxed);
+    auto pos = static_cast<size_t>(sample % capacity_);
+    for (unsigned int i = 0; i < channel_count; i++) {
+        float value = i < columns ? values[i] : numeric_limits<float>::quiet_NaN();
+        channels_[i].load(memory_order_relaxed)[pos].store(value, memory_order_relaxed);
+    }
+    count_.store(sample + 1, memory_order_release);
+}
@@ -0,0 +1,71 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_SAMPLES_HH
+#define SERIAL_SAMPLES_HH
+
+#include <QMutex>
+#include <QString>
+
+#include <atomic>
+#include <string>
+
+#define SERIAL_SAMPLES_MAX_CHANNELS 8
+
+/* Extracts numeric columns from serial lines such as "12,-3.5,7" or "temp:21.5 hum:40",
+   and stores them in one ring per channel. Each line makes one sample, missing values are
+   stored as NaN.
+
+   parse() and clear() must be called from one thread at a time (Board does that under
+   serial_lock_), and the other methods can be called from any thread at any time. Rings
+   are allocated the first time a channel gets a value, and are never freed before the
+   destructor runs (or release(), see there), so readers never see a dangling pointer. */
+class SerialSamples {
+    size_t capacity_;
+
+    std::atomic<std::atomic<float> *> channels_[SERIAL_SAMPLES_MAX_CHANNELS];
+    std::atomic<unsigned int> channel_count_ {0};
+    std::atomic<uint64_t> count_ {0};
+
+    mutable QMutex names_lock_;
+    QString names_[SERIAL_SAMPLES_MAX_CHANNELS];
+
+    // Parser state
+    std::string line_;
+    std::string parsed_names_[SERIAL_SAMPLES_MAX_CHANNELS];
+
+public:
+    SerialSamples(size_t capacity);
+    ~SerialSamples();
+
+    SerialSamples &operator=(const SerialSamples &other) = delete;
+    SerialSamples(const SerialSamples &other) = delete;
+
+    size_t capacity() const { return capacity_; }
+    unsigned int channelCount() const { return channel_count_; }
+    QString channelName(unsigned int channel) const;
+
+    // Samples are numbered from 0 (or the last clear()), only the last capacity() remain
+    uint64_t count() const { return count_.load(std::memory_order_acquire); }
+    float value(unsigned int channel, uint64_t sample) const;
+    bool range(unsigned int channel, uint64_t start, uint64_t end, float *r_min,
+               float *r_max) const;
+
+    void parse(const char *buf, size_t len);
+    void clear();
+    void release();
+
+    size_t memoryUsage() const;
+
+private:
+    void parseLine(const char *line, size_t len);
+};
+
+#endif
@@ -0,0 +1,244 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <algorithm>
+#include <cstring>
+
+#include "serial_search.hpp"
+
+using namespace std;
+
+#define FILTER_BITS 65536
+#define BIGRAM_FLAG 0x1000000u
+
+static inline uint8_t fold_byte(uint8_t c)
+{
+    return (c >= 'A' && c <= 'Z') ? static_cast<uint8_t>(c + 32) : c;
+}
+
+static inline void set_bit(uint64_t *bits, uint32_t hash)
+{
+    bits[hash >> 6] |= 1ull << (hash & 63);
+}
+
+static inline bool test_bit(const uint64_t *bits, uint32_t hash)
+{
+    return bits[hash >> 6] & (1ull << (hash & 63));
+}
+
+// Two 16-bit hashes, one for each bit of the Bloom filter
+static inline uint32_t hash1(uint32_t key) { return (key * 2654435761u) >> 16; }
+static inline uint32_t hash2(uint32_t key) { return (key * 2246822519u) >> 16; }
+
+SerialSearchFilter::SerialSearchFilter()
+    : bits_(new uint64_t[FILTER_BITS / 64])
+{
+    clear();
+}
+
+void SerialSearchFilter::add(const char *buf, size_t len, uint32_t *state)
+{
+    uint64_t *bits = bits_.get();
+    uint32_t trigram = *state;
+
+    for (size_t i = 0; i < len; i++) {
+        trigram = ((trigram << 8) | fold_byte(static_cast<uint8_t>(buf[i]))) & 0xFFFFFF;
+        uint32_t bigram = BIGRAM_FLAG | (trigram & 0xFFFF);
+
+        set_bit(bits, hash1(trigram));
+        set_bit(bits, hash2(trigram));
+        set_bit(bits, hash1(bigram));
+        set_bit(bits, hash2(bigram));
+    }
+
+    *state = trigram;
+}
+
+void SerialSearchFilter::clear()
+{
+    memset(bits_.get(), 0, FILTER_BITS / 8);
+}
+
+size_t SerialSearchFilter::memoryUsage()
+{
+    return FILTER_BITS / 8;
+}
+
+bool SerialSearchFilter::mayContain(uint32_t key) const
+{
+    return test_bit(bits_.get(), hash1(key)) && test_bit(bits_.get(), hash2(key));
+}
+
+/* Collects literal runs that any match must contain. This is deliberately simple and
+   conservative: anything we don't understand ends the current run, optional atoms are
+   removed, and we give up on alternatives and option changes. */
+static vector<QString> find_required_literals(const QString &pattern)
+{
+    vector<QString> runs;
+    QString run;
+    int depth = 0;
+
+    auto flush = [&]() {
+        if (!run.isEmpty())
+            runs.push_back(run);
+        run.clear();
+    };
+
+    for (int i = 0; i < pattern.size(); i++) {
+        QChar c = pattern[i];
+        QChar atom;
+
+        if (c == '|') {
+            return {};
+        } else if (c == '\\') {
+            if (i + 1 >= pattern.size())
+                break;
+            QChar next = pattern[++i];
+            if (next.isLetterOrNumber()) {
+                // Escapes with arguments (\x41, \p{Lu}, \k<name>, \1) are not worth it
+                if (next.unicode() >= 128 || !strchr("dDwWsSbBnrtfeahHvVRAzZGK", next.toLatin1()))
+                    return {};
+                flush();
+                continue;
+            }
+            atom = next;
+        } else if (c == '[') {
+            flush();
+            i++;
+            if (i < pattern.size() && pattern[i] == '^')
+                i++;
+            if (i < pattern.size() && pattern[i] == ']')
+                i++;
+            while (i < pattern.size() && pattern[i] != ']') {
+                if (pattern[i] == '\\')
+                    i++;
+                i++;
+            }
+            continue;
+        } else if (c == '(') {
+            if (i + 1 < pattern.size() && pattern[i + 1] == '?' &&
+                    (i + 2 >= pattern.size() || pattern[i + 2] != ':'))
+                return {};
+            flush();
+            depth++;
+            continue;
+        } else if (c == ')') {
+            flush();
+            depth--;
+            continue;
+        } else if (c == '*' || c == '?' || c == '{') {
+            // The previous atom is optional, or repeated an unknown number of times
+            if (!run.isEmpty())
+                run.chop(1);
+            flush();
+            if (c == '{') {
+                while (i < pattern.size() && pattern[i] != '}')
+                    i++;
+            }
+            continue;
+        } else if (c == '+' || c == '.' || c == '^' || c == '$') {
+            flush();
+            continue;
+        } else {
+            atom = c;
+        }
+
+        // Groups may be optional or repeated, don't bother
+        if (depth) {
+            flush();
+            continue;
+        }
+        run += atom;
+    }
+    flush();
+
+    return runs;
+}
+
+SerialSearchQuery::SerialSearchQuery(const QString &pattern, bool regex, bool case_sensitive)
+{
+    re_.setPattern(regex ? pattern : QRegularExpression::escape(pattern));
+    if (!case_sensitive)
+        re_.setPatternOptions(QRegularExpression::CaseInsensitiveOption);
+    if (!isValid())
+        return;
+    re_.optimize();
+
+    vector<QString> runs;
+    if (regex) {
+        runs = find_required_literals(pattern);
+    } else {
+        runs.push_back(pattern);
+    }
+
+    for (auto &run: runs) {
+        auto utf8 = run.toUtf8();
+
+        /* Filters only fold ASCII, so split case-insensitive runs around other
+           characters. Case-sensitive runs can be used as is. */
+        for (int start = 0; start < utf8.size();) {
+            int end = start;
+            while (end < utf8.size() && (case_sensitive || !(utf8[end] & 0x80)))
+                end++;
+
+            uint32_t trigram = 0;
+            for (int i = start; i < end; i++) {
+                trigram = ((trigram << 8) | fold_byte(static_cast<uint8_t>(utf8[i]))) & 0xFFFFFF;
+                if (i - start >= 2) {
+                    keys_.push_back(trigram);
+                } else if (i - start == 1 && end - start == 2) {
+                    keys_.push_back(BIGRAM_FLAG | (trigram & 0xFFFF));
+                }
+            }
+
+            start = end + 1;
+        }
+    }
+
+    sort(keys_.begin(), keys_.end());
+    keys_.erase(unique(keys_.begin(), keys_.end()), keys_.end());
+}
+
+vector<QString> SerialSearchQuery::requiredLiterals(const QString &pattern)
+{
+    return find_required_literals(pattern);
+}
+
+bool SerialSearchQuery::match(const QString &text, int from, bool backward, int *r_start,
+                              int *r_length) const
+{
+    if (!backward) {
+        if (from > text.size())
+            return false;
+
+        auto m = re_.match(text, from);
+        if (!m.hasMatch())
+            return false;
+
+        *r_start = m.capturedStart();
+        *r_length = m.capturedLength();
+        return true;
+    } else {
+        bool found = false;
+
+        auto it = re_.globalMatch(text);
+        while (it.hasNext()) {
+            auto m = it.next();
+            if (m.capturedStart() >= from)
+                break;
+
+            *r_start = m.capturedStart();
+            *r_length = m.capturedLength();
+            found = true;
+        }
+
+        return found;
+    }
+}
@@ -0,0 +1,88 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_SEARCH_HH
+#define SERIAL_SEARCH_HH
+
+#include <QRegularExpression>
+#include <QString>
+
+#include <memory>
+#include <vector>
+
+/* Bloom filter of the bigrams and trigrams found in a block of text (64 kB in practice),
+   so searches can skip most blocks without looking at them. Keys are ASCII case-folded,
+   the same filter works for case-sensitive and case-insensitive searches. False positives
+   are fine, candidate text is always checked with the real pattern afterwards. */
+class SerialSearchFilter {
+    std::unique_ptr<uint64_t[]> bits_;
+
+public:
+    SerialSearchFilter();
+
+    SerialSearchFilter(SerialSearchFilter &&other) = default;
+    SerialSearchFilter &operator=(SerialSearchFilter &&other) = default;
+
+    // The state carries the last bytes over, for keys split between two calls
+    void add(const char *buf, size_t len, uint32_t *state);
+    void clear();
+
+    bool mayContain(uint32_t key) const;
+
+    static size_t memoryUsage();
+};
+
+struct SerialSearchMatch {
+    uint64_t line;
+    int start;
+    int length;
+};
+
+class SerialSearchQuery {
+    QRegularExpression re_;
+    std::vector<uint32_t> keys_;
+
+public:
+    SerialSearchQuery(const QString &pattern, bool regex, bool case_sensitive);
+
+    bool isValid() const { return !re_.pattern().isEmpty() && re_.isValid(); }
+    QString errorString() const { return re_.errorString(); }
+
+    // Keys any match must contain, empty when the pattern gives nothing to filter on
+    const std::vector<uint32_t> &keys() const { return keys_; }
+
+    template <typename It>
+    bool mayMatch(It first, It last) const;
+    bool mayMatch(const SerialSearchFilter &filter) const
+        { return mayMatch(&filter, &filter + 1); }
+
+    // Backward searches return the last match starting before from
+    bool match(const QString &text, int from, bool backward, int *r_start, int *r_length) const;
+
+    // Literal strings that any match of the regular expression must contain
+    static std::vector<QString> requiredLiterals(const QString &pattern);
+};
+
+// Checks that every key is in at least one of the filters in [first, last)
+template <typename It>
+bool SerialSearchQuery::mayMatch(It first, It last) const
+{
+    for (auto key: keys_) {
+        bool found = false;
+        for (auto it = first; it != last && !found; ++it)
+            found = it->mayContain(key);
+        if (!found)
+            return false;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,525 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include <QApplication>
+#include <QClipboard>
+#include <QDateTime>
+#include <QKeyEvent>
+#include <QMenu>
+#include <QPainter>
+#include <QScrollBar>
+
+#include <algorithm>
+#include <climits>
+
+#include "serial_view.hpp"
+
+using namespace std;
+
+#define TEXT_MARGIN 4
+#define TAB_WIDTH 8
+// "hh:mm:ss.zzz "
+#define TIMESTAMP_WIDTH 13
+
+SerialView::SerialView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    setFocusPolicy(Qt::StrongFocus);
+    viewport()->setCursor(Qt::IBeamCursor);
+    viewport()->setBackgroundRole(QPalette::Base);
+}
+
+SerialView::~SerialView()
+{
+    if (buffer_)
+        buffer_->detach();
+}
+
+void SerialView::setBuffer(SerialBuffer *buffer)
+{
+    if (buffer_) {
+        buffer_->disconnect(this);
+        buffer_->detach();
+    }
+
+    buffer_ = buffer;
+    anchor_ = {};
+    cursor_ = {};
+    selecting_ = false;
+    has_match_ = false;
+
+    if (buffer_) {
+        buffer_->attach();
+        connect(buffer_, &SerialBuffer::appended, this, &SerialView::handleAppend);
+        connect(buffer_, &SerialBuffer::trimmed, this, &SerialView::handleTrim);
+        connect(buffer_, &SerialBuffer::cleared, this, &SerialView::handleClear);
+    }
+
+    scrollToEnd();
+}
+
+void SerialView::setShowTimestamps(bool show)
+{
+    if (show == timestamps_)
+        return;
+
+    // Columns move, the old selection would not make sense anymore
+    timestamps_ = show;
+    anchor_ = {};
+    cursor_ = {};
+    has_match_ = false;
+
+    updateScrollBars();
+    viewport()->update();
+}
+
+QString SerialView::selectedText() const
+{
+    if (!buffer_ || !hasSelection())
+        return QString();
+
+    auto start = min(anchor_, cursor_);
+    auto end = max(anchor_, cursor_);
+    if (start.line < buffer_->firstLine())
+        start = {buffer_->firstLine(), 0};
+
+    QString text;
+    for (uint64_t line = start.line; line <= end.line && line < buffer_->endLine(); line++) {
+        auto line_text = displayText(line);
+
+        int start_column = line == start.line ? start.column : 0;
+        if (line == end.line) {
+            text += line_text.mid(start_column, end.column - start_column);
+        } else {
+            text += line_text.mid(start_column);
+            text += '\n';
+        }
+    }
+
+    return text;
+}
+
+QMenu *SerialView::createStandardContextMenu()
+{
+    auto menu = new QMenu(this);
+
+    auto copy_action = menu->addAction(tr("&Copy"));
+    copy_action->setShortcut(QKeySequence::Copy);
+    copy_action->setEnabled(hasSelection());
+    connect(copy_action, &QAction::triggered, this, &SerialView::copy);
+
+    menu->addSeparator();
+
+    auto select_action = menu->addAction(tr("Select All"));
+    select_action->setShortcut(QKeySequence::SelectAll);
+    connect(select_action, &QAction::triggered, this, &SerialView::selectAll);
+
+    return menu;
+}
+
+bool SerialView::find(const SerialSearchQuery &query, bool backward)
+{
+    if (!buffer_ || !query.isValid())
+        return false;
+
+    uint64_t line;
+    int from;
+    if (has_match_) {
+        line = match_.line;
+        from = backward ? match_.start : match_.start + max(match_.length, 1);
+    } else if (!backward) {
+        line = top_line_;
+        from = 0;
+    } else {
+        line = top_line_ + static_cast<uint64_t>(visibleLines()) - 1;
+        from = INT_MAX;
+    }
+
+    SerialSearchMatch match;
+    if (!buffer_->search(query, line, from, backward, &match)) {
+        // Wrap around
+        if (!backward) {
+            line = buffer_->firstLine();
+            from = 0;
+        } else {
+            line = buffer_->endLine() - 1;
+            from = INT_MAX;
+        }
+        if (!buffer_->search(query, line, from, backward, &match))
+            return false;
+    }
+    match_ = match;
+    has_match_ = true;
+
+    auto text = buffer_->lineText(match.line);
+    anchor_ = {match.line, prefixWidth() + displayColumn(text, match.start)};
+    cursor_ = {match.line, prefixWidth() + displayColumn(text, match.start + match.length)};
+
+    // Bring the match into view, and stop following new data
+    auto visible_lines = static_cast<uint64_t>(visibleLines());
+    if (match.line < top_line_ || match.line >= top_line_ + visible_lines) {
+        autoscroll_ = false;
+        top_line_ = match.line > visible_lines / 2 ? match.line - visible_lines / 2 : 0;
+        updateScrollBars();
+    }
+    {
+        auto hbar = horizontalScrollBar();
+        int char_width = charWidth();
+        int start_x = anchor_.column * char_width;
+        int end_x = cursor_.column * char_width + 2 * TEXT_MARGIN;
+
+        if (start_x < hbar->value() || end_x > hbar->value() + viewport()->width())
+            hbar->setValue(start_x - viewport()->width() / 2);
+    }
+
+    viewport()->update();
+    return true;
+}
+
+void SerialView::clear()
+{
+    if (buffer_)
+        buffer_->clear();
+}
+
+void SerialView::copy()
+{
+    if (hasSelection())
+        QApplication::clipboard()->setText(selectedText());
+}
+
+void SerialView::selectAll()
+{
+    if (!buffer_)
+        return;
+
+    uint64_t last_line = buffer_->endLine() - 1;
+    anchor_ = {buffer_->firstLine(), 0};
+    has_match_ = false;
+    cursor_ = {last_line, displayText(last_line).length()};
+
+    viewport()->update();
+}
+
+void SerialView::scrollToEnd()
+{
+    autoscroll_ = true;
+    updateScrollBars();
+    viewport()->update();
+}
+
+void SerialView::paintEvent(QPaintEvent *e)
+{
+    Q_UNUSED(e);
+
+    if (!buffer_)
+        return;
+
+    QPainter painter(viewport());
+    painter.setFont(font());
+
+    int line_height = lineHeight();
+    int char_width = charWidth();
+    int ascent = fontMetrics().ascent();
+    int width = viewport()->width();
+    int height = viewport()->height();
+
+    // Only draw the visible part of long lines
+    int first_column = horizontalScrollBar()->value() / char_width;
+    int columns = width / char_width + 2;
+    int x = TEXT_MARGIN - horizontalScrollBar()->value() + first_column * char_width;
+
+    bool selection = hasSelection();
+    auto start = min(anchor_, cursor_);
+    auto end = max(anchor_, cursor_);
+
+    uint64_t end_line = buffer_->endLine();
+    int y = 0;
+    for (uint64_t line = top_line_; line < end_line && y < height; line++, y += line_height) {
+        auto text = displayText(line).mid(first_column, columns);
+
+        if (buffer_->isHighlighted(line)) {
+            auto color = palette().color(QPalette::Highlight);
+            color.setAlpha(64);
+            painter.fillRect(0, y, width, line_height, color);
+        }
+
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(x, y + ascent, text);
+
+        if (selection && line >= start.line && line <= end.line) {
+            // Select past the end of the line to show the newline is selected too
+            int start_column = (line == start.line ? start.column : 0) - first_column;
+            int end_column = (line == end.line ? end.column : INT_MAX / 2) - first_column;
+            start_column = max(start_column, 0);
+            end_column = min(end_column, columns);
+
+            if (end_column > start_column) {
+                QRect rect(x + start_column * char_width, y,
+                           (end_column - start_column) * char_width, line_height);
+
+                painter.save();
+                painter.fillRect(rect, palette().highlight());
+                painter.setClipRect(rect);
+                painter.setPen(palette().color(QPalette::HighlightedText));
+                painter.drawText(x, y + ascent, text);
+                painter.restore();
+            }
+        }
+    }
+}
+
+void SerialView::resizeEvent(QResizeEvent *e)
+{
+    QAbstractScrollArea::resizeEvent(e);
+    updateScrollBars();
+}
+
+void SerialView::changeEvent(QEvent *e)
+{
+    QAbstractScrollArea::changeEvent(e);
+
+    if (e->type() == QEvent::FontChange) {
+        updateScrollBars();
+        viewport()->update();
+    }
+}
+
+void SerialView::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx);
+    Q_UNUSED(dy);
+
+    if (buffer_) {
+        auto vbar = verticalScrollBar();
+
+        top_line_ = buffer_->firstLine() + static_cast<uint64_t>(vbar->value());
+        autoscroll_ = vbar->value() >= vbar->maximum();
+    }
+
+    viewport()->update();
+}
+
+void SerialView::mousePressEvent(QMouseEvent *e)
+{
+    if (!buffer_ || e->button() != Qt::LeftButton) {
+        QAbstractScrollArea::mousePressEvent(e);
+        return;
+    }
+
+    cursor_ = positionAt(e->pos());
+    if (!(e->modifiers() & Qt::ShiftModifier))
+        anchor_ = cursor_;
+    selecting_ = true;
+    has_match_ = false;
+
+    viewport()->update();
+}
+
+void SerialView::mouseMoveEvent(QMouseEvent *e)
+{
+    if (!selecting_) {
+        QAbstractScrollArea::mouseMoveEvent(e);
+        return;
+    }
+
+    // Scroll when the mouse goes past the top or bottom edge
+    if (e->pos().y() < 0) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepSub);
+    } else if (e->pos().y() >= viewport()->height()) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderSingleStepAdd);
+    }
+
+    cursor_ = positionAt(e->pos());
+    viewport()->update();
+}
+
+void SerialView::mouseReleaseEvent(QMouseEvent *e)
+{
+    if (!selecting_) {
+        QAbstractScrollArea::mouseReleaseEvent(e);
+        return;
+    }
+
+    selecting_ = false;
+    if (hasSelection() && QApplication::clipboard()->supportsSelection())
+        QApplication::clipboard()->setText(selectedText(), QClipboard::Selection);
+}
+
+void SerialView::mouseDoubleClickEvent(QMouseEvent *e)
+{
+    if (!buffer_ || e->button() != Qt::LeftButton) {
+        QAbstractScrollArea::mouseDoubleClickEvent(e);
+        return;
+    }
+
+    auto pos = positionAt(e->pos());
+    anchor_ = {pos.line, 0};
+    cursor_ = {pos.line, displayText(pos.line).length()};
+
+    viewport()->update();
+}
+
+void SerialView::keyPressEvent(QKeyEvent *e)
+{
+    if (e == QKeySequence::Copy) {
+        copy();
+    } else if (e == QKeySequence::SelectAll) {
+        selectAll();
+    } else if (e == QKeySequence::MoveToStartOfDocument) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderToMinimum);
+    } else if (e == QKeySequence::MoveToEndOfDocument) {
+        verticalScrollBar()->triggerAction(QAbstractSlider::SliderToMaximum);
+    } else {
+        QAbstractScrollArea::keyPressEvent(e);
+    }
+}
+
+void SerialView::handleAppend()
+{
+    updateScrollBars();
+    viewport()->update();
+}
+
+void SerialView::handleTrim()
+{
+    // Keep the top line steady, unless it has been dropped
+    updateScrollBars();
+    viewport()->update();
+}
+
+void SerialView::handleClear()
+{
+    top_line_ = 0;
+    anchor_ = {};
+    cursor_ = {};
+    selecting_ = false;
+    has_match_ = false;
+
+    scrollToEnd();
+}
+
+int SerialView::lineHeight() const
+{
+    return max(fontMetrics().lineSpacing(), 1);
+}
+
+int SerialView::charWidth() const
+{
+    return max(fontMetrics().width(QLatin1Char('M')), 1);
+}
+
+int SerialView::visibleLines() const
+{
+    return max(viewport()->height() / lineHeight(), 1);
+}
+
+int SerialView::prefixWidth() const
+{
+    return timestamps_ ? TIMESTAMP_WIDTH : 0;
+}
+
+QString SerialView::displayText(uint64_t line) const
+{
+    auto text = buffer_->lineText(line);
+
+    // Expand tabs, or columns would not match what we draw
+    if (text.contains('\t')) {
+        QString expanded;
+        expanded.reserve(text.length() + TAB_WIDTH);
+        for (auto c: text) {
+            if (c == '\t') {
+                expanded.append(QString(TAB_WIDTH - expanded.length() % TAB_WIDTH, ' '));
+            } else {
+                expanded.append(c);
+            }
+        }
+        text = expanded;
+    }
+
+    // Lines from before timestamps were enabled don't have one
+    if (timestamps_) {
+        qint64 time = buffer_->lineTime(line);
+        if (time >= 0) {
+            text.prepend(QDateTime::fromMSecsSinceEpoch(time).toString("hh:mm:ss.zzz "));
+        } else {
+            text.prepend(QString(TIMESTAMP_WIDTH, ' '));
+        }
+    }
+
+    return text;
+}
+
+// Converts a QString index to a column, taking tabs into account
+int SerialView::displayColumn(const QString &text, int pos)
+{
+    int column = 0;
+    for (int i = 0; i < pos && i < text.size(); i++)
+        column = text[i] == '\t' ? (column / TAB_WIDTH + 1) * TAB_WIDTH : column + 1;
+
+    return column;
+}
+
+SerialView::Position SerialView::positionAt(const QPoint &pos) const
+{
+    Position position;
+
+    int row = max(pos.y(), 0) / lineHeight();
+    position.line = min(top_line_ + static_cast<uint64_t>(row), buffer_->endLine() - 1);
+
+    int char_width = charWidth();
+    int x = pos.x() - TEXT_MARGIN + horizontalScrollBar()->value() + char_width / 2;
+    position.column = min(max(x, 0) / char_width, displayText(position.line).length());
+
+    return position;
+}
+
+void SerialView::updateScrollBars()
+{
+    auto vbar = verticalScrollBar();
+    auto hbar = horizontalScrollBar();
+
+    if (!buffer_) {
+        top_line_ = 0;
+        vbar->setRange(0, 0);
+        hbar->setRange(0, 0);
+        return;
+    }
+
+    int visible_lines = visibleLines();
+    uint64_t first_line = buffer_->firstLine();
+    uint64_t line_count = buffer_->lineCount();
+    int max_value = static_cast<int>(min(line_count > static_cast<uint64_t>(visible_lines)
+                                         ? line_count - static_cast<uint64_t>(visible_lines) : 0,
+                                         static_cast<uint64_t>(INT_MAX)));
+
+    if (autoscroll_ || top_line_ > first_line + static_cast<uint64_t>(max_value)) {
+        top_line_ = first_line + static_cast<uint64_t>(max_value);
+    } else if (top_line_ < first_line) {
+        top_line_ = first_line;
+    }
+
+    /* We track top_line_ ourselves, don't let the intermediate values set by setRange()
+       go through scrollContentsBy(). */
+    bool blocked = vbar->blockSignals(true);
+    vbar->setRange(0, max_value);
+    vbar->setPageStep(visible_lines);
+    vbar->setSingleStep(1);
+    vbar->setValue(static_cast<int>(top_line_ - first_line));
+    vbar->blockSignals(blocked);
+
+    int char_width = charWidth();
+    size_t content_width = (buffer_->maxLineLength() + static_cast<size_t>(prefixWidth())) *
+                           static_cast<size_t>(char_width) + 2 * TEXT_MARGIN;
+    int max_x = static_cast<int>(min(content_width, static_cast<size_t>(INT_MAX))) - viewport()->width();
+    hbar->setRange(0, max(max_x, 0));
+    hbar->setPageStep(viewport()->width());
+    hbar->setSingleStep(char_width);
+}
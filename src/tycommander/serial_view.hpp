@@ -0,0 +1,106 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#ifndef SERIAL_VIEW_HH
+#define SERIAL_VIEW_HH
+
+#include <QAbstractScrollArea>
+#include <QPointer>
+
+#include "serial_buffer.hpp"
+
+class QMenu;
+
+/* Read-only view of a SerialBuffer which only renders the visible lines, so appending to
+   a huge buffer does not cost more than appending to a small one. The view assumes a
+   fixed-pitch font: columns are used for selection and horizontal scrolling. */
+class SerialView : public QAbstractScrollArea {
+    Q_OBJECT
+
+    struct Position {
+        uint64_t line;
+        int column;
+
+        bool operator==(const Position &other) const
+            { return line == other.line && column == other.column; }
+        bool operator<(const Position &other) const
+            { return line < other.line || (line == other.line && column < other.column); }
+    };
+
+    QPointer<SerialBuffer> buffer_;
+
+    uint64_t top_line_ = 0;
+    bool autoscroll_ = true;
+    bool timestamps_ = false;
+
+    Position anchor_ = {};
+    Position cursor_ = {};
+    bool selecting_ = false;
+
+    SerialSearchMatch match_;
+    bool has_match_ = false;
+
+public:
+    SerialView(QWidget *parent = nullptr);
+    virtual ~SerialView();
+
+    SerialBuffer *buffer() const { return buffer_; }
+    void setBuffer(SerialBuffer *buffer);
+
+    // Lines received with timestamps enabled in Board start with the time of day
+    bool showTimestamps() const { return timestamps_; }
+    void setShowTimestamps(bool show);
+
+    bool hasSelection() const { return !(anchor_ == cursor_); }
+    QString selectedText() const;
+
+    QMenu *createStandardContextMenu();
+
+    // Searches start from the last match, or from the visible lines after resetSearch()
+    bool find(const SerialSearchQuery &query, bool backward = false);
+    void resetSearch() { has_match_ = false; }
+
+public slots:
+    void clear();
+    void copy();
+    void selectAll();
+    void scrollToEnd();
+
+protected:
+    void paintEvent(QPaintEvent *e) override;
+    void resizeEvent(QResizeEvent *e) override;
+    void changeEvent(QEvent *e) override;
+    void scrollContentsBy(int dx, int dy) override;
+
+    void mousePressEvent(QMouseEvent *e) override;
+    void mouseMoveEvent(QMouseEvent *e) override;
+    void mouseReleaseEvent(QMouseEvent *e) override;
+    void mouseDoubleClickEvent(QMouseEvent *e) override;
+    void keyPressEvent(QKeyEvent *e) override;
+
+private slots:
+    void handleAppend();
+    void handleTrim();
+    void handleClear();
+
+private:
+    int lineHeight() const;
+    int charWidth() const;
+    int visibleLines() const;
+
+    int prefixWidth() const;
+    QString displayText(uint64_t line) const;
+    static int displayColumn(const QString &text, int pos);
+    Position positionAt(const QPoint &pos) const;
+
+    void updateScrollBars();
+};
+
+#endif
@@ -0,0 +1,83 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Measures adds, lookups and removals in _hs_htable, starting from the 64 buckets used by
+   the device monitors. Run it with the number of nodes, the default is 100000. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/htable.h"
+#include "../../src/libty/system.h"
+
+struct node {
+    _hs_htable_head hnode;
+    unsigned int value;
+};
+
+static void report(const char *name, uint64_t start, unsigned int count)
+{
+    uint64_t elapsed = ty_micros() - start;
+    printf("  %-8s %8.3f ms total, %6.1f ns per operation\n", name, (double)elapsed / 1000.0,
+           (double)elapsed * 1000.0 / count);
+}
+
+int main(int argc, char **argv)
+{
+    _hs_htable table;
+    struct node *nodes;
+    unsigned int count = 100000;
+    unsigned int found = 0;
+    uint64_t start;
+
+    if (argc > 1)
+        count = (unsigned int)strtoul(argv[1], NULL, 10);
+    if (!count) {
+        fprintf(stderr, "Usage: %s [nodes]\n", argv[0]);
+        return 1;
+    }
+
+    nodes = calloc(count, sizeof(*nodes));
+    if (!nodes || _hs_htable_init(&table, 64) < 0) {
+        fprintf(stderr, "Not enough memory\n");
+        return 1;
+    }
+
+    printf("Simulating %u nodes:\n", count);
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < count; i++) {
+        nodes[i].value = i;
+        _hs_htable_add(&table, _hs_htable_hash_ptr(&nodes[i]), &nodes[i].hnode);
+    }
+    report("Add", start, count);
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < count; i++) {
+        struct node *node = &nodes[(i * 7919u) % count];
+
+        _hs_htable_foreach_hash(cur, &table, _hs_htable_hash_ptr(node)) {
+            if (cur == &node->hnode) {
+                found++;
+                break;
+            }
+        }
+    }
+    report("Lookup", start, count);
+
+    start = ty_micros();
+    for (unsigned int i = 0; i < count; i++)
+        _hs_htable_remove(&table, &nodes[(i * 7919u) % count].hnode);
+    report("Remove", start, count);
+
+    printf("  %u buckets, found %u of %u nodes\n", table.size, found, count);
+
+    _hs_htable_release(&table);
+    free(nodes);
+    return 0;
+}
@@ -0,0 +1,411 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Simulates enumeration storms (e.g. a hub full of boards power-cycling) with fake serial
+   devices, and measures how long the monitor takes to process each interface event. Run it
+   with the number of boards to simulate, the default is 2000.
+
+   With "--replay <file> [callbacks]", the monitor processes the events of a recorded (or
+   generated with gen_storm) event file as fast as possible instead, with the given number of
+   registered callbacks (1 by default), and reports how many changes a batch callback gets.
+
+   With "--latency [busy] [cycles]", a worker thread waits for a replayed Teensy to reboot to
+   the bootloader again and again (20 cycles by default), while the main thread only refreshes
+   the monitor every "busy" milliseconds (50 by default), like a busy GUI. It measures how
+   long the worker takes to see the bootloader, without and then with the hotplug thread. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/replay_priv.h"
+#include "../../src/libty/board.h"
+#include "../../src/libty/class_priv.h"
+#include "../../src/libty/monitor_priv.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/thread.h"
+
+#define LATENCY_FILENAME "bench_latency.events"
+// The bootloader shows up 100 ms after the start of each cycle
+#define LATENCY_CYCLE_DELAY 600
+#define LATENCY_BOOTLOADER_DELAY 100
+
+struct latency_context {
+    ty_board *board;
+    uint64_t start;
+    unsigned int cycles;
+
+    unsigned int count;
+    uint64_t total;
+    uint64_t max;
+};
+
+static const struct _ty_class_vtable *generic_vtable;
+
+static hs_device *make_device(unsigned int port, unsigned int serial)
+{
+    hs_device *dev;
+    char buf[32];
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return NULL;
+    dev->refcount = 1;
+
+    snprintf(buf, sizeof(buf), "usb-%u-%u", port / 100, port % 100);
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->location = strdup(buf);
+    dev->path = strdup(buf);
+    dev->vid = 0x1234;
+    dev->pid = 0x5678;
+    snprintf(buf, sizeof(buf), "SN%08u", serial);
+    dev->serial_number_string = strdup(buf);
+    dev->match_udata = (void *)generic_vtable;
+
+    return dev;
+}
+
+static int process_all(ty_monitor *monitor, hs_device **devs, unsigned int count,
+                       hs_device_status status, const char *name)
+{
+    uint64_t start = ty_micros();
+
+    for (unsigned int i = 0; i < count; i++) {
+        int r;
+
+        devs[i]->status = status;
+        r = _ty_monitor_process_device(monitor, devs[i]);
+        if (r < 0)
+            return r;
+    }
+
+    uint64_t elapsed = ty_micros() - start;
+    printf("  %-12s %8.3f ms total, %6.3f us per event\n", name, (double)elapsed / 1000.0,
+           (double)elapsed / count);
+
+    return 0;
+}
+
+static int count_event(ty_board *board, ty_monitor_event event, void *udata)
+{
+    uint64_t *events_count = udata;
+
+    TY_UNUSED(board);
+    TY_UNUSED(event);
+
+    (*events_count)++;
+    return 0;
+}
+
+static int count_changes(const ty_monitor_change *changes, unsigned int count, void *udata)
+{
+    uint64_t *changes_count = udata;
+
+    TY_UNUSED(changes);
+
+    *changes_count += count;
+    return 0;
+}
+
+static int replay_events(const char *filename, unsigned int callbacks)
+{
+    ty_monitor *monitor = NULL;
+    uint64_t events_count = 0, changes_count = 0, start, elapsed;
+    int r;
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_set_replay(monitor, filename, 0.0);
+    if (r < 0)
+        goto cleanup;
+    for (unsigned int i = 0; i < callbacks; i++) {
+        r = ty_monitor_register_callback(monitor, count_event, &events_count);
+        if (r < 0)
+            goto cleanup;
+    }
+    r = ty_monitor_register_batch_callback(monitor, count_changes, &changes_count);
+    if (r < 0)
+        goto cleanup;
+
+    // With a speed of 0, all the events are processed when the monitor starts
+    start = ty_micros();
+    r = ty_monitor_start(monitor);
+    if (r < 0)
+        goto cleanup;
+    elapsed = ty_micros() - start;
+
+    printf("Replayed '%s' with %u callbacks:\n", filename, callbacks);
+    printf("  %-12s %8.3f ms total, %"PRIu64" callback calls, %"PRIu64" batched changes\n",
+           "Replay", (double)elapsed / 1000.0, events_count, changes_count);
+
+    r = 0;
+cleanup:
+    ty_monitor_free(monitor);
+    return r;
+}
+
+static void set_teensy_device(hs_device *dev, bool bootloader)
+{
+    dev->location = "usb-1-1";
+    dev->vid = 0x16C0;
+    if (bootloader) {
+        dev->type = HS_DEVICE_TYPE_HID;
+        dev->key = "/sim/hidraw0";
+        dev->path = "/dev/hidraw0";
+        dev->pid = 0x478;
+        dev->bcd_device = 0x105;
+        dev->u.hid.usage_page = 0xFF9C;
+        dev->u.hid.usage = 0x21;
+        dev->serial_number_string = "000186A0";
+    } else {
+        dev->type = HS_DEVICE_TYPE_SERIAL;
+        dev->key = "/sim/ttyACM0";
+        dev->path = "/dev/ttyACM0";
+        dev->pid = 0x483;
+        dev->bcd_device = 0x275;
+        dev->serial_number_string = "1000000";
+    }
+}
+
+static int write_latency_events(unsigned int cycles)
+{
+    hs_device serial = {0}, bootloader = {0};
+    FILE *fp;
+    int r;
+
+    set_teensy_device(&serial, false);
+    set_teensy_device(&bootloader, true);
+
+    fp = fopen(LATENCY_FILENAME, "w");
+    if (!fp)
+        return ty_error(TY_ERROR_IO, "Cannot open '%s': %s", LATENCY_FILENAME, strerror(errno));
+
+#define WRITE_EVENT(Time, Dev, Status) \
+        do { \
+            (Dev)->status = (Status); \
+            r = _hs_replay_write_event(fp, (Time), (Dev)); \
+            if (r < 0) \
+                goto cleanup; \
+        } while (0)
+
+    r = _hs_replay_write_header(fp);
+    if (r < 0)
+        goto cleanup;
+    WRITE_EVENT(0, &serial, HS_DEVICE_STATUS_ONLINE);
+    for (unsigned int i = 0; i < cycles; i++) {
+        uint64_t base = (uint64_t)(i + 1) * LATENCY_CYCLE_DELAY;
+
+        WRITE_EVENT(base, &serial, HS_DEVICE_STATUS_DISCONNECTED);
+        WRITE_EVENT(base + LATENCY_BOOTLOADER_DELAY, &bootloader, HS_DEVICE_STATUS_ONLINE);
+        WRITE_EVENT(base + 300, &bootloader, HS_DEVICE_STATUS_DISCONNECTED);
+        WRITE_EVENT(base + 400, &serial, HS_DEVICE_STATUS_ONLINE);
+    }
+
+#undef WRITE_EVENT
+
+    r = 0;
+cleanup:
+    fclose(fp);
+    return r;
+}
+
+static int wait_bootloader_thread(void *udata)
+{
+    struct latency_context *ctx = udata;
+
+    for (unsigned int i = 0; i < ctx->cycles; i++) {
+        uint64_t expected = ctx->start + (uint64_t)(i + 1) * LATENCY_CYCLE_DELAY +
+                            LATENCY_BOOTLOADER_DELAY;
+        uint64_t now;
+        int r;
+
+        r = ty_board_wait_for(ctx->board, TY_BOARD_CAPABILITY_UPLOAD, 2 * LATENCY_CYCLE_DELAY);
+        if (r <= 0)
+            return 0;
+        now = ty_millis();
+        if (now > expected) {
+            ctx->total += now - expected;
+            if (now - expected > ctx->max)
+                ctx->max = now - expected;
+        }
+        ctx->count++;
+
+        r = ty_board_wait_for(ctx->board, TY_BOARD_CAPABILITY_RUN, 2 * LATENCY_CYCLE_DELAY);
+        if (r <= 0)
+            return 0;
+    }
+
+    return 0;
+}
+
+static int measure_latency(bool threaded, unsigned int busy, unsigned int cycles)
+{
+    ty_monitor *monitor = NULL;
+    struct latency_context ctx = {0};
+    ty_thread thread;
+    bool thread_started = false;
+    uint64_t end;
+    int r;
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_set_replay(monitor, LATENCY_FILENAME, 1.0);
+    if (r < 0)
+        goto cleanup;
+    r = ty_monitor_set_threaded(monitor, threaded);
+    if (r < 0)
+        goto cleanup;
+
+    // The replay clock starts with the monitor
+    ctx.start = ty_millis();
+    ctx.cycles = cycles;
+    r = ty_monitor_start(monitor);
+    if (r < 0)
+        goto cleanup;
+    ctx.board = ty_monitor_find_board(monitor, "1000000");
+    if (!ctx.board) {
+        r = ty_error(TY_ERROR_NOT_FOUND, "Cannot find the replayed board");
+        goto cleanup;
+    }
+
+    r = ty_thread_create(&thread, wait_bootloader_thread, &ctx);
+    if (r < 0)
+        goto cleanup;
+    thread_started = true;
+
+    // Always busy, the monitor only gets refreshed in between
+    end = ctx.start + (uint64_t)(cycles + 1) * LATENCY_CYCLE_DELAY;
+    while (ty_millis() < end) {
+        r = ty_monitor_refresh(monitor);
+        if (r < 0)
+            goto cleanup;
+        ty_delay(busy);
+    }
+
+    r = 0;
+cleanup:
+    if (thread_started)
+        ty_thread_join(&thread);
+    ty_board_unref(ctx.board);
+    ty_monitor_free(monitor);
+
+    if (!r) {
+        printf("  %-12s %8.3f ms average, %3"PRIu64" ms max (%u/%u cycles)\n",
+               threaded ? "Threaded" : "Main loop",
+               ctx.count ? (double)ctx.total / ctx.count : 0.0, ctx.max, ctx.count, cycles);
+    }
+    return r;
+}
+
+static int measure_latencies(unsigned int busy, unsigned int cycles)
+{
+    int r;
+
+    r = write_latency_events(cycles);
+    if (r < 0)
+        return r;
+
+    printf("Reboot to bootloader latency with a main loop busy for %u ms:\n", busy);
+    r = measure_latency(false, busy, cycles);
+    if (!r)
+        r = measure_latency(true, busy, cycles);
+
+    remove(LATENCY_FILENAME);
+    return r;
+}
+
+int main(int argc, char **argv)
+{
+    ty_monitor *monitor = NULL;
+    hs_device **devs = NULL;
+    unsigned int count = 2000;
+    int r;
+
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        unsigned int callbacks = 1;
+
+        if (argc > 3)
+            callbacks = (unsigned int)strtoul(argv[3], NULL, 10);
+        return !!replay_events(argv[2], callbacks);
+    }
+    if (argc > 1 && strcmp(argv[1], "--latency") == 0) {
+        unsigned int busy = 50, cycles = 20;
+
+        if (argc > 2)
+            busy = (unsigned int)strtoul(argv[2], NULL, 10);
+        if (argc > 3)
+            cycles = (unsigned int)strtoul(argv[3], NULL, 10);
+        if (!cycles) {
+            fprintf(stderr, "Usage: %s --latency [busy] [cycles]\n", argv[0]);
+            return 1;
+        }
+        return !!measure_latencies(busy, cycles);
+    }
+
+    if (argc > 1)
+        count = (unsigned int)strtoul(argv[1], NULL, 10);
+    if (!count) {
+        fprintf(stderr, "Usage: %s [boards]\n", argv[0]);
+        return 1;
+    }
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        if (strcmp(_ty_classes[i].name, "Generic") == 0)
+            generic_vtable = _ty_classes[i].vtable;
+    }
+
+    r = ty_monitor_new(&monitor);
+    if (r < 0)
+        goto cleanup;
+
+    devs = calloc(count, sizeof(*devs));
+    if (!devs) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        devs[i] = make_device(i, i);
+        if (!devs[i]) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+    }
+
+    printf("Simulating %u boards:\n", count);
+    if ((r = process_all(monitor, devs, count, HS_DEVICE_STATUS_ONLINE, "Add")) < 0)
+        goto cleanup;
+    if ((r = process_all(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED, "Remove")) < 0)
+        goto cleanup;
+    if ((r = process_all(monitor, devs, count, HS_DEVICE_STATUS_ONLINE, "Reconnect")) < 0)
+        goto cleanup;
+
+    // Plug different boards in the same ports, the old ones get dropped
+    if ((r = process_all(monitor, devs, count, HS_DEVICE_STATUS_DISCONNECTED, "Unplug")) < 0)
+        goto cleanup;
+    for (unsigned int i = 0; i < count; i++) {
+        hs_device_unref(devs[i]);
+        devs[i] = make_device(i, count + i);
+        if (!devs[i]) {
+            r = ty_error(TY_ERROR_MEMORY, NULL);
+            goto cleanup;
+        }
+    }
+    if ((r = process_all(monitor, devs, count, HS_DEVICE_STATUS_ONLINE, "Replace")) < 0)
+        goto cleanup;
+
+    r = 0;
+cleanup:
+    ty_monitor_free(monitor);
+    if (devs) {
+        for (unsigned int i = 0; i < count; i++)
+            hs_device_unref(devs[i]);
+    }
+    free(devs);
+    return !!r;
+}
@@ -0,0 +1,197 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+/* Writes a synthetic event file in which many Teensy 3.2 boards (500 by default) reboot to
+   the bootloader and back at the same time, like a batch upload on a big hub. Replay it with
+   TYTOOLS_REPLAY=file (and TYTOOLS_REPLAY_SPEED) in tycmd or TyCommander, or with
+   "bench_monitor --replay file". The output only depends on the arguments. */
+
+#include "../../src/libty/common.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/replay_priv.h"
+
+struct board {
+    hs_device serial;
+    hs_device halfkay;
+};
+
+struct event {
+    uint64_t time;
+    size_t seq;
+    hs_device *dev;
+    hs_device_status status;
+};
+
+static uint32_t rand_state = 42;
+
+static unsigned int rand_range(unsigned int min, unsigned int max)
+{
+    // xorshift32, we want the same file on every platform
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+
+    return min + rand_state % (max - min + 1);
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    const struct event *event1 = a;
+    const struct event *event2 = b;
+
+    if (event1->time != event2->time)
+        return event1->time < event2->time ? -1 : 1;
+    return event1->seq < event2->seq ? -1 : (event1->seq > event2->seq);
+}
+
+static void init_board(struct board *board, unsigned int idx)
+{
+    char buf[64];
+
+    // Seven boards per hub, like the common cheap USB hubs
+    snprintf(buf, sizeof(buf), "usb-1-%u-%u", idx / 7 + 1, idx % 7 + 1);
+    board->serial.location = strdup(buf);
+    board->halfkay.location = strdup(buf);
+
+    snprintf(buf, sizeof(buf), "/sim/%u/tty/ttyACM%u", idx, idx);
+    board->serial.key = strdup(buf);
+    snprintf(buf, sizeof(buf), "/dev/ttyACM%u", idx);
+    board->serial.path = strdup(buf);
+    board->serial.type = HS_DEVICE_TYPE_SERIAL;
+    board->serial.vid = 0x16C0;
+    board->serial.pid = 0x483;
+    board->serial.bcd_device = 0x275;
+    board->serial.manufacturer_string = strdup("Teensyduino");
+    board->serial.product_string = strdup("USB Serial");
+    snprintf(buf, sizeof(buf), "%u", (100000 + idx) * 10);
+    board->serial.serial_number_string = strdup(buf);
+
+    snprintf(buf, sizeof(buf), "/sim/%u/hidraw/hidraw%u", idx, idx);
+    board->halfkay.key = strdup(buf);
+    snprintf(buf, sizeof(buf), "/dev/hidraw%u", idx);
+    board->halfkay.path = strdup(buf);
+    board->halfkay.type = HS_DEVICE_TYPE_HID;
+    board->halfkay.vid = 0x16C0;
+    board->halfkay.pid = 0x478;
+    board->halfkay.bcd_device = 0x105;
+    board->halfkay.u.hid.usage_page = 0xFF9C;
+    board->halfkay.u.hid.usage = 0x21;
+    snprintf(buf, sizeof(buf), "%08X", 100000 + idx);
+    board->halfkay.serial_number_string = strdup(buf);
+}
+
+static void release_device(hs_device *dev)
+{
+    free(dev->key);
+    free(dev->location);
+    free(dev->path);
+    free(dev->manufacturer_string);
+    free(dev->product_string);
+    free(dev->serial_number_string);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename;
+    unsigned int boards_count = 500, cycles = 3;
+    struct board *boards = NULL;
+    struct event *events = NULL;
+    size_t events_count = 0;
+    FILE *fp = NULL;
+    int r;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [boards] [cycles]\n", argv[0]);
+        return 1;
+    }
+    filename = argv[1];
+    if (argc > 2)
+        boards_count = (unsigned int)strtoul(argv[2], NULL, 10);
+    if (argc > 3)
+        cycles = (unsigned int)strtoul(argv[3], NULL, 10);
+    if (!boards_count || boards_count > 100000) {
+        fprintf(stderr, "The number of boards must be between 1 and 100000\n");
+        return 1;
+    }
+
+    boards = calloc(boards_count, sizeof(*boards));
+    events = calloc(boards_count * (1 + 4 * (size_t)cycles), sizeof(*events));
+    if (!boards || !events) {
+        r = ty_error(TY_ERROR_MEMORY, NULL);
+        goto cleanup;
+    }
+    for (unsigned int i = 0; i < boards_count; i++)
+        init_board(&boards[i], i);
+
+#define ADD_EVENT(Time, Dev, Status) \
+        do { \
+            struct event *event = &events[events_count]; \
+            event->time = (Time); \
+            event->seq = events_count++; \
+            event->dev = (Dev); \
+            event->status = (Status); \
+        } while (0)
+
+    // All the boards are there when the monitor starts
+    for (unsigned int i = 0; i < boards_count; i++)
+        ADD_EVENT(0, &boards[i].serial, HS_DEVICE_STATUS_ONLINE);
+
+    // Reboot everything at once, upload, and go back to the sketch
+    for (unsigned int i = 0; i < cycles; i++) {
+        uint64_t base = 2000 + (uint64_t)i * 8000;
+
+        for (unsigned int j = 0; j < boards_count; j++) {
+            uint64_t time = base + rand_range(0, 500);
+
+            ADD_EVENT(time, &boards[j].serial, HS_DEVICE_STATUS_DISCONNECTED);
+            time += rand_range(150, 400);
+            ADD_EVENT(time, &boards[j].halfkay, HS_DEVICE_STATUS_ONLINE);
+            time += rand_range(800, 2500);
+            ADD_EVENT(time, &boards[j].halfkay, HS_DEVICE_STATUS_DISCONNECTED);
+            time += rand_range(300, 800);
+            ADD_EVENT(time, &boards[j].serial, HS_DEVICE_STATUS_ONLINE);
+        }
+    }
+
+#undef ADD_EVENT
+
+    qsort(events, events_count, sizeof(*events), compare_events);
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        r = ty_error(TY_ERROR_IO, "Cannot open '%s': %s", filename, strerror(errno));
+        goto cleanup;
+    }
+    r = _hs_replay_write_header(fp);
+    if (r < 0)
+        goto cleanup;
+    for (size_t i = 0; i < events_count; i++) {
+        events[i].dev->status = events[i].status;
+        r = _hs_replay_write_event(fp, events[i].time, events[i].dev);
+        if (r < 0)
+            goto cleanup;
+    }
+
+    printf("Wrote %zu events for %u boards to '%s'\n", events_count, boards_count, filename);
+
+    r = 0;
+cleanup:
+    if (fp)
+        fclose(fp);
+    if (boards) {
+        for (unsigned int i = 0; i < boards_count; i++) {
+            release_device(&boards[i].serial);
+            release_device(&boards[i].halfkay);
+        }
+    }
+    free(boards);
+    free(events);
+    return !!r;
+}
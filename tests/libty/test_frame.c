@@ -0,0 +1,181 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/frame.h"
+
+struct collect_context {
+    uint8_t buf[256];
+    size_t len;
+    unsigned int count;
+};
+
+static int collect_frame(const uint8_t *frame, size_t len, void *udata)
+{
+    struct collect_context *ctx = udata;
+
+    if (ctx->len + len > sizeof(ctx->buf))
+        return -1;
+    memcpy(ctx->buf + ctx->len, frame, len);
+    ctx->len += len;
+    ctx->count++;
+
+    return 0;
+}
+
+static void test_frame_crc(void)
+{
+    ASSERT(ty_crc16("123456789", 9) == 0x29B1);
+    ASSERT(ty_crc32("123456789", 9) == 0xCBF43926);
+    ASSERT(ty_crc16("", 0) == 0xFFFF);
+    ASSERT(ty_crc32("", 0) == 0);
+}
+
+static void test_frame_cobs(void)
+{
+    {
+        static const uint8_t data[] = {0x03, 0x11, 0x22, 0x02, 0x33, 0x00, 0x01, 0x01, 0x00};
+        static const uint8_t expected[] = {0x11, 0x22, 0x00, 0x33, 0x00};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+        int r;
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_NONE, 64);
+        r = ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(!r);
+        ASSERT(ctx.count == 2);
+        ASSERT(ctx.len == sizeof(expected) && !memcmp(ctx.buf, expected, sizeof(expected)));
+        ASSERT(decoder.valid_count == 2 && !decoder.invalid_count);
+
+        ty_frame_decoder_release(&decoder);
+    }
+
+    // Frames split across reads, with empty frames in between
+    {
+        static const uint8_t data[] = {0x00, 0x00, 0x03, 0x11, 0x22, 0x02, 0x33, 0x00};
+        static const uint8_t expected[] = {0x11, 0x22, 0x00, 0x33};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_NONE, 64);
+        for (size_t i = 0; i < sizeof(data); i++)
+            ty_frame_decoder_process(&decoder, data + i, 1, collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(ctx.len == sizeof(expected) && !memcmp(ctx.buf, expected, sizeof(expected)));
+        ASSERT(decoder.valid_count == 1 && !decoder.invalid_count);
+
+        ty_frame_decoder_release(&decoder);
+    }
+
+    // Encoded empty frames are ignored too, with or without a check
+    {
+        static const uint8_t data[] = {0x01, 0x00, 0x02, 0x44, 0x00, 0x01, 0x00};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_NONE, 64);
+        ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(ctx.len == 1 && ctx.buf[0] == 0x44);
+        ASSERT(decoder.valid_count == 1 && !decoder.invalid_count);
+
+        ty_frame_decoder_release(&decoder);
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_CRC16, 64);
+        ty_frame_decoder_process(&decoder, data, 2, collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(!decoder.valid_count && !decoder.invalid_count);
+
+        ty_frame_decoder_release(&decoder);
+    }
+
+    // Truncated block and oversized frame
+    {
+        static const uint8_t data[] = {0x05, 0x11, 0x22, 0x00, 0x06, 0x01, 0x02, 0x03, 0x04, 0x05, 0x00,
+                                       0x02, 0x44, 0x00};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_NONE, 4);
+        ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(ctx.len == 1 && ctx.buf[0] == 0x44);
+        ASSERT(decoder.valid_count == 1 && decoder.invalid_count == 2);
+
+        ty_frame_decoder_release(&decoder);
+    }
+}
+
+static void test_frame_slip(void)
+{
+    {
+        static const uint8_t data[] = {0xC0, 0x01, 0xDB, 0xDC, 0xDB, 0xDD, 0x02, 0xC0, 0xC0,
+                                       0x03, 0xDB, 0x04, 0xC0, 0x05, 0xC0};
+        static const uint8_t expected[] = {0x01, 0xC0, 0xDB, 0x02, 0x05};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_SLIP, TY_FRAME_CHECK_NONE, 64);
+        ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(ctx.count == 2);
+        ASSERT(ctx.len == sizeof(expected) && !memcmp(ctx.buf, expected, sizeof(expected)));
+        ASSERT(decoder.valid_count == 2 && decoder.invalid_count == 1);
+
+        ty_frame_decoder_release(&decoder);
+    }
+}
+
+static void test_frame_check(void)
+{
+    {
+        static const uint8_t data[] = {0x04, 0x41, 0x15, 0xB9, 0x00, 0x04, 0x41, 0x15, 0xBA, 0x00};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_COBS, TY_FRAME_CHECK_CRC16, 16);
+        ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(ctx.len == 1 && ctx.buf[0] == 0x41);
+        ASSERT(decoder.valid_count == 1 && decoder.invalid_count == 1);
+
+        ty_frame_decoder_release(&decoder);
+    }
+
+    {
+        static const uint8_t data[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9',
+                                       0x26, 0x39, 0xF4, 0xCB, 0xC0, 0x26, 0x39, 0xC0};
+        ty_frame_decoder decoder;
+        struct collect_context ctx = {0};
+
+        ty_frame_decoder_init(&decoder, TY_FRAME_ENCODING_SLIP, TY_FRAME_CHECK_CRC32, 16);
+        ty_frame_decoder_process(&decoder, data, sizeof(data), collect_frame, &ctx);
+
+        ASSERT(ctx.count == 1);
+        ASSERT(ctx.len == 9 && !memcmp(ctx.buf, "123456789", 9));
+        ASSERT(decoder.valid_count == 1 && decoder.invalid_count == 1);
+
+        ty_frame_decoder_release(&decoder);
+    }
+}
+
+void test_frame(void)
+{
+    test_frame_crc();
+    test_frame_cobs();
+    test_frame_slip();
+    test_frame_check();
+}
@@ -0,0 +1,173 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/htable.h"
+
+#define NODE_COUNT 1000
+
+struct node {
+    _hs_htable_head hnode;
+    unsigned int value;
+};
+
+static unsigned int count_nodes(_hs_htable *table)
+{
+    unsigned int count = 0;
+    _hs_htable_foreach(cur, table)
+        count++;
+
+    return count;
+}
+
+static struct node *find_node(_hs_htable *table, unsigned int value)
+{
+    _hs_htable_foreach_hash(cur, table, value) {
+        struct node *node = ty_container_of(cur, struct node, hnode);
+
+        if (node->value == value)
+            return node;
+    }
+
+    return NULL;
+}
+
+static void test_htable_grow(void)
+{
+    static struct node nodes[NODE_COUNT];
+    _hs_htable table;
+    bool found = true;
+    int r;
+
+    r = _hs_htable_init(&table, 4);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    // Look up old nodes as the table grows, some of them are still in the old buckets
+    for (unsigned int i = 0; i < NODE_COUNT; i++) {
+        nodes[i].value = i;
+        _hs_htable_add(&table, i, &nodes[i].hnode);
+
+        found &= (find_node(&table, i / 2) == &nodes[i / 2]);
+    }
+    ASSERT(found);
+    ASSERT(table.count == NODE_COUNT);
+    ASSERT(table.size >= NODE_COUNT / 2);
+    ASSERT(count_nodes(&table) == NODE_COUNT);
+    ASSERT(!table.old_heads);
+
+    _hs_htable_release(&table);
+}
+
+static void test_htable_lookup(void)
+{
+    static struct node nodes[NODE_COUNT];
+    _hs_htable table;
+    bool found = true;
+    int r;
+
+    r = _hs_htable_init(&table, 64);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    // Stop right after the table starts to grow, with most nodes still in the old buckets
+    for (unsigned int i = 0; i < 65; i++) {
+        nodes[i].value = i;
+        _hs_htable_add(&table, i, &nodes[i].hnode);
+    }
+    ASSERT(table.old_heads);
+
+    // Lookups must find everything without moving anything, other threads may be reading
+    {
+        _hs_htable_head *old_heads = table.old_heads;
+        unsigned int rehash_idx = table.rehash_idx;
+
+        for (unsigned int i = 0; i < 65; i++)
+            found &= (find_node(&table, i) == &nodes[i]);
+        found &= !find_node(&table, 65) && !find_node(&table, 65 + 64);
+
+        ASSERT(found);
+        ASSERT(table.old_heads == old_heads && table.rehash_idx == rehash_idx);
+    }
+
+    /* Key 10 now has a node in the new bucket and another in the old one, a break must
+       end the lookup before it gets to the old bucket. */
+    {
+        struct node extra = {.value = 10};
+        unsigned int visited = 0;
+
+        _hs_htable_add(&table, 10, &extra.hnode);
+        ASSERT(table.old_heads);
+
+        _hs_htable_foreach_hash(cur, &table, 10)
+            visited++;
+        ASSERT(visited == 2);
+
+        visited = 0;
+        _hs_htable_foreach_hash(cur, &table, 10) {
+            visited++;
+            break;
+        }
+        ASSERT(visited == 1);
+    }
+
+    _hs_htable_release(&table);
+}
+
+static void test_htable_remove(void)
+{
+    static struct node nodes[NODE_COUNT];
+    _hs_htable table;
+    bool found = true;
+    unsigned int removed = 0;
+    int r;
+
+    r = _hs_htable_init(&table, 64);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    // Same keys for a lot of nodes, to get long chains
+    for (unsigned int i = 0; i < NODE_COUNT; i++) {
+        nodes[i].value = i;
+        _hs_htable_add(&table, i % 16, &nodes[i].hnode);
+    }
+    for (unsigned int i = 0; i < NODE_COUNT; i += 2)
+        _hs_htable_remove(&table, &nodes[i].hnode);
+    ASSERT(table.count == NODE_COUNT / 2);
+    ASSERT(count_nodes(&table) == NODE_COUNT / 2);
+    ASSERT(!nodes[0].hnode.next && nodes[1].hnode.next);
+
+    // Removing the current node while iterating is allowed
+    _hs_htable_foreach_hash(cur, &table, 3) {
+        struct node *node = ty_container_of(cur, struct node, hnode);
+
+        found &= (node->value % 16 == 3);
+        _hs_htable_remove(&table, cur);
+        removed++;
+    }
+    ASSERT(found && removed);
+    ASSERT(!find_node(&table, 3));
+    ASSERT(count_nodes(&table) == NODE_COUNT / 2 - removed);
+
+    _hs_htable_clear(&table);
+    ASSERT(!table.count && !count_nodes(&table));
+
+    _hs_htable_release(&table);
+}
+
+void test_htable(void)
+{
+    test_htable_grow();
+    test_htable_lookup();
+    test_htable_remove();
+}
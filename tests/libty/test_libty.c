@@ -11,7 +11,15 @@
 #include <stdarg.h>
 #include "test_libty.h"
 
+void test_frame(void);
+void test_htable(void);
+void test_monitor(void);
 void test_optline(void);
+#ifdef __linux__
+void test_sysfs(void);
+#endif
+void test_timer_queue(void);
+void test_timestamp(void);
 
 static char current_file[1024];
 static char current_fn[256];
@@ -68,7 +76,15 @@ void report_test(bool pred, const char *file, unsigned int line, const char *fn,
 
 int main(void)
 {
+    test_frame();
+    test_htable();
+    test_monitor();
     test_optline();
+#ifdef __linux__
+    test_sysfs();
+#endif
+    test_timer_queue();
+    test_timestamp();
 
     conclude_current_test();
     if (cases_failures) {
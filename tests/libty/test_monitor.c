@@ -0,0 +1,477 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libhs/replay_priv.h"
+#include "../../src/libty/board.h"
+#include "../../src/libty/class_priv.h"
+#include "../../src/libty/monitor_priv.h"
+#include "../../src/libty/system.h"
+#include "../../src/libty/thread.h"
+
+#define BOARD_COUNT 200
+
+struct list_context {
+    ty_board *boards[BOARD_COUNT * 2];
+    unsigned int count;
+};
+
+static hs_device *make_device(unsigned int port, const char *serial_number)
+{
+    hs_device *dev;
+    char location[32];
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return NULL;
+    dev->refcount = 1;
+
+    snprintf(location, sizeof(location), "usb-1-%u", port);
+    dev->type = HS_DEVICE_TYPE_SERIAL;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->location = strdup(location);
+    dev->path = strdup(location);
+    dev->vid = 0x1234;
+    dev->pid = 0x5678;
+    dev->serial_number_string = strdup(serial_number);
+    for (unsigned int i = 0; i < _ty_classes_count; i++) {
+        if (strcmp(_ty_classes[i].name, "Generic") == 0)
+            dev->match_udata = (void *)_ty_classes[i].vtable;
+    }
+
+    return dev;
+}
+
+static int list_board(ty_board *board, ty_monitor_event event, void *udata)
+{
+    struct list_context *ctx = udata;
+
+    TY_UNUSED(event);
+
+    if (ctx->count == TY_COUNTOF(ctx->boards))
+        return -1;
+    ctx->boards[ctx->count++] = board;
+
+    return 0;
+}
+
+static void test_monitor_index(void)
+{
+    ty_monitor *monitor = NULL;
+    hs_device *devs[BOARD_COUNT] = {0};
+    ty_board *board42, *board;
+    struct list_context ctx;
+    char serial_number[32];
+    int r;
+
+    r = ty_monitor_new(&monitor);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    for (unsigned int i = 0; i < BOARD_COUNT; i++) {
+        snprintf(serial_number, sizeof(serial_number), "SN%u", i);
+        devs[i] = make_device(i, serial_number);
+        ASSERT(devs[i] && !_ty_monitor_process_device(monitor, devs[i]));
+    }
+
+    ctx.count = 0;
+    ty_monitor_list(monitor, list_board, &ctx);
+    ASSERT(ctx.count == BOARD_COUNT);
+    ASSERT_STR_EQUAL(ty_board_get_location(ctx.boards[0]), "usb-1-0");
+    ASSERT_STR_EQUAL(ty_board_get_location(ctx.boards[BOARD_COUNT - 1]), "usb-1-199");
+
+    board42 = ty_monitor_find_board(monitor, "SN42");
+    ASSERT(board42 && strcmp(ty_board_get_location(board42), "usb-1-42") == 0);
+    ASSERT(!ty_monitor_find_board(monitor, "SN1000"));
+
+    // Missing boards are still indexed, and come back in place
+    for (unsigned int i = 0; i < BOARD_COUNT; i += 2) {
+        devs[i]->status = HS_DEVICE_STATUS_DISCONNECTED;
+        ASSERT(!_ty_monitor_process_device(monitor, devs[i]));
+    }
+    ctx.count = 0;
+    ty_monitor_list(monitor, list_board, &ctx);
+    ASSERT(ctx.count == BOARD_COUNT / 2);
+    board = ty_monitor_find_board(monitor, "SN42");
+    ASSERT(board == board42);
+    ty_board_unref(board);
+    ASSERT(ty_board_get_status(board42) == TY_BOARD_STATUS_MISSING);
+
+    for (unsigned int i = 0; i < BOARD_COUNT; i += 2) {
+        devs[i]->status = HS_DEVICE_STATUS_ONLINE;
+        ASSERT(!_ty_monitor_process_device(monitor, devs[i]));
+    }
+    ctx.count = 0;
+    ty_monitor_list(monitor, list_board, &ctx);
+    ASSERT(ctx.count == BOARD_COUNT);
+    ASSERT(ctx.boards[42] == board42);
+    ASSERT(ty_board_get_status(board42) == TY_BOARD_STATUS_ONLINE);
+
+    /* Plugging another board in the same port drops the old one, the new boards go at
+       the end of the list, after the ones that did not change. */
+    for (unsigned int i = 0; i < BOARD_COUNT; i += 2) {
+        devs[i]->status = HS_DEVICE_STATUS_DISCONNECTED;
+        _ty_monitor_process_device(monitor, devs[i]);
+        hs_device_unref(devs[i]);
+
+        snprintf(serial_number, sizeof(serial_number), "SN%u", BOARD_COUNT + i);
+        devs[i] = make_device(i, serial_number);
+        ASSERT(devs[i] && !_ty_monitor_process_device(monitor, devs[i]));
+    }
+    ctx.count = 0;
+    ty_monitor_list(monitor, list_board, &ctx);
+    ASSERT(ctx.count == BOARD_COUNT);
+    ASSERT_STR_EQUAL(ty_board_get_location(ctx.boards[0]), "usb-1-1");
+    ASSERT_STR_EQUAL(ty_board_get_location(ctx.boards[BOARD_COUNT / 2]), "usb-1-0");
+
+    // Our reference keeps the dropped board alive, but the index forgets it
+    ASSERT(ty_board_get_status(board42) == TY_BOARD_STATUS_DROPPED);
+    ty_board_unref(board42);
+    ASSERT(!ty_monitor_find_board(monitor, "SN42"));
+    board42 = ty_monitor_find_board(monitor, "SN242");
+    ASSERT(board42 && strcmp(ty_board_get_location(board42), "usb-1-42") == 0);
+    ty_board_unref(board42);
+
+    ty_monitor_free(monitor);
+    for (unsigned int i = 0; i < BOARD_COUNT; i++)
+        hs_device_unref(devs[i]);
+}
+
+static hs_device *make_teensy_device(hs_device_type type, const char *location,
+                                     const char *serial_number, const char *product)
+{
+    hs_device *dev;
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return NULL;
+    dev->refcount = 1;
+
+    dev->type = type;
+    dev->status = HS_DEVICE_STATUS_ONLINE;
+    dev->location = strdup(location);
+    dev->key = strdup(serial_number);
+    dev->path = strdup(location);
+    dev->vid = 0x16C0;
+    if (type == HS_DEVICE_TYPE_HID) {
+        dev->pid = 0x478;
+        dev->u.hid.usage_page = 0xFF9C;
+        dev->u.hid.usage = 0x21;
+    } else {
+        dev->pid = 0x483;
+        dev->bcd_device = 0x275;
+    }
+    dev->product_string = product ? strdup(product) : NULL;
+    dev->serial_number_string = strdup(serial_number);
+
+    return dev;
+}
+
+static bool write_replay_file(const char *filename)
+{
+    hs_device *devs[3] = {
+        make_teensy_device(HS_DEVICE_TYPE_SERIAL, "usb-1-1", "4242420", "USB Serial 100%"),
+        make_teensy_device(HS_DEVICE_TYPE_HID, "usb-1-2", "00067933", NULL),
+        make_teensy_device(HS_DEVICE_TYPE_HID, "usb-1-3", "0006793A", "-")
+    };
+    FILE *fp;
+    bool success = false;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(devs); i++) {
+        if (!devs[i])
+            goto cleanup;
+    }
+    // Not a Teensy (and not a serial device either), the replay must skip it
+    devs[2]->vid = 0x1234;
+
+    fp = fopen(filename, "w");
+    if (!fp)
+        goto cleanup;
+    success = !_hs_replay_write_header(fp) &&
+              !_hs_replay_write_event(fp, 1000, devs[0]) &&
+              !_hs_replay_write_event(fp, 1000, devs[1]) &&
+              !_hs_replay_write_event(fp, 1010, devs[2]);
+    devs[0]->status = HS_DEVICE_STATUS_DISCONNECTED;
+    success &= !_hs_replay_write_event(fp, 1500, devs[0]);
+    fclose(fp);
+
+cleanup:
+    for (unsigned int i = 0; i < TY_COUNTOF(devs); i++)
+        hs_device_unref(devs[i]);
+    return success;
+}
+
+static void test_monitor_replay(void)
+{
+    const char *filename = "test_replay.events";
+    FILE *fp;
+    uint64_t time;
+    hs_device *dev = NULL;
+    ty_monitor *monitor = NULL;
+    ty_board *board;
+    int r;
+
+    ASSERT(write_replay_file(filename));
+
+    fp = fopen(filename, "r");
+    ASSERT(fp);
+    if (!fp)
+        return;
+    ASSERT(!_hs_replay_read_header(fp));
+    r = _hs_replay_read_event(fp, &time, &dev);
+    ASSERT(r == 1);
+    if (r == 1) {
+        ASSERT(time == 1000);
+        ASSERT(dev->status == HS_DEVICE_STATUS_ONLINE && dev->type == HS_DEVICE_TYPE_SERIAL);
+        ASSERT(dev->vid == 0x16C0 && dev->pid == 0x483 && dev->bcd_device == 0x275);
+        ASSERT_STR_EQUAL(dev->location, "usb-1-1");
+        ASSERT_STR_EQUAL(dev->product_string, "USB Serial 100%");
+        ASSERT(!dev->manufacturer_string);
+        hs_device_unref(dev);
+    }
+    r = _hs_replay_read_event(fp, &time, &dev);
+    ASSERT(r == 1);
+    if (r == 1) {
+        ASSERT(dev->type == HS_DEVICE_TYPE_HID);
+        ASSERT(dev->u.hid.usage_page == 0xFF9C && dev->u.hid.usage == 0x21);
+        hs_device_unref(dev);
+    }
+    r = _hs_replay_read_event(fp, &time, &dev);
+    ASSERT(r == 1);
+    if (r == 1) {
+        ASSERT_STR_EQUAL(dev->product_string, "-");
+        hs_device_unref(dev);
+    }
+    r = _hs_replay_read_event(fp, &time, &dev);
+    ASSERT(r == 1 && time == 1500 && dev->status == HS_DEVICE_STATUS_DISCONNECTED);
+    if (r == 1)
+        hs_device_unref(dev);
+    ASSERT(!_hs_replay_read_event(fp, &time, &dev));
+    fclose(fp);
+
+    // Replay everything at once, the first board is gone by the end
+    r = ty_monitor_new(&monitor);
+    ASSERT(!r);
+    if (!r) {
+        ASSERT(!ty_monitor_set_replay(monitor, filename, 0.0));
+        ASSERT(!ty_monitor_start(monitor));
+
+        board = ty_monitor_find_board(monitor, "4242420");
+        ASSERT(board && ty_board_get_status(board) == TY_BOARD_STATUS_MISSING);
+        ty_board_unref(board);
+        board = ty_monitor_find_board(monitor, "4242430");
+        ASSERT(board && ty_board_get_status(board) == TY_BOARD_STATUS_ONLINE);
+        ASSERT(board && ty_board_has_capability(board, TY_BOARD_CAPABILITY_UPLOAD));
+        ty_board_unref(board);
+        ASSERT(!ty_monitor_find_board(monitor, "4242500"));
+    }
+    ty_monitor_free(monitor);
+
+    remove(filename);
+}
+
+struct batch_context {
+    unsigned int calls;
+    unsigned int events;
+    ty_monitor_change changes[4];
+    unsigned int count;
+};
+
+static int count_event(ty_board *board, ty_monitor_event event, void *udata)
+{
+    struct batch_context *ctx = udata;
+
+    TY_UNUSED(board);
+    TY_UNUSED(event);
+
+    ctx->events++;
+    return 0;
+}
+
+static int store_batch(const ty_monitor_change *changes, unsigned int count, void *udata)
+{
+    struct batch_context *ctx = udata;
+
+    ctx->calls++;
+    ctx->count = 0;
+    for (unsigned int i = 0; i < count && i < TY_COUNTOF(ctx->changes); i++)
+        ctx->changes[ctx->count++] = changes[i];
+
+    return 0;
+}
+
+static void test_monitor_batch(void)
+{
+    const char *filename = "test_batch.events";
+    ty_monitor *monitor = NULL;
+    struct batch_context ctx = {0};
+    int r;
+
+    ASSERT(write_replay_file(filename));
+
+    r = ty_monitor_new(&monitor);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    ASSERT(!ty_monitor_set_replay(monitor, filename, 0.0));
+    ASSERT(!ty_monitor_register_callback(monitor, count_event, &ctx));
+    ASSERT(!ty_monitor_register_batch_callback(monitor, store_batch, &ctx));
+
+    /* Both boards show up, and the first one disappears, in the same refresh. The batch
+       has one ADDED change per board, in order. */
+    ASSERT(!ty_monitor_start(monitor));
+    ASSERT(ctx.events == 3);
+    ASSERT(ctx.calls == 1 && ctx.count == 2);
+    if (ctx.count == 2) {
+        ASSERT(ctx.changes[0].event == TY_MONITOR_EVENT_ADDED);
+        ASSERT_STR_EQUAL(ty_board_get_location(ctx.changes[0].board), "usb-1-1");
+        ASSERT(ty_board_get_status(ctx.changes[0].board) == TY_BOARD_STATUS_MISSING);
+        ASSERT(ctx.changes[1].event == TY_MONITOR_EVENT_ADDED);
+        ASSERT_STR_EQUAL(ty_board_get_location(ctx.changes[1].board), "usb-1-2");
+    }
+
+    // Nothing happened since, no batch
+    ASSERT(!ty_monitor_refresh(monitor));
+    ASSERT(ctx.calls == 1);
+
+cleanup:
+    ty_monitor_free(monitor);
+    remove(filename);
+}
+
+static int count_disappeared(ty_board *board, ty_monitor_event event, void *udata)
+{
+    unsigned int *count = udata;
+
+    TY_UNUSED(board);
+
+    *count += (event == TY_MONITOR_EVENT_DISAPPEARED);
+    return 0;
+}
+
+static void test_monitor_threaded(void)
+{
+    const char *filename = "test_threaded.events";
+    ty_monitor *monitor = NULL;
+    ty_board *board = NULL;
+    unsigned int disappeared = 0;
+    int r;
+
+    ASSERT(write_replay_file(filename));
+
+    r = ty_monitor_new(&monitor);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    // The first board goes away 100 ms after the start
+    ASSERT(!ty_monitor_set_replay(monitor, filename, 5.0));
+    ASSERT(!ty_monitor_set_threaded(monitor, true));
+    ASSERT(!ty_monitor_register_callback(monitor, count_disappeared, &disappeared));
+    ASSERT(!ty_monitor_start(monitor));
+
+    board = ty_monitor_find_board(monitor, "4242420");
+    ASSERT(board);
+    if (!board)
+        goto cleanup;
+
+    // The hotplug thread processes the removal, but callbacks wait for ty_monitor_refresh()
+    ty_delay(300);
+    ASSERT(!disappeared);
+    ASSERT(!ty_monitor_refresh(monitor));
+    ASSERT(disappeared == 1);
+    ASSERT(ty_board_get_status(board) == TY_BOARD_STATUS_MISSING);
+
+cleanup:
+    ty_board_unref(board);
+    ty_monitor_free(monitor);
+    remove(filename);
+}
+
+struct wait_context {
+    ty_board *board;
+    int ret;
+};
+
+static int wait_serial_thread(void *udata)
+{
+    struct wait_context *ctx = udata;
+
+    ctx->ret = ty_board_wait_for(ctx->board, TY_BOARD_CAPABILITY_SERIAL, 5000);
+    return 0;
+}
+
+static void test_monitor_wait_board(void)
+{
+    ty_monitor *monitor = NULL;
+    hs_device *devs[8] = {0};
+    struct wait_context ctx = {0};
+    ty_thread thread;
+    _ty_monitor_wait_stats stats;
+    char serial_number[32];
+    int r;
+
+    r = ty_monitor_new(&monitor);
+    ASSERT(!r);
+    if (r < 0)
+        return;
+
+    for (unsigned int i = 0; i < TY_COUNTOF(devs); i++) {
+        snprintf(serial_number, sizeof(serial_number), "SN%u", i);
+        devs[i] = make_device(i, serial_number);
+        ASSERT(devs[i] && !_ty_monitor_process_device(monitor, devs[i]));
+    }
+    ctx.board = ty_monitor_find_board(monitor, "SN0");
+    ASSERT(ctx.board);
+    if (!ctx.board)
+        goto cleanup;
+
+    devs[0]->status = HS_DEVICE_STATUS_DISCONNECTED;
+    ASSERT(!_ty_monitor_process_device(monitor, devs[0]));
+
+    r = ty_thread_create(&thread, wait_serial_thread, &ctx);
+    ASSERT(!r);
+    if (r < 0)
+        goto cleanup;
+    ty_delay(100);
+
+    // Other boards come and go, this must not wake up the waiter
+    for (unsigned int i = 0; i < 20; i++) {
+        hs_device *dev = devs[1 + i % (TY_COUNTOF(devs) - 1)];
+
+        dev->status = HS_DEVICE_STATUS_DISCONNECTED;
+        _ty_monitor_process_device(monitor, dev);
+        dev->status = HS_DEVICE_STATUS_ONLINE;
+        _ty_monitor_process_device(monitor, dev);
+    }
+
+    devs[0]->status = HS_DEVICE_STATUS_ONLINE;
+    ASSERT(!_ty_monitor_process_device(monitor, devs[0]));
+    ty_thread_join(&thread);
+    ASSERT(ctx.ret == 1);
+
+    _ty_monitor_get_wait_stats(monitor, &stats);
+    ASSERT(stats.wakeups <= 1 && !stats.useless_wakeups);
+
+cleanup:
+    ty_board_unref(ctx.board);
+    ty_monitor_free(monitor);
+    for (unsigned int i = 0; i < TY_COUNTOF(devs); i++)
+        hs_device_unref(devs[i]);
+}
+
+void test_monitor(void)
+{
+    test_monitor_index();
+    test_monitor_replay();
+    test_monitor_batch();
+    test_monitor_threaded();
+    test_monitor_wait_board();
+}
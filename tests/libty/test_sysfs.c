@@ -0,0 +1,318 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#define _XOPEN_SOURCE 700
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "test_libty.h"
+#include "../../src/libhs/device.h"
+#include "../../src/libhs/sysfs_priv.h"
+
+#define USB_ROOT "/devices/pci0000:00/0000:00:14.0/usb1"
+
+struct list_context {
+    char devpaths[8][_HS_SYSFS_PATH_SIZE];
+    unsigned int count;
+};
+
+static size_t decode_escapes(const char *str, char *buf, size_t size)
+{
+    size_t len = 0;
+
+    while (*str && len < size) {
+        if (str[0] == '\\' && str[1] == 'n') {
+            buf[len++] = '\n';
+            str += 2;
+        } else if (str[0] == '\\' && str[1] == '0') {
+            buf[len++] = 0;
+            str += 2;
+        } else if (str[0] == '\\' && str[1] == 'x' && str[2] && str[3]) {
+            char hex[3] = {str[2], str[3], 0};
+            buf[len++] = (char)strtoul(hex, NULL, 16);
+            str += 4;
+        } else {
+            buf[len++] = *str++;
+        }
+    }
+
+    return len;
+}
+
+static bool make_parent_dirs(char *path)
+{
+    for (char *ptr = strchr(path + 1, '/'); ptr; ptr = strchr(ptr + 1, '/')) {
+        *ptr = 0;
+        int r = mkdir(path, 0755);
+        *ptr = '/';
+        if (r < 0 && errno != EEXIST)
+            return false;
+    }
+
+    return true;
+}
+
+// Creates the tree described in fixtures/sysfs.txt in dir
+static bool build_fixture(const char *dir)
+{
+    FILE *fp;
+    char line[2048];
+    bool success = true;
+
+    fp = fopen(TEST_FIXTURES_DIR "/sysfs.txt", "r");
+    if (!fp)
+        return false;
+
+    while (success && fgets(line, sizeof(line), fp)) {
+        char directive[8], rel_path[1024], path[2048];
+        const char *arg = "";
+        int offset = 0;
+
+        line[strcspn(line, "\n")] = 0;
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        if (sscanf(line, "%7s %1023s%n", directive, rel_path, &offset) < 2) {
+            success = false;
+            break;
+        }
+        if (line[offset] == ' ')
+            arg = line + offset + 1;
+        snprintf(path, sizeof(path), "%s/%s", dir, rel_path);
+        if (!make_parent_dirs(path)) {
+            success = false;
+            break;
+        }
+
+        if (strcmp(directive, "link") == 0) {
+            success = !symlink(arg, path);
+        } else {
+            char content[1024];
+            size_t len = 0;
+            FILE *out;
+
+            if (strcmp(directive, "file") == 0) {
+                len = decode_escapes(arg, content, sizeof(content) - 1);
+                content[len++] = '\n';
+            } else if (strcmp(directive, "data") == 0) {
+                len = decode_escapes(arg, content, sizeof(content));
+            } else if (strcmp(directive, "node") != 0) {
+                success = false;
+                break;
+            }
+
+            out = fopen(path, "wb");
+            success = out && fwrite(content, 1, len, out) == len;
+            if (out)
+                fclose(out);
+        }
+    }
+
+    fclose(fp);
+    return success;
+}
+
+static int remove_fixture_file(const char *path, const struct stat *sb, int type, struct FTW *ftw)
+{
+    TY_UNUSED(sb);
+    TY_UNUSED(type);
+    TY_UNUSED(ftw);
+
+    return remove(path);
+}
+
+static int list_devpath(const char *devpath, void *udata)
+{
+    struct list_context *ctx = udata;
+
+    if (ctx->count == TY_COUNTOF(ctx->devpaths))
+        return -1;
+    snprintf(ctx->devpaths[ctx->count++], sizeof(ctx->devpaths[0]), "%s", devpath);
+
+    return 0;
+}
+
+static bool has_devpath(const struct list_context *ctx, const char *devpath)
+{
+    for (unsigned int i = 0; i < ctx->count; i++) {
+        if (strcmp(ctx->devpaths[i], devpath) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+static int read_device(const _hs_sysfs_root *root, const char *devpath, hs_device_type type,
+                       _hs_sysfs_device *rsysdev, hs_device **rdev)
+{
+    hs_device *dev;
+    int r;
+
+    dev = calloc(1, sizeof(*dev));
+    if (!dev)
+        return -1;
+    dev->refcount = 1;
+
+    r = _hs_sysfs_read_device(root, devpath, type, rsysdev, dev);
+    if (r > 0 && _hs_sysfs_read_strings(root, rsysdev, dev) < 0)
+        r = -1;
+
+    if (r > 0) {
+        *rdev = dev;
+    } else {
+        hs_device_unref(dev);
+    }
+    return r;
+}
+
+static void test_sysfs_devices(const _hs_sysfs_root *root)
+{
+    struct list_context ctx = {0};
+    _hs_sysfs_device sysdev;
+    hs_device *dev;
+    char hid_path[_HS_SYSFS_PATH_SIZE];
+    int r;
+
+    r = _hs_sysfs_list(root, "tty", list_devpath, &ctx);
+    ASSERT(!r && ctx.count == 4);
+    ASSERT(has_devpath(&ctx, USB_ROOT "/1-2/1-2:1.0/tty/ttyACM0"));
+    ASSERT(has_devpath(&ctx, USB_ROOT "/1-5/1-5:1.0/tty/ttyACM1"));
+    ASSERT(has_devpath(&ctx, "/devices/virtual/tty/tty0"));
+    ASSERT(has_devpath(&ctx, "/devices/platform/serial8250/tty/ttyS0"));
+
+    ctx.count = 0;
+    r = _hs_sysfs_list(root, "hidraw", list_devpath, &ctx);
+    ASSERT(!r && ctx.count == 1);
+
+    // The class does not exist, that is not an error
+    ctx.count = 0;
+    r = _hs_sysfs_list(root, "usbmisc", list_devpath, &ctx);
+    ASSERT(!r && !ctx.count);
+
+    r = read_device(root, USB_ROOT "/1-2/1-2:1.0/tty/ttyACM0", HS_DEVICE_TYPE_SERIAL,
+                    &sysdev, &dev);
+    ASSERT(r == 1);
+    if (r == 1) {
+        char path[_HS_SYSFS_PATH_SIZE];
+
+        snprintf(path, sizeof(path), "%s/ttyACM0", root->dev_dir);
+        ASSERT_STR_EQUAL(dev->path, path);
+        ASSERT_STR_EQUAL(dev->key, USB_ROOT "/1-2/1-2:1.0/tty/ttyACM0");
+        ASSERT_STR_EQUAL(dev->location, "usb-1-2");
+        ASSERT(dev->type == HS_DEVICE_TYPE_SERIAL);
+        ASSERT(dev->vid == 0x16C0 && dev->pid == 0x483 && dev->bcd_device == 0x280);
+        ASSERT(dev->iface_number == 0);
+        ASSERT_STR_EQUAL(dev->manufacturer_string, "Teensyduino");
+        ASSERT_STR_EQUAL(dev->product_string, "USB Serial");
+        ASSERT_STR_EQUAL(dev->serial_number_string, "4242420");
+        hs_device_unref(dev);
+    }
+
+    r = read_device(root, USB_ROOT "/1-3/1-3.4/1-3.4:1.0/0003:16C0:0478.0002/hidraw/hidraw1",
+                    HS_DEVICE_TYPE_HID, &sysdev, &dev);
+    ASSERT(r == 1);
+    if (r == 1) {
+        char path[_HS_SYSFS_PATH_SIZE + 32];
+        struct stat sb;
+
+        ASSERT_STR_EQUAL(dev->location, "usb-1-3-4");
+        ASSERT(dev->type == HS_DEVICE_TYPE_HID);
+        ASSERT(dev->vid == 0x16C0 && dev->pid == 0x478 && dev->bcd_device == 0x105);
+        ASSERT(dev->manufacturer_string && !dev->product_string && !dev->serial_number_string);
+
+        ASSERT(_hs_sysfs_get_hid_path(root, &sysdev, hid_path, sizeof(hid_path)));
+        snprintf(path, sizeof(path), "%s/report_descriptor", hid_path);
+        ASSERT(!stat(path, &sb) && sb.st_size == 22);
+        hs_device_unref(dev);
+    }
+
+    // No device node, and non-USB devices
+    ASSERT(!read_device(root, USB_ROOT "/1-5/1-5:1.0/tty/ttyACM1", HS_DEVICE_TYPE_SERIAL,
+                        &sysdev, &dev));
+    ASSERT(!read_device(root, "/devices/virtual/tty/tty0", HS_DEVICE_TYPE_SERIAL, &sysdev, &dev));
+    ASSERT(!read_device(root, "/devices/platform/serial8250/tty/ttyS0", HS_DEVICE_TYPE_SERIAL,
+                        &sysdev, &dev));
+    ASSERT(!read_device(root, USB_ROOT "/1-9/1-9:1.0/tty/ttyACM9", HS_DEVICE_TYPE_SERIAL,
+                        &sysdev, &dev));
+}
+
+static void test_sysfs_tree(void)
+{
+    char dir[] = "/tmp/test_sysfs_XXXXXX";
+    char sys_dir[sizeof(dir) + 8], dev_dir[sizeof(dir) + 8];
+    _hs_sysfs_root root;
+
+    ASSERT(mkdtemp(dir));
+    snprintf(sys_dir, sizeof(sys_dir), "%s/sys", dir);
+    snprintf(dev_dir, sizeof(dev_dir), "%s/dev", dir);
+    root.sys_dir = sys_dir;
+    root.dev_dir = dev_dir;
+
+    if (build_fixture(dir)) {
+        test_sysfs_devices(&root);
+    } else {
+        ASSERT(false && "Failed to create sysfs fixture");
+    }
+
+    nftw(dir, remove_fixture_file, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void test_uevent_parse(void)
+{
+    FILE *fp;
+    char line[4096];
+    _hs_uevent events[16];
+    unsigned int total = 0, count = 0;
+
+    fp = fopen(TEST_FIXTURES_DIR "/uevents.txt", "r");
+    ASSERT(fp);
+    if (!fp)
+        return;
+
+    while (fgets(line, sizeof(line), fp) && count < TY_COUNTOF(events)) {
+        static char bufs[16][4096];
+        size_t len;
+
+        line[strcspn(line, "\n")] = 0;
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        total++;
+        len = decode_escapes(line, bufs[count], sizeof(bufs[count]));
+        if (_hs_uevent_parse(bufs[count], len, &events[count]))
+            count++;
+    }
+    fclose(fp);
+
+    // The udev message and the one without DEVPATH are rejected
+    ASSERT(total == 7 && count == 5);
+    if (count != 5)
+        return;
+
+    ASSERT_STR_EQUAL(events[0].action, "add");
+    ASSERT_STR_EQUAL(events[0].subsystem, "usb");
+    ASSERT_STR_EQUAL(events[1].devpath, USB_ROOT "/1-2/1-2:1.0/tty/ttyACM0");
+    ASSERT_STR_EQUAL(events[1].subsystem, "tty");
+    ASSERT_STR_EQUAL(events[1].devname, "ttyACM0");
+    ASSERT(events[1].seqnum == 4183);
+    ASSERT_STR_EQUAL(events[2].action, "bind");
+    ASSERT(!events[2].devname);
+    ASSERT_STR_EQUAL(events[3].subsystem, "hidraw");
+    ASSERT_STR_EQUAL(events[4].action, "remove");
+
+    // Messages must be NUL-terminated
+    ASSERT(!_hs_uevent_parse("add@/devices/foo\0ACTION=add", 27, &events[0]));
+}
+
+void test_sysfs(void)
+{
+    test_sysfs_tree();
+    test_uevent_parse();
+}
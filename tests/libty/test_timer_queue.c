@@ -0,0 +1,111 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/timer.h"
+
+#define NODE_COUNT 500
+
+static uint32_t rand_state = 1;
+
+static uint32_t next_rand(void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+
+    return rand_state;
+}
+
+// Pop everything and check that deadlines come out in order, and match the queued count
+static bool drain_in_order(ty_timer_queue *queue, size_t expected_count)
+{
+    ty_timer_queue_node *node;
+    uint64_t prev_deadline = 0;
+    size_t count = 0;
+    bool ordered = true;
+
+    while ((node = ty_timer_queue_pop(queue, UINT64_MAX))) {
+        ordered &= (node->deadline >= prev_deadline) && !ty_timer_queue_has(node);
+        prev_deadline = node->deadline;
+        count++;
+    }
+
+    return ordered && count == expected_count;
+}
+
+static void test_timer_queue_order(void)
+{
+    static ty_timer_queue_node nodes[NODE_COUNT];
+    ty_timer_queue queue = {0};
+    size_t queued = 0;
+    bool success = true;
+
+    for (unsigned int i = 0; i < NODE_COUNT; i++)
+        success &= !ty_timer_queue_add(&queue, &nodes[i], next_rand() % 10000);
+    ASSERT(success);
+    ASSERT(queue.count == NODE_COUNT);
+
+    // Move and remove nodes all over the heap
+    for (unsigned int i = 0; i < NODE_COUNT; i += 3)
+        ty_timer_queue_add(&queue, &nodes[i], next_rand() % 10000);
+    for (unsigned int i = 0; i < NODE_COUNT; i++) {
+        if (i % 5 == 1)
+            ty_timer_queue_remove(&queue, &nodes[i]);
+        queued += ty_timer_queue_has(&nodes[i]);
+    }
+    ASSERT(queue.count == queued);
+
+    // Removing a node twice is harmless
+    ty_timer_queue_remove(&queue, &nodes[1]);
+    ASSERT(queue.count == queued);
+
+    ASSERT(drain_in_order(&queue, queued));
+    ASSERT(!ty_timer_queue_peek(&queue));
+
+    ty_timer_queue_release(&queue);
+}
+
+static void test_timer_queue_timeout(void)
+{
+    ty_timer_queue_node nodes[3] = {0};
+    ty_timer_queue queue = {0};
+
+    ASSERT(ty_timer_queue_get_timeout(&queue, 1000) == -1);
+    ASSERT(!ty_timer_queue_pop(&queue, 1000));
+
+    ty_timer_queue_add(&queue, &nodes[0], 1500);
+    ty_timer_queue_add(&queue, &nodes[1], 1200);
+    ty_timer_queue_add(&queue, &nodes[2], 1800);
+    ASSERT(ty_timer_queue_peek(&queue) == &nodes[1]);
+    ASSERT(ty_timer_queue_get_timeout(&queue, 1000) == 200);
+
+    // Nothing expires before its deadline
+    ASSERT(!ty_timer_queue_pop(&queue, 1199));
+    ASSERT(ty_timer_queue_pop(&queue, 1200) == &nodes[1]);
+    ASSERT(ty_timer_queue_get_timeout(&queue, 1600) == 0);
+
+    // Moving a node later or earlier changes the first deadline
+    ty_timer_queue_add(&queue, &nodes[0], 2000);
+    ASSERT(ty_timer_queue_peek(&queue) == &nodes[2]);
+    ty_timer_queue_add(&queue, &nodes[0], 1000);
+    ASSERT(ty_timer_queue_peek(&queue) == &nodes[0]);
+
+    ty_timer_queue_clear(&queue);
+    ASSERT(!queue.count && !ty_timer_queue_has(&nodes[0]) && !ty_timer_queue_has(&nodes[2]));
+
+    ty_timer_queue_release(&queue);
+}
+
+void test_timer_queue(void)
+{
+    test_timer_queue_order();
+    test_timer_queue_timeout();
+}
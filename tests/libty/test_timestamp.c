@@ -0,0 +1,118 @@
+/* TyTools - public domain
+   Niels Martignène <niels.martignene@protonmail.com>
+   https://neodd.com/tytools
+
+   This software is in the public domain. Where that dedication is not
+   recognized, you are granted a perpetual, irrevocable license to copy,
+   distribute, and modify this file as you see fit.
+
+   See the LICENSE file for more details. */
+
+#include "test_libty.h"
+#include "../../src/libty/timestamp.h"
+
+struct collect_context {
+    uint64_t times[16];
+    size_t offsets[16];
+    unsigned int count;
+    size_t len;
+};
+
+static int collect_line(const char *buf, size_t len, uint64_t time, bool line_start, void *udata)
+{
+    struct collect_context *ctx = udata;
+
+    TY_UNUSED(buf);
+
+    if (line_start) {
+        if (ctx->count == TY_COUNTOF(ctx->times))
+            return -1;
+        ctx->times[ctx->count] = time;
+        ctx->offsets[ctx->count] = ctx->len;
+        ctx->count++;
+    }
+    ctx->len += len;
+
+    return 0;
+}
+
+static void test_timestamp_usb(void)
+{
+    ty_line_stamper stamper;
+    struct collect_context ctx = {0};
+    int r;
+
+    ty_line_stamper_init(&stamper, 0);
+
+    r = ty_line_stamper_process(&stamper, "foo\nbar\nba", 10, 1000, collect_line, &ctx);
+    ASSERT(!r);
+    r = ty_line_stamper_process(&stamper, "z\n", 2, 2000, collect_line, &ctx);
+    ASSERT(!r);
+    r = ty_line_stamper_process(&stamper, "\n", 1, 3000, collect_line, &ctx);
+    ASSERT(!r);
+
+    ASSERT(ctx.count == 4);
+    ASSERT(ctx.len == 13);
+    ASSERT(ctx.offsets[0] == 0 && ctx.times[0] == 1000);
+    ASSERT(ctx.offsets[1] == 4 && ctx.times[1] == 1000);
+    ASSERT(ctx.offsets[2] == 8 && ctx.times[2] == 1000);
+    ASSERT(ctx.offsets[3] == 12 && ctx.times[3] == 3000);
+}
+
+static void test_timestamp_usb_gap(void)
+{
+    ty_line_stamper stamper;
+    struct collect_context ctx = {0};
+    char buf[4096];
+    int r;
+
+    // A big USB read after a long silence must not be back-dated into the gap
+    memset(buf, 'x', sizeof(buf));
+    buf[sizeof(buf) - 2] = '\n';
+    buf[sizeof(buf) - 1] = 'y';
+
+    ty_line_stamper_init(&stamper, 0);
+    r = ty_line_stamper_process(&stamper, "a\n", 2, 1000, collect_line, &ctx);
+    ASSERT(!r);
+    r = ty_line_stamper_process(&stamper, buf, sizeof(buf), 5000000, collect_line, &ctx);
+    ASSERT(!r);
+
+    ASSERT(ctx.count == 3);
+    ASSERT(ctx.times[0] == 1000);
+    ASSERT(ctx.times[1] == 5000000);
+    ASSERT(ctx.offsets[2] == 2 + sizeof(buf) - 1 && ctx.times[2] == 5000000);
+}
+
+static void test_timestamp_serial(void)
+{
+    ty_line_stamper stamper;
+    struct collect_context ctx = {0};
+
+    // 100 us per byte, the second line starts 4 bytes (400 us) before the end of the read
+    ty_line_stamper_init(&stamper, 100);
+    ty_line_stamper_process(&stamper, "a\n", 2, 10000, collect_line, &ctx);
+    ty_line_stamper_process(&stamper, "abc\ndef\n", 8, 20000, collect_line, &ctx);
+
+    ASSERT(ctx.count == 3);
+    ASSERT(ctx.times[0] == 10000);
+    ASSERT(ctx.times[1] == 19200);
+    ASSERT(ctx.times[2] == 19600);
+
+    // Bytes cannot have arrived before the previous read
+    ty_line_stamper_process(&stamper, "x\ny\n", 4, 20200, collect_line, &ctx);
+    ASSERT(ctx.count == 5);
+    ASSERT(ctx.times[3] == 20000);
+    ASSERT(ctx.times[4] == 20100);
+
+    ty_line_stamper_reset(&stamper);
+    ty_line_stamper_process(&stamper, "z\n", 2, 5000, collect_line, &ctx);
+    ASSERT(ctx.count == 6);
+    ASSERT(ctx.times[5] == 5000);
+}
+
+void test_timestamp(void)
+{
+    test_timestamp_usb();
+    test_timestamp_usb_gap();
+    test_timestamp_serial();
+}